@@ -0,0 +1,179 @@
+// Animation benchmark: objects move across the scene for a number of frames. Each frame
+// the top-level BVH is maintained two ways, by a full rebuild and by bvh_tree::update()
+// (refit, partial subtree rebuild or full rebuild when the SAH cost degrades), and the
+// same camera rays are traced through both. Reports per-frame maintenance time, SAH cost
+// and traversal speed, then the mean time and SAH cost of each kind of update. The
+// checksums of the two trees must agree every frame.
+//
+// Usage: anim_benchmark [--frames N] [scene file]
+//
+// The scene's first top-level instance slides back and forth the whole time, which a refit
+// follows. In the second half a swarm, the instances whose rest centers lie within
+// `swarm_radius` of the first grid corner, lifts off and spreads out through the ceiling.
+// Its primitives drag the subtrees they were built in along, so those boxes balloon
+// (partial rebuilds) until the scene bounds themselves double (a full rebuild).
+
+#include "rtweekend.h"
+#include "scene.h"
+#include "bvh.h"
+#include "instance.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+static double ms_since(bench_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+static const char* update_name(bvh_update kind) {
+    switch (kind) {
+        case bvh_update::refit:   return "refit";
+        case bvh_update::partial: return "partial";
+        default:                  return "rebuild";
+    }
+}
+
+struct trace_result {
+    double mrays_per_s;
+    double checksum;
+};
+
+static trace_result trace(const hittable& world, const std::vector<ray>& rays) {
+    hit_record rec;
+    double checksum = 0;
+    auto start = bench_clock::now();
+    for (const auto& r : rays) {
+        if (world.hit(r, 0.001, infinity, rec))
+            checksum += rec.t;
+    }
+    return {rays.size() / ms_since(start) / 1e3, checksum};
+}
+
+int main(int argc, char* argv[]) {
+    std::string path = PT_SCENE_DIR "/animated_box.scene";
+    int frames = 60;
+    for (int a = 1; a < argc; a++) {
+        if (std::string(argv[a]) == "--frames" && a + 1 < argc)
+            frames = std::atoi(argv[++a]);
+        else
+            path = argv[a];
+    }
+
+    scene scn;
+    try {
+        scn = load_scene(path);
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+
+    shared_ptr<instance> moving;
+    for (const auto& object : scn.objects.objects) {
+        if ((moving = std::dynamic_pointer_cast<instance>(object)))
+            break;
+    }
+    if (!moving) {
+        std::fprintf(stderr, "Error: %s has no instance to animate\n", path.c_str());
+        return 1;
+    }
+    const transform rest = moving->object_to_world();
+
+    // The swarm: grid cubes around the floor's near right corner
+    const double swarm_radius = 60;
+    const point3 corner(8, 0, 8);
+    std::vector<shared_ptr<instance>> swarm;
+    std::vector<transform> swarm_rest;
+    std::vector<vec3> swarm_spread;
+    seed_random(7);
+    for (const auto& object : scn.objects.objects) {
+        auto inst = std::dynamic_pointer_cast<instance>(object);
+        aabb box;
+        if (!inst || inst == moving || !inst->bounding_box(box) || (box.centroid() - corner).length() > swarm_radius)
+            continue;
+        swarm.push_back(inst);
+        swarm_rest.push_back(inst->object_to_world());
+        swarm_spread.push_back(vec3(random_double(-1, 1), random_double(0, 1), random_double(-1, 1)));
+    }
+
+    bvh_accel rebuilt, updated;
+    rebuilt.objects = updated.objects = scn.objects.objects;
+    rebuilt.tree.layout = updated.tree.layout = scn.settings.accel;
+    updated.tree.dynamic = true;
+    rebuilt.build();
+    updated.build();
+
+    // Jittered camera rays, one per pixel of a 256 x 256 image
+    seed_random(1);
+    std::vector<ray> rays;
+    camera cam = scn.make_camera();
+    const int size = 256;
+    for (int j = 0; j < size; j++) {
+        for (int i = 0; i < size; i++)
+            rays.push_back(cam.get_ray((i + random_double()) / (size-1), (j + random_double()) / (size-1)));
+    }
+
+    std::printf("Scene %s (%zu top-level objects, %zu in the swarm, %zu rays per frame, %d frames)\n",
+        path.c_str(), scn.objects.objects.size(), swarm.size(), rays.size(), frames);
+    std::printf("  %5s %11s %11s %8s %9s %9s %10s %10s %6s\n", "frame", "rebuild ms", "update ms", "update",
+        "SAH full", "SAH upd", "Mrays full", "Mrays upd", "match");
+
+    double total_rebuild = 0, total_update = 0;
+    int kinds[3] = {0, 0, 0};
+    double kind_ms[3] = {0, 0, 0}, kind_sah[3] = {0, 0, 0}, kind_full_sah[3] = {0, 0, 0};
+    bool all_match = true;
+    for (int f = 0; f < frames; f++) {
+        // Slide across the floor and back, turning as it goes
+        const double phase = 2 * pi * f / frames;
+        const vec3 offset(250 * (0.5 - 0.5 * cos(phase)), 0, 200 * sin(0.5 * phase));
+        moving->set_transform(transform::translate(offset) * rest * transform::rotate(1, 90.0 * f / frames));
+
+        // The swarm flies up and back, each member on its own spread
+        const double flight = std::max(0.0, 2.0 * f / frames - 1);
+        for (size_t k = 0; k < swarm.size(); k++) {
+            const vec3 path = flight * (vec3(400, 900, 400) + 300 * swarm_spread[k]);
+            swarm[k]->set_transform(transform::translate(path) * swarm_rest[k]);
+        }
+
+        auto start = bench_clock::now();
+        rebuilt.build();
+        const double rebuild_ms = ms_since(start);
+
+        start = bench_clock::now();
+        const auto kind = updated.update();
+        const double update_ms = ms_since(start);
+
+        auto full = trace(rebuilt, rays);
+        auto upd = trace(updated, rays);
+        const bool match = full.checksum == upd.checksum;
+
+        total_rebuild += rebuild_ms;
+        total_update += update_ms;
+        kinds[static_cast<int>(kind)]++;
+        kind_ms[static_cast<int>(kind)] += update_ms;
+        kind_sah[static_cast<int>(kind)] += updated.tree.sah_cost;
+        kind_full_sah[static_cast<int>(kind)] += rebuilt.tree.sah_cost;
+        all_match = all_match && match;
+
+        std::printf("  %5d %11.3f %11.3f %8s %9.2f %9.2f %10.3f %10.3f %6s\n", f, rebuild_ms, update_ms,
+            update_name(kind), rebuilt.tree.sah_cost, updated.tree.sah_cost, full.mrays_per_s, upd.mrays_per_s,
+            match ? "yes" : "NO");
+    }
+
+    std::printf("\nMean per frame: rebuild %.3f ms, update %.3f ms (%d refits, %d partial, %d full rebuilds)\n",
+        total_rebuild / frames, total_update / frames, kinds[0], kinds[1], kinds[2]);
+    std::printf("  %8s %7s %11s %9s %9s\n", "update", "frames", "update ms", "SAH upd", "SAH full");
+    for (int k = 0; k < 3; k++) {
+        if (kinds[k] == 0) {
+            std::printf("  %8s %7d %11s %9s %9s\n", update_name(static_cast<bvh_update>(k)), 0, "-", "-", "-");
+            continue;
+        }
+        std::printf("  %8s %7d %11.3f %9.2f %9.2f\n", update_name(static_cast<bvh_update>(k)), kinds[k],
+            kind_ms[k] / kinds[k], kind_sah[k] / kinds[k], kind_full_sah[k] / kinds[k]);
+    }
+    return all_match ? 0 : 1;
+}
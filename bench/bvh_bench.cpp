@@ -0,0 +1,219 @@
+// BVH layout benchmark: node count, node memory, build time and closest-hit throughput
+// for each BVH layout on the Cornell Box and on a million-triangle mesh. The checksum
+// column must match across layouts; a mismatch means a layout lost or invented hits.
+// A second table compares the builders on the mesh at one thread and at every hardware
+// thread: build time, SAH cost of the resulting tree and traversal speed.
+//
+// Usage: bvh_benchmark [--threads N] [scene file]
+
+#include "rtweekend.h"
+#include "scene.h"
+#include "mesh.h"
+#include "bvh.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+static double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+struct layout_result {
+    double build_ms;
+    size_t nodes;
+    size_t node_bytes;
+    double mrays_per_s;
+    double checksum;    // sum of hit distances; must agree across layouts
+};
+
+static const char* layout_name(bvh_layout layout) {
+    switch (layout) {
+        case bvh_layout::wide:      return "wide (4)";
+        case bvh_layout::quantized: return "quantized";
+        default:                    return "binary";
+    }
+}
+
+static const bvh_layout all_layouts[] = {bvh_layout::binary, bvh_layout::wide, bvh_layout::quantized};
+
+// Traces every ray through the tree until at least min_seconds have passed
+static layout_result measure(const hittable& object, const bvh_tree& tree, double build_ms, const std::vector<ray>& rays) {
+    const double min_seconds = 1.0;
+    hit_record rec;
+
+    // Warm-up pass, also yields the checksum
+    double checksum = 0;
+    for (const auto& r : rays) {
+        if (object.hit(r, 0.001, infinity, rec))
+            checksum += rec.t;
+    }
+
+    size_t traced = 0;
+    auto start = bench_clock::now();
+    double elapsed = 0;
+    do {
+        for (const auto& r : rays) {
+            object.hit(r, 0.001, infinity, rec);
+        }
+        traced += rays.size();
+        elapsed = seconds_since(start);
+    } while (elapsed < min_seconds);
+
+    return {build_ms, tree.node_count(), tree.memory_usage() - tree.prim_indices.capacity() * sizeof(int),
+            traced / elapsed / 1e6, checksum};
+}
+
+static void print_header(const char* title, size_t prims, size_t rays) {
+    std::printf("\n%s (%zu primitives, %zu rays)\n", title, prims, rays);
+    std::printf("  %-10s %10s %10s %12s %10s %12s %14s\n",
+        "layout", "build ms", "nodes", "node KiB", "B/node", "Mrays/s", "checksum");
+}
+
+static void print_row(bvh_layout layout, const layout_result& r) {
+    std::printf("  %-10s %10.2f %10zu %12.1f %10.1f %12.3f %14.6g\n", layout_name(layout), r.build_ms, r.nodes,
+        r.node_bytes / 1024.0, static_cast<double>(r.node_bytes) / r.nodes, r.mrays_per_s, r.checksum);
+}
+
+// Jittered camera rays covering the image
+static std::vector<ray> camera_rays(const scene& scn, int width, int height, int samples) {
+    std::vector<ray> rays;
+    camera cam = scn.make_camera();
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            for (int s = 0; s < samples; s++) {
+                rays.push_back(cam.get_ray((i + random_double()) / (width-1), (j + random_double()) / (height-1)));
+            }
+        }
+    }
+    return rays;
+}
+
+// Rays from random points on a sphere around the box towards random points inside it
+static std::vector<ray> enclosing_rays(const aabb& box, size_t count) {
+    std::vector<ray> rays;
+    auto center = box.centroid();
+    auto radius = (box.max() - box.min()).length();
+    for (size_t n = 0; n < count; n++) {
+        auto z = random_double(-1, 1);
+        auto a = random_double(0, 2*pi);
+        auto rr = sqrt(1 - z*z);
+        point3 origin = center + radius * vec3(rr*cos(a), rr*sin(a), z);
+        point3 target(random_double(box.min().x(), box.max().x()),
+                      random_double(box.min().y(), box.max().y()),
+                      random_double(box.min().z(), box.max().z()));
+        rays.emplace_back(origin, target - origin);
+    }
+    return rays;
+}
+
+static void bench_scene(const std::string& path) {
+    scene scn = load_scene(path);
+    seed_random(1);
+    auto rays = camera_rays(scn, 256, 256, 4);
+
+    print_header(("Scene " + path).c_str(), scn.objects.objects.size(), rays.size());
+    for (auto layout : all_layouts) {
+        bvh_accel accel;
+        accel.objects = scn.objects.objects;
+        accel.tree.layout = layout;
+        auto start = bench_clock::now();
+        accel.build();
+        auto build_ms = seconds_since(start) * 1e3;
+        print_row(layout, measure(accel, accel.tree, build_ms, rays));
+    }
+}
+
+static void bench_mesh(int segments) {
+    std::vector<point3> vertices;
+    std::vector<int> indices;
+    make_uv_sphere(point3(0, 0, 0), 100, segments, vertices, indices);
+    auto mat = make_shared<lambertian>(color(0.73, 0.73, 0.73));
+
+    seed_random(2);
+    triangle_mesh mesh;
+    mesh.vertices = vertices;
+    mesh.indices = indices;
+    mesh.mp = mat;
+    mesh.build();
+    auto rays = enclosing_rays(mesh.tree.bounds(), 1 << 19);
+
+    print_header("UV sphere mesh", indices.size() / 3, rays.size());
+    for (auto layout : all_layouts) {
+        mesh.tree.layout = layout;
+        auto start = bench_clock::now();
+        mesh.build();
+        auto build_ms = seconds_since(start) * 1e3;
+        print_row(layout, measure(mesh, mesh.tree, build_ms, rays));
+    }
+}
+
+static void bench_builders(int segments, int max_threads) {
+    std::vector<point3> vertices;
+    std::vector<int> indices;
+    make_uv_sphere(point3(0, 0, 0), 100, segments, vertices, indices);
+
+    seed_random(3);
+    triangle_mesh mesh;
+    mesh.vertices = vertices;
+    mesh.indices = indices;
+    mesh.mp = make_shared<lambertian>(color(0.73, 0.73, 0.73));
+    mesh.build();
+    auto rays = enclosing_rays(mesh.tree.bounds(), 1 << 19);
+
+    std::vector<int> thread_counts = {1};
+    if (max_threads > 1)
+        thread_counts.push_back(max_threads);
+
+    std::printf("\nBVH builders, binary layout (%zu primitives, %zu rays)\n", indices.size() / 3, rays.size());
+    std::printf("  %-10s %8s %10s %10s %10s %12s %14s\n",
+        "builder", "threads", "build ms", "nodes", "SAH cost", "Mrays/s", "checksum");
+    const bvh_builder builders[] = {bvh_builder::sah, bvh_builder::lbvh};
+    for (auto builder : builders) {
+        for (int threads : thread_counts) {
+            thread_pool pool(threads);
+            mesh.tree.builder = builder;
+            mesh.tree.pool = &pool;
+
+            // Best of three, the first build also pays for page faults
+            double build_ms = infinity;
+            for (int k = 0; k < 3; k++) {
+                auto start = bench_clock::now();
+                mesh.build();
+                build_ms = std::min(build_ms, seconds_since(start) * 1e3);
+            }
+            mesh.tree.pool = nullptr;
+
+            auto r = measure(mesh, mesh.tree, build_ms, rays);
+            std::printf("  %-10s %8d %10.2f %10zu %10.2f %12.3f %14.6g\n", builder == bvh_builder::lbvh ? "lbvh" : "sah",
+                threads, r.build_ms, r.nodes, mesh.tree.sah_cost, r.mrays_per_s, r.checksum);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::string path = PT_SCENE_DIR "/cornell_box.scene";
+    int threads = thread_pool::hardware_threads();
+    for (int a = 1; a < argc; a++) {
+        if (std::string(argv[a]) == "--threads" && a + 1 < argc)
+            threads = std::atoi(argv[++a]);
+        else
+            path = argv[a];
+    }
+
+    try {
+        bench_scene(path);
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+    bench_mesh(1000);
+    bench_builders(1000, threads);
+    std::printf("\nsizeof(bvh_node) = %zu, sizeof(bvh4_node) = %zu, sizeof(qbvh4_node) = %zu\n",
+        sizeof(bvh_node), sizeof(bvh4_node), sizeof(qbvh4_node));
+}
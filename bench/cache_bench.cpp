@@ -0,0 +1,178 @@
+// Radiance cache at equal time: renders a scene without the cache and with each update
+// policy for the same wall time, and reports each result's error against a converged
+// reference along with what the cache cost.
+//
+// Usage: cache_benchmark [--seconds S] [--threads N] [--modes off,once,progressive]
+//                        [--bounce B] [--cell size] [--image W H]
+//                        [--reference file.pfm] [--reference-spp N] [scene file]
+//
+// Each mode first renders 2 spp to measure its cost per sample, then renders a fresh image
+// with as many samples as fit in the budget (default 20 s), and again with a corrected
+// count if that missed by more than a tenth; a cache trained once counts its training
+// against the budget a single time. The cache is biased, so the error is measured rather
+// than taken from the variance: relMSE as image_compare computes it, with RMSE alongside.
+// The reference is read from --reference when that file exists; otherwise it is rendered
+// without the cache at --reference-spp samples (default 1024) from another seed and written
+// there if a path was given. The default scene is scenes/cornell_box.scene; --image
+// overrides its resolution, which the reference must match.
+
+#include "rtweekend.h"
+#include "scene.h"
+#include "renderer.h"
+#include "pfm.h"
+#include "thread_pool.h"
+#include "compare.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+struct bench_options {
+    int bounce = 1;
+    double cell = 0;
+    int width = 0, height = 0;      // 0 keeps the scene's
+};
+
+struct mode_result {
+    std::string name;
+    int samples = 0;
+    double seconds = 0;
+    double rmse = 0;
+    double relmse = 0;
+    render_stats stats;
+};
+
+static scene load_mode(const std::string& path, const std::string& name, const bench_options& options,
+                       thread_pool& pool) {
+    scene scn = load_scene(path, &pool);
+    scn.settings.integrator = integrator_type::path;
+    scn.settings.radiance_cache = name != "off";
+    scn.settings.cache_cell = options.cell;
+    scn.settings.cache_bounce = options.bounce;
+    if (name == "once") {
+        scn.settings.cache_policy = cache_update::once;
+        scn.settings.cache_training = 4;
+    } else if (name == "progressive") {
+        scn.settings.cache_policy = cache_update::progressive;
+        scn.settings.cache_training = 0.25;
+    } else if (name != "off") {
+        throw std::runtime_error("unknown cache mode '" + name + "'");
+    }
+    if (options.width > 0) {
+        scn.settings.image_width = options.width;
+        scn.settings.image_height = options.height;
+    }
+    return scn;
+}
+
+static mode_result run_mode(const std::string& path, const std::string& name, const bench_options& options,
+                            double budget, const float_image& reference, thread_pool& pool) {
+    scene scn = load_mode(path, name, options, pool);
+    if (scn.settings.image_width != reference.width || scn.settings.image_height != reference.height)
+        throw std::runtime_error("reference is not " + std::to_string(scn.settings.image_width) + "x"
+                                 + std::to_string(scn.settings.image_height));
+    mode_result result;
+    result.name = name;
+    renderer render(scn, pool);
+    render.show_progress = false;
+
+    // Calibration on a throwaway image; a one-off training is not a per-sample cost
+    framebuffer trial(scn.settings.image_width, scn.settings.image_height);
+    scn.settings.samples_per_pixel = 2;
+    const render_stats calibration = render.render(trial);
+    const double fixed = name == "once" ? calibration.cache_seconds : 0;
+    const double per_sample = std::max(1e-9, (calibration.seconds - fixed) / 2);
+    scn.settings.samples_per_pixel = std::max(2, static_cast<int>((budget - fixed) / per_sample));
+
+    // A progressive cache makes samples cheaper as it fills, so a render more than a tenth
+    // off the budget is rescaled and run again from scratch
+    framebuffer fb(scn.settings.image_width, scn.settings.image_height);
+    for (int attempt = 0; ; attempt++) {
+        fb = framebuffer(scn.settings.image_width, scn.settings.image_height);
+        result.stats = render.render(fb);
+        result.samples = scn.settings.samples_per_pixel;
+        result.seconds = result.stats.seconds;
+        if (attempt == 2 || std::fabs(result.seconds - budget) < 0.1 * budget)
+            break;
+        const double scale = (budget - fixed) / std::max(1e-9, result.seconds - fixed);
+        scn.settings.samples_per_pixel = std::max(2, static_cast<int>(result.samples * scale));
+    }
+
+    const image_error e = compare_images(fb.mean(), reference);
+    result.rmse = e.rmse;
+    result.relmse = e.relmse;
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    double seconds = 20;
+    int threads = 0;
+    std::vector<std::string> modes = {"off", "once", "progressive"};
+    bench_options options;
+    std::string reference_path;
+    int reference_spp = 1024;
+    std::string path = PT_SCENE_DIR "/cornell_box.scene";
+    bool usage_error = false;
+
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--seconds" && a + 1 < argc)
+            seconds = std::atof(argv[++a]);
+        else if (arg == "--threads" && a + 1 < argc)
+            threads = std::atoi(argv[++a]);
+        else if (arg == "--modes" && a + 1 < argc)
+            modes = split_list(argv[++a]);
+        else if (arg == "--bounce" && a + 1 < argc)
+            options.bounce = std::atoi(argv[++a]);
+        else if (arg == "--cell" && a + 1 < argc)
+            options.cell = std::atof(argv[++a]);
+        else if (arg == "--image" && a + 2 < argc) {
+            options.width = std::atoi(argv[++a]);
+            options.height = std::atoi(argv[++a]);
+        } else if (arg == "--reference" && a + 1 < argc)
+            reference_path = argv[++a];
+        else if (arg == "--reference-spp" && a + 1 < argc)
+            reference_spp = std::atoi(argv[++a]);
+        else if (arg[0] != '-')
+            path = arg;
+        else
+            usage_error = true;
+    }
+    if (usage_error || seconds <= 0 || threads < 0 || modes.empty() || options.bounce < 1 || options.cell < 0
+        || options.width < 0 || options.height < 0 || reference_spp < 1) {
+        std::fprintf(stderr, "Usage: %s [--seconds S] [--threads N] [--modes off,once,progressive]\n"
+                             "       [--bounce B] [--cell size] [--image W H]\n"
+                             "       [--reference file.pfm] [--reference-spp N] [scene file]\n",
+                     argv[0]);
+        return 2;
+    }
+
+    try {
+        thread_pool pool(threads);
+        const auto ref = load_reference(reference_path, load_mode(path, "off", options, pool), reference_spp, pool);
+        const float_image& reference = ref.image;
+        if (!ref.rendered)
+            std::printf("%s, reference %s\n", path.c_str(), reference_path.c_str());
+        else
+            std::printf("%s, reference at %d spp in %.1f s\n", path.c_str(), reference_spp, ref.seconds);
+        std::printf("%.0f s per mode on %d threads, lookups at hit %d\n", seconds, pool.size(), options.bounce);
+        std::printf("  %-12s %6s %9s %10s %10s %10s %9s %7s %9s\n", "mode", "spp", "render s", "RMSE", "relMSE",
+                    "reduction", "train s", "hits", "cache KiB");
+
+        std::vector<mode_result> results;
+        for (const auto& name : modes) {
+            results.push_back(run_mode(path, name, options, seconds, reference, pool));
+            const auto& r = results.back();
+            const double lookups = static_cast<double>(r.stats.cache_hits + r.stats.cache_misses);
+            std::printf("  %-12s %6d %9.2f %10.4g %10.4g %9.2fx %9.2f %6.1f%% %9zu\n", r.name.c_str(), r.samples,
+                        r.seconds, r.rmse, r.relmse, results.front().relmse / r.relmse, r.stats.cache_seconds,
+                        lookups > 0 ? 100 * r.stats.cache_hits / lookups : 0.0, r.stats.cache_store_bytes / 1024);
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 2;
+    }
+    return 0;
+}
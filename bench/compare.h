@@ -0,0 +1,83 @@
+#ifndef BENCH_COMPARE_H
+#define BENCH_COMPARE_H
+
+#include "scene.h"
+#include "renderer.h"
+#include "pfm.h"
+#include "thread_pool.h"
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Shared pieces of the benchmarks that measure error against a converged reference: comma
+// lists from the command line, the error of an image as image_compare computes it, and the
+// reference itself, read from a file or rendered.
+
+// "a,b,c" as {"a", "b", "c"}
+inline std::vector<std::string> split_list(const std::string& list) {
+    std::vector<std::string> out;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ','))
+        out.push_back(item);
+    return out;
+}
+
+struct image_error {
+    double rmse = 0;
+    double relmse = 0;      // squared error over the squared reference plus 0.01
+};
+
+inline image_error compare_images(const float_image& test, const float_image& reference) {
+    double sum = 0, relative = 0;
+    for (size_t k = 0; k < test.pixels.size(); k++) {
+        const double d = test.pixels[k] - reference.pixels[k];
+        sum += d * d;
+        relative += d * d / (static_cast<double>(reference.pixels[k]) * reference.pixels[k] + 0.01);
+    }
+    image_error e;
+    e.rmse = std::sqrt(sum / test.pixels.size());
+    e.relmse = relative / test.pixels.size();
+    return e;
+}
+
+struct reference_image {
+    float_image image;
+    bool rendered = false;      // false when read from the file
+    double seconds = 0;
+    double noise_rmse = 0;      // expected RMSE of the rendered reference's own noise
+};
+
+// The image in `file` when it exists; otherwise `scn` rendered at `spp` samples from the next
+// seed, so its noise is independent of the measured renders', and written to `file` if given
+inline reference_image load_reference(const std::string& file, scene scn, int spp, thread_pool& pool) {
+    reference_image ref;
+    if (!file.empty() && std::ifstream(file).good()) {
+        ref.image = read_pfm(file);
+        return ref;
+    }
+
+    scn.settings.seed += 1;
+    scn.settings.samples_per_pixel = spp;
+    framebuffer fb(scn.settings.image_width, scn.settings.image_height);
+    renderer render(scn, pool);
+    render.show_progress = false;
+    ref.rendered = true;
+    ref.seconds = render.render(fb).seconds;
+    ref.image = fb.mean();
+
+    // The variance of the reference's pixel means is its expected squared error
+    const auto variance = fb.variance();
+    double sum = 0;
+    for (float v : variance.pixels)
+        sum += v;
+    ref.noise_rmse = std::sqrt(sum / variance.pixels.size());
+
+    if (!file.empty())
+        write_pfm(file, ref.image);
+    return ref;
+}
+
+#endif
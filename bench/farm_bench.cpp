@@ -0,0 +1,97 @@
+// Render farm scaling: renders one frame with ImageRenderer --farm at several worker counts on
+// this machine and reports the speedup and scaling efficiency of each against one worker.
+//
+// Usage: farm_benchmark [--workers 1,2,4] [--threads N] [scene file]
+//
+// --threads sets the threads of every worker (default 1), so the worker counts compare like
+// with like. The default scene is scenes/cornell_box.scene. Efficiency is speedup divided by
+// the worker count; it drops once workers outnumber the cores.
+
+#include "json.h"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Runs the farm once and returns the render time in seconds from its --stats output
+static double render_seconds(const std::string& scene, int workers, int threads) {
+    const std::string stats_path = "/tmp/pt-farm-bench-" + std::to_string(getpid()) + ".json";
+    const std::string worker_arg = std::to_string(workers), thread_arg = std::to_string(threads);
+
+    std::fflush(nullptr);
+    const pid_t pid = fork();
+    if (pid < 0)
+        throw std::runtime_error("fork failed");
+    if (pid == 0) {
+        const int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, 1);   // the image
+        dup2(null_fd, 2);   // progress
+        const char* args[] = {PT_RENDERER, "--farm", worker_arg.c_str(), "--threads", thread_arg.c_str(),
+                              "--stats", stats_path.c_str(), scene.c_str(), nullptr};
+        execv(PT_RENDERER, const_cast<char* const*>(args));
+        _exit(127);
+    }
+    int status = 0;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        throw std::runtime_error("farm render with " + worker_arg + " workers failed");
+
+    std::ifstream in(stats_path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    const std::string text = ss.str();
+    std::remove(stats_path.c_str());
+    return json_parser(text).parse()["phases_ms"]["render"].as_number() / 1000;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<int> counts = {1, 2, 4};
+    int threads = 1;
+    std::string scene = PT_SCENE_DIR "/cornell_box.scene";
+    bool usage_error = false;
+
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--workers" && a + 1 < argc) {
+            counts.clear();
+            std::stringstream list(argv[++a]);
+            std::string item;
+            while (std::getline(list, item, ','))
+                counts.push_back(std::atoi(item.c_str()));
+        } else if (arg == "--threads" && a + 1 < argc)
+            threads = std::atoi(argv[++a]);
+        else if (arg[0] != '-')
+            scene = arg;
+        else
+            usage_error = true;
+    }
+    for (int n : counts)
+        usage_error = usage_error || n < 1;
+    if (usage_error || counts.empty() || threads < 1) {
+        std::fprintf(stderr, "Usage: %s [--workers 1,2,4] [--threads N] [scene file]\n", argv[0]);
+        return 2;
+    }
+
+    try {
+        std::printf("%s, %d thread%s per worker\n", scene.c_str(), threads, threads == 1 ? "" : "s");
+        std::printf("  %8s %10s %9s %11s\n", "workers", "render s", "speedup", "efficiency");
+        double base = 0;
+        for (int n : counts) {
+            const double seconds = render_seconds(scene, n, threads);
+            if (base == 0)
+                base = seconds * counts[0];     // one worker's time, scaled if the list starts higher
+            const double speedup = base / seconds;
+            std::printf("  %8d %10.3f %8.2fx %10.1f%%\n", n, seconds, speedup, 100 * speedup / n);
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,177 @@
+// Path guiding pass by pass: renders a scene with the path integrator and with the guided
+// one, and reports for every guiding pass the variance of a single sample and what it
+// cost, so the reduction the guide brings can be seen growing as it learns.
+//
+// Usage: guiding_benchmark [--threads N] [--spp N] [--image W H] [--bsdf-fraction a]
+//                          [--lights none|uniform|bvh] [scene file]
+//
+// Guiding pass k holds samples 2^k - 1 to 2^(k+1) - 2 of every pixel (see guiding.h); both
+// integrators render one sample per pixel at a time up to --spp (default 255), and the
+// framebuffer's sums are read at each pass boundary. A pass's relative variance is the
+// sample variance of its samples in a pixel over the square of the pixel's final mean plus
+// 0.01, as image_compare weighs errors, averaged over the image; the reduction is the path
+// integrator's over the guided one's, and the efficiency gain also divides by the cost of
+// a sample. The default scene is scenes/cornell_occluded.scene, lit through a narrow gap.
+
+#include "rtweekend.h"
+#include "scene.h"
+#include "renderer.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+struct bench_options {
+    int spp = 255;
+    int width = 0, height = 0;      // 0 keeps the scene's
+    double bsdf_fraction = 0;       // 0 keeps the scene's
+    const char* lights = nullptr;
+};
+
+// Sums at a pass boundary
+struct snapshot {
+    std::vector<color> pixels;
+    std::vector<color> squares;
+    uint32_t samples = 0;
+    double seconds = 0;
+};
+
+struct pass_result {
+    uint32_t first = 0, end = 0;    // samples [first, end)
+    double seconds = 0;
+    double relvar = 0;
+};
+
+static std::vector<pass_result> run(const std::string& path, integrator_type integrator,
+                                    const bench_options& options, thread_pool& pool, render_stats& stats) {
+    scene scn = load_scene(path, &pool);
+    scn.settings.integrator = integrator;
+    scn.settings.samples_per_pixel = options.spp;
+    if (options.width > 0) {
+        scn.settings.image_width = options.width;
+        scn.settings.image_height = options.height;
+    }
+    if (options.bsdf_fraction > 0)
+        scn.settings.guide_bsdf_fraction = options.bsdf_fraction;
+    if (options.lights) {
+        const std::string name = options.lights;
+        scn.settings.lights = name == "uniform" ? light_sampling::uniform
+                            : name == "bvh" ? light_sampling::bvh : light_sampling::none;
+    }
+
+    using clock = std::chrono::steady_clock;
+    framebuffer fb(scn.settings.image_width, scn.settings.image_height);
+    renderer render(scn, pool);
+    render.show_progress = false;
+    render.pass_samples = 1;
+    std::vector<snapshot> snapshots(1);
+    snapshots[0].pixels.assign(fb.pixels.size(), color(0, 0, 0));
+    snapshots[0].squares.assign(fb.pixels.size(), color(0, 0, 0));
+    const auto start = clock::now();
+    auto take = [&](const framebuffer& image) {
+        snapshot s;
+        s.pixels = image.pixels;
+        s.squares = image.squares;
+        s.samples = image.samples[0];
+        s.seconds = std::chrono::duration<double>(clock::now() - start).count();
+        snapshots.push_back(std::move(s));
+    };
+    render.on_pass = [&](const framebuffer& image) {
+        if (image.samples[0] == path_guide::pass_end(path_guide::pass_of(image.samples[0] - 1)))
+            take(image);
+    };
+    stats = render.render(fb);
+    take(fb);
+
+    std::vector<pass_result> passes;
+    const std::vector<color>& final_sums = fb.pixels;
+    for (size_t p = 1; p < snapshots.size(); p++) {
+        const snapshot& a = snapshots[p - 1];
+        const snapshot& b = snapshots[p];
+        pass_result r;
+        r.first = a.samples;
+        r.end = b.samples;
+        r.seconds = b.seconds - a.seconds;
+        const double n = b.samples - a.samples;
+        double sum = 0;
+        for (size_t k = 0; k < fb.pixels.size(); k++) {
+            const color mean = final_sums[k] / fb.samples[k];
+            for (int c = 0; c < 3; c++) {
+                const double m = (b.pixels[k][c] - a.pixels[k][c]) / n;
+                const double var = n > 1 ? ((b.squares[k][c] - a.squares[k][c]) / n - m * m) * n / (n - 1) : 0;
+                sum += std::max(0.0, var) / (mean[c] * mean[c] + 0.01);
+            }
+        }
+        r.relvar = sum / (3.0 * fb.pixels.size());
+        passes.push_back(r);
+    }
+    return passes;
+}
+
+int main(int argc, char* argv[]) {
+    int threads = 0;
+    bench_options options;
+    std::string path = PT_SCENE_DIR "/cornell_occluded.scene";
+    bool usage_error = false;
+
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--threads" && a + 1 < argc)
+            threads = std::atoi(argv[++a]);
+        else if (arg == "--spp" && a + 1 < argc)
+            options.spp = std::atoi(argv[++a]);
+        else if (arg == "--image" && a + 2 < argc) {
+            options.width = std::atoi(argv[++a]);
+            options.height = std::atoi(argv[++a]);
+        } else if (arg == "--bsdf-fraction" && a + 1 < argc)
+            options.bsdf_fraction = std::atof(argv[++a]);
+        else if (arg == "--lights" && a + 1 < argc)
+            options.lights = argv[++a];
+        else if (arg[0] != '-')
+            path = arg;
+        else
+            usage_error = true;
+    }
+    const std::string lights = options.lights ? options.lights : "none";
+    if (usage_error || threads < 0 || options.spp < 3 || options.width < 0 || options.height < 0
+        || options.bsdf_fraction < 0 || options.bsdf_fraction > 1
+        || (lights != "none" && lights != "uniform" && lights != "bvh")) {
+        std::fprintf(stderr, "Usage: %s [--threads N] [--spp N] [--image W H] [--bsdf-fraction a]\n"
+                             "       [--lights none|uniform|bvh] [scene file]\n",
+                     argv[0]);
+        return 2;
+    }
+
+    try {
+        thread_pool pool(threads);
+        render_stats path_stats, guided_stats;
+        const auto plain = run(path, integrator_type::path, options, pool, path_stats);
+        const auto guided = run(path, integrator_type::guided, options, pool, guided_stats);
+        std::printf("%s, %d spp on %d threads\n", path.c_str(), options.spp, pool.size());
+        std::printf("  %-12s %11s %10s %11s %10s %10s %10s\n", "pass spp", "path ms/spp", "relvar", "guided ms/spp",
+                    "relvar", "reduction", "efficiency");
+        double plain_seconds = 0, guided_seconds = 0;
+        for (size_t p = 0; p < std::min(plain.size(), guided.size()); p++) {
+            const auto& a = plain[p];
+            const auto& b = guided[p];
+            const double n = a.end - a.first;
+            const double reduction = b.relvar > 0 ? a.relvar / b.relvar : 0;
+            const std::string range = std::to_string(a.first) + "-" + std::to_string(a.end - 1);
+            std::printf("  %-12s %11.2f %10.4g %13.2f %10.4g %9.2fx %9.2fx\n", range.c_str(), 1000 * a.seconds / n,
+                        a.relvar, 1000 * b.seconds / n, b.relvar, reduction, reduction * a.seconds / b.seconds);
+            plain_seconds += a.seconds;
+            guided_seconds += b.seconds;
+        }
+        std::printf("Render: path %.2f s, guided %.2f s; guide %zu regions, %zu nodes, %zu KiB, updates %.3f s\n",
+                    plain_seconds, guided_seconds, guided_stats.guide_leaves, guided_stats.guide_nodes,
+                    guided_stats.guide_memory_bytes / 1024, guided_stats.guide_seconds);
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 2;
+    }
+    return 0;
+}
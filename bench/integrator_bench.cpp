@@ -0,0 +1,175 @@
+// Time to equal error: renders a scene with each integrator in passes of doubling sample
+// counts, measures the error of every pass against a converged reference, and reports how
+// long each integrator takes to reach the same error.
+//
+// Usage: integrator_benchmark [--seconds S] [--threads N] [--integrators path,bdpt]
+//                             [--reference file.pfm] [--reference-spp N] [--target-relmse x]
+//                             [scene file]
+//
+// The reference is read from --reference when that file exists; otherwise it is rendered with
+// the last integrator listed at --reference-spp samples (default 256) and written there if a
+// path was given. It uses a different seed from the timed renders, so its noise is
+// independent of theirs; that noise still adds to every error, and is printed so it can be
+// kept well below the target. Each integrator renders 1, 2, 4, ... spp while the next pass
+// fits in the budget (default 60 s).
+//
+// The error compared is relMSE, the squared error over the squared reference plus 0.01 as
+// image_compare computes it, so a few pixels near a light cannot decide the result alone;
+// RMSE is printed alongside. The target is the worst final relMSE of all integrators unless
+// given, and the time to reach it is interpolated between passes on a log-log scale, where
+// relMSE falls as the inverse of time. The default scene is scenes/cornell_occluded.scene.
+
+#include "rtweekend.h"
+#include "scene.h"
+#include "renderer.h"
+#include "pfm.h"
+#include "thread_pool.h"
+#include "compare.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+struct pass_result {
+    int samples = 0;
+    double seconds = 0;         // cumulative
+    double rmse = 0;
+    double relmse = 0;
+};
+
+struct integrator_result {
+    std::string name;
+    std::vector<pass_result> passes;
+};
+
+static scene load_with(const std::string& path, const std::string& name, thread_pool& pool) {
+    scene scn = load_scene(path, &pool);
+    if (!integrator_from_name(name, scn.settings.integrator))
+        throw std::runtime_error("unknown integrator '" + name + "'");
+    return scn;
+}
+
+static integrator_result run_integrator(const std::string& path, const std::string& name, double budget,
+                                        const float_image& reference, thread_pool& pool) {
+    scene scn = load_with(path, name, pool);
+    if (scn.settings.image_width != reference.width || scn.settings.image_height != reference.height)
+        throw std::runtime_error("reference is not " + std::to_string(scn.settings.image_width) + "x"
+                                 + std::to_string(scn.settings.image_height));
+    integrator_result result;
+    result.name = name;
+    framebuffer fb(scn.settings.image_width, scn.settings.image_height);
+    renderer render(scn, pool);
+    render.show_progress = false;
+
+    // The renderer continues from the samples a framebuffer holds, and doubling the count
+    // costs about as much again as everything so far
+    double seconds = 0;
+    for (int spp = 1; ; spp *= 2) {
+        scn.settings.samples_per_pixel = spp;
+        seconds += render.render(fb).seconds;
+        const image_error e = compare_images(fb.mean(), reference);
+        pass_result p;
+        p.samples = spp;
+        p.rmse = e.rmse;
+        p.relmse = e.relmse;
+        p.seconds = seconds;
+        result.passes.push_back(p);
+        if (seconds * 2 > budget)
+            break;
+    }
+    return result;
+}
+
+// Seconds until `r` reaches `target`, between the passes that straddle it
+static double time_to_error(const integrator_result& r, double target) {
+    const auto& p = r.passes;
+    if (p.front().relmse <= target)
+        return p.front().seconds * p.front().relmse / target;
+    for (size_t k = 1; k < p.size(); k++) {
+        if (p[k].relmse <= target) {
+            const double slope = std::log(p[k].seconds / p[k - 1].seconds) / std::log(p[k].relmse / p[k - 1].relmse);
+            return p[k - 1].seconds * std::exp(slope * std::log(target / p[k - 1].relmse));
+        }
+    }
+    return -1;
+}
+
+int main(int argc, char* argv[]) {
+    double seconds = 60;
+    int threads = 0;
+    std::vector<std::string> integrators = {"path", "bdpt"};
+    std::string reference_path;
+    int reference_spp = 256;
+    double target = 0;
+    std::string path = PT_SCENE_DIR "/cornell_occluded.scene";
+    bool usage_error = false;
+
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--seconds" && a + 1 < argc)
+            seconds = std::atof(argv[++a]);
+        else if (arg == "--threads" && a + 1 < argc)
+            threads = std::atoi(argv[++a]);
+        else if (arg == "--integrators" && a + 1 < argc)
+            integrators = split_list(argv[++a]);
+        else if (arg == "--reference" && a + 1 < argc)
+            reference_path = argv[++a];
+        else if (arg == "--reference-spp" && a + 1 < argc)
+            reference_spp = std::atoi(argv[++a]);
+        else if (arg == "--target-relmse" && a + 1 < argc)
+            target = std::atof(argv[++a]);
+        else if (arg[0] != '-')
+            path = arg;
+        else
+            usage_error = true;
+    }
+    if (usage_error || seconds <= 0 || threads < 0 || integrators.empty() || reference_spp < 1 || target < 0) {
+        std::fprintf(stderr, "Usage: %s [--seconds S] [--threads N] [--integrators path,bdpt]\n"
+                             "       [--reference file.pfm] [--reference-spp N] [--target-relmse x] [scene file]\n",
+                     argv[0]);
+        return 2;
+    }
+
+    try {
+        thread_pool pool(threads);
+        const auto ref = load_reference(reference_path, load_with(path, integrators.back(), pool), reference_spp,
+                                        pool);
+        const float_image& reference = ref.image;
+        if (!ref.rendered)
+            std::printf("%s, reference %s\n", path.c_str(), reference_path.c_str());
+        else
+            std::printf("%s, reference %s at %d spp in %.1f s, noise RMSE %.4g\n", path.c_str(),
+                        integrators.back().c_str(), reference_spp, ref.seconds, ref.noise_rmse);
+        std::printf("Up to %.0f s per integrator on %d threads\n", seconds, pool.size());
+        std::printf("  %-10s %6s %9s %10s %10s\n", "integrator", "spp", "render s", "RMSE", "relMSE");
+
+        std::vector<integrator_result> results;
+        for (const auto& name : integrators) {
+            results.push_back(run_integrator(path, name, seconds, reference, pool));
+            for (const auto& p : results.back().passes)
+                std::printf("  %-10s %6d %9.2f %10.4g %10.4g\n", name.c_str(), p.samples, p.seconds, p.rmse, p.relmse);
+        }
+
+        if (target == 0) {
+            for (const auto& r : results)
+                target = std::max(target, r.passes.back().relmse);
+        }
+        std::printf("Time to relMSE %.4g:\n", target);
+        const double base = time_to_error(results.front(), target);
+        for (const auto& r : results) {
+            const double t = time_to_error(r, target);
+            if (t < 0)
+                std::printf("  %-10s not reached\n", r.name.c_str());
+            else if (base > 0)
+                std::printf("  %-10s %9.2f s %8.2fx\n", r.name.c_str(), t, base / t);
+            else
+                std::printf("  %-10s %9.2f s\n", r.name.c_str(), t);
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 2;
+    }
+    return 0;
+}
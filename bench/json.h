@@ -0,0 +1,200 @@
+#ifndef BENCH_JSON_H
+#define BENCH_JSON_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Minimal JSON for benchmark result files: a value tree, a strict parser and string
+// escaping for writers. Numbers are doubles; objects keep their keys sorted.
+
+struct json_value {
+    enum kind_t { null, boolean, number, string, array, object } kind = null;
+    bool b = false;
+    double n = 0;
+    std::string s;
+    std::vector<json_value> items;
+    std::map<std::string, json_value> fields;
+
+    bool has(const std::string& key) const { return kind == object && fields.count(key) > 0; }
+
+    const json_value& operator[](const std::string& key) const {
+        auto it = fields.find(key);
+        if (kind != object || it == fields.end())
+            throw std::runtime_error("missing JSON field '" + key + "'");
+        return it->second;
+    }
+
+    double as_number() const {
+        if (kind != number)
+            throw std::runtime_error("expected a JSON number");
+        return n;
+    }
+
+    const std::string& as_string() const {
+        if (kind != string)
+            throw std::runtime_error("expected a JSON string");
+        return s;
+    }
+};
+
+class json_parser {
+public:
+    explicit json_parser(const std::string& source) : text(source) {}
+
+    json_value parse() {
+        json_value v = value();
+        skip_space();
+        if (pos != text.size())
+            fail("trailing characters");
+        return v;
+    }
+
+private:
+    const std::string& text;
+    size_t pos = 0;
+
+    [[noreturn]] void fail(const std::string& message) const {
+        throw std::runtime_error("JSON offset " + std::to_string(pos) + ": " + message);
+    }
+
+    void skip_space() {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r'))
+            pos++;
+    }
+
+    bool consume(char c) {
+        skip_space();
+        if (pos < text.size() && text[pos] == c) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c) {
+        if (!consume(c))
+            fail(std::string("expected '") + c + "'");
+    }
+
+    bool keyword(const char* word) {
+        size_t len = std::string(word).size();
+        if (text.compare(pos, len, word) != 0)
+            return false;
+        pos += len;
+        return true;
+    }
+
+    json_value value();
+    std::string string_literal();
+};
+
+json_value json_parser::value() {
+    skip_space();
+    if (pos >= text.size())
+        fail("unexpected end of input");
+
+    json_value v;
+    const char c = text[pos];
+    if (c == '{') {
+        pos++;
+        v.kind = json_value::object;
+        if (consume('}'))
+            return v;
+        do {
+            skip_space();
+            std::string key = string_literal();
+            expect(':');
+            v.fields[key] = value();
+        } while (consume(','));
+        expect('}');
+    } else if (c == '[') {
+        pos++;
+        v.kind = json_value::array;
+        if (consume(']'))
+            return v;
+        do {
+            v.items.push_back(value());
+        } while (consume(','));
+        expect(']');
+    } else if (c == '"') {
+        v.kind = json_value::string;
+        v.s = string_literal();
+    } else if (keyword("true")) {
+        v.kind = json_value::boolean;
+        v.b = true;
+    } else if (keyword("false")) {
+        v.kind = json_value::boolean;
+    } else if (keyword("null")) {
+        v.kind = json_value::null;
+    } else {
+        const char* start = text.c_str() + pos;
+        char* end = nullptr;
+        v.kind = json_value::number;
+        v.n = std::strtod(start, &end);
+        if (end == start)
+            fail("unexpected character");
+        pos += end - start;
+    }
+    return v;
+}
+
+std::string json_parser::string_literal() {
+    if (pos >= text.size() || text[pos] != '"')
+        fail("expected a string");
+    pos++;
+    std::string out;
+    while (pos < text.size() && text[pos] != '"') {
+        char c = text[pos++];
+        if (c == '\\' && pos < text.size()) {
+            char e = text[pos++];
+            switch (e) {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'u':
+                    // Only ASCII escapes are produced by our writers
+                    if (pos + 4 > text.size())
+                        fail("bad escape");
+                    out += static_cast<char>(std::strtol(text.substr(pos, 4).c_str(), nullptr, 16));
+                    pos += 4;
+                    break;
+                default: out += e; break;
+            }
+        } else {
+            out += c;
+        }
+    }
+    if (pos >= text.size())
+        fail("unterminated string");
+    pos++;
+    return out;
+}
+
+inline std::string json_escape(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char buf[8];
+                    std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    return out + "\"";
+}
+
+#endif
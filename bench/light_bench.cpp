@@ -0,0 +1,115 @@
+// Many-light sampling at equal time: renders a scene with each light_sampling mode for the
+// same wall time and reports how noisy each result is.
+//
+// Usage: light_benchmark [--seconds S] [--threads N] [--modes none,uniform,bvh] [scene file]
+//
+// Each mode first renders 2 spp to measure its cost per sample, then continues to as many
+// samples as fit in the budget (default 20 s). Noise is the mean variance of the pixel
+// estimates, from the per-pixel sample variance, and the relative variance weights dark
+// pixels up the way image_compare's relMSE does. All modes are unbiased, so the variance is
+// their expected squared error. Efficiency is 1 / (variance * time), relative to the first
+// mode listed. The default scene is scenes/many_lights.scene.
+
+#include "rtweekend.h"
+#include "scene.h"
+#include "renderer.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct mode_result {
+    std::string name;
+    int samples = 0;
+    double seconds = 0;
+    double variance = 0;
+    double relative_variance = 0;
+};
+
+static mode_result run_mode(const std::string& path, const std::string& name, double budget, thread_pool& pool) {
+    scene scn = load_scene(path, &pool);
+    if (name == "none")
+        scn.settings.lights = light_sampling::none;
+    else if (name == "uniform")
+        scn.settings.lights = light_sampling::uniform;
+    else if (name == "bvh")
+        scn.settings.lights = light_sampling::bvh;
+    else
+        throw std::runtime_error("unknown light sampling '" + name + "'");
+
+    mode_result result;
+    result.name = name;
+    framebuffer fb(scn.settings.image_width, scn.settings.image_height);
+    renderer render(scn, pool);
+    render.show_progress = false;
+
+    // The renderer continues from the samples a framebuffer holds, so the calibration pass counts
+    scn.settings.samples_per_pixel = 2;
+    result.seconds = render.render(fb).seconds;
+    scn.settings.samples_per_pixel = std::max(2, static_cast<int>(budget / (result.seconds / 2)));
+    result.seconds += render.render(fb).seconds;
+    result.samples = scn.settings.samples_per_pixel;
+
+    const auto mean = fb.mean();
+    const auto variance = fb.variance();
+    for (size_t k = 0; k < variance.pixels.size(); k++) {
+        result.variance += variance.pixels[k];
+        result.relative_variance += variance.pixels[k] / (mean.pixels[k] * mean.pixels[k] + 0.01);
+    }
+    result.variance /= variance.pixels.size();
+    result.relative_variance /= variance.pixels.size();
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    double seconds = 20;
+    int threads = 0;
+    std::vector<std::string> modes = {"uniform", "bvh"};
+    std::string path = PT_SCENE_DIR "/many_lights.scene";
+    bool usage_error = false;
+
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--seconds" && a + 1 < argc)
+            seconds = std::atof(argv[++a]);
+        else if (arg == "--threads" && a + 1 < argc)
+            threads = std::atoi(argv[++a]);
+        else if (arg == "--modes" && a + 1 < argc) {
+            modes.clear();
+            std::stringstream list(argv[++a]);
+            std::string item;
+            while (std::getline(list, item, ','))
+                modes.push_back(item);
+        } else if (arg[0] != '-')
+            path = arg;
+        else
+            usage_error = true;
+    }
+    if (usage_error || seconds <= 0 || threads < 0 || modes.empty()) {
+        std::fprintf(stderr, "Usage: %s [--seconds S] [--threads N] [--modes none,uniform,bvh] [scene file]\n", argv[0]);
+        return 2;
+    }
+
+    try {
+        thread_pool pool(threads);
+        std::printf("%s, %.0f s per mode on %d threads\n", path.c_str(), seconds, pool.size());
+        std::printf("  %-8s %6s %9s %14s %14s %11s\n", "mode", "spp", "render s", "mean variance", "rel. variance",
+                    "efficiency");
+        std::vector<mode_result> results;
+        for (const auto& name : modes) {
+            results.push_back(run_mode(path, name, seconds, pool));
+            const auto& r = results.back();
+            const auto& base = results.front();
+            const double efficiency = (base.relative_variance * base.seconds) / (r.relative_variance * r.seconds);
+            std::printf("  %-8s %6d %9.2f %14.6g %14.6g %10.2fx\n", r.name.c_str(), r.samples, r.seconds, r.variance,
+                        r.relative_variance, efficiency);
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,205 @@
+// Micro-benchmarks for the hot kernels: ray-rectangle hit and miss, hittable_list::hit over
+// the Cornell Box, lambertian::scatter, random_double and write_color. Inputs are generated
+// once from fixed seeds and cycled, every kernel is warmed up first, and the reported figure
+// is the median of several timed runs, so numbers are stable enough to compare across
+// commits on the same machine.
+//
+// Usage: benchmarks [--filter substring] [--min-time seconds]
+
+#include "rtweekend.h"
+#include "aarect.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "color.h"
+#include "scene.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+// Keeps a value alive without the compiler seeing through it
+template <typename T>
+inline void do_not_optimize(const T& value) {
+#if defined(__GNUC__)
+    asm volatile("" : : "g"(&value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+// Discards output but still runs the formatting in front of it
+class null_buffer : public std::streambuf {
+protected:
+    int overflow(int c) override {
+        setp(buffer, buffer + sizeof(buffer));
+        return c;
+    }
+
+private:
+    char buffer[256];
+};
+
+struct bench_options {
+    std::string filter;
+    double min_time = 0.5;      // seconds of timed runs per benchmark
+};
+
+// body() performs `ops` operations per call. Reports the median of the timed runs.
+template <typename F>
+void run_benchmark(const bench_options& opt, const char* name, const char* unit, int ops, F&& body) {
+    if (!opt.filter.empty() && std::string(name).find(opt.filter) == std::string::npos)
+        return;
+
+    const int runs = 7;
+    const double run_time = opt.min_time / runs;
+
+    // Warm-up, also sizes a run so one takes about run_time
+    long calls = 1;
+    while (true) {
+        auto start = bench_clock::now();
+        for (long c = 0; c < calls; c++)
+            body();
+        double elapsed = std::chrono::duration<double>(bench_clock::now() - start).count();
+        if (elapsed >= run_time / 4) {
+            calls = std::max(1L, static_cast<long>(calls * run_time / elapsed));
+            break;
+        }
+        calls *= 2;
+    }
+
+    std::vector<double> ns_per_op(runs);
+    for (int r = 0; r < runs; r++) {
+        auto start = bench_clock::now();
+        for (long c = 0; c < calls; c++)
+            body();
+        double elapsed = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+        ns_per_op[r] = elapsed / (static_cast<double>(calls) * ops);
+    }
+    std::sort(ns_per_op.begin(), ns_per_op.end());
+    const double median = ns_per_op[runs / 2];
+    const double spread = (ns_per_op[runs - 1] - ns_per_op[0]) / median * 100;
+
+    std::printf("  %-28s %10.2f %12.3f %-8s %7.1f%%\n", name, median, 1e3 / median, unit, spread);
+}
+
+// Rays from the Cornell Box camera position towards random points of a rectangle at z = 555
+static std::vector<ray> rays_towards(double x0, double x1, double y0, double y1, size_t count) {
+    std::vector<ray> rays;
+    const point3 origin(278, 278, -800);
+    for (size_t n = 0; n < count; n++) {
+        point3 target(random_double(x0, x1), random_double(y0, y1), 555);
+        rays.emplace_back(origin, target - origin);
+    }
+    return rays;
+}
+
+int main(int argc, char* argv[]) {
+    bench_options opt;
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--filter" && a + 1 < argc)
+            opt.filter = argv[++a];
+        else if (arg == "--min-time" && a + 1 < argc)
+            opt.min_time = std::atof(argv[++a]);
+        else {
+            std::fprintf(stderr, "Usage: %s [--filter substring] [--min-time seconds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    scene scn;
+    try {
+        scn = load_scene(PT_SCENE_DIR "/cornell_box.scene");
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+
+    // Input sets are a power of two so the index wraps with a mask
+    const size_t count = 4096;
+    const size_t mask = count - 1;
+
+    seed_random(1);
+    auto white = make_shared<lambertian>(color(0.73, 0.73, 0.73));
+    xy_rect back_wall(0, 555, 0, 555, 555, white);
+    auto hit_rays = rays_towards(0, 555, 0, 555, count);
+    auto miss_rays = rays_towards(600, 1100, 0, 555, count);
+
+    std::vector<ray> camera_rays;
+    camera cam = scn.make_camera();
+    for (size_t n = 0; n < count; n++)
+        camera_rays.push_back(cam.get_ray(random_double(), random_double()));
+
+    // Hit records on lambertian surfaces for the scatter kernel
+    std::vector<hit_record> records;
+    std::vector<ray> record_rays;
+    for (size_t n = 0; records.size() < count; n++) {
+        hit_record rec;
+        const auto& r = camera_rays[n & mask];
+        if (scn.objects.hit(r, 0.001, infinity, rec) && dynamic_cast<lambertian*>(rec.mat)) {
+            records.push_back(rec);
+            record_rays.push_back(r);
+        }
+    }
+
+    std::vector<color> pixels;
+    for (size_t n = 0; n < count; n++)
+        pixels.emplace_back(random_double(0, 200), random_double(0, 200), random_double(0, 200));
+
+    std::printf("%zu inputs per kernel, median of 7 runs\n", count);
+    std::printf("  %-28s %10s %12s %-8s %8s\n", "benchmark", "ns/op", "rate", "", "spread");
+
+    const int batch = 256;
+    size_t i = 0;
+    hit_record rec;
+
+    run_benchmark(opt, "xy_rect::hit (hit)", "Mrays/s", batch, [&] {
+        for (int k = 0; k < batch; k++, i++)
+            do_not_optimize(back_wall.hit(hit_rays[i & mask], 0.001, infinity, rec));
+    });
+    run_benchmark(opt, "xy_rect::hit (miss)", "Mrays/s", batch, [&] {
+        for (int k = 0; k < batch; k++, i++)
+            do_not_optimize(back_wall.hit(miss_rays[i & mask], 0.001, infinity, rec));
+    });
+    run_benchmark(opt, "hittable_list::hit (Cornell)", "Mrays/s", batch, [&] {
+        for (int k = 0; k < batch; k++, i++)
+            do_not_optimize(scn.objects.hit(camera_rays[i & mask], 0.001, infinity, rec));
+    });
+    run_benchmark(opt, "bvh_accel::hit (Cornell)", "Mrays/s", batch, [&] {
+        for (int k = 0; k < batch; k++, i++)
+            do_not_optimize(scn.world->hit(camera_rays[i & mask], 0.001, infinity, rec));
+    });
+
+    seed_random(2);
+    run_benchmark(opt, "lambertian::scatter", "Mrays/s", batch, [&] {
+        color attenuation;
+        ray scattered;
+        for (int k = 0; k < batch; k++, i++) {
+            const size_t n = i & mask;
+            do_not_optimize(records[n].mat->scatter(record_rays[n], records[n], attenuation, scattered));
+            do_not_optimize(scattered);
+        }
+    });
+
+    seed_random(3);
+    run_benchmark(opt, "random_double", "Mops/s", batch, [&] {
+        double sum = 0;
+        for (int k = 0; k < batch; k++)
+            sum += random_double();
+        do_not_optimize(sum);
+    });
+
+    null_buffer discard;
+    std::ostream out(&discard);
+    run_benchmark(opt, "write_color", "Mops/s", batch, [&] {
+        for (int k = 0; k < batch; k++, i++)
+            write_color(out, pixels[i & mask], 200);
+    });
+}
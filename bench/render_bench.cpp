@@ -0,0 +1,306 @@
+// End-to-end render benchmark: renders the canonical scenes at fixed settings and records
+// wall time, primary and secondary ray counts, Mrays/s, samples/s and peak RSS per scene
+// in a JSON file. A second mode compares two such files and flags regressions.
+//
+// Usage:
+//   render_benchmark [--threads N] [--repeats N] [--scenes name,name] [--output file.json]
+//   render_benchmark --compare base.json new.json [--threshold percent]
+//
+// On POSIX each scene renders in a forked child, so its peak RSS is its own; elsewhere
+// everything runs in one process and peak RSS is not reported. The compare mode exits
+// with status 1 when a metric got worse by more than the threshold (default 5%) or the
+// run-to-run spread of the two measurements, whichever is larger.
+
+#include "rtweekend.h"
+#include "scene.h"
+#include "renderer.h"
+#include "thread_pool.h"
+#include "json.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define RENDER_BENCH_FORK 1
+#endif
+
+#ifdef __VERSION__
+#define RENDER_BENCH_COMPILER __VERSION__
+#else
+#define RENDER_BENCH_COMPILER "unknown"
+#endif
+
+struct bench_case {
+    const char* name;
+    const char* file;
+    int width;
+    int height;
+    int samples_per_pixel;
+    int max_depth;
+};
+
+// The fixed settings override the scene files, so results stay comparable when a
+// scene's own defaults change
+static const bench_case canonical_cases[] = {
+    {"cornell",      "cornell_box.scene",  200, 200, 32, 10},
+    {"cornell_deep", "cornell_box.scene",  200, 200, 16, 50},
+    {"cornell_mesh", "cornell_mesh.scene", 200, 200, 16, 10},
+};
+
+struct bench_options {
+    int threads = 0;
+    int repeats = 3;
+    std::string scenes;
+    std::string output = "render_bench.json";
+};
+
+// Renders one case `repeats` times and returns its result object as JSON text
+static std::string run_case(const bench_case& c, const bench_options& opt) {
+    thread_pool pool(opt.threads);
+    scene scn = load_scene(std::string(PT_SCENE_DIR "/") + c.file, &pool);
+    scn.settings.image_width = c.width;
+    scn.settings.image_height = c.height;
+    scn.settings.samples_per_pixel = c.samples_per_pixel;
+    scn.settings.max_depth = c.max_depth;
+
+    std::vector<double> seconds;
+    render_stats stats;
+    for (int r = 0; r < opt.repeats; r++) {
+        framebuffer fb(c.width, c.height);
+        renderer render(scn, pool);
+        render.show_progress = false;
+        stats = render.render(fb);
+        seconds.push_back(stats.seconds);
+    }
+    std::sort(seconds.begin(), seconds.end());
+    const double wall = seconds[seconds.size() / 2];
+    const double spread = (seconds.back() - seconds.front()) / wall;
+
+    std::ostringstream out;
+    out.precision(9);
+    out << "{\"scene\": " << json_escape(c.name) << ", \"file\": " << json_escape(c.file)
+        << ", \"width\": " << c.width << ", \"height\": " << c.height
+        << ", \"samples_per_pixel\": " << c.samples_per_pixel << ", \"max_depth\": " << c.max_depth
+        << ", \"threads\": " << pool.size() << ", \"repeats\": " << opt.repeats
+        << ", \"primitives\": " << scn.primitive_count << ", \"build_ms\": " << scn.build_ms
+        << ", \"wall_s\": " << wall << ", \"wall_spread\": " << spread
+        << ", \"samples\": " << stats.samples << ", \"primary_rays\": " << stats.primary_rays
+        << ", \"secondary_rays\": " << stats.secondary_rays
+        << ", \"mrays_per_s\": " << stats.rays() / wall / 1e6
+        << ", \"samples_per_s\": " << stats.samples / wall << "}";
+    return out.str();
+}
+
+// Runs a case and adds its peak RSS in KiB (-1 when unknown)
+static json_value measure_case(const bench_case& c, const bench_options& opt) {
+    std::string text;
+    long peak_rss_kib = -1;
+
+#ifdef RENDER_BENCH_FORK
+    int fds[2];
+    if (pipe(fds) != 0)
+        throw std::runtime_error("pipe failed");
+    std::fflush(nullptr);
+    pid_t pid = fork();
+    if (pid < 0)
+        throw std::runtime_error("fork failed");
+    if (pid == 0) {
+        close(fds[0]);
+        int status = 0;
+        try {
+            auto result = run_case(c, opt);
+            if (write(fds[1], result.data(), result.size()) != static_cast<ssize_t>(result.size()))
+                status = 1;
+        } catch (const std::exception& e) {
+            std::fprintf(stderr, "Error: %s\n", e.what());
+            status = 1;
+        }
+        close(fds[1]);
+        _exit(status);
+    }
+
+    close(fds[1]);
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fds[0], buf, sizeof(buf))) > 0)
+        text.append(buf, static_cast<size_t>(n));
+    close(fds[0]);
+
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        throw std::runtime_error(std::string("scene '") + c.name + "' failed");
+#ifdef __APPLE__
+    peak_rss_kib = usage.ru_maxrss / 1024;     // bytes on macOS
+#else
+    peak_rss_kib = usage.ru_maxrss;
+#endif
+#else
+    text = run_case(c, opt);
+#endif
+
+    json_value result = json_parser(text).parse();
+    json_value rss;
+    rss.kind = json_value::number;
+    rss.n = static_cast<double>(peak_rss_kib);
+    result.fields["peak_rss_kib"] = rss;
+    return result;
+}
+
+static int run_benchmarks(const bench_options& opt) {
+    std::vector<json_value> results;
+    std::printf("  %-14s %9s %12s %14s %10s %12s %12s\n",
+        "scene", "wall s", "primary", "secondary", "Mrays/s", "samples/s", "peak RSS MiB");
+    for (const auto& c : canonical_cases) {
+        if (!opt.scenes.empty() && ("," + opt.scenes + ",").find(std::string(",") + c.name + ",") == std::string::npos)
+            continue;
+        auto r = measure_case(c, opt);
+        std::printf("  %-14s %9.3f %12.0f %14.0f %10.3f %12.0f %12.1f\n", c.name, r["wall_s"].as_number(),
+            r["primary_rays"].as_number(), r["secondary_rays"].as_number(), r["mrays_per_s"].as_number(),
+            r["samples_per_s"].as_number(), r["peak_rss_kib"].as_number() / 1024.0);
+        results.push_back(r);
+    }
+
+    std::ofstream out(opt.output);
+    if (!out)
+        throw std::runtime_error("cannot write '" + opt.output + "'");
+    std::time_t now = std::time(nullptr);
+    char stamp[32];
+    std::strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+    // Keys in the order written by run_case, then the RSS the parent measured
+    const char* keys[] = {"scene", "file", "width", "height", "samples_per_pixel", "max_depth", "threads", "repeats",
+        "primitives", "build_ms", "wall_s", "wall_spread", "samples", "primary_rays", "secondary_rays",
+        "mrays_per_s", "samples_per_s", "peak_rss_kib"};
+    out.precision(9);
+    out << "{\n  \"version\": 1,\n  \"timestamp\": " << json_escape(stamp)
+        << ",\n  \"compiler\": " << json_escape(RENDER_BENCH_COMPILER) << ",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        out << (i ? ",\n" : "\n") << "    {";
+        for (size_t k = 0; k < sizeof(keys) / sizeof(keys[0]); k++) {
+            const auto& v = results[i][keys[k]];
+            out << (k ? ", " : "") << json_escape(keys[k]) << ": ";
+            if (v.kind == json_value::string)
+                out << json_escape(v.s);
+            else
+                out << v.n;
+        }
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+    std::printf("Results written to %s\n", opt.output.c_str());
+    return 0;
+}
+
+static json_value read_results(const std::string& path) {
+    std::ifstream in(path);
+    if (!in)
+        throw std::runtime_error("cannot open '" + path + "'");
+    std::stringstream ss;
+    ss << in.rdbuf();
+    const std::string text = ss.str();
+    return json_parser(text).parse();
+}
+
+static int compare_results(const std::string& base_path, const std::string& new_path, double threshold) {
+    const auto base = read_results(base_path);
+    const auto next = read_results(new_path);
+
+    struct metric {
+        const char* key;
+        bool higher_is_better;
+        bool timed;     // subject to run-to-run noise
+    };
+    const metric metrics[] = {
+        {"wall_s", false, true},
+        {"mrays_per_s", true, true},
+        {"samples_per_s", true, true},
+        {"peak_rss_kib", false, false},
+    };
+
+    int regressions = 0;
+    std::printf("  %-14s %-14s %14s %14s %9s %9s  %s\n", "scene", "metric", "base", "new", "change", "allowed", "status");
+    for (const auto& b : base["results"].items) {
+        const auto& name = b["scene"].as_string();
+        const json_value* n = nullptr;
+        for (const auto& candidate : next["results"].items) {
+            if (candidate["scene"].as_string() == name)
+                n = &candidate;
+        }
+        if (!n) {
+            std::printf("  %-14s missing from %s\n", name.c_str(), new_path.c_str());
+            continue;
+        }
+
+        for (const auto& m : metrics) {
+            const double old_value = b[m.key].as_number();
+            const double new_value = (*n)[m.key].as_number();
+            if (old_value <= 0 || new_value < 0)
+                continue;   // not measured
+
+            const double change = (new_value - old_value) / old_value * 100;
+            double allowed = threshold;
+            if (m.timed)
+                allowed = std::max(allowed, (b["wall_spread"].as_number() + (*n)["wall_spread"].as_number()) * 100);
+
+            const double worse = m.higher_is_better ? -change : change;
+            const char* status = worse > allowed ? "REGRESSION" : (worse < -allowed ? "improved" : "ok");
+            if (worse > allowed)
+                regressions++;
+            std::printf("  %-14s %-14s %14.4g %14.4g %+8.1f%% %8.1f%%  %s\n", name.c_str(), m.key, old_value,
+                new_value, change, allowed, status);
+        }
+    }
+
+    std::printf("%d regression%s\n", regressions, regressions == 1 ? "" : "s");
+    return regressions > 0 ? 1 : 0;
+}
+
+int main(int argc, char* argv[]) {
+    bench_options opt;
+    std::vector<std::string> compare;
+    double threshold = 5.0;
+    bool usage_error = false;
+
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--threads" && a + 1 < argc)
+            opt.threads = std::atoi(argv[++a]);
+        else if (arg == "--repeats" && a + 1 < argc)
+            opt.repeats = std::max(1, std::atoi(argv[++a]));
+        else if (arg == "--scenes" && a + 1 < argc)
+            opt.scenes = argv[++a];
+        else if (arg == "--output" && a + 1 < argc)
+            opt.output = argv[++a];
+        else if (arg == "--compare" && a + 2 < argc) {
+            compare.push_back(argv[++a]);
+            compare.push_back(argv[++a]);
+        } else if (arg == "--threshold" && a + 1 < argc)
+            threshold = std::atof(argv[++a]);
+        else
+            usage_error = true;
+    }
+    if (usage_error) {
+        std::fprintf(stderr, "Usage: %s [--threads N] [--repeats N] [--scenes a,b] [--output file.json]\n"
+                             "       %s --compare base.json new.json [--threshold percent]\n", argv[0], argv[0]);
+        return 2;
+    }
+
+    try {
+        if (!compare.empty())
+            return compare_results(compare[0], compare[1], threshold);
+        return run_benchmarks(opt);
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 2;
+    }
+}
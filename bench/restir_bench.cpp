@@ -0,0 +1,174 @@
+// Reservoir resampling at equal time: renders a many-light scene with next-event estimation
+// choosing lights uniformly and through the light BVH, and with ReSTIR, for the same wall
+// time, and reports each result's error against a converged reference.
+//
+// Usage: restir_benchmark [--seconds S] [--threads N] [--modes uniform,bvh,restir]
+//                         [--max-depth D] [--candidates N] [--neighbours N] [--history H]
+//                         [--image W H] [--reference file.pfm] [--reference-spp N] [scene file]
+//
+// Each mode first renders 2 spp to measure its cost per sample, then renders a fresh image
+// with as many samples as fit in the budget (default 10 s). ReSTIR samples lights with the
+// scene's light_sampling past the first hit. Its reuse correlates samples, so the error is
+// measured rather than taken from the variance: relMSE as image_compare computes it, with
+// RMSE alongside. --max-depth 2 leaves only the direct light, which is all ReSTIR resamples.
+// The reference is read from --reference when that file exists; otherwise it is rendered
+// with the light BVH at --reference-spp samples (default 512) from another seed and written
+// there if a path was given. The default scene is scenes/cornell_many_lights.scene; --image
+// and --max-depth override its settings, which the reference must match.
+
+#include "rtweekend.h"
+#include "scene.h"
+#include "renderer.h"
+#include "pfm.h"
+#include "thread_pool.h"
+#include "compare.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+struct bench_options {
+    int max_depth = 0;              // 0 keeps the scene's
+    int candidates = 8;
+    int neighbours = 3;
+    double history = 0;
+    int width = 0, height = 0;      // 0 keeps the scene's
+};
+
+struct mode_result {
+    std::string name;
+    int samples = 0;
+    double seconds = 0;
+    double rmse = 0;
+    double relmse = 0;
+    render_stats stats;
+};
+
+static scene load_mode(const std::string& path, const std::string& name, const bench_options& options,
+                       thread_pool& pool) {
+    scene scn = load_scene(path, &pool);
+    scn.settings.integrator = integrator_type::path;
+    scn.settings.radiance_cache = false;
+    scn.settings.restir = name == "restir";
+    scn.settings.restir_candidates = options.candidates;
+    scn.settings.restir_neighbours = options.neighbours;
+    scn.settings.restir_history = options.history;
+    if (name == "uniform")
+        scn.settings.lights = light_sampling::uniform;
+    else if (name == "bvh")
+        scn.settings.lights = light_sampling::bvh;
+    else if (name != "restir")
+        throw std::runtime_error("unknown mode '" + name + "'");
+    if (options.max_depth > 0)
+        scn.settings.max_depth = options.max_depth;
+    if (options.width > 0) {
+        scn.settings.image_width = options.width;
+        scn.settings.image_height = options.height;
+    }
+    return scn;
+}
+
+static mode_result run_mode(const std::string& path, const std::string& name, const bench_options& options,
+                            double budget, const float_image& reference, thread_pool& pool) {
+    scene scn = load_mode(path, name, options, pool);
+    if (scn.settings.image_width != reference.width || scn.settings.image_height != reference.height)
+        throw std::runtime_error("reference is not " + std::to_string(scn.settings.image_width) + "x"
+                                 + std::to_string(scn.settings.image_height));
+    mode_result result;
+    result.name = name;
+    renderer render(scn, pool);
+    render.show_progress = false;
+
+    framebuffer trial(scn.settings.image_width, scn.settings.image_height);
+    scn.settings.samples_per_pixel = 2;
+    const double per_sample = std::max(1e-9, render.render(trial).seconds / 2);
+    scn.settings.samples_per_pixel = std::max(2, static_cast<int>(budget / per_sample));
+
+    framebuffer fb(scn.settings.image_width, scn.settings.image_height);
+    result.stats = render.render(fb);
+    result.samples = scn.settings.samples_per_pixel;
+    result.seconds = result.stats.seconds;
+
+    const image_error e = compare_images(fb.mean(), reference);
+    result.rmse = e.rmse;
+    result.relmse = e.relmse;
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    double seconds = 10;
+    int threads = 0;
+    std::vector<std::string> modes = {"uniform", "bvh", "restir"};
+    bench_options options;
+    std::string reference_path;
+    int reference_spp = 512;
+    std::string path = PT_SCENE_DIR "/cornell_many_lights.scene";
+    bool usage_error = false;
+
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--seconds" && a + 1 < argc)
+            seconds = std::atof(argv[++a]);
+        else if (arg == "--threads" && a + 1 < argc)
+            threads = std::atoi(argv[++a]);
+        else if (arg == "--modes" && a + 1 < argc)
+            modes = split_list(argv[++a]);
+        else if (arg == "--max-depth" && a + 1 < argc)
+            options.max_depth = std::atoi(argv[++a]);
+        else if (arg == "--candidates" && a + 1 < argc)
+            options.candidates = std::atoi(argv[++a]);
+        else if (arg == "--neighbours" && a + 1 < argc)
+            options.neighbours = std::atoi(argv[++a]);
+        else if (arg == "--history" && a + 1 < argc)
+            options.history = std::atof(argv[++a]);
+        else if (arg == "--image" && a + 2 < argc) {
+            options.width = std::atoi(argv[++a]);
+            options.height = std::atoi(argv[++a]);
+        } else if (arg == "--reference" && a + 1 < argc)
+            reference_path = argv[++a];
+        else if (arg == "--reference-spp" && a + 1 < argc)
+            reference_spp = std::atoi(argv[++a]);
+        else if (arg[0] != '-')
+            path = arg;
+        else
+            usage_error = true;
+    }
+    if (usage_error || seconds <= 0 || threads < 0 || modes.empty() || options.max_depth < 0
+        || options.candidates < 1 || options.neighbours < 0 || options.neighbours > 15 || options.history < 0
+        || options.width < 0 || options.height < 0 || reference_spp < 1) {
+        std::fprintf(stderr, "Usage: %s [--seconds S] [--threads N] [--modes uniform,bvh,restir]\n"
+                             "       [--max-depth D] [--candidates N] [--neighbours N] [--history H]\n"
+                             "       [--image W H] [--reference file.pfm] [--reference-spp N] [scene file]\n",
+                     argv[0]);
+        return 2;
+    }
+
+    try {
+        thread_pool pool(threads);
+        const auto ref = load_reference(reference_path, load_mode(path, "bvh", options, pool), reference_spp, pool);
+        const float_image& reference = ref.image;
+        if (!ref.rendered)
+            std::printf("%s, reference %s\n", path.c_str(), reference_path.c_str());
+        else
+            std::printf("%s, reference at %d spp in %.1f s\n", path.c_str(), reference_spp, ref.seconds);
+        std::printf("%.0f s per mode on %d threads, ReSTIR %d candidates, %d neighbours, history %g\n", seconds,
+                    pool.size(), options.candidates, options.neighbours, options.history);
+        std::printf("  %-10s %6s %9s %10s %10s %10s %11s %11s\n", "mode", "spp", "render s", "RMSE", "relMSE",
+                    "reduction", "shadow/spp", "restir KiB");
+
+        std::vector<mode_result> results;
+        for (const auto& name : modes) {
+            results.push_back(run_mode(path, name, options, seconds, reference, pool));
+            const auto& r = results.back();
+            const double pixel_samples = static_cast<double>(reference.width) * reference.height * r.samples;
+            std::printf("  %-10s %6d %9.2f %10.4g %10.4g %9.2fx %11.2f %11zu\n", r.name.c_str(), r.samples,
+                        r.seconds, r.rmse, r.relmse, results.front().relmse / r.relmse,
+                        r.stats.shadow_rays / pixel_samples, r.stats.restir_memory_bytes / 1024);
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,156 @@
+// Cost of spectral rendering: renders each scene with RGB paths and with hero-wavelength
+// spectral ones at the same samples per pixel, and reports the time per sample of both,
+// the spectral overhead, each image's mean colour and the relMSE between the two.
+//
+// Usage: spectral_benchmark [--threads N] [--spp N] [--image W H] [--repeats N] [scene files]
+//
+// Each mode renders --repeats times (default 9) at --spp samples (default 32) and --image size
+// (default 200x200), alternating between the modes so that each RGB render and the spectral
+// one after it see about the same load on the machine; every other setting is the scene's.
+// Times are medians with their interquartile range as a percentage of the median. The
+// overhead is the median of the paired per-repeat ratios, with their interquartile range, so
+// a drift in the machine's speed between repeats cancels; the overhead is resolved when
+// that range excludes zero. The default scenes are
+// scenes/cornell_box.scene with light_sampling uniform, and scenes/cornell_glass.scene,
+// whose glass disperses. The two images differ by their noise and by what the round trip
+// from RGB to spectra and back changes in saturated colours, so the relMSE bounds both.
+
+#include "rtweekend.h"
+#include "scene.h"
+#include "renderer.h"
+#include "thread_pool.h"
+#include "compare.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+struct bench_options {
+    int spp = 32;
+    int width = 200, height = 200;
+    int repeats = 9;
+};
+
+struct mode_result {
+    std::vector<double> seconds;    // one per repeat, in order
+    float_image image;
+    color mean;
+};
+
+// The q-quantile of `values`, interpolating between neighbours
+static double quantile(std::vector<double> values, double q) {
+    std::sort(values.begin(), values.end());
+    const double pos = q * (values.size() - 1);
+    const size_t lo = static_cast<size_t>(pos);
+    const size_t hi = std::min(lo + 1, values.size() - 1);
+    return values[lo] + (pos - lo) * (values[hi] - values[lo]);
+}
+
+// Interquartile range as a percentage of the median
+static double spread(const std::vector<double>& values) {
+    return 100 * (quantile(values, 0.75) - quantile(values, 0.25)) / quantile(values, 0.5);
+}
+
+static scene load_mode(const std::string& path, bool spectral, bool nee, const bench_options& options,
+                       thread_pool& pool) {
+    scene scn = load_scene(path, &pool);
+    scn.settings.integrator = integrator_type::path;
+    scn.settings.spectral = spectral;
+    if (nee)
+        scn.settings.lights = light_sampling::uniform;
+    scn.settings.samples_per_pixel = options.spp;
+    scn.settings.image_width = options.width;
+    scn.settings.image_height = options.height;
+    return scn;
+}
+
+// One render into `result`, keeping the first image and every time
+static void run_once(const scene& scn, thread_pool& pool, int repeat, mode_result& result) {
+    renderer render(scn, pool);
+    render.show_progress = false;
+    framebuffer fb(scn.settings.image_width, scn.settings.image_height);
+    result.seconds.push_back(render.render(fb).seconds);
+    if (repeat > 0)
+        return;
+    result.image = fb.mean();
+    for (int j = 0; j < fb.height; j++) {
+        for (int i = 0; i < fb.width; i++)
+            result.mean += result.image.at(i, j);
+    }
+    result.mean = result.mean / (static_cast<double>(fb.width) * fb.height);
+}
+
+int main(int argc, char* argv[]) {
+    int threads = 0;
+    bench_options options;
+    std::vector<std::string> paths;
+    bool usage_error = false;
+
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--threads" && a + 1 < argc)
+            threads = std::atoi(argv[++a]);
+        else if (arg == "--spp" && a + 1 < argc)
+            options.spp = std::atoi(argv[++a]);
+        else if (arg == "--image" && a + 2 < argc) {
+            options.width = std::atoi(argv[++a]);
+            options.height = std::atoi(argv[++a]);
+        } else if (arg == "--repeats" && a + 1 < argc)
+            options.repeats = std::atoi(argv[++a]);
+        else if (arg[0] != '-')
+            paths.push_back(arg);
+        else
+            usage_error = true;
+    }
+    if (usage_error || threads < 0 || options.spp < 1 || options.width < 2 || options.height < 2
+        || options.repeats < 1) {
+        std::fprintf(stderr, "Usage: %s [--threads N] [--spp N] [--image W H] [--repeats N] [scene files]\n",
+                     argv[0]);
+        return 2;
+    }
+    // The Cornell Box has no light_sampling of its own
+    std::vector<bool> nee(paths.size(), false);
+    if (paths.empty()) {
+        paths = {PT_SCENE_DIR "/cornell_box.scene", PT_SCENE_DIR "/cornell_glass.scene"};
+        nee = {true, false};
+    }
+
+    try {
+        thread_pool pool(threads);
+#ifdef SPECTRUM_SSE
+        const char* lanes = "SSE";
+#else
+        const char* lanes = "scalar";
+#endif
+        std::printf("%dx%d, %d spp, median of %d on %d threads, %s spectra\n", options.width, options.height,
+                    options.spp, options.repeats, pool.size(), lanes);
+        std::printf("  %-22s %17s %17s %9s %17s %24s %24s %9s\n", "scene", "RGB ms/spp", "spec ms/spp",
+                    "overhead", "overhead IQR", "RGB mean", "spectral mean", "relMSE");
+        for (size_t s = 0; s < paths.size(); s++) {
+            const scene rgb_scene = load_mode(paths[s], false, nee[s], options, pool);
+            const scene spectral_scene = load_mode(paths[s], true, nee[s], options, pool);
+            mode_result rgb, spectral;
+            for (int r = 0; r < options.repeats; r++) {
+                run_once(rgb_scene, pool, r, rgb);
+                run_once(spectral_scene, pool, r, spectral);
+            }
+            const image_error error = compare_images(spectral.image, rgb.image);
+            std::vector<double> overheads;
+            for (int r = 0; r < options.repeats; r++)
+                overheads.push_back(100 * (spectral.seconds[r] / rgb.seconds[r] - 1));
+            std::string name = paths[s].substr(paths[s].find_last_of("/\\") + 1);
+            std::printf("  %-22s %9.2f \u00b1%5.1f%% %9.2f \u00b1%5.1f%% %8.1f%% %7.1f%% %7.1f%% "
+                        "%8.4f %7.4f %7.4f %8.4f %7.4f %7.4f %9.4g\n", name.c_str(),
+                        1000 * quantile(rgb.seconds, 0.5) / options.spp, spread(rgb.seconds),
+                        1000 * quantile(spectral.seconds, 0.5) / options.spp, spread(spectral.seconds),
+                        quantile(overheads, 0.5), quantile(overheads, 0.25), quantile(overheads, 0.75),
+                        rgb.mean.x(), rgb.mean.y(), rgb.mean.z(), spectral.mean.x(), spectral.mean.y(),
+                        spectral.mean.z(), error.relmse);
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 2;
+    }
+    return 0;
+}
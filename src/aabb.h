@@ -0,0 +1,86 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "rtweekend.h"
+#include <utility>
+
+// Axis-Aligned Bounding Box
+
+class aabb {
+public:
+    // Default box is empty (inverted), so expanding it by anything yields that thing
+    aabb() : minimum(infinity, infinity, infinity), maximum(-infinity, -infinity, -infinity) {}
+    aabb(const point3& a, const point3& b) : minimum(a), maximum(b) {}
+
+    point3 min() const { return minimum; }
+    point3 max() const { return maximum; }
+
+    bool empty() const {
+        return minimum.x() > maximum.x() || minimum.y() > maximum.y() || minimum.z() > maximum.z();
+    }
+
+    void expand(const point3& p) {
+        for (int a = 0; a < 3; a++) {
+            minimum[a] = fmin(minimum[a], p[a]);
+            maximum[a] = fmax(maximum[a], p[a]);
+        }
+    }
+
+    void expand(const aabb& box) {
+        for (int a = 0; a < 3; a++) {
+            minimum[a] = fmin(minimum[a], box.minimum[a]);
+            maximum[a] = fmax(maximum[a], box.maximum[a]);
+        }
+    }
+
+    point3 centroid() const {
+        return 0.5 * (minimum + maximum);
+    }
+
+    double surface_area() const {
+        if (empty())
+            return 0;
+        auto d = maximum - minimum;
+        return 2.0 * (d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+    }
+
+    int longest_axis() const {
+        auto d = maximum - minimum;
+        if (d.x() > d.y() && d.x() > d.z())
+            return 0;
+        return d.y() > d.z() ? 1 : 2;
+    }
+
+    // Slab test with a precomputed reciprocal direction (used by BVH traversal).
+    // Flat boxes (e.g. around axis-aligned rectangles) still register hits.
+    bool hit(const point3& orig, const vec3& inv_dir, double t_min, double t_max) const {
+        for (int a = 0; a < 3; a++) {
+            auto t0 = (minimum[a] - orig[a]) * inv_dir[a];
+            auto t1 = (maximum[a] - orig[a]) * inv_dir[a];
+            if (inv_dir[a] < 0.0)
+                std::swap(t0, t1);
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+            if (t_max < t_min)
+                return false;
+        }
+        return true;
+    }
+
+    bool hit(const ray& r, double t_min, double t_max) const {
+        auto d = r.direction();
+        return hit(r.origin(), vec3(1/d.x(), 1/d.y(), 1/d.z()), t_min, t_max);
+    }
+
+public:
+    point3 minimum;
+    point3 maximum;
+};
+
+inline aabb surrounding_box(const aabb& box0, const aabb& box1) {
+    aabb box = box0;
+    box.expand(box1);
+    return box;
+}
+
+#endif
@@ -15,9 +15,20 @@ public:
 
     virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+    virtual bool bounding_box(aabb& output_box) const override {
+        // The bounding box must have non-zero width in each dimension, so pad the thin axis
+        output_box = aabb(point3(x0, y0, k-0.0001), point3(x1, y1, k+0.0001));
+        return true;
+    }
+
+    virtual size_t memory_usage() const override {
+        return sizeof(*this);
+    }
+
 public:
     shared_ptr<material> mp;
     double x0, x1, y0, y1, k;
+    int light = -1;     // set when the scene samples this rectangle as an emitter
 };
 
 // XZ Rectangle (perpendicular to Y axis)
@@ -29,9 +40,20 @@ public:
 
     virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+    virtual bool bounding_box(aabb& output_box) const override {
+        // The bounding box must have non-zero width in each dimension, so pad the thin axis
+        output_box = aabb(point3(x0, k-0.0001, z0), point3(x1, k+0.0001, z1));
+        return true;
+    }
+
+    virtual size_t memory_usage() const override {
+        return sizeof(*this);
+    }
+
 public:
     shared_ptr<material> mp;
     double x0, x1, z0, z1, k;
+    int light = -1;     // set when the scene samples this rectangle as an emitter
 };
 
 // YZ Rectangle (perpendicular to X axis)
@@ -43,9 +65,20 @@ public:
 
     virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+    virtual bool bounding_box(aabb& output_box) const override {
+        // The bounding box must have non-zero width in each dimension, so pad the thin axis
+        output_box = aabb(point3(k-0.0001, y0, z0), point3(k+0.0001, y1, z1));
+        return true;
+    }
+
+    virtual size_t memory_usage() const override {
+        return sizeof(*this);
+    }
+
 public:
     shared_ptr<material> mp;
     double y0, y1, z0, z1, k;
+    int light = -1;     // set when the scene samples this rectangle as an emitter
 };
 
 // Implementation
@@ -63,7 +96,8 @@ bool xy_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
     rec.p = r.at(t);
     auto outward_normal = vec3(0, 0, 1);
     rec.set_face_normal(r, outward_normal);
-    rec.mat = mp;
+    rec.mat = mp.get();
+    rec.light = light;
     return true;
 }
 
@@ -81,7 +115,8 @@ bool xz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
     rec.p = r.at(t);
     auto outward_normal = vec3(0, 1, 0);
     rec.set_face_normal(r, outward_normal);
-    rec.mat = mp;
+    rec.mat = mp.get();
+    rec.light = light;
     return true;
 }
 
@@ -99,7 +134,8 @@ bool yz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
     rec.p = r.at(t);
     auto outward_normal = vec3(1, 0, 0);
     rec.set_face_normal(r, outward_normal);
-    rec.mat = mp;
+    rec.mat = mp.get();
+    rec.light = light;
     return true;
 }
 
@@ -0,0 +1,310 @@
+#ifndef BDPT_H
+#define BDPT_H
+
+#include "rtweekend.h"
+#include "color.h"
+#include "hittable.h"
+#include "integrator.h"
+#include "lights.h"
+#include "material.h"
+#include "stats.h"
+#include <cmath>
+#include <vector>
+
+// Bidirectional Path Tracing
+//
+// Every sample traces two subpaths: one from the camera, as the path tracer does, and one
+// from a point on an emitter. Each prefix of the camera subpath is then joined to each
+// prefix of the light subpath by a shadow ray, so a path of k segments can be found k ways,
+// and each way is weighted by the power heuristic over the densities with which all the
+// others would have produced the same path (Veach 1997, ch. 10; the bookkeeping follows
+// pbrt-v3). Light that reaches the room through a narrow gap is found by light subpaths
+// that squeeze through it and by camera subpaths that connect to them, where the path tracer
+// has to hit the gap by chance.
+//
+// Strategies with a single camera vertex, which would connect light subpaths straight to the
+// lens and add to other pixels than the one being sampled, are left out: every sample still
+// lands in its own pixel, so the image stays independent of threads, passes and tiles, and
+// the per-pixel variance stays meaningful. The weights sum over the strategies used, so the
+// estimate stays unbiased; only caustics seen directly, which nothing in these scenes makes,
+// lose their best strategy.
+//
+// Light subpaths start on the light set's emitters, chosen in proportion to their power
+// whatever light_sampling says, with a cosine-distributed direction about either face.
+// Emitters outside the light set (triangles, meshes, instances) are only found by camera
+// subpaths, which then keep their full weight, as does the background.
+
+namespace bdpt_detail {
+
+struct vertex {
+    hit_record rec;         // for a point on an emitter: p, the emitter's normal and light
+    color beta;             // subpath throughput up to this vertex, over its density
+    double pdf_fwd = 0;     // area density of this vertex given by its own subpath
+    double pdf_rev = 0;     // the same had the other subpath produced it
+    bool on_light = false;  // starts a light subpath, or was sampled on an emitter
+    bool camera = false;
+    bool delta = false;     // scattered specularly (glass), so no other strategy ends here
+
+    const point3& p() const { return rec.p; }
+
+    // Whether a shadow ray can end here: a surface that scatters diffusely
+    bool connectible() const {
+        return !on_light && !camera && rec.mat->pdf(rec, rec.normal) > 0;
+    }
+};
+
+// Solid-angle density `pdf` at `from` towards `to` as an area density at `to`; the camera
+// has no surface to project onto
+inline double to_area(double pdf, const vertex& from, const vertex& to) {
+    const vec3 d = to.p() - from.p();
+    const double dist2 = d.length_squared();
+    if (!to.camera)
+        pdf *= std::fabs(dot(to.rec.normal, d)) / std::sqrt(dist2);
+    return pdf / dist2;
+}
+
+// Density with which an emitter at `from` sends light towards `to`: cosine-distributed
+// over both faces
+inline double emission_pdf(const vertex& from, const vertex& to) {
+    const vec3 w = unit_vector(to.p() - from.p());
+    return to_area(std::fabs(dot(from.rec.normal, w)) / (2 * pi), from, to);
+}
+
+// Density with which the subpath through `from` continues to `to`, as an area density
+inline double pdf(const vertex& from, const vertex& to) {
+    if (from.on_light)
+        return emission_pdf(from, to);
+    return to_area(from.rec.mat->pdf(from.rec, to.p() - from.p()), from, to);
+}
+
+// Density with which a light subpath would start at `v`, a point on an emitter
+inline double origin_pdf(const vertex& v, const light_set& lights) {
+    return lights.power_pmf(v.rec.light) / lights.emitters[v.rec.light].area;
+}
+
+// Cosine-distributed direction about unit n
+inline vec3 cosine_direction(const vec3& n) {
+    const auto a = random_double(0, 2 * pi);
+    const auto z = random_double(-1, 1);
+    const auto r = std::sqrt(1 - z * z);
+    const vec3 d = n + vec3(r * std::cos(a), r * std::sin(a), z);
+    return d.length_squared() < 1e-16 ? n : d;
+}
+
+// Extends the subpath that starts at path[0] along r until it leaves the scene, reaches an
+// emitter or holds max_vertices vertices; returns the vertex count. `escaped` gets the
+// throughput of a ray that left the scene.
+inline int random_walk(const hittable& world, ray r, color beta, double pdf_dir, int max_vertices, vertex* path,
+                       bool camera, color* escaped) {
+    int n = 1;
+    while (n < max_vertices) {
+        thread_ray_counters().traced++;
+        vertex& v = path[n];
+        vertex& prev = path[n - 1];
+        if (!world.hit(r, 0.001, infinity, v.rec)) {
+            if (camera)
+                PT_STAT(thread_path_counters().ended_miss++);
+            *escaped = beta;
+            return n;
+        }
+        v.beta = beta;
+        v.on_light = v.camera = v.delta = false;
+        v.pdf_fwd = to_area(pdf_dir, prev, v);
+        v.pdf_rev = 0;
+        n++;
+
+        // Diffuse reflection is the same both ways, so the reverse density is the forward one
+        // towards the previous vertex
+        prev.pdf_rev = to_area(v.rec.mat->pdf(v.rec, -r.direction()), v, prev);
+
+        ray scattered;
+        color attenuation;
+        if (!v.rec.mat->scatter(r, v.rec, attenuation, scattered)) {
+            if (camera)
+                PT_STAT(thread_path_counters().ended_light++);
+            return n;
+        }
+        pdf_dir = v.rec.mat->pdf(v.rec, scattered.direction());
+        v.delta = v.rec.mat->pdf(v.rec, v.rec.normal) <= 0;
+        beta = beta * attenuation;
+        r = scattered;
+    }
+    if (camera)
+        PT_STAT(thread_path_counters().ended_max_depth++);
+    return n;
+}
+
+inline double remap(double pdf) {
+    return pdf != 0 ? pdf : 1;
+}
+
+// Power-heuristic weight of joining light[0..s) to camera[0..t); `sampled` stands in for
+// light[0] when s == 1
+inline double mis_weight(const vertex* light, int s, const vertex* camera, int t, const vertex& sampled,
+                         const light_set& lights) {
+    if (s + t == 2)
+        return 1;
+    const vertex& pt = camera[t - 1];
+    const vertex& pt_prev = camera[t - 2];
+    const vertex* qs = s == 1 ? &sampled : s > 1 ? &light[s - 1] : nullptr;
+
+    // The reverse densities at the two vertices either side of the join depend on it
+    const double pt_rev = s > 0 ? pdf(*qs, pt) : origin_pdf(pt, lights);
+    const double pt_prev_rev = s > 0 ? pdf(pt, pt_prev) : emission_pdf(pt, pt_prev);
+    const double qs_rev = s > 0 ? pdf(pt, *qs) : 0;
+    const double qs_prev_rev = s > 1 ? pdf(*qs, light[s - 2]) : 0;
+
+    // Ratios of the density of each other strategy to this one's, walking the join point
+    // towards the camera (stopping short of a single camera vertex) and towards the light.
+    // Strategies that would join at a specular vertex do not exist; their zero densities
+    // count as 1 so the ratios beyond them come out right, as in pbrt.
+    double sum = 0, ratio = 1;
+    for (int i = t - 1; i > 1; i--) {
+        const double rev = i == t - 1 ? pt_rev : i == t - 2 ? pt_prev_rev : camera[i].pdf_rev;
+        const double r = remap(rev) / remap(camera[i].pdf_fwd);
+        ratio *= r * r;
+        if (!camera[i].delta && !camera[i - 1].delta)
+            sum += ratio;
+    }
+    ratio = 1;
+    for (int i = s - 1; i >= 0; i--) {
+        const double fwd = s == 1 ? sampled.pdf_fwd : light[i].pdf_fwd;
+        const double rev = i == s - 1 ? qs_rev : i == s - 2 ? qs_prev_rev : light[i].pdf_rev;
+        const double r = remap(rev) / remap(fwd);
+        ratio *= r * r;
+        if (!(s > 1 && light[i].delta) && !(i > 0 && light[i - 1].delta))
+            sum += ratio;
+    }
+    return 1 / (1 + sum);
+}
+
+// Whether nothing blocks the segment between two vertices
+inline bool visible(const hittable& world, const point3& a, const point3& b) {
+    thread_ray_counters().traced++;
+    thread_ray_counters().shadow++;
+    const vec3 d = b - a;
+    const double dist = d.length();
+    hit_record blocker;
+    return !world.hit(ray(a, d / dist), 0.001, dist * (1 - 1e-6), blocker);
+}
+
+inline bool is_black(const color& c) {
+    return c.x() <= 0 && c.y() <= 0 && c.z() <= 0;
+}
+
+// Weighted contribution of the path made of the first s light and first t camera vertices
+inline color connect(const hittable& world, const light_set& lights, const vertex* light, int s, const vertex* camera,
+                     int t, vertex& sampled) {
+    const vertex& pt = camera[t - 1];
+    color result;
+    if (s == 0) {
+        // The camera subpath found an emitter by itself
+        const color le = pt.rec.mat->emitted();
+        if (is_black(le))
+            return color(0, 0, 0);
+        if (pt.rec.light < 0)
+            return pt.beta * le;
+        result = pt.beta * le;
+    } else if (s == 1) {
+        // A fresh point on an emitter, as next-event estimation takes
+        if (!pt.connectible())
+            return color(0, 0, 0);
+        double pmf;
+        const int index = lights.sample_power(random_double(), pmf);
+        if (index < 0)
+            return color(0, 0, 0);
+        const emitter& e = lights.emitters[index];
+        sampled.rec.p = e.point(random_double(), random_double());
+        sampled.rec.normal = e.normal;
+        sampled.rec.light = index;
+        sampled.on_light = true;
+        sampled.camera = false;
+        sampled.pdf_fwd = pmf / e.area;
+        sampled.beta = e.radiance / sampled.pdf_fwd;
+
+        const vec3 d = sampled.p() - pt.p();
+        const double dist2 = d.length_squared();
+        const double cos_light = std::fabs(dot(e.normal, d)) / std::sqrt(dist2);
+        result = pt.beta * pt.rec.mat->eval(pt.rec, d) * sampled.beta * (cos_light / dist2);
+        if (is_black(result) || !visible(world, pt.p(), sampled.p()))
+            return color(0, 0, 0);
+    } else {
+        const vertex& qs = light[s - 1];
+        if (!qs.connectible() || !pt.connectible())
+            return color(0, 0, 0);
+        const vec3 d = qs.p() - pt.p();
+        result = qs.beta * qs.rec.mat->eval(qs.rec, -d) * pt.rec.mat->eval(pt.rec, d) * pt.beta
+               / d.length_squared();
+        if (is_black(result) || !visible(world, pt.p(), qs.p()))
+            return color(0, 0, 0);
+    }
+    return result * mis_weight(light, s, camera, t, sampled, lights);
+}
+
+} // namespace bdpt_detail
+
+// One bidirectional sample of the radiance along camera ray r, with paths of at most
+// max_depth segments; fills `aov` from the first hit when given
+color bdpt_color(const ray& r, const color& background, const hittable& world, const light_set& lights, int max_depth,
+                 first_hit* aov = nullptr) {
+    using namespace bdpt_detail;
+    static thread_local std::vector<vertex> camera_path, light_path;
+    camera_path.resize(max_depth + 1);
+    light_path.resize(std::max(max_depth - 1, 1));
+
+    // The camera's own density only enters strategies with one camera vertex, which are not
+    // used, so it is left at 1
+    vertex& z0 = camera_path[0];
+    z0.rec.p = r.origin();
+    z0.beta = color(1, 1, 1);
+    z0.camera = true;
+    z0.on_light = false;
+    z0.pdf_fwd = 1;
+    color escaped(0, 0, 0);
+    const int t_max = random_walk(world, r, color(1, 1, 1), 1, max_depth + 1, camera_path.data(), true, &escaped);
+    color result = escaped * background;
+
+    if (aov && t_max > 1) {
+        const hit_record& rec = camera_path[1].rec;
+        aov->albedo = rec.mat->surface_albedo();
+        aov->normal = rec.normal;
+        aov->distance = (rec.p - r.origin()).length();
+    }
+
+    // A point on an emitter and a walk away from it; every connection adds a segment, so
+    // the light subpath holds at most max_depth - 1 vertices
+    int s_max = 0;
+    double pmf;
+    const int index = max_depth > 1 ? lights.sample_power(random_double(), pmf) : -1;
+    if (index >= 0) {
+        const emitter& e = lights.emitters[index];
+        vertex& y0 = light_path[0];
+        y0.rec.p = e.point(random_double(), random_double());
+        y0.rec.normal = e.normal;
+        y0.rec.light = index;
+        y0.on_light = true;
+        y0.camera = false;
+        y0.pdf_fwd = pmf / e.area;
+        y0.pdf_rev = 0;
+        y0.beta = e.radiance / y0.pdf_fwd;
+
+        const vec3 dir = cosine_direction(random_double() < 0.5 ? e.normal : -e.normal);
+        const double pdf_dir = std::fabs(dot(e.normal, unit_vector(dir))) / (2 * pi);
+        if (pdf_dir > 0) {
+            color unused;
+            s_max = random_walk(world, ray(y0.rec.p, dir), y0.beta * (2 * pi), pdf_dir, max_depth - 1,
+                                light_path.data(), false, &unused);
+        } else {
+            s_max = 1;
+        }
+    }
+
+    vertex sampled;
+    for (int t = 2; t <= t_max; t++) {
+        for (int s = 0; s <= s_max && s + t - 1 <= max_depth; s++)
+            result += connect(world, lights, light_path.data(), s, camera_path.data(), t, sampled);
+    }
+    return result;
+}
+
+#endif
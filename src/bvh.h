@@ -0,0 +1,554 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "hittable.h"
+#include "wide_bvh.h"
+#include "quantized_bvh.h"
+#include "bvh_build.h"
+#include "stats.h"
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// Bounding Volume Hierarchy
+//
+// Nodes live depth-first in one flat array: an interior node's first child directly follows
+// it and `offset` holds the index of the second child. A leaf covers `count` entries of
+// `prim_indices` starting at `offset`. The tree only knows primitive boxes; callers supply a
+// per-primitive intersection callback, so the same structure serves the scene and meshes.
+//
+// The binary tree is always what gets built, by one of the builders in bvh_build.h (run on
+// `pool` when one is set). With the wide layouts it is then collapsed into 4-wide nodes,
+// which are traversed instead, and the binary nodes are released. The quantized layout
+// stores child bounds as 8-bit offsets to cut node memory in half again.
+//
+// Dynamic trees keep their binary nodes after collapsing, so update() can follow moving
+// primitives without a full build: it refits every box bottom-up, rebuilds the subtrees
+// whose boxes grew past `subtree_ratio` times their build-time area, and falls back to a
+// full build once the tree's SAH cost exceeds `rebuild_ratio` times the cost it was built
+// with. Primitives never move between subtrees in a refit, which is what makes the cost
+// creep up over time.
+
+enum class bvh_layout { binary, wide, quantized };
+
+// What bvh_tree::update() had to do
+enum class bvh_update { refit, partial, rebuild };
+
+struct bvh_node {
+    aabb box;
+    int offset;
+    unsigned short count;   // 0 for interior nodes
+    unsigned short axis;    // split axis, used to visit the nearer child first
+
+    bool is_leaf() const { return count > 0; }
+};
+
+class bvh_tree {
+public:
+    static const int max_leaf_size = 4;
+    static_assert(max_leaf_size <= bvh_max_leaf_count, "leaf counts must fit the node layouts");
+    static const int stack_size = 64;
+    // Relative cost of one traversal step versus one primitive test
+    static constexpr double traversal_cost = 0.125;
+
+    void build(const std::vector<aabb>& prim_boxes);
+
+    // Moves every node box to the current primitive boxes, keeping the tree shape.
+    // Requires the binary nodes: a binary or dynamic tree.
+    void refit(const std::vector<aabb>& prim_boxes);
+
+    // Refit, then rebuild degraded subtrees or the whole tree as the ratios dictate
+    bvh_update update(const std::vector<aabb>& prim_boxes);
+
+    // hit_prim(prim, t_min, t_max) tests one primitive and shrinks t_max on a closer hit
+    template <typename F>
+    bool intersect(const ray& r, double t_min, double t_max, F&& hit_prim) const;
+
+    bool empty() const { return prim_indices.empty(); }
+    aabb bounds() const { return root_box; }
+
+    // Nodes of the layout used for traversal
+    size_t node_count() const {
+        switch (layout) {
+            case bvh_layout::wide:      return wide.nodes.size();
+            case bvh_layout::quantized: return quantized.nodes.size();
+            default:                    return nodes.size();
+        }
+    }
+
+    size_t memory_usage() const {
+        return nodes.capacity() * sizeof(bvh_node) + wide.memory_usage() + quantized.memory_usage()
+             + prim_indices.capacity() * sizeof(int) + built_area.capacity() * sizeof(float);
+    }
+
+public:
+    bvh_layout layout = bvh_layout::binary;
+    bvh_builder builder = bvh_builder::sah;
+    thread_pool* pool = nullptr;    // not owned; builds on the calling thread when null
+    double sah_cost = 0;            // expected cost of a random ray through the current tree
+    bool dynamic = false;           // keep binary nodes and build areas for update()
+    double rebuild_ratio = 1.5;
+    double subtree_ratio = 2.0;
+    std::vector<bvh_node> nodes;    // binary nodes, empty once collapsed unless dynamic
+    wide_bvh<bvh4_node> wide;
+    wide_bvh<qbvh4_node> quantized;
+    std::vector<int> prim_indices;
+    aabb root_box;
+
+private:
+    // Dynamic trees only: node areas and SAH cost (against the root area) at the last build
+    std::vector<float> built_area;
+    double built_root_area = 0;
+    double built_sah_cost = 0;
+
+    // Builds a subtree over `prims` into `out`; leaf offsets start at prim_base
+    void build_nodes(std::vector<bvh_build_prim>& prims, std::vector<bvh_node>& out, int prim_base, int max_depth) const;
+    static int flatten(const std::vector<bvh_build_node>& tmp, int index, std::vector<bvh_node>& out, int prim_base);
+    void refit_nodes(const std::vector<aabb>& prim_boxes);
+    void rebuild_subtree(int root, int depth, const std::vector<aabb>& prim_boxes);
+    int subtree_end(int index) const;
+    double compute_sah_cost(double root_area) const;
+    void finish_layout();
+
+    template <typename F>
+    bool intersect_binary(const ray& r, double t_min, double t_max, F&& hit_prim) const;
+
+    template <typename Node>
+    void collapse(wide_bvh<Node>& out) const;
+
+    template <typename Node>
+    int collapse_node(std::vector<Node>& out, int binary_index) const;
+};
+
+// Implementation
+void bvh_tree::build(const std::vector<aabb>& prim_boxes) {
+    nodes.clear();
+    built_area.clear();
+    wide = {};
+    quantized = {};
+    prim_indices.clear();
+    root_box = aabb();
+    if (prim_boxes.empty())
+        return;
+
+    std::vector<bvh_build_prim> prims(prim_boxes.size());
+    for (size_t i = 0; i < prim_boxes.size(); i++)
+        prims[i] = {prim_boxes[i], prim_boxes[i].centroid(), static_cast<int>(i)};
+
+    nodes.reserve(2 * prims.size());
+    build_nodes(prims, nodes, 0, stack_size);
+
+    prim_indices.reserve(prims.size());
+    for (const auto& p : prims)
+        prim_indices.push_back(p.index);
+    root_box = nodes[0].box;
+    sah_cost = compute_sah_cost(root_box.surface_area());
+
+    if (dynamic) {
+        built_area.resize(nodes.size());
+        for (size_t i = 0; i < nodes.size(); i++)
+            built_area[i] = static_cast<float>(nodes[i].box.surface_area());
+        built_root_area = root_box.surface_area();
+        built_sah_cost = sah_cost;
+    }
+    finish_layout();
+}
+
+void bvh_tree::build_nodes(std::vector<bvh_build_prim>& prims, std::vector<bvh_node>& out, int prim_base, int max_depth) const {
+    if (builder == bvh_builder::lbvh) {
+        lbvh_builder b(prims, pool, max_leaf_size, max_depth);
+        int root = b.build();
+        flatten(b.result(), root, out, prim_base);
+    } else {
+        sah_bvh_builder b(prims, pool, max_leaf_size, max_depth);
+        int root = b.build();
+        flatten(b.result(), root, out, prim_base);
+    }
+}
+
+// Copies the builder's linked tree into the depth-first array
+int bvh_tree::flatten(const std::vector<bvh_build_node>& tmp, int index, std::vector<bvh_node>& out, int prim_base) {
+    const int node_index = static_cast<int>(out.size());
+    out.emplace_back();
+    const auto& src = tmp[index];
+    out[node_index].box = src.box;
+    if (src.left < 0) {
+        out[node_index].offset = prim_base + src.begin;
+        out[node_index].count = static_cast<unsigned short>(src.count);
+        out[node_index].axis = 0;
+        return node_index;
+    }
+
+    flatten(tmp, src.left, out, prim_base);
+    const int second = flatten(tmp, src.right, out, prim_base);
+    out[node_index].offset = second;
+    out[node_index].count = 0;
+    out[node_index].axis = static_cast<unsigned short>(src.axis);
+    return node_index;
+}
+
+// Collapses into the traversal layout and releases what traversal no longer needs
+void bvh_tree::finish_layout() {
+    if (layout == bvh_layout::wide)
+        collapse(wide);
+    else if (layout == bvh_layout::quantized)
+        collapse(quantized);
+
+    if (layout != bvh_layout::binary && !dynamic)
+        nodes.clear();
+    nodes.shrink_to_fit();
+}
+
+void bvh_tree::refit(const std::vector<aabb>& prim_boxes) {
+    if (nodes.empty())
+        return;
+    refit_nodes(prim_boxes);
+    if (layout != bvh_layout::binary)
+        finish_layout();
+}
+
+void bvh_tree::refit_nodes(const std::vector<aabb>& prim_boxes) {
+    // Children always follow their parent, so a reverse sweep sees them first
+    for (int i = static_cast<int>(nodes.size()) - 1; i >= 0; i--) {
+        auto& node = nodes[i];
+        if (node.is_leaf()) {
+            aabb box;
+            for (int k = node.offset; k < node.offset + node.count; k++)
+                box.expand(prim_boxes[prim_indices[k]]);
+            node.box = box;
+        } else {
+            node.box = surrounding_box(nodes[i+1].box, nodes[node.offset].box);
+        }
+    }
+    root_box = nodes[0].box;
+    sah_cost = compute_sah_cost(root_box.surface_area());
+}
+
+bvh_update bvh_tree::update(const std::vector<aabb>& prim_boxes) {
+    if (!dynamic || nodes.empty() || prim_boxes.size() != prim_indices.size()) {
+        build(prim_boxes);
+        return bvh_update::rebuild;
+    }
+
+    refit_nodes(prim_boxes);
+
+    // Against the build-time root area, so a growing root cannot hide the degradation
+    if (compute_sah_cost(built_root_area) > rebuild_ratio * built_sah_cost) {
+        build(prim_boxes);
+        return bvh_update::rebuild;
+    }
+
+    // Topmost subtrees whose box grew too much, with their depth; nested ones go with them
+    std::vector<std::pair<int, int>> roots;
+    struct entry { int index, depth; } stack[stack_size + 1];
+    int sp = 0;
+    stack[sp++] = {0, 0};
+    while (sp > 0) {
+        const entry e = stack[--sp];
+        const auto& node = nodes[e.index];
+        if (node.is_leaf())
+            continue;
+        const double area = node.box.surface_area();
+        if (area > 0 && area > subtree_ratio * built_area[e.index]) {
+            roots.push_back({e.index, e.depth});
+            continue;
+        }
+        stack[sp++] = {node.offset, e.depth + 1};
+        stack[sp++] = {e.index + 1, e.depth + 1};
+    }
+
+    if (!roots.empty() && roots.front().first == 0) {
+        build(prim_boxes);
+        return bvh_update::rebuild;
+    }
+
+    // Highest index first, so splicing one subtree leaves the others' indices valid
+    std::sort(roots.rbegin(), roots.rend());
+    for (const auto& root : roots)
+        rebuild_subtree(root.first, root.second, prim_boxes);
+
+    // Ancestors of a rebuilt subtree may shrink again
+    if (!roots.empty())
+        refit_nodes(prim_boxes);
+    finish_layout();
+    return roots.empty() ? bvh_update::refit : bvh_update::partial;
+}
+
+// One past the last node of the subtree at `index`
+int bvh_tree::subtree_end(int index) const {
+    while (!nodes[index].is_leaf())
+        index = nodes[index].offset;
+    return index + 1;
+}
+
+void bvh_tree::rebuild_subtree(int root, int depth, const std::vector<aabb>& prim_boxes) {
+    const int end = subtree_end(root);
+
+    // A subtree's leaves cover one contiguous range of prim_indices
+    int first = static_cast<int>(prim_indices.size()), last = 0;
+    for (int i = root; i < end; i++) {
+        if (nodes[i].is_leaf()) {
+            first = std::min(first, nodes[i].offset);
+            last = std::max(last, nodes[i].offset + static_cast<int>(nodes[i].count));
+        }
+    }
+
+    std::vector<bvh_build_prim> prims(last - first);
+    for (int k = first; k < last; k++) {
+        const int p = prim_indices[k];
+        prims[k - first] = {prim_boxes[p], prim_boxes[p].centroid(), p};
+    }
+
+    std::vector<bvh_node> subtree;
+    subtree.reserve(2 * prims.size());
+    build_nodes(prims, subtree, first, stack_size - depth);
+    for (size_t k = 0; k < prims.size(); k++)
+        prim_indices[first + k] = prims[k].index;
+
+    // Shift links past the subtree by the change in node count, then splice it in
+    const int delta = static_cast<int>(subtree.size()) - (end - root);
+    for (auto& node : subtree) {
+        if (!node.is_leaf())
+            node.offset += root;
+    }
+    for (int i = 0; i < static_cast<int>(nodes.size()); i++) {
+        if ((i < root || i >= end) && !nodes[i].is_leaf() && nodes[i].offset >= end)
+            nodes[i].offset += delta;
+    }
+
+    std::vector<float> areas(subtree.size());
+    for (size_t k = 0; k < subtree.size(); k++)
+        areas[k] = static_cast<float>(subtree[k].box.surface_area());
+
+    nodes.erase(nodes.begin() + root, nodes.begin() + end);
+    nodes.insert(nodes.begin() + root, subtree.begin(), subtree.end());
+    built_area.erase(built_area.begin() + root, built_area.begin() + end);
+    built_area.insert(built_area.begin() + root, areas.begin(), areas.end());
+}
+
+// Surface area heuristic: node areas relative to the root weight traversal and primitive tests
+double bvh_tree::compute_sah_cost(double root_area) const {
+    if (nodes.empty() || root_area <= 0)
+        return 0;
+    double cost = 0;
+    for (const auto& node : nodes) {
+        const double p = node.box.surface_area() / root_area;
+        cost += p * (node.is_leaf() ? node.count : traversal_cost);
+    }
+    return cost;
+}
+
+template <typename Node>
+void bvh_tree::collapse(wide_bvh<Node>& out) const {
+    out.nodes.clear();
+    out.nodes.reserve(nodes.size() / 3 + 1);
+    if (nodes[0].is_leaf()) {
+        const int offset = nodes[0].offset, count = nodes[0].count;
+        out.nodes.emplace_back();
+        out.nodes[0].set_children(1, &nodes[0].box, &offset, &count);
+        return;
+    }
+    collapse_node(out.nodes, 0);
+    out.nodes.shrink_to_fit();
+}
+
+template <typename Node>
+int bvh_tree::collapse_node(std::vector<Node>& out, int binary_index) const {
+    const int index = static_cast<int>(out.size());
+    out.emplace_back();
+
+    // Open the largest interior grandchild until the node has four children
+    int children[4] = {binary_index + 1, nodes[binary_index].offset};
+    int n = 2;
+    while (n < 4) {
+        int best = -1;
+        double best_area = -1;
+        for (int i = 0; i < n; i++) {
+            const auto& c = nodes[children[i]];
+            if (!c.is_leaf() && c.box.surface_area() > best_area) {
+                best_area = c.box.surface_area();
+                best = i;
+            }
+        }
+        if (best < 0)
+            break;
+        const int opened = children[best];
+        children[best] = opened + 1;
+        children[n++] = nodes[opened].offset;
+    }
+
+    aabb boxes[4];
+    int indices[4], counts[4];
+    for (int i = 0; i < n; i++) {
+        const auto& c = nodes[children[i]];
+        boxes[i] = c.box;
+        indices[i] = c.is_leaf() ? c.offset : collapse_node(out, children[i]);
+        counts[i] = c.count;
+    }
+    out[index].set_children(n, boxes, indices, counts);
+    return index;
+}
+
+template <typename F>
+bool bvh_tree::intersect(const ray& r, double t_min, double t_max, F&& hit_prim) const {
+    auto hit_leaf = [&](int first, int count, double t0, double& t1) {
+        bool hit_anything = false;
+        PT_STAT(thread_path_counters().prim_tests += count);
+        for (int i = first; i < first + count; i++) {
+            if (hit_prim(prim_indices[i], t0, t1))
+                hit_anything = true;
+        }
+        return hit_anything;
+    };
+
+    switch (layout) {
+        case bvh_layout::wide:      return wide.intersect(r, t_min, t_max, hit_leaf);
+        case bvh_layout::quantized: return quantized.intersect(r, t_min, t_max, hit_leaf);
+        default:                    return intersect_binary(r, t_min, t_max, hit_prim);
+    }
+}
+
+template <typename F>
+bool bvh_tree::intersect_binary(const ray& r, double t_min, double t_max, F&& hit_prim) const {
+    if (nodes.empty())
+        return false;
+
+    const point3 orig = r.origin();
+    const vec3 dir = r.direction();
+    const vec3 inv_dir(1/dir.x(), 1/dir.y(), 1/dir.z());
+    const bool dir_is_neg[3] = {inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0};
+
+    int stack[stack_size];
+    int sp = 0;
+    int current = 0;
+    bool hit_anything = false;
+
+    while (true) {
+        const bvh_node& node = nodes[current];
+        PT_STAT(thread_path_counters().nodes_visited++);
+        if (node.box.hit(orig, inv_dir, t_min, t_max)) {
+            if (!node.is_leaf()) {
+                // Descend into the near child, defer the far one
+                if (dir_is_neg[node.axis]) {
+                    stack[sp++] = current + 1;
+                    current = node.offset;
+                } else {
+                    stack[sp++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+
+            PT_STAT(thread_path_counters().prim_tests += node.count);
+            for (int i = node.offset; i < node.offset + node.count; i++) {
+                if (hit_prim(prim_indices[i], t_min, t_max))
+                    hit_anything = true;
+            }
+        }
+
+        if (sp == 0)
+            break;
+        current = stack[--sp];
+    }
+
+    return hit_anything;
+}
+
+// BVH over a list of hittables, used as the top-level scene structure. Objects without a
+// bounding box cannot be culled, so they stay out of the tree and every ray tests them.
+class bvh_accel : public hittable {
+public:
+    bvh_accel() {}
+    bvh_accel(const std::vector<shared_ptr<hittable>>& src_objects) : objects(src_objects) {
+        build();
+    }
+
+    // (Re)builds the tree over the current objects
+    void build();
+
+    // Follows objects that moved since the last build (see bvh_tree::update)
+    bvh_update update();
+
+    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+    virtual bool bounding_box(aabb& output_box) const override {
+        output_box = tree.bounds();
+        return !tree.empty() && unbounded.empty();
+    }
+
+    virtual size_t memory_usage() const override;
+
+public:
+    std::vector<shared_ptr<hittable>> objects;
+    bvh_tree tree;
+
+private:
+    std::vector<int> tree_objects;   // object index of each tree primitive
+    std::vector<int> unbounded;      // objects tested by every ray
+
+    // Boxes of the bounded objects; also fills the two index lists
+    std::vector<aabb> object_boxes(std::vector<int>& bounded, std::vector<int>& rest) const;
+};
+
+void bvh_accel::build() {
+    tree.build(object_boxes(tree_objects, unbounded));
+}
+
+bvh_update bvh_accel::update() {
+    std::vector<int> bounded, rest;
+    auto boxes = object_boxes(bounded, rest);
+    if (bounded != tree_objects) {
+        // An object gained or lost its bounds, so the tree's primitives changed
+        tree_objects = std::move(bounded);
+        unbounded = std::move(rest);
+        tree.build(boxes);
+        return bvh_update::rebuild;
+    }
+    return tree.update(boxes);
+}
+
+std::vector<aabb> bvh_accel::object_boxes(std::vector<int>& bounded, std::vector<int>& rest) const {
+    std::vector<aabb> boxes;
+    bounded.clear();
+    rest.clear();
+    for (size_t i = 0; i < objects.size(); i++) {
+        aabb box;
+        if (objects[i]->bounding_box(box)) {
+            boxes.push_back(box);
+            bounded.push_back(static_cast<int>(i));
+        } else {
+            rest.push_back(static_cast<int>(i));
+        }
+    }
+    return boxes;
+}
+
+size_t bvh_accel::memory_usage() const {
+    size_t bytes = sizeof(*this) + objects.capacity() * sizeof(shared_ptr<hittable>) + tree.memory_usage()
+        + (tree_objects.capacity() + unbounded.capacity()) * sizeof(int);
+    for (const auto& object : objects)
+        bytes += object->memory_usage();
+    return bytes;
+}
+
+bool bvh_accel::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    double closest = t_max;
+    bool hit_anything = tree.intersect(r, t_min, t_max, [&](int i, double t0, double& t1) {
+        if (!objects[tree_objects[i]]->hit(r, t0, t1, rec))
+            return false;
+        t1 = closest = rec.t;
+        return true;
+    });
+
+    for (int i : unbounded) {
+        if (objects[i]->hit(r, t_min, closest, rec)) {
+            closest = rec.t;
+            hit_anything = true;
+        }
+    }
+    return hit_anything;
+}
+
+#endif
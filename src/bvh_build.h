@@ -0,0 +1,439 @@
+#ifndef BVH_BUILD_H
+#define BVH_BUILD_H
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// BVH Builders
+//
+// Both builders produce a temporary tree with explicit child links, which bvh_tree then
+// flattens into its depth-first layout. Large subtrees are built as independent tasks on
+// the thread pool, so node slots are claimed from an atomic counter instead of appended.
+// Without a pool (or with a one-thread pool) everything runs on the calling thread.
+//
+// - Binned SAH: top-down, 16 bins along the longest centroid axis. Large nodes compute
+//   bounds, fill bins and partition in parallel chunks. Partitioning is stable, so the
+//   tree is the same for every thread count.
+// - LBVH: sorts primitives by the 30-bit Morton code of their centroid with a parallel LSD
+//   radix sort, then splits each range at its highest differing code bit. Far cheaper to
+//   build than SAH, at the price of a higher SAH cost (slower traversal).
+
+enum class bvh_builder { sah, lbvh };
+
+// Largest leaf every node layout can store: qbvh4_node keeps its counts in a byte
+const int bvh_max_leaf_count = 255;
+
+struct bvh_build_prim {
+    aabb box;
+    point3 centroid;
+    int index;
+};
+
+struct bvh_build_node {
+    aabb box;
+    int left = -1;      // children, -1 for leaves
+    int right = -1;
+    int begin = 0;      // leaf primitive range
+    int count = 0;
+    int axis = 0;
+};
+
+class bvh_build_base {
+public:
+    bvh_build_base(std::vector<bvh_build_prim>& build_prims, thread_pool* thread_pool_ptr, int leaf_size, int depth_limit)
+        : prims(build_prims), pool(thread_pool_ptr && thread_pool_ptr->size() > 1 ? thread_pool_ptr : nullptr),
+          max_leaf_size(std::min(leaf_size, bvh_max_leaf_count)), max_depth(depth_limit),
+          nodes(2 * build_prims.size()) {}
+
+    std::vector<bvh_build_node>& result() { return nodes; }
+
+protected:
+    // Ranges below this size are processed serially
+    static const int parallel_grain = 16384;
+    // Subtrees above this size are built as separate tasks
+    static const int spawn_threshold = 4096;
+
+    std::vector<bvh_build_prim>& prims;
+    thread_pool* pool;
+    const int max_leaf_size;
+    const int max_depth;
+    std::vector<bvh_build_node> nodes;
+    std::atomic<int> node_count{0};
+
+    int allocate_node() {
+        return node_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    int make_leaf(int index, int begin, int end, const aabb& box) {
+        auto& node = nodes[index];
+        node.box = box;
+        node.begin = begin;
+        node.count = end - begin;
+        return index;
+    }
+
+    // Runs body(lo, hi, chunk) over [begin, end) and returns the chunk count
+    template <typename F>
+    int for_chunks(int begin, int end, F&& body) {
+        const int n = end - begin;
+        if (!pool || n < 2 * parallel_grain) {
+            body(begin, end, 0);
+            return 1;
+        }
+        const int chunks = (n + parallel_grain - 1) / parallel_grain;
+        parallel_for(*pool, 0, chunks, 1, [&](int c0, int c1) {
+            for (int c = c0; c < c1; c++) {
+                int lo = begin + c * parallel_grain;
+                body(lo, std::min(lo + parallel_grain, end), c);
+            }
+        });
+        return chunks;
+    }
+
+    int chunk_count(int begin, int end) const {
+        const int n = end - begin;
+        return (!pool || n < 2 * parallel_grain) ? 1 : (n + parallel_grain - 1) / parallel_grain;
+    }
+
+    aabb range_box(int begin, int end) {
+        std::vector<aabb> partial(chunk_count(begin, end));
+        for_chunks(begin, end, [&](int lo, int hi, int c) {
+            for (int i = lo; i < hi; i++)
+                partial[c].expand(prims[i].box);
+        });
+        aabb box;
+        for (const auto& b : partial)
+            box.expand(b);
+        return box;
+    }
+
+    // Builds both children, the left one as a separate task when the range is large
+    template <typename L, typename R>
+    void build_children(int n, L&& build_left, R&& build_right) {
+        if (pool && n > spawn_threshold) {
+            task_group group(*pool);
+            group.run(build_left);
+            build_right();
+            group.wait();
+        } else {
+            build_left();
+            build_right();
+        }
+    }
+};
+
+// Binned SAH Builder
+class sah_bvh_builder : public bvh_build_base {
+public:
+    using bvh_build_base::bvh_build_base;
+
+    int build() {
+        return build_range(0, static_cast<int>(prims.size()), 0);
+    }
+
+private:
+    static const int bin_count = 16;
+
+    struct bin_set {
+        aabb box[bin_count];
+        int count[bin_count] = {};
+    };
+
+    int build_range(int begin, int end, int depth);
+
+    // Stable partition, so serial and parallel builds agree. Returns the split index.
+    template <typename Pred>
+    int partition(int begin, int end, Pred&& goes_left);
+};
+
+int sah_bvh_builder::build_range(int begin, int end, int depth) {
+    const int index = allocate_node();
+    const int n = end - begin;
+
+    aabb box, centroid_box;
+    {
+        std::vector<aabb> partial_box(chunk_count(begin, end)), partial_centroid(partial_box.size());
+        for_chunks(begin, end, [&](int lo, int hi, int c) {
+            for (int i = lo; i < hi; i++) {
+                partial_box[c].expand(prims[i].box);
+                partial_centroid[c].expand(prims[i].centroid);
+            }
+        });
+        for (size_t c = 0; c < partial_box.size(); c++) {
+            box.expand(partial_box[c]);
+            centroid_box.expand(partial_centroid[c]);
+        }
+    }
+
+    if (n == 1)
+        return make_leaf(index, begin, end, box);
+
+    const int axis = centroid_box.longest_axis();
+    const double lo = centroid_box.minimum[axis];
+    const double extent = centroid_box.maximum[axis] - lo;
+    int mid = begin + n/2;
+
+    auto by_centroid = [axis](const bvh_build_prim& a, const bvh_build_prim& b) {
+        return a.centroid[axis] < b.centroid[axis];
+    };
+
+    if (extent <= 0) {
+        // All centroids coincide, so no plane separates them
+        if (n <= max_leaf_size)
+            return make_leaf(index, begin, end, box);
+    } else if (depth >= max_depth/2) {
+        // Fall back to median splits so the tree depth stays within the traversal stack
+        std::nth_element(prims.begin() + begin, prims.begin() + mid, prims.begin() + end, by_centroid);
+    } else {
+        auto bin_of = [&](const bvh_build_prim& p) {
+            int b = static_cast<int>(bin_count * ((p.centroid[axis] - lo) / extent));
+            return b < bin_count ? b : bin_count - 1;
+        };
+
+        // Fill bins per chunk, then reduce
+        std::vector<bin_set> partial(chunk_count(begin, end));
+        for_chunks(begin, end, [&](int lo_i, int hi_i, int c) {
+            auto& bins = partial[c];
+            for (int i = lo_i; i < hi_i; i++) {
+                int b = bin_of(prims[i]);
+                bins.box[b].expand(prims[i].box);
+                bins.count[b]++;
+            }
+        });
+        bin_set bins;
+        for (const auto& p : partial) {
+            for (int b = 0; b < bin_count; b++) {
+                bins.box[b].expand(p.box[b]);
+                bins.count[b] += p.count[b];
+            }
+        }
+
+        // Sweep the bin boundaries
+        double right_area[bin_count];
+        int right_count[bin_count];
+        aabb acc;
+        int count = 0;
+        for (int b = bin_count - 1; b > 0; b--) {
+            acc.expand(bins.box[b]);
+            count += bins.count[b];
+            right_area[b] = acc.surface_area();
+            right_count[b] = count;
+        }
+
+        double best_cost = infinity;
+        int best_split = -1;
+        acc = aabb();
+        count = 0;
+        for (int b = 0; b < bin_count - 1; b++) {
+            acc.expand(bins.box[b]);
+            count += bins.count[b];
+            if (count == 0 || right_count[b+1] == 0)
+                continue;
+            auto cost = count * acc.surface_area() + right_count[b+1] * right_area[b+1];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_split = b;
+            }
+        }
+
+        // Relative cost of one traversal step versus one primitive test
+        const double traversal_cost = 0.125;
+        auto leaf_cost = static_cast<double>(n);
+        auto split_cost = traversal_cost + best_cost / box.surface_area();
+
+        if (n <= max_leaf_size && leaf_cost <= split_cost)
+            return make_leaf(index, begin, end, box);
+
+        if (best_split >= 0)
+            mid = partition(begin, end, [&](const bvh_build_prim& p) { return bin_of(p) <= best_split; });
+        if (mid == begin || mid == end) {
+            mid = begin + n/2;
+            std::nth_element(prims.begin() + begin, prims.begin() + mid, prims.begin() + end, by_centroid);
+        }
+    }
+
+    auto& node = nodes[index];
+    node.box = box;
+    node.axis = axis;
+    build_children(n, [&] { node.left = build_range(begin, mid, depth + 1); },
+                      [&] { node.right = build_range(mid, end, depth + 1); });
+    return index;
+}
+
+template <typename Pred>
+int sah_bvh_builder::partition(int begin, int end, Pred&& goes_left) {
+    const int chunks = chunk_count(begin, end);
+    if (chunks == 1) {
+        auto it = std::stable_partition(prims.begin() + begin, prims.begin() + end, goes_left);
+        return static_cast<int>(it - prims.begin());
+    }
+
+    // Count per chunk, prefix-sum the offsets, then scatter into a buffer and copy back
+    std::vector<int> left_count(chunks, 0);
+    for_chunks(begin, end, [&](int lo, int hi, int c) {
+        for (int i = lo; i < hi; i++)
+            left_count[c] += goes_left(prims[i]) ? 1 : 0;
+    });
+
+    std::vector<int> left_offset(chunks), right_offset(chunks);
+    int total_left = 0;
+    for (int c = 0; c < chunks; c++) {
+        left_offset[c] = total_left;
+        total_left += left_count[c];
+    }
+    int right_base = total_left;
+    for (int c = 0; c < chunks; c++) {
+        right_offset[c] = right_base;
+        int lo = begin + c * parallel_grain;
+        right_base += std::min(lo + parallel_grain, end) - lo - left_count[c];
+    }
+
+    std::vector<bvh_build_prim> scratch(end - begin);
+    for_chunks(begin, end, [&](int lo, int hi, int c) {
+        int l = left_offset[c], r = right_offset[c];
+        for (int i = lo; i < hi; i++)
+            scratch[goes_left(prims[i]) ? l++ : r++] = prims[i];
+    });
+    for_chunks(begin, end, [&](int lo, int hi, int) {
+        std::copy(scratch.begin() + (lo - begin), scratch.begin() + (hi - begin), prims.begin() + lo);
+    });
+    return begin + total_left;
+}
+
+// Linear BVH Builder (Morton codes)
+class lbvh_builder : public bvh_build_base {
+public:
+    using bvh_build_base::bvh_build_base;
+
+    int build();
+
+private:
+    std::vector<uint32_t> codes;
+
+    int build_range(int begin, int end, int depth);
+    void radix_sort();
+
+    // Spreads the low 10 bits of v so there are two zero bits between each
+    static uint32_t expand_bits(uint32_t v) {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    }
+
+    // The highest set bit of v (non-zero) on its own; portable where __builtin_clz is not
+    static uint32_t highest_bit(uint32_t v) {
+        v |= v >> 1;
+        v |= v >> 2;
+        v |= v >> 4;
+        v |= v >> 8;
+        v |= v >> 16;
+        return v ^ (v >> 1);
+    }
+};
+
+int lbvh_builder::build() {
+    const int n = static_cast<int>(prims.size());
+
+    std::vector<aabb> partial(chunk_count(0, n));
+    for_chunks(0, n, [&](int lo, int hi, int c) {
+        for (int i = lo; i < hi; i++)
+            partial[c].expand(prims[i].centroid);
+    });
+    aabb centroid_box;
+    for (const auto& b : partial)
+        centroid_box.expand(b);
+
+    // 10 bits per axis on the centroid bounds
+    codes.resize(n);
+    const auto lo = centroid_box.min();
+    const auto extent = centroid_box.max() - lo;
+    for_chunks(0, n, [&](int i0, int i1, int) {
+        for (int i = i0; i < i1; i++) {
+            uint32_t q[3];
+            for (int a = 0; a < 3; a++) {
+                double t = extent[a] > 0 ? (prims[i].centroid[a] - lo[a]) / extent[a] : 0.5;
+                q[a] = static_cast<uint32_t>(clamp(t * 1024.0, 0.0, 1023.0));
+            }
+            codes[i] = (expand_bits(q[0]) << 2) | (expand_bits(q[1]) << 1) | expand_bits(q[2]);
+        }
+    });
+
+    radix_sort();
+    return build_range(0, n, 0);
+}
+
+void lbvh_builder::radix_sort() {
+    const int n = static_cast<int>(prims.size());
+    const int chunks = chunk_count(0, n);
+    const int radix = 256;
+
+    std::vector<uint32_t> codes_tmp(n);
+    std::vector<bvh_build_prim> prims_tmp(n);
+    std::vector<int> histogram(chunks * radix);
+
+    // Four stable 8-bit passes; each chunk scatters to its own precomputed offsets
+    for (int shift = 0; shift < 32; shift += 8) {
+        std::fill(histogram.begin(), histogram.end(), 0);
+        for_chunks(0, n, [&](int lo, int hi, int c) {
+            int* h = &histogram[c * radix];
+            for (int i = lo; i < hi; i++)
+                h[(codes[i] >> shift) & 0xFF]++;
+        });
+
+        int sum = 0;
+        for (int d = 0; d < radix; d++) {
+            for (int c = 0; c < chunks; c++) {
+                int count = histogram[c * radix + d];
+                histogram[c * radix + d] = sum;
+                sum += count;
+            }
+        }
+
+        for_chunks(0, n, [&](int lo, int hi, int c) {
+            int* offset = &histogram[c * radix];
+            for (int i = lo; i < hi; i++) {
+                int dst = offset[(codes[i] >> shift) & 0xFF]++;
+                codes_tmp[dst] = codes[i];
+                prims_tmp[dst] = prims[i];
+            }
+        });
+        codes.swap(codes_tmp);
+        prims.swap(prims_tmp);
+    }
+}
+
+int lbvh_builder::build_range(int begin, int end, int depth) {
+    const int index = allocate_node();
+    const int n = end - begin;
+    const uint32_t first = codes[begin], last = codes[end-1];
+
+    if (n == 1 || (first == last && n <= max_leaf_size))
+        return make_leaf(index, begin, end, range_box(begin, end));
+
+    int mid;
+    if (first == last || depth >= max_depth/2) {
+        mid = begin + n/2;
+    } else {
+        // The first code with the highest differing bit set starts the right half
+        const uint32_t bit = highest_bit(first ^ last);
+        mid = static_cast<int>(std::partition_point(codes.begin() + begin, codes.begin() + end,
+            [&](uint32_t code) { return (code & bit) == 0; }) - codes.begin());
+    }
+
+    auto& node = nodes[index];
+    build_children(n, [&] { node.left = build_range(begin, mid, depth + 1); },
+                      [&] { node.right = build_range(mid, end, depth + 1); });
+
+    node.box = surrounding_box(nodes[node.left].box, nodes[node.right].box);
+    node.axis = node.box.longest_axis();
+    return index;
+}
+
+#endif
@@ -0,0 +1,365 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "renderer.h"
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+// Render Checkpoints and Partial Renders
+//
+// A checkpoint holds what a render needs to carry on: every pixel's sample sums, sums of
+// squares, sample count and generator state, plus the settings that must not change in
+// between. Resuming from one continues each pixel's random sequence where it stopped, so
+// the finished sums are exactly those of an uninterrupted render. Files are written under a
+// temporary name and renamed over the old checkpoint, so the file on disk is always whole.
+//
+// Layout, in host byte order: the magic "PTCKPT02", a byte-order mark, width, height, then
+// the checkpoint_settings fields in declaration order, then the per-pixel arrays.
+//
+// A partial render is the result of rendering one region of an image: the sums, sums of
+// squares and sample counts of the pixels in that region, with the full image size and
+// where the region sits in it. Partials of the same frame are merged by adding them pixel
+// by pixel (tools/merge_partials), which stitches separate regions together and averages
+// overlapping ones by their sample counts. Layout: the magic "PTPART01", a byte-order
+// mark, the full width and height, the region's x0, y0, x1, y1 in framebuffer
+// coordinates, then the region's arrays row by row.
+
+// Everything besides the image size that decides what a pixel's samples add up to
+struct checkpoint_settings {
+    int32_t max_depth = 0;
+    int64_t seed = 0;
+    int32_t sampler = 0;
+    int32_t integrator = 0;
+    int32_t lights = 0;             // light_sampling
+    int32_t spectral = 0;
+    int32_t radiance_cache = 0;
+    int32_t restir = 0;
+
+    checkpoint_settings() = default;
+    explicit checkpoint_settings(const render_settings& s)
+        : max_depth(s.max_depth), seed(s.seed), sampler(static_cast<int32_t>(s.sampler)),
+          integrator(static_cast<int32_t>(s.integrator)), lights(static_cast<int32_t>(s.lights)),
+          spectral(s.spectral), radiance_cache(s.radiance_cache), restir(s.restir) {}
+};
+
+namespace checkpoint_detail {
+
+const char magic[8] = {'P', 'T', 'C', 'K', 'P', 'T', '0', '2'};
+const char partial_magic[8] = {'P', 'T', 'P', 'A', 'R', 'T', '0', '1'};
+const uint32_t byte_order_mark = 0x01020304u;
+
+template <typename T>
+void write_array(std::FILE* f, const std::vector<T>& v) {
+    if (std::fwrite(v.data(), sizeof(T), v.size(), f) != v.size())
+        throw std::runtime_error("write failed");
+}
+
+template <typename T>
+void read_array(std::FILE* f, std::vector<T>& v) {
+    if (std::fread(v.data(), sizeof(T), v.size(), f) != v.size())
+        throw std::runtime_error("truncated checkpoint");
+}
+
+template <typename T>
+void write_value(std::FILE* f, const T& value) {
+    if (std::fwrite(&value, sizeof(T), 1, f) != 1)
+        throw std::runtime_error("write failed");
+}
+
+template <typename T>
+T read_value(std::FILE* f) {
+    T value;
+    if (std::fread(&value, sizeof(T), 1, f) != 1)
+        throw std::runtime_error("truncated checkpoint");
+    return value;
+}
+
+// The first setting that differs between two checkpoints, or nullptr
+inline const char* settings_mismatch(const checkpoint_settings& a, const checkpoint_settings& b) {
+    if (a.max_depth != b.max_depth)
+        return "max_depth";
+    if (a.seed != b.seed)
+        return "seed";
+    if (a.sampler != b.sampler)
+        return "sampler";
+    if (a.integrator != b.integrator)
+        return "integrator";
+    if (a.lights != b.lights)
+        return "light_sampling";
+    if (a.spectral != b.spectral)
+        return "spectral";
+    if (a.radiance_cache != b.radiance_cache)
+        return "radiance_cache";
+    if (a.restir != b.restir)
+        return "restir";
+    return nullptr;
+}
+
+} // namespace checkpoint_detail
+
+inline void write_checkpoint(const std::string& path, const framebuffer& fb, const checkpoint_settings& settings) {
+    using namespace checkpoint_detail;
+    const std::string temp = path + ".tmp";
+    std::FILE* f = std::fopen(temp.c_str(), "wb");
+    if (!f)
+        throw std::runtime_error("cannot write '" + temp + "'");
+    try {
+        if (std::fwrite(magic, 1, sizeof(magic), f) != sizeof(magic))
+            throw std::runtime_error("write failed");
+        write_value(f, byte_order_mark);
+        write_value(f, static_cast<int32_t>(fb.width));
+        write_value(f, static_cast<int32_t>(fb.height));
+        write_value(f, settings.max_depth);
+        write_value(f, settings.seed);
+        write_value(f, settings.sampler);
+        write_value(f, settings.integrator);
+        write_value(f, settings.lights);
+        write_value(f, settings.spectral);
+        write_value(f, settings.radiance_cache);
+        write_value(f, settings.restir);
+        write_array(f, fb.pixels);
+        write_array(f, fb.squares);
+        write_array(f, fb.samples);
+        write_array(f, fb.samplers);
+        if (std::fflush(f) != 0)
+            throw std::runtime_error("write failed");
+#if defined(__unix__) || defined(__APPLE__)
+        // On disk before the rename makes it the checkpoint
+        fsync(fileno(f));
+#endif
+    } catch (const std::exception& e) {
+        std::fclose(f);
+        std::remove(temp.c_str());
+        throw std::runtime_error("'" + temp + "': " + e.what());
+    }
+    std::fclose(f);
+
+#ifdef _WIN32
+    std::remove(path.c_str());      // rename does not replace files on Windows
+#endif
+    if (std::rename(temp.c_str(), path.c_str()) != 0)
+        throw std::runtime_error("cannot rename '" + temp + "' to '" + path + "'");
+}
+
+// Loads a checkpoint into `fb`, which must have its size; throws if it was made with
+// different settings
+inline void read_checkpoint(const std::string& path, framebuffer& fb, const checkpoint_settings& settings) {
+    using namespace checkpoint_detail;
+    std::FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f)
+        throw std::runtime_error("cannot open '" + path + "'");
+    try {
+        char header[sizeof(magic)];
+        if (std::fread(header, 1, sizeof(header), f) != sizeof(header) || std::memcmp(header, magic, sizeof(magic)) != 0)
+            throw std::runtime_error("not a render checkpoint");
+        if (read_value<uint32_t>(f) != byte_order_mark)
+            throw std::runtime_error("written on a machine with a different byte order");
+        const auto width = read_value<int32_t>(f);
+        const auto height = read_value<int32_t>(f);
+        checkpoint_settings saved;
+        saved.max_depth = read_value<int32_t>(f);
+        saved.seed = read_value<int64_t>(f);
+        saved.sampler = read_value<int32_t>(f);
+        saved.integrator = read_value<int32_t>(f);
+        saved.lights = read_value<int32_t>(f);
+        saved.spectral = read_value<int32_t>(f);
+        saved.radiance_cache = read_value<int32_t>(f);
+        saved.restir = read_value<int32_t>(f);
+        if (width != fb.width || height != fb.height)
+            throw std::runtime_error("made for a " + std::to_string(width) + "x" + std::to_string(height) + " image");
+        if (const char* name = settings_mismatch(saved, settings))
+            throw std::runtime_error("made with a different " + std::string(name));
+        read_array(f, fb.pixels);
+        read_array(f, fb.squares);
+        read_array(f, fb.samples);
+        read_array(f, fb.samplers);
+    } catch (const std::exception& e) {
+        std::fclose(f);
+        throw std::runtime_error("'" + path + "': " + e.what());
+    }
+    std::fclose(f);
+}
+
+struct partial_render {
+    int full_width = 0;
+    int full_height = 0;
+    pixel_rect region;
+    std::vector<color> pixels;      // region.width() * region.height(), rows from y0 up
+    std::vector<color> squares;
+    std::vector<uint32_t> samples;
+};
+
+inline void write_partial(const std::string& path, const framebuffer& fb, const pixel_rect& region) {
+    using namespace checkpoint_detail;
+    partial_render part;
+    for (int j = region.y0; j < region.y1; j++) {
+        const size_t row = static_cast<size_t>(j) * fb.width;
+        part.pixels.insert(part.pixels.end(), fb.pixels.begin() + row + region.x0, fb.pixels.begin() + row + region.x1);
+        part.squares.insert(part.squares.end(), fb.squares.begin() + row + region.x0, fb.squares.begin() + row + region.x1);
+        part.samples.insert(part.samples.end(), fb.samples.begin() + row + region.x0, fb.samples.begin() + row + region.x1);
+    }
+
+    std::FILE* f = std::fopen(path.c_str(), "wb");
+    if (!f)
+        throw std::runtime_error("cannot write '" + path + "'");
+    try {
+        if (std::fwrite(partial_magic, 1, sizeof(partial_magic), f) != sizeof(partial_magic))
+            throw std::runtime_error("write failed");
+        write_value(f, byte_order_mark);
+        const int32_t header[6] = {fb.width, fb.height, region.x0, region.y0, region.x1, region.y1};
+        for (int32_t v : header)
+            write_value(f, v);
+        write_array(f, part.pixels);
+        write_array(f, part.squares);
+        write_array(f, part.samples);
+        if (std::fflush(f) != 0)
+            throw std::runtime_error("write failed");
+    } catch (const std::exception& e) {
+        std::fclose(f);
+        throw std::runtime_error("'" + path + "': " + e.what());
+    }
+    std::fclose(f);
+}
+
+inline partial_render read_partial(const std::string& path) {
+    using namespace checkpoint_detail;
+    std::FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f)
+        throw std::runtime_error("cannot open '" + path + "'");
+    partial_render part;
+    try {
+        char header[sizeof(partial_magic)];
+        if (std::fread(header, 1, sizeof(header), f) != sizeof(header)
+            || std::memcmp(header, partial_magic, sizeof(partial_magic)) != 0)
+            throw std::runtime_error("not a partial render");
+        if (read_value<uint32_t>(f) != byte_order_mark)
+            throw std::runtime_error("written on a machine with a different byte order");
+        part.full_width = read_value<int32_t>(f);
+        part.full_height = read_value<int32_t>(f);
+        part.region.x0 = read_value<int32_t>(f);
+        part.region.y0 = read_value<int32_t>(f);
+        part.region.x1 = read_value<int32_t>(f);
+        part.region.y1 = read_value<int32_t>(f);
+        const auto& r = part.region;
+        if (part.full_width <= 0 || part.full_height <= 0 || r.empty() || r.x0 < 0 || r.y0 < 0
+            || r.x1 > part.full_width || r.y1 > part.full_height)
+            throw std::runtime_error("bad region");
+        const size_t n = static_cast<size_t>(r.width()) * r.height();
+        part.pixels.resize(n);
+        part.squares.resize(n);
+        part.samples.resize(n);
+        read_array(f, part.pixels);
+        read_array(f, part.squares);
+        read_array(f, part.samples);
+    } catch (const std::exception& e) {
+        std::fclose(f);
+        throw std::runtime_error("'" + path + "': " + e.what());
+    }
+    std::fclose(f);
+    return part;
+}
+
+// Adds a partial render's sums and sample counts into `fb`, which has the full image size
+inline void merge_partial(framebuffer& fb, const partial_render& part) {
+    if (part.full_width != fb.width || part.full_height != fb.height)
+        throw std::runtime_error("partial is for a " + std::to_string(part.full_width) + "x"
+                                 + std::to_string(part.full_height) + " image");
+    const auto& r = part.region;
+    size_t n = 0;
+    for (int j = r.y0; j < r.y1; j++) {
+        for (int i = r.x0; i < r.x1; i++, n++) {
+            const size_t k = static_cast<size_t>(j) * fb.width + i;
+            fb.pixels[k] += part.pixels[n];
+            fb.squares[k] += part.squares[n];
+            fb.samples[k] += part.samples[n];
+        }
+    }
+}
+
+// Writes checkpoints on a thread of its own, so rendering never waits on the disk. submit()
+// copies the framebuffer and returns; when a write is still running, the copy replaces any
+// snapshot still waiting rather than queueing behind it.
+class checkpoint_writer {
+public:
+    checkpoint_writer(const std::string& path, const checkpoint_settings& settings)
+        : path(path), settings(settings), worker([this] { run(); }) {}
+
+    ~checkpoint_writer() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    checkpoint_writer(const checkpoint_writer&) = delete;
+    checkpoint_writer& operator=(const checkpoint_writer&) = delete;
+
+    void submit(const framebuffer& fb) {
+        auto snapshot = std::make_unique<framebuffer>(fb);
+        snapshot->cost.clear();
+        snapshot->albedo.clear();
+        snapshot->normal.clear();
+        snapshot->distance.clear();
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            pending = std::move(snapshot);
+        }
+        wake.notify_one();
+    }
+
+    // Blocks until every submitted snapshot is on disk
+    void flush() {
+        std::unique_lock<std::mutex> guard(lock);
+        idle.wait(guard, [this] { return !pending && !writing; });
+    }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> guard(lock);
+        while (true) {
+            wake.wait(guard, [this] { return stopping || pending; });
+            if (!pending)
+                return;
+            auto fb = std::move(pending);
+            writing = true;
+            guard.unlock();
+            try {
+                trace_scope trace("write checkpoint", "output");
+                write_checkpoint(path, *fb, settings);
+            } catch (const std::exception& e) {
+                // A failed checkpoint must not end the render it is protecting
+                std::clog << "\nWarning: checkpoint failed: " << e.what() << '\n';
+            }
+            guard.lock();
+            writing = false;
+            idle.notify_all();
+        }
+    }
+
+    std::string path;
+    checkpoint_settings settings;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::unique_ptr<framebuffer> pending;
+    bool writing = false;
+    bool stopping = false;
+    std::thread worker;     // last, so it starts after everything it uses
+};
+
+#endif
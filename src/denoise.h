@@ -0,0 +1,213 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include "renderer.h"
+#include "pfm.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+// Edge-Aware Denoising
+//
+// An à-trous wavelet filter guided by the first-hit features, after "Edge-Avoiding À-Trous
+// Wavelet Transform for fast Global Illumination Filtering" (Dammertz et al. 2010) with the
+// variance-driven luminance weight of SVGF (Schied et al. 2017). Each iteration blurs with a
+// 5x5 B3-spline kernel whose taps are `step` pixels apart, doubling the step every time, so
+// five iterations cover a 61-pixel footprint at 25 taps a pixel. Every tap is weighted down
+// by how far its normal, depth and luminance are from the centre pixel's, so edges and
+// contact shadows survive while flat regions are smoothed.
+//
+// Texture is taken out first: the colour is divided by the first-hit albedo, filtered as
+// irradiance and multiplied back, so the filter does not blur surface detail. The luminance
+// weight scales with the standard deviation of each pixel's mean, which is filtered along
+// with the colour; noisy pixels borrow widely and converged ones keep to themselves.
+//
+// The image is held as separate float planes and filtered one row at a time across the
+// pool, so the inner loops run over contiguous floats.
+
+struct denoise_settings {
+    int iterations = 5;
+    float sigma_normal = 128;       // exponent on the normals' cosine
+    float sigma_depth = 1;          // in units of the local depth gradient
+    float sigma_luminance = 4;      // in standard deviations of the pixel's mean
+};
+
+namespace denoise_detail {
+
+inline float luminance(float r, float g, float b) {
+    return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+}
+
+// One image as planes; irradiance and its luminance variance ping-pong between iterations
+struct planes {
+    explicit planes(size_t n) : r(n), g(n), b(n), var(n) {}
+    std::vector<float> r, g, b, var;
+};
+
+} // namespace denoise_detail
+
+// Returns the filtered mean image of `fb`, which must have tracked features
+inline float_image denoise(const framebuffer& fb, thread_pool& pool, const denoise_settings& s = denoise_settings()) {
+    using namespace denoise_detail;
+    trace_scope trace("denoise", "output");
+    const int w = fb.width, h = fb.height;
+    const size_t n = static_cast<size_t>(w) * h;
+
+    const auto mean = fb.mean();
+    const auto variance = fb.variance();
+    const auto albedo_img = fb.albedo_image();
+    const auto normal_img = fb.normal_image();
+    const auto distance_img = fb.distance_image();
+
+    // Demodulated irradiance and guides; albedo near black is left alone rather than divided by
+    std::vector<float> albedo(n * 3), nx(n), ny(n), nz(n), depth(n), gradient(n);
+    planes cur(n), next(n);
+    for (size_t k = 0; k < n; k++) {
+        float var[3];
+        for (int c = 0; c < 3; c++) {
+            const float a = albedo_img.pixels[k * 3 + c];
+            albedo[k * 3 + c] = a < 0.01f ? 1.0f : a;
+            var[c] = variance.pixels[k * 3 + c] / (albedo[k * 3 + c] * albedo[k * 3 + c]);
+        }
+        cur.r[k] = mean.pixels[k * 3] / albedo[k * 3];
+        cur.g[k] = mean.pixels[k * 3 + 1] / albedo[k * 3 + 1];
+        cur.b[k] = mean.pixels[k * 3 + 2] / albedo[k * 3 + 2];
+        cur.var[k] = luminance(var[0], var[1], var[2]);
+        nx[k] = normal_img.pixels[k * 3];
+        ny[k] = normal_img.pixels[k * 3 + 1];
+        nz[k] = normal_img.pixels[k * 3 + 2];
+        depth[k] = distance_img.pixels[k * 3];
+    }
+    // Largest central difference of depth, so slanted surfaces are not cut at every tap
+    for (int j = 0; j < h; j++) {
+        for (int i = 0; i < w; i++) {
+            const size_t k = static_cast<size_t>(j) * w + i;
+            const float dx = depth[j * static_cast<size_t>(w) + std::min(i + 1, w - 1)]
+                           - depth[j * static_cast<size_t>(w) + std::max(i - 1, 0)];
+            const float dy = depth[std::min(j + 1, h - 1) * static_cast<size_t>(w) + i]
+                           - depth[std::max(j - 1, 0) * static_cast<size_t>(w) + i];
+            gradient[k] = 0.5f * std::max(std::abs(dx), std::abs(dy));
+        }
+    }
+
+    // A pixel's own variance is unreliable at a few samples, and zero where none of them found
+    // light; the luminance spread over its 7x7 neighbourhood on the same surface (normal and
+    // albedo, which keeps lights apart from what surrounds them) sets a floor
+    {
+        std::vector<float> spatial(n);
+        parallel_for(pool, 0, h, 4, [&](int lo, int hi) {
+            for (int j = lo; j < hi; j++) {
+                for (int i = 0; i < w; i++) {
+                    const size_t p = static_cast<size_t>(j) * w + i;
+                    float sum = 0, sum_sq = 0;
+                    int count = 0;
+                    for (int y = std::max(j - 3, 0); y <= std::min(j + 3, h - 1); y++) {
+                        for (int x = std::max(i - 3, 0); x <= std::min(i + 3, w - 1); x++) {
+                            const size_t q = static_cast<size_t>(y) * w + x;
+                            if (nx[p] * nx[q] + ny[p] * ny[q] + nz[p] * nz[q] < 0.9f
+                                || std::abs(albedo[p * 3] - albedo[q * 3]) + std::abs(albedo[p * 3 + 1] - albedo[q * 3 + 1])
+                                   + std::abs(albedo[p * 3 + 2] - albedo[q * 3 + 2]) > 0.05f)
+                                continue;
+                            const float l = luminance(cur.r[q], cur.g[q], cur.b[q]);
+                            sum += l;
+                            sum_sq += l * l;
+                            count++;
+                        }
+                    }
+                    if (count > 1) {
+                        const float m = sum / count;
+                        spatial[p] = std::max(sum_sq / count - m * m, 0.0f);
+                    }
+                }
+            }
+        });
+        for (size_t k = 0; k < n; k++)
+            cur.var[k] = std::max(cur.var[k], spatial[k]);
+    }
+
+    static const float kernel[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16};
+    std::vector<float> blurred_var(n);
+    for (int it = 0, step = 1; it < s.iterations; it++, step *= 2) {
+        // The luminance weight uses a 3x3 blur of the variance, since a pixel whose few samples
+        // happened to agree would otherwise refuse every neighbour
+        parallel_for(pool, 0, h, 4, [&](int lo, int hi) {
+            static const float blur[3] = {0.25f, 0.5f, 0.25f};
+            for (int j = lo; j < hi; j++) {
+                for (int i = 0; i < w; i++) {
+                    float sum = 0, sum_w = 0;
+                    for (int dy = -1; dy <= 1; dy++) {
+                        for (int dx = -1; dx <= 1; dx++) {
+                            const int x = i + dx, y = j + dy;
+                            if (x < 0 || x >= w || y < 0 || y >= h)
+                                continue;
+                            sum += blur[dx + 1] * blur[dy + 1] * cur.var[static_cast<size_t>(y) * w + x];
+                            sum_w += blur[dx + 1] * blur[dy + 1];
+                        }
+                    }
+                    blurred_var[static_cast<size_t>(j) * w + i] = sum / sum_w;
+                }
+            }
+        });
+
+        parallel_for(pool, 0, h, 4, [&](int lo, int hi) {
+            for (int j = lo; j < hi; j++) {
+                for (int i = 0; i < w; i++) {
+                    const size_t p = static_cast<size_t>(j) * w + i;
+                    const float lp = luminance(cur.r[p], cur.g[p], cur.b[p]);
+                    const float lum_scale = s.sigma_luminance * std::sqrt(std::max(blurred_var[p], 0.0f)) + 1e-6f;
+                    const float depth_scale = s.sigma_depth * gradient[p] * step + 1e-3f;
+                    const bool p_hit = nx[p] != 0 || ny[p] != 0 || nz[p] != 0;
+
+                    float sum_w = 0, sum_r = 0, sum_g = 0, sum_b = 0, sum_var = 0;
+                    for (int dy = -2; dy <= 2; dy++) {
+                        const int y = j + dy * step;
+                        if (y < 0 || y >= h)
+                            continue;
+                        for (int dx = -2; dx <= 2; dx++) {
+                            const int x = i + dx * step;
+                            if (x < 0 || x >= w)
+                                continue;
+                            const size_t q = static_cast<size_t>(y) * w + x;
+                            float weight = kernel[dx + 2] * kernel[dy + 2];
+                            if (q != p) {
+                                // Hits only mix with hits and misses with misses
+                                const float cos_n = nx[p] * nx[q] + ny[p] * ny[q] + nz[p] * nz[q];
+                                const bool q_hit = nx[q] != 0 || ny[q] != 0 || nz[q] != 0;
+                                const float w_normal = p_hit != q_hit ? 0.0f
+                                                     : p_hit ? std::pow(std::max(cos_n, 0.0f), s.sigma_normal) : 1.0f;
+                                const float dist = static_cast<float>(std::max(std::abs(dx), std::abs(dy)));
+                                const float lq = luminance(cur.r[q], cur.g[q], cur.b[q]);
+                                weight *= w_normal * std::exp(-std::abs(depth[p] - depth[q]) / (depth_scale * dist)
+                                                              - std::abs(lp - lq) / lum_scale);
+                            }
+                            sum_w += weight;
+                            sum_r += weight * cur.r[q];
+                            sum_g += weight * cur.g[q];
+                            sum_b += weight * cur.b[q];
+                            sum_var += weight * weight * cur.var[q];
+                        }
+                    }
+                    // The centre tap always counts, so sum_w > 0
+                    next.r[p] = sum_r / sum_w;
+                    next.g[p] = sum_g / sum_w;
+                    next.b[p] = sum_b / sum_w;
+                    next.var[p] = sum_var / (sum_w * sum_w);
+                }
+            }
+        });
+        std::swap(cur, next);
+    }
+
+    float_image out(w, h);
+    for (size_t k = 0; k < n; k++) {
+        out.pixels[k * 3] = cur.r[k] * albedo[k * 3];
+        out.pixels[k * 3 + 1] = cur.g[k] * albedo[k * 3 + 1];
+        out.pixels[k * 3 + 2] = cur.b[k] * albedo[k * 3 + 2];
+    }
+    return out;
+}
+
+#endif
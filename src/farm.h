@@ -0,0 +1,668 @@
+#ifndef FARM_H
+#define FARM_H
+
+#include "rtweekend.h"
+#include "scene.h"
+#include "renderer.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define PT_FARM 1
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0      // macOS; SIGPIPE is ignored below instead
+#endif
+#endif
+
+// Render Farm
+//
+// A coordinator splits the frame into jobs, square pixel regions of `job_size`, and deals
+// them out to worker processes over stream sockets: TCP ("host:port") or Unix ("unix:path").
+// Each worker loads the same scene file itself, renders a job with the usual renderer
+// restricted to the job's region, and sends back the region's sums, sums of squares and
+// sample counts, which the coordinator adds into its framebuffer. A pixel samples the same
+// way whoever renders it, so the image matches a single-process render exactly. When a
+// worker disconnects in the middle of a job (a crash or kill), answers out of turn or sits
+// on a job longer than `job_timeout`, it is dropped and the job goes back into the queue
+// for the others. The coordinator never blocks on one connection: it keeps what has arrived
+// of each message until the rest does, so a worker that stalls halfway through a result
+// holds up only its own job, until the timeout takes it back.
+//
+// Messages are a 4-byte type and a 4-byte payload size followed by the payload, all in host
+// byte order; the hello message carries a byte-order mark so mismatched machines are
+// turned away. A payload larger than the receiver expects counts as a lost peer. POSIX only.
+
+#ifdef PT_FARM
+
+namespace farm_detail {
+
+enum message_type : uint32_t { hello = 1, job = 2, result = 3, bye = 4 };
+
+const uint32_t byte_order_mark = 0x01020304u;
+
+// Jobs and goodbyes the coordinator sends are a few words
+const size_t max_job_payload = 64;
+
+// A result carries the job id, three ray counts, the render time, then a color sum, a color
+// sum of squares and a sample count per pixel
+inline size_t result_payload_size(size_t pixels) {
+    return sizeof(int32_t) + 3 * sizeof(uint64_t) + sizeof(double)
+         + pixels * (2 * sizeof(color) + sizeof(uint32_t));
+}
+
+// Grows a byte buffer one value at a time, and reads it back in the same order
+struct message {
+    uint32_t type = 0;
+    std::vector<char> payload;
+    size_t read_pos = 0;
+
+    template <typename T>
+    void put(const T& value) {
+        const char* p = reinterpret_cast<const char*>(&value);
+        payload.insert(payload.end(), p, p + sizeof(T));
+    }
+
+    template <typename T>
+    void put_array(const std::vector<T>& v) {
+        const char* p = reinterpret_cast<const char*>(v.data());
+        payload.insert(payload.end(), p, p + v.size() * sizeof(T));
+    }
+
+    template <typename T>
+    T get() {
+        T value;
+        if (read_pos + sizeof(T) > payload.size())
+            throw std::runtime_error("short farm message");
+        std::memcpy(&value, payload.data() + read_pos, sizeof(T));
+        read_pos += sizeof(T);
+        return value;
+    }
+
+    template <typename T>
+    void get_array(std::vector<T>& v, size_t count) {
+        if (read_pos + count * sizeof(T) > payload.size())
+            throw std::runtime_error("short farm message");
+        v.resize(count);
+        std::memcpy(v.data(), payload.data() + read_pos, count * sizeof(T));
+        read_pos += count * sizeof(T);
+    }
+};
+
+inline bool send_all(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        const ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+inline bool recv_all(int fd, void* data, size_t size) {
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        const ssize_t n = ::recv(fd, p, size, 0);
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+inline bool send_message(int fd, const message& m) {
+    const uint32_t header[2] = {m.type, static_cast<uint32_t>(m.payload.size())};
+    return send_all(fd, header, sizeof(header)) && send_all(fd, m.payload.data(), m.payload.size());
+}
+
+// False when the peer went away or announced more than `max_payload` bytes
+inline bool recv_message(int fd, message& m, size_t max_payload) {
+    uint32_t header[2];
+    if (!recv_all(fd, header, sizeof(header)) || header[1] > max_payload)
+        return false;
+    m.type = header[0];
+    m.payload.resize(header[1]);
+    m.read_pos = 0;
+    return recv_all(fd, m.payload.data(), m.payload.size());
+}
+
+// Appends whatever has arrived on `fd` to `inbox` without waiting for the rest of a message,
+// so a peer that stalls halfway holds up nobody else. False when the peer went away.
+inline bool recv_available(int fd, std::vector<char>& inbox) {
+    const size_t chunk = 1 << 16;
+    const size_t used = inbox.size();
+    inbox.resize(used + chunk);
+    const ssize_t n = ::recv(fd, inbox.data() + used, chunk, MSG_DONTWAIT);
+    inbox.resize(used + static_cast<size_t>(std::max<ssize_t>(n, 0)));
+    if (n < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    return n > 0;
+}
+
+enum class inbox_state { waiting, ready, oversized };
+
+// Moves the first message in `inbox` into `m` once all of it has arrived
+inline inbox_state take_message(std::vector<char>& inbox, message& m, size_t max_payload) {
+    uint32_t header[2];
+    if (inbox.size() < sizeof(header))
+        return inbox_state::waiting;
+    std::memcpy(header, inbox.data(), sizeof(header));
+    if (header[1] > max_payload)
+        return inbox_state::oversized;
+    const size_t size = sizeof(header) + header[1];
+    if (inbox.size() < size)
+        return inbox_state::waiting;
+    m.type = header[0];
+    m.payload.assign(inbox.begin() + sizeof(header), inbox.begin() + size);
+    m.read_pos = 0;
+    inbox.erase(inbox.begin(), inbox.begin() + size);
+    return inbox_state::ready;
+}
+
+// "unix:path" or "host:port"
+struct socket_address {
+    bool is_unix = false;
+    std::string path;   // unix
+    std::string host;   // tcp
+    std::string port;
+};
+
+inline socket_address parse_address(const std::string& text) {
+    socket_address a;
+    if (text.compare(0, 5, "unix:") == 0) {
+        a.is_unix = true;
+        a.path = text.substr(5);
+        if (a.path.empty() || a.path.size() >= sizeof(sockaddr_un::sun_path))
+            throw std::runtime_error("bad Unix socket path in '" + text + "'");
+        return a;
+    }
+    const auto colon = text.rfind(':');
+    if (colon == std::string::npos || colon + 1 == text.size())
+        throw std::runtime_error("expected unix:path or host:port, got '" + text + "'");
+    a.host = colon == 0 ? "0.0.0.0" : text.substr(0, colon);
+    a.port = text.substr(colon + 1);
+    return a;
+}
+
+inline int open_socket(const std::string& text, bool listening) {
+    const auto a = parse_address(text);
+    if (a.is_unix) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, a.path.c_str(), sizeof(addr.sun_path) - 1);
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            throw std::runtime_error("cannot create a socket");
+        if (listening)
+            ::unlink(a.path.c_str());
+        const auto* sa = reinterpret_cast<const sockaddr*>(&addr);
+        const bool ok = listening ? ::bind(fd, sa, sizeof(addr)) == 0 && ::listen(fd, 64) == 0
+                                  : ::connect(fd, sa, sizeof(addr)) == 0;
+        if (!ok) {
+            ::close(fd);
+            throw std::runtime_error("cannot " + std::string(listening ? "listen on" : "connect to") + " '" + text + "'");
+        }
+        return fd;
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    addrinfo* found = nullptr;
+    if (::getaddrinfo(a.host.c_str(), a.port.c_str(), &hints, &found) != 0)
+        throw std::runtime_error("cannot resolve '" + text + "'");
+    int fd = -1;
+    for (addrinfo* ai = found; ai && fd < 0; ai = ai->ai_next) {
+        fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        const int one = 1;
+        bool ok;
+        if (listening) {
+            ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            ok = ::bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && ::listen(fd, 64) == 0;
+        } else {
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            ok = ::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0;
+        }
+        if (!ok) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    ::freeaddrinfo(found);
+    if (fd < 0)
+        throw std::runtime_error("cannot " + std::string(listening ? "listen on" : "connect to") + " '" + text + "'");
+    return fd;
+}
+
+inline message hello_message(const scene& scn) {
+    message m;
+    m.type = hello;
+    m.put(byte_order_mark);
+    m.put(static_cast<int32_t>(scn.settings.image_width));
+    m.put(static_cast<int32_t>(scn.settings.image_height));
+    m.put(static_cast<int32_t>(scn.settings.samples_per_pixel));
+    m.put(static_cast<int32_t>(scn.settings.max_depth));
+    m.put(static_cast<int64_t>(scn.settings.seed));
+    m.put(static_cast<int32_t>(scn.settings.lights));
+    m.put(static_cast<int32_t>(scn.settings.integrator));
+    m.put(static_cast<int32_t>(scn.settings.sampler));
+    m.put(static_cast<int32_t>(scn.settings.spectral));
+    // The acceleration structure decides ties between equally near hits, so it must match too
+    m.put(static_cast<int32_t>(scn.settings.accel));
+    m.put(static_cast<int32_t>(scn.settings.builder));
+    m.put(static_cast<int32_t>(scn.settings.radiance_cache));
+    m.put(scn.settings.cache_cell);
+    m.put(static_cast<int32_t>(scn.settings.cache_bounce));
+    m.put(static_cast<int32_t>(scn.settings.cache_policy));
+    m.put(scn.settings.cache_training);
+    return m;
+}
+
+} // namespace farm_detail
+
+// Per-worker figures from a farm render
+struct farm_worker_stats {
+    int jobs = 0;
+    int lost_jobs = 0;          // taken back after the worker disconnected mid-job
+    double busy_seconds = 0;    // render time the worker reported
+    uint64_t rays = 0;
+    bool connected = true;
+};
+
+class farm_coordinator {
+public:
+    static const int job_size = 64;
+
+    farm_coordinator(const scene& s, const std::string& address) : scn(s), address(address) {}
+    ~farm_coordinator();
+
+    farm_coordinator(const farm_coordinator&) = delete;
+    farm_coordinator& operator=(const farm_coordinator&) = delete;
+
+    // Starts listening; workers may connect from then on
+    void listen();
+
+    // Starts `count` local workers running `program --worker address --threads threads
+    // [options] scene`
+    void spawn_workers(const std::string& program, const std::string& scene_path, int count, int threads,
+                       const std::vector<std::string>& options = {});
+
+    // Deals out every job of `region` (the whole image when empty) and adds the results into
+    // `fb`. Throws when the work cannot finish: every local worker is gone and none remain.
+    render_stats render(framebuffer& fb, pixel_rect region);
+
+public:
+    bool show_progress = true;
+    double job_timeout = 600;                   // seconds before a silent worker's job is taken back
+    std::vector<farm_worker_stats> workers;     // in connection order
+
+private:
+    struct connection {
+        int fd = -1;
+        int worker = 0;     // index into `workers`
+        int job = -1;       // job in progress, or -1
+        bool greeted = false;
+        std::chrono::steady_clock::time_point job_start{};
+        std::vector<char> inbox;    // bytes of messages not yet complete
+    };
+
+    void assign(connection& c, std::deque<int>& queue, const std::vector<pixel_rect>& jobs);
+    void drop(connection& c, std::deque<int>& queue);
+    bool local_workers_alive();
+
+    const scene& scn;
+    std::string address;
+    int listen_fd = -1;
+    std::vector<pid_t> children;
+    std::vector<connection> connections;
+};
+
+farm_coordinator::~farm_coordinator() {
+    for (auto& c : connections)
+        ::close(c.fd);
+    if (listen_fd >= 0)
+        ::close(listen_fd);
+    for (pid_t pid : children) {
+        ::kill(pid, SIGTERM);
+        ::waitpid(pid, nullptr, 0);
+    }
+    const auto a = farm_detail::parse_address(address);
+    if (a.is_unix)
+        ::unlink(a.path.c_str());
+}
+
+void farm_coordinator::listen() {
+    ::signal(SIGPIPE, SIG_IGN);     // a worker dying mid-send must not take the coordinator along
+    listen_fd = farm_detail::open_socket(address, true);
+}
+
+void farm_coordinator::spawn_workers(const std::string& program, const std::string& scene_path, int count, int threads,
+                                     const std::vector<std::string>& options) {
+    const std::string thread_arg = std::to_string(threads);
+    std::vector<const char*> args = {program.c_str(), "--worker", address.c_str(), "--threads", thread_arg.c_str()};
+    for (const auto& option : options)
+        args.push_back(option.c_str());
+    args.push_back(scene_path.c_str());
+    args.push_back(nullptr);
+    for (int w = 0; w < count; w++) {
+        std::fflush(nullptr);
+        const pid_t pid = ::fork();
+        if (pid < 0)
+            throw std::runtime_error("fork failed");
+        if (pid == 0) {
+            ::execv(program.c_str(), const_cast<char* const*>(args.data()));
+            std::perror("exec");
+            ::_exit(127);
+        }
+        children.push_back(pid);
+    }
+}
+
+bool farm_coordinator::local_workers_alive() {
+    for (auto it = children.begin(); it != children.end();) {
+        if (::waitpid(*it, nullptr, WNOHANG) == *it)
+            it = children.erase(it);
+        else
+            ++it;
+    }
+    return !children.empty();
+}
+
+void farm_coordinator::assign(connection& c, std::deque<int>& queue, const std::vector<pixel_rect>& jobs) {
+    using namespace farm_detail;
+    message m;
+    if (queue.empty()) {
+        c.job = -1;
+        return;
+    }
+    c.job = queue.front();
+    queue.pop_front();
+    const auto& r = jobs[c.job];
+    m.type = job;
+    m.put(static_cast<int32_t>(c.job));
+    for (int32_t v : {r.x0, r.y0, r.x1, r.y1})
+        m.put(v);
+    c.job_start = std::chrono::steady_clock::now();
+    if (!send_message(c.fd, m))
+        drop(c, queue);
+}
+
+void farm_coordinator::drop(connection& c, std::deque<int>& queue) {
+    if (c.job >= 0) {
+        queue.push_front(c.job);
+        workers[c.worker].lost_jobs++;
+        trace_instant("job lost", "farm", c.job);
+    }
+    c.job = -1;
+    workers[c.worker].connected = false;
+    ::close(c.fd);
+    c.fd = -1;
+}
+
+render_stats farm_coordinator::render(framebuffer& fb, pixel_rect region) {
+    using namespace farm_detail;
+    using clock = std::chrono::steady_clock;
+    const auto start = clock::now();
+    trace_scope trace("farm render", "farm");
+
+    if (region.empty())
+        region = pixel_rect{0, 0, fb.width, fb.height};
+
+    // Jobs top rows first, like the tiles of a local render
+    std::vector<pixel_rect> jobs;
+    for (int y1 = region.y1; y1 > region.y0; y1 -= job_size) {
+        for (int x0 = region.x0; x0 < region.x1; x0 += job_size)
+            jobs.push_back(pixel_rect{x0, std::max(region.y0, y1 - job_size), std::min(x0 + job_size, region.x1), y1});
+    }
+    std::deque<int> queue;
+    for (int j = 0; j < static_cast<int>(jobs.size()); j++)
+        queue.push_back(j);
+    std::vector<bool> finished(jobs.size());
+    size_t remaining = jobs.size();
+
+    const message expected_hello = hello_message(scn);
+    const size_t max_payload = std::max(result_payload_size(static_cast<size_t>(job_size) * job_size),
+                                        expected_hello.payload.size());
+    render_stats stats;
+
+    while (remaining > 0) {
+        std::vector<pollfd> fds;
+        fds.push_back({listen_fd, POLLIN, 0});
+        for (const auto& c : connections)
+            fds.push_back({c.fd, POLLIN, 0});
+        const int ready = ::poll(fds.data(), fds.size(), 200);
+        if (ready < 0 && errno != EINTR)
+            throw std::runtime_error("poll failed");
+
+        if (ready > 0 && (fds[0].revents & POLLIN)) {
+            const int fd = ::accept(listen_fd, nullptr, nullptr);
+            if (fd >= 0) {
+                connections.push_back({fd, static_cast<int>(workers.size())});
+                workers.emplace_back();
+            }
+        }
+
+        for (size_t n = 1; ready > 0 && n < fds.size(); n++) {
+            if (!(fds[n].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            auto& c = connections[n - 1];
+            if (!recv_available(c.fd, c.inbox)) {
+                drop(c, queue);
+                continue;
+            }
+
+            // Every message that is complete by now; the rest waits for the next poll
+            message m;
+            while (c.fd >= 0) {
+                const auto state = take_message(c.inbox, m, max_payload);
+                if (state == inbox_state::waiting)
+                    break;
+                if (state == inbox_state::oversized) {
+                    drop(c, queue);
+                    continue;
+                }
+
+                if (m.type == hello && !c.greeted) {
+                    if (m.payload != expected_hello.payload) {
+                        std::clog << "\rFarm: turned away a worker with different scene settings\n";
+                        message reply;
+                        reply.type = bye;
+                        send_message(c.fd, reply);
+                        drop(c, queue);
+                        continue;
+                    }
+                    c.greeted = true;
+                    assign(c, queue, jobs);
+                } else if (m.type == result && c.greeted && c.job >= 0) {
+                    // An answer to another job or of the wrong size is a protocol error too
+                    const auto& r = jobs[c.job];
+                    const size_t count = static_cast<size_t>(r.width()) * r.height();
+                    if (m.payload.size() != result_payload_size(count) || m.get<int32_t>() != c.job) {
+                        drop(c, queue);
+                        continue;
+                    }
+                    const int id = c.job;
+                    const auto primary = m.get<uint64_t>();
+                    const auto secondary = m.get<uint64_t>();
+                    const auto shadow = m.get<uint64_t>();
+                    const auto seconds = m.get<double>();
+                    std::vector<color> pixels, squares;
+                    std::vector<uint32_t> samples;
+                    m.get_array(pixels, count);
+                    m.get_array(squares, count);
+                    m.get_array(samples, count);
+
+                    size_t k = 0;
+                    for (int j = r.y0; j < r.y1; j++) {
+                        for (int i = r.x0; i < r.x1; i++, k++) {
+                            const size_t p = static_cast<size_t>(j) * fb.width + i;
+                            fb.pixels[p] = pixels[k];
+                            fb.squares[p] = squares[k];
+                            fb.samples[p] = samples[k];
+                        }
+                    }
+                    finished[id] = true;
+                    remaining--;
+                    stats.primary_rays += primary;
+                    stats.secondary_rays += secondary;
+                    stats.shadow_rays += shadow;
+                    auto& w = workers[c.worker];
+                    w.jobs++;
+                    w.busy_seconds += seconds;
+                    w.rays += primary + secondary;
+                    if (show_progress)
+                        std::clog << "\rJobs remaining: " << remaining << ' ' << std::flush;
+                    assign(c, queue, jobs);
+                } else {
+                    drop(c, queue);     // protocol error
+                }
+            }
+        }
+        // A worker that hangs without disconnecting would otherwise hold its job forever
+        const auto now = clock::now();
+        for (auto& c : connections) {
+            if (c.fd >= 0 && c.job >= 0
+                && std::chrono::duration<double>(now - c.job_start).count() > job_timeout) {
+                std::clog << "\rFarm: worker " << c.worker + 1 << " timed out on job " << c.job << '\n';
+                drop(c, queue);
+            }
+        }
+        connections.erase(std::remove_if(connections.begin(), connections.end(),
+                                         [](const connection& c) { return c.fd < 0; }),
+                          connections.end());
+
+        // Jobs put back by a lost worker go to whoever is idle
+        for (auto& c : connections) {
+            if (c.greeted && c.job < 0 && !queue.empty())
+                assign(c, queue, jobs);
+        }
+        connections.erase(std::remove_if(connections.begin(), connections.end(),
+                                         [](const connection& c) { return c.fd < 0; }),
+                          connections.end());
+
+        // With only local workers, nobody else is coming once they are all gone
+        if (remaining > 0 && connections.empty() && !children.empty() && !local_workers_alive())
+            throw std::runtime_error("every farm worker exited before the frame was done");
+    }
+
+    message done;
+    done.type = bye;
+    for (auto& c : connections)
+        send_message(c.fd, done);
+
+    stats.seconds = std::chrono::duration<double>(clock::now() - start).count();
+    stats.samples = stats.primary_rays;
+    return stats;
+}
+
+// Jobs, busy time and utilization per worker. Utilization is busy time over the frame's wall
+// time, so the mean across workers is the farm's scaling efficiency for the frame.
+inline void print_farm_report(std::ostream& out, const std::vector<farm_worker_stats>& workers, double seconds) {
+    out << "\rFarm: " << workers.size() << " workers in " << seconds << " s\n";
+    double busy = 0;
+    for (size_t w = 0; w < workers.size(); w++) {
+        const auto& s = workers[w];
+        busy += s.busy_seconds;
+        out << "  worker " << w + 1 << ": " << s.jobs << " jobs, " << s.busy_seconds << " s busy ("
+            << (seconds > 0 ? 100 * s.busy_seconds / seconds : 0) << "%), " << s.rays / 1e6 << " Mrays";
+        if (s.lost_jobs > 0)
+            out << ", " << s.lost_jobs << " lost";
+        out << (s.connected ? "" : ", disconnected") << '\n';
+    }
+    if (!workers.empty() && seconds > 0)
+        out << "  efficiency " << 100 * busy / (seconds * workers.size()) << "%\n";
+}
+
+// Connects to a coordinator and renders the jobs it hands out until it says goodbye
+inline void run_farm_worker(const std::string& address, const scene& scn, thread_pool& pool) {
+    using namespace farm_detail;
+    ::signal(SIGPIPE, SIG_IGN);
+
+    // The coordinator may still be starting up
+    int fd = -1;
+    for (int attempt = 0; fd < 0; attempt++) {
+        try {
+            fd = open_socket(address, false);
+        } catch (const std::exception&) {
+            if (attempt >= 50)
+                throw;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+
+    if (!send_message(fd, hello_message(scn))) {
+        ::close(fd);
+        throw std::runtime_error("lost the coordinator");
+    }
+
+    framebuffer fb(scn.settings.image_width, scn.settings.image_height);
+    renderer render(scn, pool);
+    render.show_progress = false;
+
+    message m;
+    while (recv_message(fd, m, max_job_payload) && m.type == job) {
+        const auto id = m.get<int32_t>();
+        pixel_rect r;
+        r.x0 = m.get<int32_t>();
+        r.y0 = m.get<int32_t>();
+        r.x1 = m.get<int32_t>();
+        r.y1 = m.get<int32_t>();
+        if (r.empty() || r.x0 < 0 || r.y0 < 0 || r.x1 > fb.width || r.y1 > fb.height)
+            break;
+
+        render.region = r;
+        const auto stats = render.render(fb);
+
+        message reply;
+        reply.type = result;
+        reply.put(id);
+        reply.put(stats.primary_rays);
+        reply.put(stats.secondary_rays);
+        reply.put(stats.shadow_rays);
+        reply.put(stats.seconds);
+        std::vector<color> pixels, squares;
+        std::vector<uint32_t> samples;
+        for (int j = r.y0; j < r.y1; j++) {
+            const size_t row = static_cast<size_t>(j) * fb.width;
+            pixels.insert(pixels.end(), fb.pixels.begin() + row + r.x0, fb.pixels.begin() + row + r.x1);
+            squares.insert(squares.end(), fb.squares.begin() + row + r.x0, fb.squares.begin() + row + r.x1);
+            samples.insert(samples.end(), fb.samples.begin() + row + r.x0, fb.samples.begin() + row + r.x1);
+        }
+        reply.put_array(pixels);
+        reply.put_array(squares);
+        reply.put_array(samples);
+        if (!send_message(fd, reply))
+            break;
+    }
+    ::close(fd);
+}
+
+#endif
+
+#endif
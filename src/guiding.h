@@ -0,0 +1,531 @@
+#ifndef GUIDING_H
+#define GUIDING_H
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "color.h"
+#include "hittable.h"
+#include "integrator.h"
+#include "lights.h"
+#include "material.h"
+#include "stats.h"
+#include "trace.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Path Guiding
+//
+// Practical path guiding (Müller et al. 2017): a binary tree over the scene's bounding box
+// holds, in each leaf, a quadtree over the sphere of directions that learns where the light
+// arriving in that region comes from. Diffuse hits draw their bounce from the leaf's
+// quadtree or from the BSDF, each with a fixed probability, and weigh it by the average of
+// the two densities (one-sample MIS), so directions the guide does not know stay reachable
+// and the image is unbiased.
+//
+// Learning runs over passes of doubling length: pass k is samples 2^k - 1 to 2^(k+1) - 2
+// of every pixel. While a pass renders, it samples from the distributions the previous pass
+// learned and deposits into a second set, each deposit the light a path brought back along
+// its bounce over the bounce's density. When the pass ends, the second set becomes the one
+// sampled, leaves that received more than split_samples * sqrt(2^k) deposits split in two,
+// and every quadtree cell holding more than 1% of its leaf's light splits in four for the
+// next pass to learn into.
+//
+// Rendering only reads the sampled set, and deposits are added to the other with relaxed
+// atomic adds, so tiles share the guide without locks and rarely touch the same cache line.
+// The adds are fixed-point integers, whose sum does not depend on the order, so the guide
+// after each pass, and with it the image, is the same for any thread count or pass split.
+
+namespace guide_detail {
+
+const int max_quad_depth = 20;
+const double subdivide_share = 0.01;    // quadtree cells holding more of the light split
+const double fixed_one = 1048576.0;     // deposits count in units of 2^-20
+
+struct quad_node {
+    float energy[4];
+    uint32_t child[4];      // 0 for a leaf quadrant; children come after their parent
+};
+
+const quad_node empty_node = {{0, 0, 0, 0}, {0, 0, 0, 0}};
+
+// Cylindrical map of the unit sphere onto the unit square, s from cos theta and t from
+// phi; it keeps area, so a density over the square is 4 pi per steradian
+inline vec3 square_to_direction(double s, double t) {
+    const double z = 2 * s - 1;
+    const double r = std::sqrt(std::max(0.0, 1 - z * z));
+    const double phi = 2 * pi * t;
+    return vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+inline void direction_to_square(const vec3& d, double& s, double& t) {
+    const vec3 u = unit_vector(d);
+    double phi = std::atan2(u.y(), u.x());
+    if (phi < 0)
+        phi += 2 * pi;
+    s = std::clamp((u.z() + 1) / 2, 0.0, 1 - 1e-12);
+    t = std::clamp(phi / (2 * pi), 0.0, 1 - 1e-12);
+}
+
+inline double luminance(const color& c) {
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
+// Directional quadtree over that square; quadrant q of a node covers the half x = q & 1 of
+// its s range and y = q >> 1 of its t range. A training tree holds the light deposited in
+// each quadrant; normalize() turns it into one to sample, each node's energies becoming the
+// shares of its own, so sampling and the density need no division by a sum.
+class dtree {
+public:
+    dtree() : nodes(1, empty_node) {}
+
+    // Sums every energy up to the root, the leaf quadrants' given by `leaf_energy(n, q)`
+    template <class Energy>
+    void gather(const Energy& leaf_energy);
+
+    // Energies to per-node shares, a node without energy sharing evenly; the light there
+    // was stays in `total`
+    void normalize();
+
+    // On a normalized tree: a point of the square drawn in proportion to the energies, and
+    // the density there
+    void sample(double u, double v, double& s, double& t, double& pdf) const;
+    double pdf(double s, double t) const;
+
+    // Leaf quadrant holding (s, t), as node * 4 + quadrant
+    uint32_t leaf(double s, double t) const;
+
+    // Replaces this tree with normalized tree `trained`'s shape refined for the next pass:
+    // quadrants holding more than `share` of its light split, down to max_quad_depth, and
+    // every energy zero
+    void refine_from(const dtree& trained, double share);
+
+    std::vector<quad_node> nodes;
+    double total = 0;
+};
+
+template <class Energy>
+void dtree::gather(const Energy& leaf_energy) {
+    // Children come after their parents
+    for (size_t n = nodes.size(); n-- > 0;) {
+        for (int q = 0; q < 4; q++) {
+            const uint32_t c = nodes[n].child[q];
+            const float* e = nodes[c].energy;
+            nodes[n].energy[q] = c == 0 ? static_cast<float>(leaf_energy(n, q)) : e[0] + e[1] + e[2] + e[3];
+        }
+    }
+}
+
+void dtree::normalize() {
+    const float* root = nodes[0].energy;
+    total = static_cast<double>(root[0]) + root[1] + root[2] + root[3];
+    for (auto& node : nodes) {
+        const double sum = static_cast<double>(node.energy[0]) + node.energy[1] + node.energy[2] + node.energy[3];
+        for (int q = 0; q < 4; q++)
+            node.energy[q] = sum > 0 ? static_cast<float>(node.energy[q] / sum) : 0.25f;
+    }
+}
+
+void dtree::sample(double u, double v, double& s, double& t, double& pdf) const {
+    uint32_t n = 0;
+    double x0 = 0, y0 = 0, size = 1;
+    pdf = 1;
+    for (;;) {
+        const float* e = nodes[n].energy;
+        // Column, then row within it; each number is stretched back to [0, 1) after a choice
+        const double left = static_cast<double>(e[0]) + e[2];
+        const int x = u < left ? 0 : 1;
+        u = x == 0 ? u / left : (u - left) / (1 - left);
+        const double column = static_cast<double>(e[x]) + e[x + 2];
+        const double low = column > 0 ? e[x] / column : 0.5;
+        const int y = v < low ? 0 : 1;
+        v = y == 0 ? v / low : (v - low) / (1 - low);
+        u = std::clamp(u, 0.0, 1 - 1e-12);
+        v = std::clamp(v, 0.0, 1 - 1e-12);
+
+        const int q = x + 2 * y;
+        pdf *= 4 * e[q];
+        size /= 2;
+        x0 += x * size;
+        y0 += y * size;
+        if (nodes[n].child[q] == 0) {
+            s = x0 + u * size;
+            t = y0 + v * size;
+            return;
+        }
+        n = nodes[n].child[q];
+    }
+}
+
+double dtree::pdf(double s, double t) const {
+    uint32_t n = 0;
+    double pdf = 1;
+    for (;;) {
+        const int x = s < 0.5 ? 0 : 1, y = t < 0.5 ? 0 : 1;
+        const int q = x + 2 * y;
+        pdf *= 4 * nodes[n].energy[q];
+        if (nodes[n].child[q] == 0)
+            return pdf;
+        s = 2 * s - x;
+        t = 2 * t - y;
+        n = nodes[n].child[q];
+    }
+}
+
+uint32_t dtree::leaf(double s, double t) const {
+    uint32_t n = 0;
+    for (;;) {
+        const int x = s < 0.5 ? 0 : 1, y = t < 0.5 ? 0 : 1;
+        const int q = x + 2 * y;
+        if (nodes[n].child[q] == 0)
+            return n * 4 + q;
+        s = 2 * s - x;
+        t = 2 * t - y;
+        n = nodes[n].child[q];
+    }
+}
+
+void dtree::refine_from(const dtree& trained, double share) {
+    nodes.assign(1, empty_node);
+    total = 0;
+    if (trained.total <= 0)
+        return;
+
+    // A quadrant's share is its node's times its part of the node; below the trained tree's
+    // leaves it is spread evenly over the children
+    struct item {
+        uint32_t node;
+        int64_t old;        // the trained tree's matching node, or -1
+        double share;       // of the whole node
+        int depth;
+    };
+    std::vector<item> stack;
+    stack.push_back(item{0, 0, 1.0, 1});
+    while (!stack.empty()) {
+        const item it = stack.back();
+        stack.pop_back();
+        for (int q = 0; q < 4; q++) {
+            const double part = it.old >= 0 ? it.share * trained.nodes[it.old].energy[q] : it.share / 4;
+            if (part <= share || it.depth >= max_quad_depth)
+                continue;
+            const uint32_t c = static_cast<uint32_t>(nodes.size());
+            nodes.push_back(empty_node);
+            nodes[it.node].child[q] = c;
+            const uint32_t old_child = it.old >= 0 ? trained.nodes[it.old].child[q] : 0;
+            stack.push_back(item{c, old_child != 0 ? static_cast<int64_t>(old_child) : -1, part, it.depth + 1});
+        }
+    }
+}
+
+// A region's two quadtrees: the one sampled, and the one the current pass deposits into
+struct guide_leaf {
+    dtree sampling;
+    dtree training;
+    // Per training leaf quadrant, its light and its number of deposits side by side, so a
+    // deposit touches one cache line and deposits to different quadrants none in common
+    std::vector<std::atomic<uint64_t>> deposits;
+    uint64_t samples = 0;                           // deposits of the last pass
+
+    void reset_deposits() {
+        deposits = std::vector<std::atomic<uint64_t>>(training.nodes.size() * 8);
+    }
+};
+
+// Node of the binary tree over space; a leaf names its guide_leaf
+struct space_node {
+    aabb bounds;
+    int axis = 0;
+    double split = 0;
+    int child = 0;      // first of two, 0 for a leaf
+    int leaf = 0;
+};
+
+} // namespace guide_detail
+
+class path_guide {
+public:
+    // Guides the box `bounds`; each guided bounce follows the BSDF with `bsdf_fraction`, and
+    // a region splits after split_samples * sqrt(2^k) deposits in pass k
+    path_guide(const aabb& bounds, double bsdf_fraction, double split_samples);
+
+    // Passes run samples [2^k - 1, 2^(k+1) - 1); the first sample after pass `k`
+    static uint32_t pass_end(int k) { return (2u << k) - 1; }
+    // The pass sample `n` belongs to
+    static int pass_of(uint32_t n) {
+        int k = 0;
+        while (pass_end(k) <= n)
+            k++;
+        return k;
+    }
+
+    // Makes the deposits of pass `k` the distributions to sample and refines both trees
+    void update(int k);
+
+    // Region of a point, and whether its quadtree has learned anything to sample from
+    int leaf_at(const point3& p) const;
+    bool active(int leaf) const { return leaves[leaf].sampling.total > 0; }
+
+    // A point (s, t) of the direction square drawn from the region's quadtree, returning its
+    // density per steradian, and that density at any point; see square_to_direction
+    double sample(int leaf, double u, double v, double& s, double& t) const {
+        double pdf;
+        leaves[leaf].sampling.sample(u, v, s, t, pdf);
+        return pdf / (4 * pi);
+    }
+    double pdf(int leaf, double s, double t) const { return leaves[leaf].sampling.pdf(s, t) / (4 * pi); }
+    double pdf(int leaf, const vec3& dir) const {
+        double s, t;
+        guide_detail::direction_to_square(dir, s, t);
+        return pdf(leaf, s, t);
+    }
+
+    // Light `value` arriving from the direction at (s, t), over the density it was drawn
+    // with; safe from any thread
+    void deposit(int leaf, double s, double t, double value) {
+        auto& l = leaves[leaf];
+        const uint32_t slot = l.training.leaf(s, t) * 2;
+        if (value > 0) {
+            const double fixed = std::min(value, 1e12) * guide_detail::fixed_one;
+            l.deposits[slot].fetch_add(static_cast<uint64_t>(fixed + 0.5), std::memory_order_relaxed);
+        }
+        l.deposits[slot + 1].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    size_t leaf_count() const { return leaves.size(); }
+    size_t node_count() const {
+        size_t n = 0;
+        for (const auto& l : leaves)
+            n += l.sampling.nodes.size() + l.training.nodes.size();
+        return n;
+    }
+    size_t memory_usage() const {
+        size_t bytes = space.capacity() * sizeof(guide_detail::space_node);
+        for (const auto& l : leaves)
+            bytes += sizeof(l) + (l.sampling.nodes.capacity() + l.training.nodes.capacity())
+                                 * sizeof(guide_detail::quad_node)
+                   + l.deposits.capacity() * sizeof(uint64_t);
+        return bytes;
+    }
+
+public:
+    double bsdf_fraction;
+    double split_samples;
+    int updates = 0;
+    double update_seconds = 0;
+
+private:
+    std::vector<guide_detail::space_node> space;
+    std::vector<guide_detail::guide_leaf> leaves;
+};
+
+path_guide::path_guide(const aabb& bounds, double fraction, double split)
+    : bsdf_fraction(fraction), split_samples(split) {
+    guide_detail::space_node root;
+    root.bounds = bounds;
+    space.push_back(root);
+    leaves.emplace_back();
+    leaves.back().reset_deposits();
+}
+
+int path_guide::leaf_at(const point3& p) const {
+    int n = 0;
+    while (space[n].child != 0)
+        n = space[n].child + (p[space[n].axis] < space[n].split ? 0 : 1);
+    return space[n].leaf;
+}
+
+void path_guide::update(int k) {
+    using clock = std::chrono::steady_clock;
+    using namespace guide_detail;
+    trace_scope trace_update("guide update", "render", k);
+    const auto start = clock::now();
+
+    // Deposits to energies, and the training trees become the ones sampled
+    for (auto& l : leaves) {
+        l.samples = 0;
+        l.training.gather([&](size_t n, int q) {
+            const size_t slot = (n * 4 + q) * 2;
+            l.samples += l.deposits[slot + 1].load(std::memory_order_relaxed);
+            return l.deposits[slot].load(std::memory_order_relaxed) / fixed_one;
+        });
+        l.sampling = l.training;
+        l.sampling.normalize();
+    }
+
+    // Busy regions split across their longest side, each half taking a copy of the
+    // quadtree and half the deposits; halves that are still busy split again
+    const double threshold = split_samples * std::sqrt(std::pow(2.0, k));
+    for (size_t i = 0; i < space.size(); i++) {
+        if (space[i].child != 0 || leaves[space[i].leaf].samples <= threshold)
+            continue;
+        const aabb box = space[i].bounds;
+        const vec3 extent = box.max() - box.min();
+        const int axis = extent.x() >= extent.y() && extent.x() >= extent.z() ? 0 : extent.y() >= extent.z() ? 1 : 2;
+        const double split = 0.5 * (box.min()[axis] + box.max()[axis]);
+        const int first = space[i].leaf;
+        leaves[first].samples /= 2;
+        leaves.emplace_back();
+        leaves.back().sampling = leaves[first].sampling;
+        leaves.back().samples = leaves[first].samples;
+
+        space_node low, high;
+        point3 low_max = box.max(), high_min = box.min();
+        low_max[axis] = split;
+        high_min[axis] = split;
+        low.bounds = aabb(box.min(), low_max);
+        low.leaf = first;
+        high.bounds = aabb(high_min, box.max());
+        high.leaf = static_cast<int>(leaves.size()) - 1;
+        space[i].axis = axis;
+        space[i].split = split;
+        space[i].child = static_cast<int>(space.size());
+        space.push_back(low);
+        space.push_back(high);
+    }
+
+    for (auto& l : leaves) {
+        l.training.refine_from(l.sampling, subdivide_share);
+        l.reset_deposits();
+    }
+    updates++;
+    update_seconds += std::chrono::duration<double>(clock::now() - start).count();
+}
+
+// Path tracing, with or without next-event estimation, whose diffuse bounces follow the
+// guide and deposit what they bring back. One-sample MIS: the bounce comes from the BSDF
+// with probability bsdf_fraction and from the guide otherwise, and is weighted by the
+// mixture's density, which light samples and emitter hits are weighted against as well.
+color guided_color(const ray& r, const color& background, const hittable& world, const light_set& lights,
+                   light_sampling mode, bool sample_lights, int depth, path_guide& guide,
+                   first_hit* aov = nullptr) {
+    // What each hit added before the path's throughput, for the deposits once the path ends
+    struct vertex {
+        color emitted;
+        color direct;
+        color weight;       // f cos / pdf of the bounce taken there
+        int leaf;           // -1 where the bounce was not guided
+        double s, t;        // its direction on the guide's square
+        double pdf;
+    };
+    static thread_local std::vector<vertex> path;
+    path.clear();
+
+    color result(0, 0, 0), throughput(1, 1, 1);
+    ray current = r;
+    double last_pdf = 0;        // density of the last bounce, 0 for camera rays
+    point3 last_p;
+    vec3 last_normal;
+    const double alpha = guide.bsdf_fraction;
+
+    for (int bounce = 0; ; bounce++) {
+        if (bounce >= depth) {
+            PT_STAT(thread_path_counters().ended_max_depth++);
+            break;
+        }
+
+        thread_ray_counters().traced++;
+        hit_record rec;
+        if (!world.hit(current, 0.001, infinity, rec)) {
+            PT_STAT(thread_path_counters().ended_miss++);
+            result += throughput * background;
+            path.push_back(vertex{background, color(0, 0, 0), color(0, 0, 0), -1, 0, 0, 0});
+            break;
+        }
+
+        if (aov && bounce == 0) {
+            aov->albedo = rec.mat->surface_albedo();
+            aov->normal = rec.normal;
+            aov->distance = rec.t * current.direction().length();
+        }
+
+        vertex x{rec.mat->emitted(), color(0, 0, 0), color(0, 0, 0), -1, 0, 0, 0};
+        if (sample_lights && last_pdf > 0 && rec.light >= 0) {
+            const emitter& light = lights.emitters[rec.light];
+            const double dist = rec.t * current.direction().length();
+            const double cos_light = std::fabs(dot(light.normal, unit_vector(current.direction())));
+            const double light_pdf = lights.pmf(mode, last_p, last_normal, rec.light) * dist * dist
+                                   / (light.area * std::max(cos_light, 1e-12));
+            x.emitted = x.emitted * mis_weight(last_pdf, light_pdf);
+        }
+        result += throughput * x.emitted;
+
+        // Surfaces without a density to guide keep their own scattering
+        if (rec.mat->pdf(rec, rec.normal) <= 0) {
+            ray scattered;
+            if (!rec.mat->scatter(current, rec, x.weight, scattered)) {
+                PT_STAT(thread_path_counters().ended_light++);
+                path.push_back(x);
+                break;
+            }
+            path.push_back(x);
+            throughput = throughput * x.weight;
+            last_pdf = 0;
+            current = scattered;
+            continue;
+        }
+
+        const int leaf = guide.leaf_at(rec.p);
+        const bool guided = guide.active(leaf);
+        auto density = [&](const vec3& wi) {
+            const double bsdf = rec.mat->pdf(rec, wi);
+            return guided ? alpha * bsdf + (1 - alpha) * guide.pdf(leaf, wi) : bsdf;
+        };
+
+        // A light sample counts as the next vertex, so none is taken at the last bounce
+        if (sample_lights && bounce + 1 < depth) {
+            x.direct = sample_direct(rec, world, lights, mode, density);
+            result += throughput * x.direct;
+        }
+
+        vec3 wi;
+        double s, t, guide_pdf;
+        if (!guided || random_double() < alpha) {
+            ray scattered;
+            color attenuation;
+            rec.mat->scatter(current, rec, attenuation, scattered);
+            wi = unit_vector(scattered.direction());
+            guide_detail::direction_to_square(wi, s, t);
+            guide_pdf = guided ? guide.pdf(leaf, s, t) : 0;
+        } else {
+            const double u = random_double();
+            guide_pdf = guide.sample(leaf, u, random_double(), s, t);
+            wi = guide_detail::square_to_direction(s, t);
+        }
+        const double bsdf_pdf = rec.mat->pdf(rec, wi);
+        const double pdf = guided ? alpha * bsdf_pdf + (1 - alpha) * guide_pdf : bsdf_pdf;
+        const color f = rec.mat->eval(rec, wi);
+        if (pdf <= 0 || (f.x() <= 0 && f.y() <= 0 && f.z() <= 0)) {
+            // A guided direction into the surface: absorbed
+            PT_STAT(thread_path_counters().ended_light++);
+            path.push_back(x);
+            break;
+        }
+        x.weight = f / pdf;
+        x.leaf = leaf;
+        x.s = s;
+        x.t = t;
+        x.pdf = pdf;
+        path.push_back(x);
+
+        throughput = throughput * x.weight;
+        last_pdf = pdf;
+        last_p = rec.p;
+        last_normal = rec.normal;
+        current = ray(rec.p, wi);
+    }
+
+    // Back from the end: `arriving` is the light reaching each hit along its bounce
+    color arriving(0, 0, 0);
+    for (size_t v = path.size(); v-- > 0;) {
+        const vertex& x = path[v];
+        if (x.leaf >= 0)
+            guide.deposit(x.leaf, x.s, x.t, guide_detail::luminance(arriving) / x.pdf);
+        arriving = x.emitted + x.direct + x.weight * arriving;
+    }
+    return result;
+}
+
+#endif
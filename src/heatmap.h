@@ -0,0 +1,66 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include "vec3.h"
+#include "pfm.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// False-Colour Heatmaps
+//
+// Maps one channel of a float image through a black-purple-orange-yellow ramp (close to
+// matplotlib's "inferno") and writes it as a binary PPM. The ramp's top is the 99th
+// percentile of the channel, not its maximum, so a few extreme pixels do not wash out the
+// rest; anything above it is drawn white.
+
+inline color heatmap_ramp(double t) {
+    static const color stops[] = {
+        color(0.00, 0.00, 0.02), color(0.34, 0.06, 0.43), color(0.73, 0.21, 0.33),
+        color(0.98, 0.55, 0.04), color(0.99, 1.00, 0.64),
+    };
+    const int last = static_cast<int>(sizeof(stops) / sizeof(stops[0])) - 1;
+    t = std::clamp(t, 0.0, 1.0) * last;
+    const int k = std::min(static_cast<int>(t), last - 1);
+    const double f = t - k;
+    return (1 - f) * stops[k] + f * stops[k+1];
+}
+
+// Writes channel `c` of `img` and returns the value the top of the ramp stands for
+inline double write_heatmap(const std::string& path, const float_image& img, int c) {
+    std::vector<float> values;
+    values.reserve(static_cast<size_t>(img.width) * img.height);
+    for (size_t k = c; k < img.pixels.size(); k += 3)
+        values.push_back(img.pixels[k]);
+    double top = 0;
+    if (!values.empty()) {
+        auto p99 = values.begin() + (values.size() - 1) * 99 / 100;
+        std::nth_element(values.begin(), p99, values.end());
+        top = *p99;
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+        throw std::runtime_error("cannot write '" + path + "'");
+    out << "P6\n" << img.width << ' ' << img.height << "\n255\n";
+    for (int j = img.height - 1; j >= 0; j--) {
+        for (int i = 0; i < img.width; i++) {
+            const double v = img.at(i, j)[c];
+            const color rgb = v > top ? color(1, 1, 1) : heatmap_ramp(top > 0 ? v / top : 0);
+            const unsigned char bytes[3] = {
+                static_cast<unsigned char>(255.999 * rgb.x()),
+                static_cast<unsigned char>(255.999 * rgb.y()),
+                static_cast<unsigned char>(255.999 * rgb.z()),
+            };
+            out.write(reinterpret_cast<const char*>(bytes), 3);
+        }
+    }
+    if (!out)
+        throw std::runtime_error("error writing '" + path + "'");
+    return top;
+}
+
+#endif
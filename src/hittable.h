@@ -3,15 +3,18 @@
 
 #include "ray.h"
 #include "rtweekend.h"
+#include "aabb.h"
+#include <cstddef>
 
 class material;
 
 struct hit_record {
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat;
+    material* mat;  // owned by the scene; raw so hits never touch a shared refcount
     double t;
     bool front_face;
+    int light;      // index in the scene's light_set, or -1 when not a sampled emitter
 
     inline void set_face_normal(const ray& r, const vec3& outward_normal) {
         front_face = dot(r.direction(), outward_normal) < 0;
@@ -22,6 +25,10 @@ struct hit_record {
 class hittable {
 public:
     virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+    virtual bool bounding_box(aabb& output_box) const = 0;
+
+    // Bytes owned by this object (geometry and acceleration data, not materials)
+    virtual size_t memory_usage() const = 0;
 };
 
 #endif
@@ -17,6 +17,8 @@ public:
     void add(shared_ptr<hittable> object) { objects.push_back(object); }
 
     virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    virtual bool bounding_box(aabb& output_box) const override;
+    virtual size_t memory_usage() const override;
 
 public:
     std::vector<shared_ptr<hittable>> objects;
@@ -38,4 +40,26 @@ bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& re
     return hit_anything;
 }
 
+bool hittable_list::bounding_box(aabb& output_box) const {
+    if (objects.empty())
+        return false;
+
+    aabb temp_box;
+    output_box = aabb();
+    for (const auto& object : objects) {
+        if (!object->bounding_box(temp_box))
+            return false;
+        output_box.expand(temp_box);
+    }
+
+    return true;
+}
+
+size_t hittable_list::memory_usage() const {
+    size_t bytes = sizeof(*this) + objects.capacity() * sizeof(shared_ptr<hittable>);
+    for (const auto& object : objects)
+        bytes += object->memory_usage();
+    return bytes;
+}
+
 #endif
@@ -0,0 +1,63 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "transform.h"
+
+// Object Instance
+//
+// Places a shared object (usually a bottom-level BVH) in the world with an affine
+// transform. Rays are moved into object space instead of moving the geometry, so any
+// number of instances share one copy of the object. Only the world-to-object transform
+// is stored: t is the same in both spaces, so hit points come from the world-space ray.
+
+class instance : public hittable {
+public:
+    instance() {}
+    instance(shared_ptr<hittable> obj, const transform& object_to_world)
+        : object(obj), world_to_object(object_to_world.inverse()) {}
+
+    // Moves the instance; the BVH containing it must be updated before the next trace
+    void set_transform(const transform& object_to_world) {
+        world_to_object = object_to_world.inverse();
+    }
+
+    transform object_to_world() const {
+        return world_to_object.inverse();
+    }
+
+    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+    virtual bool bounding_box(aabb& output_box) const override {
+        aabb object_box;
+        if (!object->bounding_box(object_box))
+            return false;
+        output_box = object_to_world().box(object_box);
+        return true;
+    }
+
+    // The shared object is accounted for once by its owner, not per instance
+    virtual size_t memory_usage() const override {
+        return sizeof(*this);
+    }
+
+public:
+    shared_ptr<hittable> object;
+    transform world_to_object;
+};
+
+bool instance::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    // The direction is not renormalized, so t is the same in both spaces
+    ray object_ray(world_to_object.point(r.origin()), world_to_object.vector(r.direction()));
+    if (!object->hit(object_ray, t_min, t_max, rec))
+        return false;
+
+    // Normals transform by the inverse transpose; dot(d, n) keeps its sign, so
+    // front_face carries over unchanged.
+    rec.p = r.at(rec.t);
+    rec.normal = unit_vector(world_to_object.transposed_vector(rec.normal));
+    return true;
+}
+
+#endif
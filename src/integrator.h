@@ -0,0 +1,249 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include "rtweekend.h"
+#include "color.h"
+#include "hittable.h"
+#include "lights.h"
+#include "material.h"
+#include "stats.h"
+#include <cmath>
+#include <cstdint>
+
+// Radiance Estimators
+//
+// One camera ray in, one sample of the radiance along it out. The renderer picks the
+// estimator per sample from the scene settings; everything here draws from the calling
+// thread's generator, which the renderer points at the pixel's own.
+
+// Rays traced by the calling thread, summed into render_stats after each tile
+struct ray_counters {
+    uint64_t primary = 0;       // camera rays
+    uint64_t traced = 0;        // every ray tested against the scene, primary included
+    uint64_t shadow = 0;        // of those, visibility rays to sampled lights
+};
+
+inline ray_counters& thread_ray_counters() {
+    static thread_local ray_counters counters;
+    return counters;
+}
+
+// What a camera ray first hit, for the denoiser's feature buffers; zero on a miss
+struct first_hit {
+    color albedo;
+    vec3 normal;
+    double distance = 0;
+};
+
+// Recursive ray bouncing; fills `aov` from the first hit when given
+color ray_color(const ray& r, const color& background, const hittable& world, int depth, first_hit* aov = nullptr) {
+    // If we've exceeded the ray bounce limit, no more light is gathered
+    if (depth <= 0) {
+        PT_STAT(thread_path_counters().ended_max_depth++);
+        return color(0, 0, 0);
+    }
+
+    thread_ray_counters().traced++;
+    hit_record rec;
+
+    // If the ray hits nothing, return the background (black in the Cornell Box)
+    if (!world.hit(r, 0.001, infinity, rec)) {
+        PT_STAT(thread_path_counters().ended_miss++);
+        return background;
+    }
+
+    if (aov) {
+        aov->albedo = rec.mat->surface_albedo();
+        aov->normal = rec.normal;
+        aov->distance = rec.t * r.direction().length();
+    }
+
+    ray scattered;
+    color attenuation;
+    color emitted = rec.mat->emitted();
+
+    // If light hit the diffuse surface, scatter the ray
+    if (rec.mat->scatter(r, rec, attenuation, scattered)) {
+        return emitted + attenuation * ray_color(scattered, background, world, depth-1);
+    }
+
+    // Otherwise, hit the light source and return emitted light
+    PT_STAT(thread_path_counters().ended_light++);
+    return emitted;
+}
+
+// Power heuristic with beta = 2, for the strategy with density `a` against one with `b`
+inline double mis_weight(double a, double b) {
+    return a * a / (a * a + b * b);
+}
+
+// What a path carries: RGB radiance, or a spectral sample at the path's wavelengths. The
+// next-event estimation below is written once over these, so both modes weigh light alike.
+struct rgb_carrier {
+    using value = color;
+
+    color zero() const { return color(0, 0, 0); }
+    color one() const { return color(1, 1, 1); }
+    color scale(const color& c, double w) const { return c * w; }
+    bool is_black(const color& c) const { return c.x() <= 0 && c.y() <= 0 && c.z() <= 0; }
+
+    color background(const color& c) const { return c; }
+    color emitted(const hit_record& rec) const { return rec.mat->emitted(); }
+    color eval(const hit_record& rec, const vec3& wi) const { return rec.mat->eval(rec, wi); }
+    color radiance(const emitter& light) const { return light.radiance; }
+
+    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {
+        return rec.mat->scatter(r_in, rec, attenuation, scattered);
+    }
+};
+
+struct spectral_carrier {
+    using value = spectrum4;
+
+    wavelengths& wl;
+
+    spectrum4 zero() const { return spectrum4(0); }
+    spectrum4 one() const { return spectrum4(1); }
+    spectrum4 scale(const spectrum4& s, double w) const { return s * static_cast<float>(w); }
+    bool is_black(const spectrum4& s) const { return s.is_black(); }
+
+    spectrum4 background(const color& c) const { return rgb_spectrum(c).at(wl); }
+    spectrum4 emitted(const hit_record& rec) const { return rec.mat->emission(wl); }
+    spectrum4 eval(const hit_record& rec, const vec3& wi) const { return rec.mat->eval(rec, wi, wl); }
+    spectrum4 radiance(const emitter& light) const { return light.spectrum.at(wl); }
+
+    // The bounce follows the hero wavelength; the others would have gone elsewhere
+    bool scatter(const ray& r_in, const hit_record& rec, spectrum4& attenuation, ray& scattered) const {
+        if (!rec.mat->scatter_spectral(r_in, rec, wl.hero(), scattered))
+            return false;
+        if (rec.mat->dispersive())
+            wl.terminate_secondary();
+        attenuation = rec.mat->reflectance(wl);
+        return true;
+    }
+};
+
+// Light from one emitter chosen by `lights` at a diffuse hit, through a shadow ray, weighted
+// against the chance that the bounce would have found the same point: `scatter_pdf(wi)` is
+// the density the bounce direction is drawn with, per steradian
+template <class Carrier, class Density>
+typename Carrier::value sample_direct(const Carrier& carrier, const hit_record& rec, const hittable& world,
+                                      const light_set& lights, light_sampling mode, const Density& scatter_pdf) {
+    double pmf;
+    const int index = lights.sample(mode, rec.p, rec.normal, random_double(), pmf);
+    if (index < 0)
+        return carrier.zero();
+    const emitter& light = lights.emitters[index];
+    const point3 q = light.point(random_double(), random_double());
+
+    const vec3 to_light = q - rec.p;
+    const double dist2 = to_light.length_squared();
+    const double dist = std::sqrt(dist2);
+    const vec3 wi = to_light / dist;
+    const double cos_light = std::fabs(dot(light.normal, wi));
+    const auto f = carrier.eval(rec, wi);
+    if (cos_light <= 0 || carrier.is_black(f))
+        return carrier.zero();
+
+    thread_ray_counters().traced++;
+    thread_ray_counters().shadow++;
+    hit_record blocker;
+    if (world.hit(ray(rec.p, wi), 0.001, dist * (1 - 1e-6), blocker))
+        return carrier.zero();
+
+    const double light_pdf = pmf * dist2 / (light.area * cos_light);
+    return carrier.scale(f * carrier.radiance(light), mis_weight(light_pdf, scatter_pdf(wi)) / light_pdf);
+}
+
+// RGB light for a bounce drawn with density `scatter_pdf`
+template <class Density>
+color sample_direct(const hit_record& rec, const hittable& world, const light_set& lights, light_sampling mode,
+                    const Density& scatter_pdf) {
+    return sample_direct(rgb_carrier{}, rec, world, lights, mode, scatter_pdf);
+}
+
+// The same for a bounce the BSDF samples
+color sample_direct(const hit_record& rec, const hittable& world, const light_set& lights, light_sampling mode) {
+    return sample_direct(rec, world, lights, mode, [&](const vec3& wi) { return rec.mat->pdf(rec, wi); });
+}
+
+// Path tracing with next-event estimation: every diffuse hit also samples a light, and
+// emitters that a bounce runs into count with the matching multiple importance sampling
+// weight, so each light path is counted once whichever strategy found it. Emitters the
+// light set does not sample keep their full weight on hits, and with `mode` none (or no
+// emitters) this is plain path tracing.
+template <class Carrier>
+typename Carrier::value trace_nee_path(const Carrier& carrier, const ray& r, const color& background,
+                                       const hittable& world, const light_set& lights, light_sampling mode,
+                                       int depth, first_hit* aov) {
+    const bool sample_lights = mode != light_sampling::none && !lights.emitters.empty();
+    auto result = carrier.zero(), throughput = carrier.one();
+    ray current = r;
+    double bsdf_pdf = 0;        // density of the last bounce, 0 for camera rays
+    point3 last_p;
+    vec3 last_normal;
+
+    for (int bounce = 0; ; bounce++) {
+        if (bounce >= depth) {
+            PT_STAT(thread_path_counters().ended_max_depth++);
+            return result;
+        }
+
+        thread_ray_counters().traced++;
+        hit_record rec;
+        if (!world.hit(current, 0.001, infinity, rec)) {
+            PT_STAT(thread_path_counters().ended_miss++);
+            return result + throughput * carrier.background(background);
+        }
+
+        if (aov && bounce == 0) {
+            aov->albedo = rec.mat->surface_albedo();
+            aov->normal = rec.normal;
+            aov->distance = rec.t * current.direction().length();
+        }
+
+        auto emitted = carrier.emitted(rec);
+        if (bsdf_pdf > 0 && rec.light >= 0) {
+            const emitter& light = lights.emitters[rec.light];
+            const double dist = rec.t * current.direction().length();
+            const double cos_light = std::fabs(dot(light.normal, unit_vector(current.direction())));
+            const double light_pdf = lights.pmf(mode, last_p, last_normal, rec.light) * dist * dist
+                                   / (light.area * std::max(cos_light, 1e-12));
+            emitted = carrier.scale(emitted, mis_weight(bsdf_pdf, light_pdf));
+        }
+        result += throughput * emitted;
+
+        ray scattered;
+        typename Carrier::value attenuation;
+        if (!carrier.scatter(current, rec, attenuation, scattered)) {
+            PT_STAT(thread_path_counters().ended_light++);
+            return result;
+        }
+
+        // A light sample counts as the next vertex, so none is taken at the last bounce
+        if (sample_lights && bounce + 1 < depth && rec.mat->pdf(rec, rec.normal) > 0)
+            result += throughput * sample_direct(carrier, rec, world, lights, mode,
+                                                 [&](const vec3& wi) { return rec.mat->pdf(rec, wi); });
+
+        throughput = throughput * attenuation;
+        bsdf_pdf = sample_lights ? rec.mat->pdf(rec, scattered.direction()) : 0;
+        last_p = rec.p;
+        last_normal = rec.normal;
+        current = scattered;
+    }
+}
+
+color ray_color_nee(const ray& r, const color& background, const hittable& world, const light_set& lights,
+                    light_sampling mode, int depth, first_hit* aov = nullptr) {
+    return trace_nee_path(rgb_carrier{}, r, background, world, lights, mode, depth, aov);
+}
+
+// Path tracing at four wavelengths (see spectrum.h), with next-event estimation as in
+// ray_color_nee() unless `mode` is none; returns the sample as RGB
+color spectral_color(const ray& r, const color& background, const hittable& world, const light_set& lights,
+                     light_sampling mode, int depth, first_hit* aov = nullptr) {
+    wavelengths wl = wavelengths::sample(random_double());
+    return wl.to_rgb(trace_nee_path(spectral_carrier{wl}, r, background, world, lights, mode, depth, aov));
+}
+
+#endif
@@ -0,0 +1,442 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "spectrum.h"
+#include "vec3.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Light Sampling
+//
+// Next-event estimation picks one emitter per diffuse hit and sends a shadow ray to a point
+// on it. With thousands of emitters, picking uniformly wastes nearly every shadow ray on
+// lights too far away, too dim or facing away to matter. The light BVH instead picks an
+// emitter with probability roughly proportional to what it can contribute to the shading
+// point, after "Importance Sampling of Many Lights With Adaptive Tree Splitting" (Conty
+// Estevez and Kulla 2018) as formulated in pbrt-v4.
+//
+// Every node bounds its lights' positions with a box, their power with the sum phi, and
+// their orientations with a cone of normals (axis w, half-angle theta_o) widened by the
+// emission spread theta_e. A node's importance at a point is phi over squared distance,
+// times the cosine of the smallest angle any of its lights could make with the point and
+// with the surface normal there. Traversal walks down from the root, choosing each child in
+// proportion to its importance; the product of those choices is the probability of the
+// emitter found, and following an emitter's stored path of choices gives the same
+// probability back for multiple importance sampling.
+//
+// Emitters are the axis-aligned rectangles with a diffuse_light material outside object
+// blocks, as parallelograms in world space. They emit from both faces, so a normal and its
+// opposite are the same orientation and theta_e is a right angle. Emissive triangles,
+// meshes and instanced objects are not sampled; paths only find them by bouncing into them.
+
+enum class light_sampling { none, uniform, bvh };
+
+// Parallelogram corner + s*u + t*v for s, t in [0, 1]
+struct emitter {
+    point3 corner;
+    vec3 u, v;
+    vec3 normal;        // unit; either side emits
+    double area = 0;
+    color radiance;
+    rgb_spectrum spectrum;      // of the radiance, for spectral rendering
+
+    emitter() {}
+    emitter(const point3& c, const vec3& u_, const vec3& v_, const color& le)
+        : corner(c), u(u_), v(v_), radiance(le), spectrum(le) {
+        const vec3 n = cross(u, v);
+        area = n.length();
+        normal = n / area;
+    }
+
+    point3 point(double s, double t) const { return corner + s * u + t * v; }
+
+    aabb bounds() const {
+        aabb box;
+        box.expand(corner);
+        box.expand(corner + u);
+        box.expand(corner + v);
+        box.expand(corner + u + v);
+        return box;
+    }
+};
+
+namespace light_detail {
+
+inline double luminance(const color& c) {
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
+// cos(max(0, a - b)) from the cosines and sines of a and b
+inline double cos_sub_clamped(double cos_a, double sin_a, double cos_b, double sin_b) {
+    if (cos_a > cos_b)
+        return 1;
+    return cos_a * cos_b + sin_a * sin_b;
+}
+
+inline double sin_sub_clamped(double cos_a, double sin_a, double cos_b, double sin_b) {
+    if (cos_a > cos_b)
+        return 0;
+    return sin_a * cos_b - cos_a * sin_b;
+}
+
+inline double safe_sqrt(double x) {
+    return std::sqrt(std::max(0.0, x));
+}
+
+// Rotates v by `angle` about the unit axis a (Rodrigues)
+inline vec3 rotate(const vec3& v, const vec3& a, double angle) {
+    const double c = std::cos(angle), s = std::sin(angle);
+    return v * c + cross(a, v) * s + a * dot(a, v) * (1 - c);
+}
+
+} // namespace light_detail
+
+// What a light BVH node knows about the emitters under it
+struct light_bounds {
+    aabb box;
+    double phi = 0;             // total power, up to a constant
+    vec3 w = vec3(0, 0, 1);     // axis of the normal cone
+    double cos_theta_o = 1;     // half-angle of the normal cone
+    double cos_theta_e = 0;     // emission spread beyond the normals (a hemisphere)
+
+    static light_bounds of(const emitter& e) {
+        light_bounds b;
+        b.box = e.bounds();
+        b.phi = light_detail::luminance(e.radiance) * e.area;
+        b.w = e.normal;
+        return b;
+    }
+
+    // Smallest cone holding both, with pbrt's DirectionCone::Union. Lights emit both ways,
+    // so b's axis is flipped when that brings it closer.
+    static light_bounds merge(const light_bounds& a, const light_bounds& b) {
+        if (a.phi == 0)
+            return b;
+        if (b.phi == 0)
+            return a;
+        light_bounds m;
+        m.box = a.box;
+        m.box.expand(b.box);
+        m.phi = a.phi + b.phi;
+        m.cos_theta_e = std::min(a.cos_theta_e, b.cos_theta_e);
+
+        const vec3 wb = dot(a.w, b.w) < 0 ? -b.w : b.w;
+        const double theta_a = std::acos(std::clamp(a.cos_theta_o, -1.0, 1.0));
+        const double theta_b = std::acos(std::clamp(b.cos_theta_o, -1.0, 1.0));
+        const double theta_d = std::acos(std::clamp(dot(a.w, wb), -1.0, 1.0));
+        if (std::min(theta_d + theta_b, pi) <= theta_a) {
+            m.w = a.w;
+            m.cos_theta_o = a.cos_theta_o;
+        } else if (std::min(theta_d + theta_a, pi) <= theta_b) {
+            m.w = wb;
+            m.cos_theta_o = b.cos_theta_o;
+        } else {
+            const double theta_o = (theta_a + theta_d + theta_b) / 2;
+            const vec3 axis = cross(a.w, wb);
+            if (theta_o >= pi || axis.length_squared() == 0) {
+                m.w = a.w;
+                m.cos_theta_o = -1;
+            } else {
+                m.w = unit_vector(light_detail::rotate(a.w, unit_vector(axis), theta_o - theta_a));
+                m.cos_theta_o = std::cos(theta_o);
+            }
+        }
+        return m;
+    }
+};
+
+// light_bounds as traversal reads it, with everything that does not depend on the shading
+// point worked out once
+struct node_bounds {
+    point3 center;
+    vec3 w = vec3(0, 0, 1);
+    double phi = 0;
+    double min_d2 = 0;          // half the diagonal: keeps points inside the box from blowing up
+    double radius2 = 0;         // of the bounding sphere
+    double cos_theta_o = 1, sin_theta_o = 0;
+    double cos_theta_e = 0;
+
+    node_bounds() {}
+    node_bounds(const light_bounds& b)
+        : center(b.box.centroid()), w(b.w), phi(b.phi), cos_theta_o(b.cos_theta_o), cos_theta_e(b.cos_theta_e) {
+        const vec3 diagonal = b.box.max() - b.box.min();
+        min_d2 = diagonal.length() / 2;
+        radius2 = diagonal.length_squared() / 4;
+        sin_theta_o = light_detail::safe_sqrt(1 - cos_theta_o * cos_theta_o);
+    }
+
+    // Conservative contribution to a point p on a surface facing n
+    double importance(const point3& p, const vec3& n) const {
+        using namespace light_detail;
+        const vec3 d = p - center;
+        const double dist2 = d.length_squared();
+        const vec3 wi = d / std::sqrt(dist2);
+
+        // Angle between the cone axis and the point, without the sign: both faces emit
+        const double cos_w = std::fabs(dot(w, wi));
+        const double sin_w = safe_sqrt(1 - cos_w * cos_w);
+
+        // Angle the box subtends, from its bounding sphere; everything if p is inside
+        const double cos_b = dist2 > radius2 ? std::sqrt(1 - radius2 / dist2) : -1;
+        const double sin_b = safe_sqrt(1 - cos_b * cos_b);
+
+        // Smallest angle any light can make with the point, then the emission cutoff
+        const double cos_x = cos_sub_clamped(cos_w, sin_w, cos_theta_o, sin_theta_o);
+        const double sin_x = sin_sub_clamped(cos_w, sin_w, cos_theta_o, sin_theta_o);
+        const double cos_p = cos_sub_clamped(cos_x, sin_x, cos_b, sin_b);
+        if (cos_p <= cos_theta_e)
+            return 0;
+
+        // Surfaces only reflect light arriving from in front of them
+        const double cos_i = -dot(wi, n);
+        const double sin_i = safe_sqrt(1 - cos_i * cos_i);
+        const double cos_ip = cos_sub_clamped(cos_i, sin_i, cos_b, sin_b);
+        if (cos_ip <= 0)
+            return 0;
+        return phi * cos_p * cos_ip / std::max(dist2, min_d2);
+    }
+};
+
+// The emitters of a scene and the two ways of choosing among them
+class light_set {
+public:
+    std::vector<emitter> emitters;
+
+    // Builds the light BVH over `emitters`
+    void build();
+
+    // Picks an emitter for a point p on a surface facing n from u in [0, 1); returns its
+    // index and probability, or -1 when no emitter can light the point
+    int sample(light_sampling mode, const point3& p, const vec3& n, double u, double& pmf) const;
+
+    // Probability that sample() picks emitter `index` at p
+    double pmf(light_sampling mode, const point3& p, const vec3& n, int index) const;
+
+    // Picks an emitter in proportion to its power alone, as light paths start; -1 when none
+    // emits anything
+    int sample_power(double u, double& pmf) const;
+    double power_pmf(int index) const;
+
+    size_t memory_usage() const {
+        return emitters.capacity() * sizeof(emitter) + nodes.capacity() * sizeof(node) + trails.capacity() * sizeof(uint64_t)
+             + power_cdf.capacity() * sizeof(double);
+    }
+
+private:
+    struct node {
+        node_bounds bounds;
+        int index = 0;          // emitter of a leaf, else the second child; the first is next
+        bool leaf = false;
+    };
+
+    struct build_item {
+        light_bounds bounds;
+        int emitter;
+    };
+
+    int build_node(std::vector<build_item>& items, int begin, int end, uint64_t trail, int depth);
+
+    std::vector<node> nodes;
+    std::vector<uint64_t> trails;   // per emitter, its path from the root: bit d set for the second child at depth d
+    std::vector<double> power_cdf;  // running sums of luminance times area, normalized
+};
+
+// Solid-angle cost of a cone of normals widened by theta_e, from pbrt-v4's SAOH
+inline double light_cone_measure(const light_bounds& b) {
+    const double theta_o = std::acos(std::clamp(b.cos_theta_o, -1.0, 1.0));
+    const double theta_e = std::acos(std::clamp(b.cos_theta_e, -1.0, 1.0));
+    const double theta_w = std::min(theta_o + theta_e, pi);
+    const double sin_o = std::sin(theta_o);
+    return 2 * pi * (1 - b.cos_theta_o)
+         + pi / 2 * (2 * theta_w * sin_o - std::cos(theta_o - 2 * theta_w) - 2 * theta_o * sin_o + b.cos_theta_o);
+}
+
+void light_set::build() {
+    nodes.clear();
+    trails.assign(emitters.size(), 0);
+    power_cdf.clear();
+    if (emitters.empty())
+        return;
+
+    double total = 0;
+    for (const auto& e : emitters)
+        power_cdf.push_back(total += light_detail::luminance(e.radiance) * e.area);
+    if (total > 0) {
+        for (auto& c : power_cdf)
+            c /= total;
+    } else {
+        power_cdf.clear();
+    }
+
+    std::vector<build_item> items;
+    items.reserve(emitters.size());
+    for (size_t i = 0; i < emitters.size(); i++) {
+        if (emitters[i].area > 0 && light_detail::luminance(emitters[i].radiance) > 0)
+            items.push_back({light_bounds::of(emitters[i]), static_cast<int>(i)});
+    }
+    if (!items.empty())
+        build_node(items, 0, static_cast<int>(items.size()), 0, 0);
+}
+
+// Splits by the surface area orientation heuristic over 12 centroid buckets per axis, so
+// lights close together and facing alike share subtrees
+int light_set::build_node(std::vector<build_item>& items, int begin, int end, uint64_t trail, int depth) {
+    const int self = static_cast<int>(nodes.size());
+    nodes.emplace_back();
+    light_bounds all;
+    aabb centroids;
+    for (int i = begin; i < end; i++) {
+        all = light_bounds::merge(all, items[i].bounds);
+        centroids.expand(items[i].bounds.box.centroid());
+    }
+    nodes[self].bounds = all;
+
+    // The trail has 64 bits; deeper trees would only come from thousands of coincident lights
+    if (end - begin == 1 || depth == 63) {
+        nodes[self].leaf = true;
+        nodes[self].index = items[begin].emitter;
+        trails[items[begin].emitter] = trail;
+        if (end - begin > 1)
+            nodes[self].bounds = items[begin].bounds;      // the rest cannot be reached
+        return self;
+    }
+
+    const int buckets = 12;
+    double best_cost = infinity;
+    int best_axis = -1, best_split = 0;
+    const vec3 extent = all.box.max() - all.box.min();
+    const double max_extent = std::max(extent.x(), std::max(extent.y(), extent.z()));
+    for (int axis = 0; axis < 3; axis++) {
+        const double lo = centroids.min()[axis], hi = centroids.max()[axis];
+        if (hi <= lo)
+            continue;
+        light_bounds bucket[buckets];
+        for (int i = begin; i < end; i++) {
+            int b = static_cast<int>(buckets * (items[i].bounds.box.centroid()[axis] - lo) / (hi - lo));
+            bucket[std::min(b, buckets - 1)] = light_bounds::merge(bucket[std::min(b, buckets - 1)], items[i].bounds);
+        }
+        // Thin boxes would otherwise look free along their long axis
+        const double regularize = extent[axis] > 0 ? max_extent / extent[axis] : 1;
+        auto cost = [&](const light_bounds& b) {
+            return b.phi * light_cone_measure(b) * b.box.surface_area();
+        };
+        for (int split = 1; split < buckets; split++) {
+            light_bounds below, above;
+            for (int b = 0; b < split; b++)
+                below = light_bounds::merge(below, bucket[b]);
+            for (int b = split; b < buckets; b++)
+                above = light_bounds::merge(above, bucket[b]);
+            const double c = regularize * (cost(below) + cost(above));
+            if (below.phi > 0 && above.phi > 0 && c < best_cost) {
+                best_cost = c;
+                best_axis = axis;
+                best_split = split;
+            }
+        }
+    }
+
+    int mid;
+    if (best_axis < 0) {
+        mid = (begin + end) / 2;    // all centroids coincide
+    } else {
+        const double lo = centroids.min()[best_axis], hi = centroids.max()[best_axis];
+        auto middle = std::partition(items.begin() + begin, items.begin() + end, [&](const build_item& item) {
+            const int b = static_cast<int>(buckets * (item.bounds.box.centroid()[best_axis] - lo) / (hi - lo));
+            return std::min(b, buckets - 1) < best_split;
+        });
+        mid = static_cast<int>(middle - items.begin());
+    }
+
+    build_node(items, begin, mid, trail, depth + 1);
+    const int second = build_node(items, mid, end, trail | (uint64_t(1) << depth), depth + 1);
+    nodes[self].index = second;
+    return self;
+}
+
+int light_set::sample(light_sampling mode, const point3& p, const vec3& n, double u, double& pmf) const {
+    if (mode == light_sampling::uniform) {
+        if (emitters.empty())
+            return -1;
+        pmf = 1.0 / emitters.size();
+        return std::min(static_cast<int>(u * emitters.size()), static_cast<int>(emitters.size()) - 1);
+    }
+    if (nodes.empty())
+        return -1;
+
+    // u is stretched back to [0, 1) after each choice, so one number serves every level
+    int i = 0;
+    pmf = 1;
+    while (!nodes[i].leaf) {
+        const int first = i + 1, second = nodes[i].index;
+        const double w0 = nodes[first].bounds.importance(p, n);
+        const double w1 = nodes[second].bounds.importance(p, n);
+        if (w0 == 0 && w1 == 0)
+            return -1;
+        const double p0 = w0 / (w0 + w1);
+        if (u < p0) {
+            i = first;
+            u = std::min(u / p0, 1 - 1e-12);
+            pmf *= p0;
+        } else {
+            i = second;
+            u = std::min((u - p0) / (1 - p0), 1 - 1e-12);
+            pmf *= 1 - p0;
+        }
+    }
+    // A lone light still has to be able to reach the point
+    if (i == 0 && nodes[0].bounds.importance(p, n) == 0)
+        return -1;
+    return nodes[i].index;
+}
+
+int light_set::sample_power(double u, double& pmf) const {
+    if (power_cdf.empty())
+        return -1;
+    const int index = std::min(static_cast<int>(std::upper_bound(power_cdf.begin(), power_cdf.end(), u) - power_cdf.begin()),
+                               static_cast<int>(power_cdf.size()) - 1);
+    pmf = power_pmf(index);
+    return index;
+}
+
+double light_set::power_pmf(int index) const {
+    if (power_cdf.empty())
+        return 0;
+    return power_cdf[index] - (index > 0 ? power_cdf[index - 1] : 0);
+}
+
+double light_set::pmf(light_sampling mode, const point3& p, const vec3& n, int index) const {
+    if (mode == light_sampling::uniform)
+        return emitters.empty() ? 0 : 1.0 / emitters.size();
+    if (nodes.empty())
+        return 0;
+
+    uint64_t trail = trails[index];
+    int i = 0;
+    double pmf = 1;
+    while (!nodes[i].leaf) {
+        const int first = i + 1, second = nodes[i].index;
+        const double w0 = nodes[first].bounds.importance(p, n);
+        const double w1 = nodes[second].bounds.importance(p, n);
+        if (w0 == 0 && w1 == 0)
+            return 0;
+        if (trail & 1) {
+            pmf *= w1 / (w0 + w1);
+            i = second;
+        } else {
+            pmf *= w0 / (w0 + w1);
+            i = first;
+        }
+        trail >>= 1;
+    }
+    if (nodes[i].index != index)
+        return 0;       // dropped at build: no area or no power
+    if (i == 0 && nodes[0].bounds.importance(p, n) == 0)
+        return 0;
+    return pmf;
+}
+
+#endif
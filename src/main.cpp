@@ -1,111 +1,364 @@
 #include "rtweekend.h"
-#include "color.h"
-#include "camera.h"
-#include "hittable_list.h"
-#include "aarect.h"
-#include "material.h"
+#include "scene.h"
+#include "renderer.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include "heatmap.h"
+#include "checkpoint.h"
+#include "farm.h"
+#include "denoise.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <string>
 
-// Recursive ray bouncing
-color ray_color(const ray& r, const hittable& world, int depth) {
-    // If we've exceeded the ray bounce limit, no more light is gathered
-    if (depth <= 0)
-        return color(0, 0, 0);
-
-    hit_record rec;
-    
-    // If the ray hits nothing, return black
-    if (!world.hit(r, 0.001, infinity, rec))
-        return color(0, 0, 0); // Background is black in Cornell Box
-
-    ray scattered;
-    color attenuation;
-    color emitted = rec.mat->emitted();
-
-    // If light hit the diffuse surface, scatter the ray
-    if (rec.mat->scatter(r, rec, attenuation, scattered)) {
-        return emitted + attenuation * ray_color(scattered, world, depth-1);
-    }
-    
-    // Otherwise, hit the light source and return emitted light
-    return emitted;
-}
-
-int main() {
-    // Image
-    const auto aspect_ratio = 1.0;
-    const int image_width = 600;
-    const int image_height = static_cast<int>(image_width / aspect_ratio);
-    const int samples_per_pixel = 200;
-    const int max_depth = 10;
-
-    // World - Cornell Box
-    hittable_list world;
-    
-    // Materials
-    auto red   = make_shared<lambertian>(color(0.65, 0.05, 0.05));
-    auto white = make_shared<lambertian>(color(0.73, 0.73, 0.73));
-    auto green = make_shared<lambertian>(color(0.12, 0.45, 0.15));
-    auto light = make_shared<diffuse_light>(color(15, 15, 15));
-
-    // Cornell Box: 555 units cube
-    // Left wall (green)
-    world.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
-    // Right wall (red)
-    world.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
-    // Light (centered on ceiling, smaller than ceiling)
-    world.add(make_shared<xz_rect>(213, 343, 227, 332, 554, light));
-    // Floor (white)
-    world.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
-    // Ceiling (white)
-    world.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
-    // Back wall (white)
-    world.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
-
-    // Two boxes (tall and short)
-    // Tall box (right side)
-    world.add(make_shared<xz_rect>(265, 430, 295, 460, 330, white));  // Top
-    world.add(make_shared<xy_rect>(265, 430, 0, 330, 460, white));    // Front
-    world.add(make_shared<xy_rect>(265, 430, 0, 330, 295, white));    // Back
-    world.add(make_shared<yz_rect>(0, 330, 295, 460, 265, white));    // Left
-    world.add(make_shared<yz_rect>(0, 330, 295, 460, 430, white));    // Right
-
-    // Short box (left side)
-    world.add(make_shared<xz_rect>(130, 295, 65, 230, 165, white));   // Top
-    world.add(make_shared<xy_rect>(130, 295, 0, 165, 230, white));    // Front
-    world.add(make_shared<xy_rect>(130, 295, 0, 165, 65, white));     // Back
-    world.add(make_shared<yz_rect>(0, 165, 65, 230, 130, white));     // Left
-    world.add(make_shared<yz_rect>(0, 165, 65, 230, 295, white));     // Right
-
-    // Camera positioned to view the Cornell Box
-    point3 lookfrom(278, 278, -800);
-    point3 lookat(278, 278, 0);
-    vec3 vup(0, 1, 0);
-    auto dist_to_focus = 10.0;
-    auto aperture = 0.0;
-    auto vfov = 40.0;
-
-    camera cam(lookfrom, lookat, vup, vfov, aspect_ratio);
+int main(int argc, char* argv[]) {
+    const char* scene_path = nullptr;
+    const char* pfm_path = nullptr;
+    const char* variance_path = nullptr;
+    const char* stats_path = nullptr;
+    const char* trace_path = nullptr;
+    std::string heatmap_prefix;
+    bool denoise_image = false;
+    std::string aov_prefix;
+    const char* checkpoint_path = nullptr;
+    double checkpoint_interval = 300;
+    bool resume = false;
+    const char* partial_path = nullptr;
+    int crop[4] = {0, 0, 0, 0};
+    bool cropped = false;
+    const char* worker_address = nullptr;
+    const char* listen_address = nullptr;
+    int farm_workers = 0;
+    const char* integrator_name = nullptr;
+    int threads = 0;
+    bool usage_error = false;
+    for (int a = 1; a < argc; a++) {
+        if (std::strcmp(argv[a], "--threads") == 0 && a + 1 < argc)
+            threads = std::atoi(argv[++a]);
+        else if (std::strcmp(argv[a], "--pfm") == 0 && a + 1 < argc)
+            pfm_path = argv[++a];
+        else if (std::strcmp(argv[a], "--variance") == 0 && a + 1 < argc)
+            variance_path = argv[++a];
+        else if (std::strcmp(argv[a], "--stats") == 0 && a + 1 < argc)
+            stats_path = argv[++a];
+        else if (std::strcmp(argv[a], "--trace") == 0 && a + 1 < argc)
+            trace_path = argv[++a];
+        else if (std::strcmp(argv[a], "--heatmap") == 0 && a + 1 < argc)
+            heatmap_prefix = argv[++a];
+        else if (std::strcmp(argv[a], "--integrator") == 0 && a + 1 < argc)
+            integrator_name = argv[++a];
+        else if (std::strcmp(argv[a], "--denoise") == 0)
+            denoise_image = true;
+        else if (std::strcmp(argv[a], "--aov") == 0 && a + 1 < argc)
+            aov_prefix = argv[++a];
+        else if (std::strcmp(argv[a], "--checkpoint") == 0 && a + 1 < argc)
+            checkpoint_path = argv[++a];
+        else if (std::strcmp(argv[a], "--checkpoint-interval") == 0 && a + 1 < argc)
+            checkpoint_interval = std::atof(argv[++a]);
+        else if (std::strcmp(argv[a], "--resume") == 0)
+            resume = true;
+        else if (std::strcmp(argv[a], "--crop") == 0 && a + 4 < argc) {
+            for (int c = 0; c < 4; c++)
+                crop[c] = std::atoi(argv[++a]);
+            cropped = true;
+        } else if (std::strcmp(argv[a], "--partial") == 0 && a + 1 < argc)
+            partial_path = argv[++a];
+        else if (std::strcmp(argv[a], "--farm") == 0 && a + 1 < argc)
+            farm_workers = std::atoi(argv[++a]);
+        else if (std::strcmp(argv[a], "--listen") == 0 && a + 1 < argc)
+            listen_address = argv[++a];
+        else if (std::strcmp(argv[a], "--worker") == 0 && a + 1 < argc)
+            worker_address = argv[++a];
+        else if (!scene_path && argv[a][0] != '-')
+            scene_path = argv[a];
+        else
+            usage_error = true;
+    }
+    const bool farm = farm_workers > 0 || listen_address;
+    // Features are neither checkpointed nor sent back by farm workers
+    const bool features = denoise_image || !aov_prefix.empty();
+    if (usage_error || !scene_path || threads < 0 || farm_workers < 0 || (resume && !checkpoint_path)
+        || (farm && (checkpoint_path || worker_address)) || (features && (farm || resume))) {
+        std::cerr << "Usage: " << argv[0] << " [--threads N] [--pfm image.pfm] [--variance variance.pfm]"
+                     " [--stats stats.json] [--trace trace.json] [--heatmap prefix]\n"
+                     "           [--integrator path|bdpt|photon|ppm|guided|mlt] [--denoise] [--aov prefix]\n"
+                     "           [--checkpoint file [--checkpoint-interval seconds] [--resume]]\n"
+                     "           [--crop x0 y0 x1 y1] [--partial file]\n"
+                     "           [--farm workers] [--listen unix:path|host:port] [--worker address] <scene file>\n";
+        return 1;
+    }
+
+    // Timeline of the whole run, viewable in chrome://tracing or ui.perfetto.dev
+    if (trace_path) {
+        trace_thread_name() = "main";
+        trace_start();
+    }
+
+#ifndef PT_FARM
+    if (farm || worker_address) {
+        std::cerr << "Error: the render farm needs POSIX sockets\n";
+        return 1;
+    }
+#endif
+
+    // Threads render tiles and build the BVHs; 0 means one per hardware thread. Local farm
+    // workers share the machine, so they get an equal part of it each.
+    const int worker_threads = threads > 0 ? threads : std::max(1, thread_pool::hardware_threads() / std::max(1, farm_workers));
+    thread_pool pool(farm ? 1 : threads);
+
+    // Scene
+    scene scn;
+    try {
+        scn = load_scene(scene_path, &pool);
+        if (integrator_name && !integrator_from_name(integrator_name, scn.settings.integrator))
+            throw std::runtime_error("unknown integrator '" + std::string(integrator_name) + "'");
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+    // Every farm job would shoot all the photon passes of the frame again for its few pixels
+    if ((farm || worker_address)
+        && (scn.settings.integrator == integrator_type::photon || scn.settings.integrator == integrator_type::ppm)) {
+        std::cerr << "Error: the photon integrators do not run on the render farm\n";
+        return 1;
+    }
+    // The guide learns from every pixel of each pass; a farm job or a crop sees only some
+    if (scn.settings.integrator == integrator_type::guided && (farm || worker_address || cropped)) {
+        std::cerr << "Error: the guided integrator does not run on the render farm or with --crop\n";
+        return 1;
+    }
+    // The cache trains on paths from the whole image, which every farm job or crop would repeat
+    if (scn.settings.radiance_cache && scn.settings.integrator == integrator_type::path
+        && (farm || worker_address || cropped)) {
+        std::cerr << "Error: radiance_cache does not run on the render farm or with --crop\n";
+        return 1;
+    }
+    // ReSTIR reuses neighbouring pixels' and earlier samples' light
+    if (scn.settings.restir && scn.settings.integrator == integrator_type::path && !scn.settings.radiance_cache
+        && (farm || worker_address || cropped)) {
+        std::cerr << "Error: restir does not run on the render farm or with --crop\n";
+        return 1;
+    }
+    // The other integrators carry RGB
+    if (scn.settings.spectral
+        && ((scn.settings.integrator != integrator_type::path && scn.settings.integrator != integrator_type::mlt)
+            || (scn.settings.integrator == integrator_type::path
+                && (scn.settings.radiance_cache || scn.settings.restir)))) {
+        std::cerr << "Error: spectral needs the path integrator, without radiance_cache or restir, or mlt\n";
+        return 1;
+    }
+    // Metropolis chains wander over the whole image and record no first-hit features
+    if (scn.settings.integrator == integrator_type::mlt && (farm || worker_address || cropped || features)) {
+        std::cerr << "Error: the mlt integrator does not run on the render farm or with --crop, --denoise or --aov\n";
+        return 1;
+    }
+    // Its steps are correlated splats, not independent samples, so a pixel has no sample variance
+    if (scn.settings.integrator == integrator_type::mlt && variance_path) {
+        std::cerr << "Error: the mlt integrator has no per-pixel variance for --variance\n";
+        return 1;
+    }
+#ifdef PT_FARM
+    // A worker renders whatever jobs its coordinator sends, then exits
+    if (worker_address) {
+        try {
+            run_farm_worker(worker_address, scn, pool);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << '\n';
+            return 1;
+        }
+        return 0;
+    }
+#endif
+
+    std::clog << "Scene: " << scn.primitive_count << " primitives, " << scn.instance_count
+              << " instances, " << scn.memory_usage() / 1024 << " KiB; parsed in " << scn.parse_ms
+              << " ms, built in " << scn.build_ms << " ms on " << pool.size() << " threads\n";
 
     // Render
-    std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-
-    for (int j = image_height-1; j >= 0; --j) {
-        std::clog << "\rScanlines remaining: " << j << ' ' << std::flush;
-        for (int i = 0; i < image_width; ++i) {
-            color pixel_color(0, 0, 0);
-            
-            // Multiple samples per pixel for antialiasing and noise reduction
-            for (int s = 0; s < samples_per_pixel; ++s) {
-                auto u = (i + random_double()) / (image_width-1);
-                auto v = (j + random_double()) / (image_height-1);
-                ray r = cam.get_ray(u, v);
-                pixel_color += ray_color(r, world, max_depth);
+    const auto& settings = scn.settings;
+    framebuffer fb(settings.image_width, settings.image_height);
+    if (!heatmap_prefix.empty())
+        fb.track_cost();
+    if (features)
+        fb.track_features();
+    renderer render(scn, pool);
+
+    // The crop window counts rows from the top like image viewers; the framebuffer from the bottom
+    if (cropped) {
+        if (crop[0] < 0 || crop[1] < 0 || crop[2] > settings.image_width || crop[3] > settings.image_height
+            || crop[2] <= crop[0] || crop[3] <= crop[1]) {
+            std::cerr << "Error: crop window outside the " << settings.image_width << "x"
+                      << settings.image_height << " image\n";
+            return 1;
+        }
+        render.region.x0 = crop[0];
+        render.region.x1 = crop[2];
+        render.region.y0 = settings.image_height - crop[3];
+        render.region.y1 = settings.image_height - crop[1];
+    }
+
+    // Long renders go in passes, with a checkpoint between passes every interval. Each
+    // pixel keeps its own random sequence, so the pass size does not change the image.
+    const checkpoint_settings ckpt_settings(settings);
+    std::unique_ptr<checkpoint_writer> checkpoints;
+    auto last_checkpoint = std::chrono::steady_clock::now();
+    try {
+        if (resume) {
+            read_checkpoint(checkpoint_path, fb, ckpt_settings);
+            std::clog << "Resuming from " << checkpoint_path << '\n';
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+    if (checkpoint_path) {
+        checkpoints = std::make_unique<checkpoint_writer>(checkpoint_path, ckpt_settings);
+        render.pass_samples = std::max(1, settings.samples_per_pixel / 32);
+        render.on_pass = [&](const framebuffer& partial) {
+            const auto now = std::chrono::steady_clock::now();
+            if (std::chrono::duration<double>(now - last_checkpoint).count() >= checkpoint_interval) {
+                checkpoints->submit(partial);
+                last_checkpoint = now;
             }
-            
-            write_color(std::cout, pixel_color, samples_per_pixel);
+        };
+    }
+
+    render_stats stats;
+#ifdef PT_FARM
+    if (farm) {
+        // Local workers meet the coordinator on a private Unix socket unless told otherwise
+        const std::string address = listen_address ? std::string(listen_address)
+                                                   : "unix:/tmp/pt-farm-" + std::to_string(::getpid()) + ".sock";
+        char self[4096];
+        const ssize_t len = ::readlink("/proc/self/exe", self, sizeof(self) - 1);
+        const std::string program = len > 0 ? std::string(self, static_cast<size_t>(len)) : std::string(argv[0]);
+        try {
+            farm_coordinator coordinator(scn, address);
+            coordinator.listen();
+            std::vector<std::string> options;
+            if (integrator_name)
+                options = {"--integrator", integrator_name};
+            coordinator.spawn_workers(program, scene_path, farm_workers, worker_threads, options);
+            std::clog << "Farm: listening on " << address << ", " << farm_workers << " local workers of "
+                      << worker_threads << " threads\n";
+            stats = coordinator.render(fb, render.region);
+            print_farm_report(std::clog, coordinator.workers, stats.seconds);
+        } catch (const std::exception& e) {
+            std::cerr << "\nError: " << e.what() << '\n';
+            return 1;
+        }
+    } else
+#endif
+    stats = render.render(fb);
+
+    // The finished render is checkpointed too, so it can later be taken to more samples
+    if (checkpoints) {
+        checkpoints->submit(fb);
+        checkpoints->flush();
+    }
+
+    // Output
+    const auto output_start = std::chrono::steady_clock::now();
+    float_image denoised;
+    double denoise_ms = 0;
+    if (denoise_image) {
+        const auto denoise_start = std::chrono::steady_clock::now();
+        denoised = denoise(fb, pool);
+        denoise_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - denoise_start).count();
+        std::clog << "\rDenoised in " << denoise_ms << " ms on " << pool.size() << " threads\n";
+    }
+    {
+        trace_scope trace("write ppm", "output");
+        if (denoise_image)
+            write_ppm(std::cout, denoised);
+        else
+            write_ppm(std::cout, fb);
+    }
+
+    // Unclamped linear output for image comparisons, and the rendered region for merging
+    try {
+        if (partial_path) {
+            trace_scope trace("write partial", "output");
+            pixel_rect region = render.region;
+            if (region.empty())
+                region = pixel_rect{0, 0, fb.width, fb.height};
+            write_partial(partial_path, fb, region);
+        }
+        if (pfm_path) {
+            trace_scope trace("write pfm", "output");
+            write_pfm(pfm_path, denoise_image ? denoised : fb.mean());
+        }
+        if (variance_path) {
+            trace_scope trace("write variance", "output");
+            write_pfm(variance_path, fb.variance());
+        }
+
+        // First-hit albedo, normal and distance, as the denoiser saw them
+        if (!aov_prefix.empty()) {
+            trace_scope trace("write aovs", "output");
+            write_pfm(aov_prefix + "_albedo.pfm", fb.albedo_image());
+            write_pfm(aov_prefix + "_normal.pfm", fb.normal_image());
+            write_pfm(aov_prefix + "_depth.pfm", fb.distance_image());
+        }
+
+        // Cost per pixel: raw rays, nodes and nanoseconds, plus a false-colour map of each
+        if (!heatmap_prefix.empty()) {
+            trace_scope trace("write heatmaps", "output");
+            const auto cost = fb.cost_image();
+            write_pfm(heatmap_prefix + "_cost.pfm", cost);
+            const char* names[3] = {"rays", "nodes", "time"};
+            const char* units[3] = {"rays", "nodes", "ns"};
+            for (int c = 0; c < 3; c++) {
+                if (c == 1 && !path_counters_enabled())
+                    continue;   // node visits are only counted with PT_STATS
+                const auto path = heatmap_prefix + "_" + names[c] + ".ppm";
+                const double top = write_heatmap(path, cost, c);
+                std::clog << "\rHeatmap " << path << ": 0 to " << top << ' ' << units[c] << " per pixel\n";
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+
+    phase_times phases;
+    phases.parse_ms = scn.parse_ms;
+    phases.build_ms = scn.build_ms;
+    phases.render_ms = stats.seconds * 1000;
+    phases.output_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - output_start).count();
+    phases.denoise_ms = denoise_ms;
+
+    std::clog << "\rDone in " << stats.seconds << " s, " << stats.rays() / stats.seconds / 1e6 << " Mrays/s\n";
+    if (path_counters_enabled())
+        print_stats(std::clog, stats, phases);
+    else {
+        print_photon_stats(std::clog, stats);
+        print_cache_stats(std::clog, stats);
+        print_guiding_stats(std::clog, stats);
+        print_restir_stats(std::clog, stats);
+        print_mlt_stats(std::clog, stats);
+    }
+
+    if (stats_path) {
+        std::ofstream out(stats_path);
+        write_stats_json(out, stats, phases);
+        if (!out) {
+            std::cerr << "Error: cannot write '" << stats_path << "'\n";
+            return 1;
         }
     }
 
-    std::clog << "\rDone.                 \n";
+    if (trace_path) {
+        std::ofstream out(trace_path);
+        trace_write(out);
+        if (!out) {
+            std::cerr << "Error: cannot write '" << trace_path << "'\n";
+            return 1;
+        }
+    }
 }
\ No newline at end of file
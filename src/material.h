@@ -3,6 +3,8 @@
 
 #include "rtweekend.h"
 #include "hittable.h"
+#include "color.h"
+#include "spectrum.h"
 
 class material {
 public:
@@ -10,12 +12,45 @@ public:
     virtual color emitted() const {
         return color(0, 0, 0);
     }
+    // Surface colour for the denoiser's albedo feature
+    virtual color surface_albedo() const {
+        return color(1, 1, 1);
+    }
+    // BSDF times the cosine for light arriving from wi, and the density scatter() samples
+    // wi with (per solid angle); zero for materials light sampling cannot help
+    virtual color eval(const hit_record& rec, const vec3& wi) const {
+        return color(0, 0, 0);
+    }
+    virtual double pdf(const hit_record& rec, const vec3& wi) const {
+        return 0;
+    }
+
+    // Spectral rendering (see spectrum.h): scatter()'s attenuation and emitted() at a path's
+    // wavelengths, and eval(), which for every material here is the reflectance times pdf()
+    virtual spectrum4 reflectance(const wavelengths& wl) const {
+        return spectrum4(0);
+    }
+    virtual spectrum4 emission(const wavelengths& wl) const {
+        return spectrum4(0);
+    }
+    virtual spectrum4 eval(const hit_record& rec, const vec3& wi, const wavelengths& wl) const {
+        return reflectance(wl) * static_cast<float>(pdf(rec, wi));
+    }
+    // scatter() for light of wavelength `lambda` (nm); only a dispersive material's
+    // direction depends on it
+    virtual bool scatter_spectral(const ray& r_in, const hit_record& rec, double lambda, ray& scattered) const {
+        color attenuation;
+        return scatter(r_in, rec, attenuation, scattered);
+    }
+    virtual bool dispersive() const {
+        return false;
+    }
 };
 
 // Diffuse Material
 class lambertian : public material {
 public:
-    lambertian(const color& a) : albedo(a) {}
+    lambertian(const color& a) : albedo(a), albedo_spectrum(a) {}
 
     virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
         auto scatter_direction = rec.normal + random_unit_vector();
@@ -29,8 +64,28 @@ public:
         return true;
     }
 
+    virtual color surface_albedo() const override {
+        return albedo;
+    }
+
+    // scatter() picks normal + a unit vector, which is cosine-distributed: the density is
+    // cos/pi, and albedo/pi times the cosine is the albedo times that
+    virtual color eval(const hit_record& rec, const vec3& wi) const override {
+        return albedo * pdf(rec, wi);
+    }
+
+    virtual double pdf(const hit_record& rec, const vec3& wi) const override {
+        const double cosine = dot(rec.normal, unit_vector(wi));
+        return cosine > 0 ? cosine / pi : 0;
+    }
+
+    virtual spectrum4 reflectance(const wavelengths& wl) const override {
+        return albedo_spectrum.at(wl);
+    }
+
 public:
     color albedo;
+    rgb_spectrum albedo_spectrum;
 
 private:
     static vec3 random_unit_vector() {
@@ -49,7 +104,7 @@ private:
 // Emissive Material (Light Source)
 class diffuse_light : public material {
 public:
-    diffuse_light(const color& c) : emit_color(c) {}
+    diffuse_light(const color& c) : emit_color(c), emit_spectrum(c) {}
 
     virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
         return false;
@@ -59,8 +114,68 @@ public:
         return emit_color;
     }
 
+    virtual spectrum4 emission(const wavelengths& wl) const override {
+        return emit_spectrum.at(wl);
+    }
+
 public:
     color emit_color;
+    rgb_spectrum emit_spectrum;
+};
+
+// Clear glass: each ray refracts, or reflects as often as Schlick's approximation of the
+// Fresnel term says. The index follows Cauchy's equation, n = A + B / lambda^2 with lambda in
+// micrometres, given by its value at the helium d line (587.6 nm) and B; B = 0 does not
+// disperse. RGB renders use the index at the d line; spectral ones bend each path's hero.
+class dielectric : public material {
+public:
+    dielectric(double index, double b = 0) : ior(index), cauchy_b(b) {}
+
+    virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
+        attenuation = color(1, 1, 1);
+        scattered = bend(r_in, rec, ior);
+        return true;
+    }
+
+    virtual spectrum4 reflectance(const wavelengths& wl) const override {
+        return spectrum4(1);
+    }
+
+    virtual bool scatter_spectral(const ray& r_in, const hit_record& rec, double lambda, ray& scattered) const override {
+        scattered = bend(r_in, rec, index_at(lambda));
+        return true;
+    }
+
+    virtual bool dispersive() const override {
+        return cauchy_b != 0;
+    }
+
+    double index_at(double lambda) const {
+        const double um = lambda / 1000;
+        return ior + cauchy_b * (1 / (um * um) - 1 / (0.5876 * 0.5876));
+    }
+
+public:
+    double ior;         // at 587.6 nm
+    double cauchy_b;    // in square micrometres
+
+private:
+    static ray bend(const ray& r_in, const hit_record& rec, double index) {
+        const double ratio = rec.front_face ? 1 / index : index;
+        const vec3 unit_direction = unit_vector(r_in.direction());
+        const double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
+        const double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+        const bool cannot_refract = ratio * sin_theta > 1.0;
+        if (cannot_refract || schlick(cos_theta, ratio) > random_double())
+            return ray(rec.p, reflect(unit_direction, rec.normal));
+        return ray(rec.p, refract(unit_direction, rec.normal, ratio));
+    }
+
+    static double schlick(double cosine, double ratio) {
+        auto r0 = (1 - ratio) / (1 + ratio);
+        r0 = r0 * r0;
+        return r0 + (1 - r0) * pow(1 - cosine, 5);
+    }
 };
 
 #endif
@@ -0,0 +1,164 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "triangle.h"
+#include "bvh.h"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Indexed Triangle Mesh
+//
+// Vertices are shared between faces and the mesh carries its own BVH over the triangles,
+// so a million-triangle mesh is one scene object rather than a million shared_ptrs.
+
+class triangle_mesh : public hittable {
+public:
+    triangle_mesh() {}
+    triangle_mesh(std::vector<point3> verts, std::vector<int> tris, shared_ptr<material> mat)
+        : vertices(std::move(verts)), indices(std::move(tris)), mp(mat) {
+        build();
+    }
+
+    int triangle_count() const { return static_cast<int>(indices.size() / 3); }
+
+    // (Re)builds the BVH after the vertex positions change
+    void build();
+
+    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+    virtual bool bounding_box(aabb& output_box) const override {
+        output_box = tree.bounds();
+        return !tree.empty();
+    }
+
+    virtual size_t memory_usage() const override {
+        return sizeof(*this) + vertices.capacity() * sizeof(point3) + indices.capacity() * sizeof(int)
+             + tree.memory_usage();
+    }
+
+public:
+    std::vector<point3> vertices;
+    std::vector<int> indices;   // three vertex indices per triangle
+    shared_ptr<material> mp;
+    bvh_tree tree;
+};
+
+void triangle_mesh::build() {
+    std::vector<aabb> boxes(triangle_count());
+    for (int i = 0; i < triangle_count(); i++) {
+        boxes[i] = triangle_box(vertices[indices[3*i]], vertices[indices[3*i+1]], vertices[indices[3*i+2]]);
+    }
+    tree.build(boxes);
+}
+
+bool triangle_mesh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    int hit_tri = -1;
+    double hit_t = t_max;
+    bool hit_anything = tree.intersect(r, t_min, t_max, [&](int i, double t0, double& t1) {
+        double t;
+        if (!intersect_triangle(r, vertices[indices[3*i]], vertices[indices[3*i+1]], vertices[indices[3*i+2]], t0, t1, t))
+            return false;
+        t1 = hit_t = t;
+        hit_tri = i;
+        return true;
+    });
+    if (!hit_anything)
+        return false;
+
+    // Only the closest triangle needs the full hit record
+    const auto& v0 = vertices[indices[3*hit_tri]];
+    const auto& v1 = vertices[indices[3*hit_tri+1]];
+    const auto& v2 = vertices[indices[3*hit_tri+2]];
+    rec.t = hit_t;
+    rec.p = r.at(hit_t);
+    rec.set_face_normal(r, unit_vector(cross(v1 - v0, v2 - v0)));
+    rec.mat = mp.get();
+    rec.light = -1;
+    return true;
+}
+
+// Tessellated Sphere
+//
+// A UV sphere with `segments` slices and segments/2 stacks, about segments^2 triangles.
+// Handy for building large meshes without shipping model files.
+inline void make_uv_sphere(
+    const point3& center, double radius, int segments, std::vector<point3>& vertices, std::vector<int>& indices
+) {
+    const int stacks = segments / 2 > 1 ? segments / 2 : 2;
+    const int base = static_cast<int>(vertices.size());
+
+    for (int j = 0; j <= stacks; j++) {
+        auto theta = pi * j / stacks;
+        for (int i = 0; i < segments; i++) {
+            auto phi = 2 * pi * i / segments;
+            vertices.push_back(center + radius * vec3(sin(theta)*cos(phi), cos(theta), sin(theta)*sin(phi)));
+        }
+    }
+
+    auto vertex = [&](int i, int j) { return base + j*segments + i % segments; };
+    for (int j = 0; j < stacks; j++) {
+        for (int i = 0; i < segments; i++) {
+            // The pole rows collapse to a point, so they only need one triangle per quad
+            if (j != 0) {
+                indices.push_back(vertex(i, j));
+                indices.push_back(vertex(i+1, j));
+                indices.push_back(vertex(i, j+1));
+            }
+            if (j != stacks - 1) {
+                indices.push_back(vertex(i+1, j));
+                indices.push_back(vertex(i+1, j+1));
+                indices.push_back(vertex(i, j+1));
+            }
+        }
+    }
+}
+
+// Wavefront OBJ Loading
+//
+// Only positions ("v") and faces ("f") are read; polygons are fan-triangulated and
+// texture/normal references ("v/vt/vn") are ignored.
+inline void load_obj(const std::string& path, std::vector<point3>& vertices, std::vector<int>& indices) {
+    std::ifstream in(path);
+    if (!in)
+        throw std::runtime_error("cannot open mesh file '" + path + "'");
+
+    const int base = static_cast<int>(vertices.size());
+    std::string line;
+    int line_number = 0;
+    while (std::getline(in, line)) {
+        line_number++;
+        std::istringstream ss(line);
+        std::string tag;
+        ss >> tag;
+
+        if (tag == "v") {
+            double x, y, z;
+            if (!(ss >> x >> y >> z))
+                throw std::runtime_error(path + ":" + std::to_string(line_number) + ": malformed vertex");
+            vertices.emplace_back(x, y, z);
+        } else if (tag == "f") {
+            std::vector<int> face;
+            std::string token;
+            while (ss >> token) {
+                int index = std::stoi(token.substr(0, token.find('/')));
+                // OBJ indices are 1-based; negative ones count back from the newest vertex
+                index = index < 0 ? static_cast<int>(vertices.size()) + index : base + index - 1;
+                if (index < base || index >= static_cast<int>(vertices.size()))
+                    throw std::runtime_error(path + ":" + std::to_string(line_number) + ": vertex index out of range");
+                face.push_back(index);
+            }
+            for (size_t k = 2; k < face.size(); k++) {
+                indices.push_back(face[0]);
+                indices.push_back(face[k-1]);
+                indices.push_back(face[k]);
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,333 @@
+#ifndef MLT_H
+#define MLT_H
+
+#include "rtweekend.h"
+#include "color.h"
+#include "lights.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Metropolis Light Transport
+//
+// Primary sample space MLT (Kelemen et al. 2002). A path is a function of the numbers it
+// is built from: the path tracer's own draws from random_double(), the first two placing
+// the camera ray on the image. Markov chains wander over those numbers, each step proposing
+// either a fresh path (a large step) or a small perturbation of every number the current
+// path used, and accepting it with probability min(1, I(new) / I(old)), where I is the
+// luminance the path brings back. The chains so spend their time on paths in proportion to
+// their light, and once one finds its way through a narrow gap it keeps exploring nearby
+// paths instead of losing them the way independent samples do.
+//
+// A chain visits paths in proportion to I, not to their light in each pixel, so every step
+// adds the path's colour over I, times b, the mean of I over all paths, to the pixel it
+// lands in. b comes from a bootstrap of independent paths before the chains start, and each
+// chain starts from one of those paths chosen in proportion to I, so it starts from the
+// distribution it samples instead of burning in. The image's brightness is exactly b's, so
+// the bootstrap's error would stay in it however long the chains run; the large steps are
+// independent paths as well, so the image is rescaled to b over them and the bootstrap
+// together (Kelemen's estimate), which converges with the rest. Both the proposal and the current path
+// are added at every step, weighted by the chance of accepting and of rejecting (Veach's
+// expected values), which keeps dark proposals from being wasted.
+//
+// The chains' count is fixed, not one per thread, and each runs its own share of the
+// spp * width * height steps from its own stream; their additions are fixed-point atomic
+// adds, whose sum does not depend on the order. Images are so the same for any thread count
+// or pass split, and a chain picks up where it stopped when a render continues.
+
+struct mlt_settings {
+    int bootstrap = 100000;     // independent paths b is estimated from
+    int chains = 64;
+    double large_step = 0.3;    // share of steps that propose a fresh path
+    double sigma = 0.01;        // spread of a small step in each number
+    uint64_t seed = 0;
+};
+
+namespace mlt_detail {
+
+constexpr double fixed_one = 16777216.0;        // pixel sums count in units of 2^-24
+const uint64_t chain_stream = 1ull << 40;       // chains draw from streams past the bootstrap's
+
+// Most one deposit adds to a channel. A step's two deposits add at most b / 0.0722 (blue's
+// share of the luminance), so this only cuts off a broken path; a pixel's sum still has
+// room for about a million deposits of it before the uint64 wraps.
+constexpr double max_deposit = 1e6;
+static_assert(max_deposit * fixed_one * 1e6 < 18446744073709551615.0, "no headroom in the pixel sums");
+
+// One number a path is built from, with its value before the step in progress
+struct primary_sample {
+    double value = 0, backup = 0;
+    int64_t modified = -1;          // step it last changed at; -1 before it was first used
+    int64_t modified_backup = -1;
+};
+
+// The numbers of a chain's current path, mutated lazily: a number only catches up on the
+// steps it missed, all small ones at once, when the next path first reads it
+class pss_sampler : public sample_source {
+public:
+    pss_sampler(double s, double large) : sigma(s), large_step_share(large) {}
+
+    // Returns whether the step is large
+    bool start_step() {
+        step++;
+        large_step = rng.next_double() < large_step_share;
+        index = 0;
+        return large_step;
+    }
+    // The bootstrap's paths are all fresh
+    void start_large_step() {
+        step++;
+        large_step = true;
+        index = 0;
+    }
+
+    double next() override {
+        if (index >= numbers.size())
+            numbers.resize(index + 1);
+        primary_sample& x = numbers[index++];
+        // A large step since the number was last read replaced it
+        if (x.modified < last_large) {
+            x.value = rng.next_double();
+            x.modified = last_large;
+        }
+        x.backup = x.value;
+        x.modified_backup = x.modified;
+        if (large_step) {
+            x.value = rng.next_double();
+        } else {
+            // Gaussian steps add up: one of sigma * sqrt(n) for the n missed, wrapped around
+            const double u1 = 1 - rng.next_double(), u2 = rng.next_double();
+            const double normal = std::sqrt(-2 * std::log(u1)) * std::cos(2 * pi * u2);
+            x.value += normal * sigma * std::sqrt(static_cast<double>(step - x.modified));
+            x.value -= std::floor(x.value);
+            if (x.value >= 1)
+                x.value = 0;
+        }
+        x.modified = step;
+        return x.value;
+    }
+
+    void accept() {
+        if (large_step)
+            last_large = step;
+    }
+    void reject() {
+        for (primary_sample& x : numbers) {
+            if (x.modified == step) {
+                x.value = x.backup;
+                x.modified = x.modified_backup;
+            }
+        }
+        step--;
+    }
+
+public:
+    pcg32 rng;
+    std::vector<primary_sample> numbers;
+
+private:
+    double sigma, large_step_share;
+    int64_t step = 0;
+    int64_t last_large = 0;
+    bool large_step = true;
+    size_t index = 0;
+};
+
+// A path's light, its luminance and the pixel it lands in
+struct path_value {
+    color L;
+    double I = 0;
+    size_t pixel = 0;
+};
+
+struct chain {
+    chain(double sigma, double large) : sampler(sigma, large) {}
+
+    pss_sampler sampler;
+    path_value current;
+    uint64_t steps = 0;
+    uint64_t accepted = 0;
+    double large_sum = 0;       // luminance of the fresh paths proposed
+    uint64_t large_steps = 0;
+    bool started = false;
+};
+
+} // namespace mlt_detail
+
+class metropolis {
+public:
+    metropolis(int w, int h, const mlt_settings& s)
+        : settings(s), width(w), height(h), weights(static_cast<size_t>(std::max(1, s.bootstrap))),
+          sums(static_cast<size_t>(w) * h * 3) {
+        chains.reserve(settings.chains);
+        for (int c = 0; c < settings.chains; c++)
+            chains.emplace_back(settings.sigma, settings.large_step);
+    }
+
+    // Bootstrap paths [begin, end); `radiance(x, y)` traces the camera ray through image
+    // point (x, y), in pixels, with random_double() as the numbers. Safe from any thread.
+    template <class Radiance>
+    void bootstrap(int begin, int end, const Radiance& radiance) {
+        for (int b = begin; b < end; b++) {
+            mlt_detail::pss_sampler sampler(settings.sigma, settings.large_step);
+            sampler.rng.seed(settings.seed, static_cast<uint64_t>(b));
+            sampler.start_large_step();
+            weights[b] = evaluate(sampler, radiance).I;
+        }
+    }
+
+    // After every bootstrap path: b, and the distribution chains start from
+    void normalize() {
+        double sum = 0;
+        for (double& w : weights) {
+            sum += w;
+            w = sum;
+        }
+        normalization = sum / weights.size();
+    }
+
+    // b over the bootstrap and every large step so far
+    double estimate() const {
+        double sum = weights.back();
+        uint64_t count = weights.size();
+        for (const auto& ch : chains) {
+            sum += ch.large_sum;
+            count += ch.large_steps;
+        }
+        return sum / count;
+    }
+
+    // Chain c's steps for the first `spp` samples per pixel of the image
+    uint64_t chain_steps(int c, uint32_t spp) const {
+        const uint64_t total = static_cast<uint64_t>(spp) * width * height;
+        return total * (c + 1) / chains.size() - total * c / chains.size();
+    }
+
+    // Takes chain c to its steps for `spp` samples per pixel; safe from any thread for
+    // different chains
+    template <class Radiance>
+    void run(int c, uint32_t spp, const Radiance& radiance);
+
+    // Pixel k's sum over the steps so far, for spp samples per pixel when all chains have
+    // been run to it; `scale` is estimate() / normalization
+    color pixel(size_t k, double scale) const {
+        return color(sums[3 * k].load(std::memory_order_relaxed),
+                     sums[3 * k + 1].load(std::memory_order_relaxed),
+                     sums[3 * k + 2].load(std::memory_order_relaxed)) * (scale / mlt_detail::fixed_one);
+    }
+
+    // True once a pixel's fixed-point sum has wrapped, which leaves the image wrong
+    bool overflowed() const { return overflow.load(std::memory_order_relaxed); }
+
+    uint64_t steps() const {
+        uint64_t n = 0;
+        for (const auto& ch : chains)
+            n += ch.steps;
+        return n;
+    }
+    uint64_t accepted() const {
+        uint64_t n = 0;
+        for (const auto& ch : chains)
+            n += ch.accepted;
+        return n;
+    }
+
+    size_t memory_usage() const {
+        size_t bytes = weights.capacity() * sizeof(double) + sums.size() * sizeof(std::atomic<uint64_t>);
+        for (const auto& ch : chains)
+            bytes += sizeof(ch) + ch.sampler.numbers.capacity() * sizeof(mlt_detail::primary_sample);
+        return bytes;
+    }
+
+public:
+    mlt_settings settings;
+    double normalization = 0;   // b, the mean luminance of a path
+
+private:
+    template <class Radiance>
+    mlt_detail::path_value evaluate(mlt_detail::pss_sampler& sampler, const Radiance& radiance) const {
+        sample_source*& source = thread_sample_source();
+        source = &sampler;
+        const double x = random_double() * width;
+        const double y = random_double() * height;
+        mlt_detail::path_value v;
+        v.L = radiance(x, y);
+        source = nullptr;
+        v.I = light_detail::luminance(v.L);
+        if (!(v.I > 0) || !std::isfinite(v.I)) {
+            v.L = color(0, 0, 0);
+            v.I = 0;
+        }
+        const size_t i = static_cast<size_t>(std::min(width - 1, static_cast<int>(x)));
+        const size_t j = static_cast<size_t>(std::min(height - 1, static_cast<int>(y)));
+        v.pixel = j * width + i;
+        return v;
+    }
+
+    void deposit(const mlt_detail::path_value& v, double weight) {
+        if (!(weight > 0) || v.I <= 0)
+            return;
+        const color value = v.L * (normalization * weight / v.I);
+        for (int c = 0; c < 3; c++) {
+            const double fixed = std::min(value[c], mlt_detail::max_deposit) * mlt_detail::fixed_one;
+            if (!(fixed > 0))
+                continue;
+            const auto add = static_cast<uint64_t>(fixed + 0.5);
+            if (sums[3 * v.pixel + c].fetch_add(add, std::memory_order_relaxed) > UINT64_MAX - add)
+                overflow.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    int width, height;
+    std::vector<double> weights;        // bootstrap luminances, then their running sums
+    std::vector<std::atomic<uint64_t>> sums;
+    std::atomic<bool> overflow{false};
+    std::vector<mlt_detail::chain> chains;
+};
+
+template <class Radiance>
+void metropolis::run(int c, uint32_t spp, const Radiance& radiance) {
+    using namespace mlt_detail;
+    chain& ch = chains[c];
+    const uint64_t target = chain_steps(c, spp);
+    if (ch.steps >= target || normalization <= 0)
+        return;
+
+    // Starts at a bootstrap path drawn in proportion to its luminance, traced again from its
+    // stream, then steps from the chain's own
+    if (!ch.started) {
+        pcg32 rng(settings.seed, chain_stream + static_cast<uint64_t>(c));
+        const double u = rng.next_double() * weights.back();
+        const int b = std::min(static_cast<int>(std::upper_bound(weights.begin(), weights.end(), u) - weights.begin()),
+                               static_cast<int>(weights.size()) - 1);
+        ch.sampler.rng.seed(settings.seed, static_cast<uint64_t>(b));
+        ch.sampler.start_large_step();
+        ch.current = evaluate(ch.sampler, radiance);
+        ch.sampler.accept();
+        ch.sampler.rng = rng;
+        ch.started = true;
+    }
+
+    for (; ch.steps < target; ch.steps++) {
+        const bool large = ch.sampler.start_step();
+        const path_value proposed = evaluate(ch.sampler, radiance);
+        if (large) {
+            ch.large_sum += proposed.I;
+            ch.large_steps++;
+        }
+        const double a = ch.current.I > 0 ? std::min(1.0, proposed.I / ch.current.I) : 1;
+        deposit(proposed, a);
+        deposit(ch.current, 1 - a);
+        if (ch.sampler.rng.next_double() < a) {
+            ch.current = proposed;
+            ch.sampler.accept();
+            ch.accepted++;
+        } else {
+            ch.sampler.reject();
+        }
+    }
+}
+
+#endif
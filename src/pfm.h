@@ -0,0 +1,86 @@
+#ifndef PFM_H
+#define PFM_H
+
+#include "vec3.h"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Float Images
+//
+// Linear RGB without clamping or gamma, stored bottom row first like the framebuffer.
+// Files use the Portable Float Map format: a "PF" header, width and height, a scale whose
+// sign gives the byte order, then rows of three 32-bit floats per pixel from the bottom up.
+
+struct float_image {
+    float_image() {}
+    float_image(int w, int h) : width(w), height(h), pixels(static_cast<size_t>(w) * h * 3) {}
+
+    vec3 at(int i, int j) const {
+        const float* p = &pixels[(static_cast<size_t>(j) * width + i) * 3];
+        return vec3(p[0], p[1], p[2]);
+    }
+
+    void set(int i, int j, const vec3& v) {
+        float* p = &pixels[(static_cast<size_t>(j) * width + i) * 3];
+        p[0] = static_cast<float>(v.x());
+        p[1] = static_cast<float>(v.y());
+        p[2] = static_cast<float>(v.z());
+    }
+
+    int width = 0;
+    int height = 0;
+    std::vector<float> pixels;
+};
+
+inline bool host_is_little_endian() {
+    const uint32_t one = 1;
+    unsigned char first;
+    std::memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+inline void write_pfm(const std::string& path, const float_image& img) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+        throw std::runtime_error("cannot write '" + path + "'");
+    out << "PF\n" << img.width << ' ' << img.height << '\n' << (host_is_little_endian() ? "-1.0" : "1.0") << '\n';
+    out.write(reinterpret_cast<const char*>(img.pixels.data()), img.pixels.size() * sizeof(float));
+    if (!out)
+        throw std::runtime_error("error writing '" + path + "'");
+}
+
+inline float_image read_pfm(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("cannot open '" + path + "'");
+
+    std::string magic;
+    int width = 0, height = 0;
+    double scale = 0;
+    in >> magic >> width >> height >> scale;
+    if (magic != "PF" || width <= 0 || height <= 0 || scale == 0)
+        throw std::runtime_error("'" + path + "' is not an RGB PFM file");
+    in.get();   // the single whitespace byte before the data
+
+    float_image img(width, height);
+    in.read(reinterpret_cast<char*>(img.pixels.data()), img.pixels.size() * sizeof(float));
+    if (!in)
+        throw std::runtime_error("'" + path + "' is truncated");
+
+    // Negative scale means little-endian data
+    if ((scale < 0) != host_is_little_endian()) {
+        for (auto& f : img.pixels) {
+            uint32_t bits;
+            std::memcpy(&bits, &f, sizeof(bits));
+            bits = (bits >> 24) | ((bits >> 8) & 0xFF00u) | ((bits << 8) & 0xFF0000u) | (bits << 24);
+            std::memcpy(&f, &bits, sizeof(bits));
+        }
+    }
+    return img;
+}
+
+#endif
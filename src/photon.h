@@ -0,0 +1,392 @@
+#ifndef PHOTON_H
+#define PHOTON_H
+
+#include "rtweekend.h"
+#include "color.h"
+#include "hittable.h"
+#include "integrator.h"
+#include "lights.h"
+#include "material.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Photon Mapping
+//
+// A photon pass shoots photons from the light set's emitters, chosen by power, and bounces
+// them diffusely through the scene, storing one record at every diffuse hit. Camera rays
+// then estimate the light leaving their first diffuse hit from the density of the photons
+// stored within a radius of it (Jensen 1996). Light that takes many bounces to reach the
+// visible surfaces, as through a gap, is found from the light's side instead of hoping a
+// camera path wanders there.
+//
+// Every sample of a pixel uses its own photon pass: sample n of every pixel reads the map
+// of pass n, shot from its own random streams. Each pass is an independent estimate, so
+// averaging the samples averages the passes too, and a pass needs only its own photons in
+// memory. The progressive variant shrinks the radius from pass to pass by
+// r_{n+1}^2 = r_n^2 (n + alpha) / (n + 1), which makes the blur go to zero while the noise
+// still averages out (Knaus and Zwicker 2011, "Progressive Photon Mapping: A Probabilistic
+// Approach"). The fixed-radius mode keeps the first radius and converges to a blurred image.
+//
+// Photons are shot in fixed chunks across the pool, each photon seeded from the scene seed,
+// the pass and its index, so a pass is the same for any thread count. The store is a hash
+// grid of cells twice the radius wide: photons are sorted by cell bucket with a parallel
+// radix sort, so a query reads the photons of 8 cells from contiguous memory.
+//
+// With light sampling on, the light arriving straight from an emitter is taken by a shadow
+// ray to the light and the photons' first hits are not stored, leaving the maps to the
+// indirect light, where their blur shows least.
+
+namespace photon_detail {
+
+// 28 bytes: position, power and the normal of the side it arrived on, scaled to 127
+struct photon {
+    float p[3];
+    float power[3];
+    int8_t n[3];
+    int8_t pad;
+};
+
+inline int8_t quantize(double x) {
+    return static_cast<int8_t>(std::lround(std::clamp(x, -1.0, 1.0) * 127));
+}
+
+} // namespace photon_detail
+
+// Settings of one photon pass
+struct photon_pass {
+    int index = 0;          // 0 for the first
+    int count = 0;          // photons shot
+    double radius = 0;
+    int max_depth = 0;      // segments of the full path, camera ray included
+    int64_t seed = 0;
+    bool direct = true;     // whether first hits are stored
+};
+
+// Radius of pass `index` from the first pass's radius
+inline double photon_radius(double first, double alpha, int index) {
+    double r2 = first * first;
+    for (int n = 1; n <= index; n++)
+        r2 *= (n + alpha) / (n + 1);
+    return std::sqrt(r2);
+}
+
+class photon_map {
+public:
+    // Shoots a pass and builds its store, replacing the previous pass but keeping its memory
+    void build(const hittable& world, const light_set& lights, const photon_pass& pass, thread_pool& pool);
+
+    // Light leaving a diffuse hit, from the photons within the radius on the same side
+    color estimate(const hit_record& rec) const;
+
+    bool includes_direct() const { return pass.direct; }
+
+    // Bytes of the photons and their index, which queries read
+    size_t store_bytes() const {
+        return photons.capacity() * sizeof(photon_detail::photon) + cell_start.capacity() * sizeof(uint32_t);
+    }
+
+    // All bytes held between passes, build buffers included
+    size_t memory_usage() const {
+        size_t bytes = store_bytes() + keys.capacity() * sizeof(uint32_t)
+                     + scratch.capacity() * sizeof(photon_detail::photon);
+        for (const auto& c : chunks)
+            bytes += c.capacity() * sizeof(photon_detail::photon);
+        return bytes;
+    }
+
+public:
+    // Figures of the last build
+    size_t stored = 0;
+    uint64_t rays = 0;
+    double trace_seconds = 0;
+    double build_seconds = 0;
+
+private:
+    static const int chunk_size = 4096;     // photons per task, fixed so passes match across pools
+
+    uint32_t bucket(int x, int y, int z) const {
+        return ((static_cast<uint32_t>(x) * 73856093u) ^ (static_cast<uint32_t>(y) * 19349663u)
+                ^ (static_cast<uint32_t>(z) * 83492791u)) & mask;
+    }
+    uint32_t bucket_of(const float* p) const {
+        return bucket(static_cast<int>(std::floor(p[0] * inv_cell)), static_cast<int>(std::floor(p[1] * inv_cell)),
+                      static_cast<int>(std::floor(p[2] * inv_cell)));
+    }
+
+    void trace(const hittable& world, const light_set& lights, int first, int last,
+               std::vector<photon_detail::photon>& out, uint64_t& ray_count) const;
+    void sort(thread_pool& pool);
+
+    photon_pass pass;
+    double inv_cell = 0;
+    uint32_t mask = 0;
+    std::vector<photon_detail::photon> photons;     // by bucket
+    std::vector<uint32_t> cell_start;               // bucket b holds photons[cell_start[b], cell_start[b + 1])
+    std::vector<uint32_t> keys;
+    std::vector<photon_detail::photon> scratch;
+    std::vector<std::vector<photon_detail::photon>> chunks;
+};
+
+void photon_map::trace(const hittable& world, const light_set& lights, int first, int last,
+                       std::vector<photon_detail::photon>& out, uint64_t& ray_count) const {
+    using photon_detail::quantize;
+    pcg32& generator = random_generator();
+    const uint64_t seed = static_cast<uint64_t>(pass.seed) + 0x9e3779b97f4a7c15ull * (pass.index + 1);
+    for (int i = first; i < last; i++) {
+        generator.seed(seed, static_cast<uint64_t>(i));
+        double pmf;
+        const int index = lights.sample_power(random_double(), pmf);
+        if (index < 0)
+            continue;
+        const emitter& e = lights.emitters[index];
+
+        // Cosine-distributed about either face: the cosine cancels, leaving area, 2 pi and the
+        // choice of emitter
+        const vec3 n = random_double() < 0.5 ? e.normal : -e.normal;
+        const auto a = random_double(0, 2 * pi);
+        const auto z = random_double(-1, 1);
+        const auto s = std::sqrt(1 - z * z);
+        vec3 dir = n + vec3(s * std::cos(a), s * std::sin(a), z);
+        if (dir.length_squared() < 1e-16)
+            dir = n;
+        ray r(e.point(random_double(), random_double()), dir);
+        color beta = e.radiance * (e.area * 2 * pi / pmf);
+
+        // A photon's k-th hit ends a path of k + 1 segments once the camera ray is added
+        for (int k = 1; k < pass.max_depth; k++) {
+            ray_count++;
+            hit_record rec;
+            if (!world.hit(r, 0.001, infinity, rec))
+                break;
+            ray scattered;
+            color attenuation;
+            if (!rec.mat->scatter(r, rec, attenuation, scattered))
+                break;
+            if (k > 1 || pass.direct) {
+                photon_detail::photon ph;
+                ph.p[0] = static_cast<float>(rec.p.x());
+                ph.p[1] = static_cast<float>(rec.p.y());
+                ph.p[2] = static_cast<float>(rec.p.z());
+                ph.power[0] = static_cast<float>(beta.x());
+                ph.power[1] = static_cast<float>(beta.y());
+                ph.power[2] = static_cast<float>(beta.z());
+                ph.n[0] = quantize(rec.normal.x());
+                ph.n[1] = quantize(rec.normal.y());
+                ph.n[2] = quantize(rec.normal.z());
+                ph.pad = 0;
+                out.push_back(ph);
+            }
+            beta = beta * attenuation;
+            r = scattered;
+        }
+    }
+}
+
+void photon_map::build(const hittable& world, const light_set& lights, const photon_pass& p, thread_pool& pool) {
+    using clock = std::chrono::steady_clock;
+    trace_scope trace_pass("photon pass", "render", p.index);
+    pass = p;
+    auto start = clock::now();
+
+    // Shoot: each chunk fills its own list, joined in chunk order
+    const int chunk_count = (pass.count + chunk_size - 1) / chunk_size;
+    chunks.resize(chunk_count);
+    std::vector<uint64_t> chunk_rays(chunk_count);
+    parallel_for(pool, 0, chunk_count, 1, [&](int lo, int hi) {
+        for (int c = lo; c < hi; c++) {
+            chunks[c].clear();
+            trace(world, lights, c * chunk_size, std::min(pass.count, (c + 1) * chunk_size), chunks[c], chunk_rays[c]);
+        }
+    });
+    std::vector<size_t> offsets(chunk_count + 1, 0);
+    rays = 0;
+    for (int c = 0; c < chunk_count; c++) {
+        offsets[c + 1] = offsets[c] + chunks[c].size();
+        rays += chunk_rays[c];
+    }
+    stored = offsets[chunk_count];
+    scratch.resize(stored);
+    parallel_for(pool, 0, chunk_count, 1, [&](int lo, int hi) {
+        for (int c = lo; c < hi; c++)
+            std::copy(chunks[c].begin(), chunks[c].end(), scratch.begin() + offsets[c]);
+    });
+    const auto traced = clock::now();
+    trace_seconds = std::chrono::duration<double>(traced - start).count();
+
+    // Index: a table of at least one bucket per photon
+    inv_cell = 1 / (2 * pass.radius);
+    uint32_t table = 1;
+    while (table < stored && table < (1u << 30))
+        table <<= 1;
+    mask = table - 1;
+    sort(pool);
+    build_seconds = std::chrono::duration<double>(clock::now() - traced).count();
+}
+
+void photon_map::sort(thread_pool& pool) {
+    using photon_detail::photon;
+    const int n = static_cast<int>(stored);
+    const int chunk_count = std::max(1, (n + chunk_size - 1) / chunk_size);
+    keys.resize(n);
+    photons.resize(n);
+    parallel_for(pool, 0, chunk_count, 1, [&](int lo, int hi) {
+        for (int c = lo; c < hi; c++) {
+            for (int i = c * chunk_size; i < std::min(n, (c + 1) * chunk_size); i++)
+                keys[i] = bucket_of(scratch[i].p);
+        }
+    });
+
+    // Stable 8-bit LSD passes over the bits the table uses, as the LBVH builder sorts
+    const int radix = 256;
+    std::vector<uint32_t> keys_tmp(n);
+    std::vector<int> histogram(static_cast<size_t>(chunk_count) * radix);
+    int bits = 0;
+    while ((1u << bits) <= mask && bits < 32)
+        bits++;
+    for (int shift = 0; shift < std::max(bits, 1); shift += 8) {
+        std::fill(histogram.begin(), histogram.end(), 0);
+        parallel_for(pool, 0, chunk_count, 1, [&](int lo, int hi) {
+            for (int c = lo; c < hi; c++) {
+                int* h = &histogram[static_cast<size_t>(c) * radix];
+                for (int i = c * chunk_size; i < std::min(n, (c + 1) * chunk_size); i++)
+                    h[(keys[i] >> shift) & 0xFF]++;
+            }
+        });
+        int sum = 0;
+        for (int d = 0; d < radix; d++) {
+            for (int c = 0; c < chunk_count; c++) {
+                const int count = histogram[static_cast<size_t>(c) * radix + d];
+                histogram[static_cast<size_t>(c) * radix + d] = sum;
+                sum += count;
+            }
+        }
+        parallel_for(pool, 0, chunk_count, 1, [&](int lo, int hi) {
+            for (int c = lo; c < hi; c++) {
+                int* offset = &histogram[static_cast<size_t>(c) * radix];
+                for (int i = c * chunk_size; i < std::min(n, (c + 1) * chunk_size); i++) {
+                    const int dst = offset[(keys[i] >> shift) & 0xFF]++;
+                    keys_tmp[dst] = keys[i];
+                    photons[dst] = scratch[i];
+                }
+            }
+        });
+        keys.swap(keys_tmp);
+        photons.swap(scratch);
+    }
+    photons.swap(scratch);      // the last pass left the sorted photons in scratch
+
+    // Each bucket starts where the sorted keys first reach it; empty ones start at the next
+    cell_start.assign(static_cast<size_t>(mask) + 2, static_cast<uint32_t>(n));
+    parallel_for(pool, 0, chunk_count, 1, [&](int lo, int hi) {
+        for (int c = lo; c < hi; c++) {
+            for (int i = c * chunk_size; i < std::min(n, (c + 1) * chunk_size); i++) {
+                if (i > 0 && keys[i] == keys[i - 1])
+                    continue;
+                for (uint32_t b = i > 0 ? keys[i - 1] + 1 : 0; b <= keys[i]; b++)
+                    cell_start[b] = static_cast<uint32_t>(i);
+            }
+        }
+    });
+}
+
+color photon_map::estimate(const hit_record& rec) const {
+    if (photons.empty())
+        return color(0, 0, 0);
+
+    // The 2x2x2 cells of width 2r nearest p cover the sphere of radius r around it; buckets
+    // shared by two of them are read once
+    int base[3];
+    for (int a = 0; a < 3; a++) {
+        const double c = rec.p[a] * inv_cell;
+        const double cell = std::floor(c);
+        base[a] = static_cast<int>(cell) - (c - cell < 0.5 ? 1 : 0);
+    }
+    uint32_t buckets[8];
+    int bucket_count = 0;
+    for (int d = 0; d < 8; d++) {
+        const uint32_t b = bucket(base[0] + (d & 1), base[1] + ((d >> 1) & 1), base[2] + ((d >> 2) & 1));
+        if (std::find(buckets, buckets + bucket_count, b) == buckets + bucket_count)
+            buckets[bucket_count++] = b;
+    }
+
+    const float px = static_cast<float>(rec.p.x()), py = static_cast<float>(rec.p.y()),
+                pz = static_cast<float>(rec.p.z());
+    const float r2 = static_cast<float>(pass.radius * pass.radius);
+    const float nx = static_cast<float>(rec.normal.x()), ny = static_cast<float>(rec.normal.y()),
+                nz = static_cast<float>(rec.normal.z());
+    float sum[3] = {0, 0, 0};
+    for (int k = 0; k < bucket_count; k++) {
+        for (uint32_t i = cell_start[buckets[k]]; i < cell_start[buckets[k] + 1]; i++) {
+            const photon_detail::photon& ph = photons[i];
+            const float dx = ph.p[0] - px, dy = ph.p[1] - py, dz = ph.p[2] - pz;
+            // Same side of a surface facing the same way, which keeps light from leaking
+            // round corners and through thin walls
+            if (dx * dx + dy * dy + dz * dz > r2 || ph.n[0] * nx + ph.n[1] * ny + ph.n[2] * nz < 0.5f * 127)
+                continue;
+            sum[0] += ph.power[0];
+            sum[1] += ph.power[1];
+            sum[2] += ph.power[2];
+        }
+    }
+    // Diffuse reflectance albedo / pi over the disc's area, per photon shot
+    const double scale = 1 / (pi * pi * pass.radius * pass.radius * pass.count);
+    return rec.mat->surface_albedo() * color(sum[0], sum[1], sum[2]) * scale;
+}
+
+// Emission seen directly, plus the light leaving the first diffuse hit: the photon map's
+// density estimate, and a light sample when the map leaves out direct light
+color photon_color(const ray& r, const color& background, const hittable& world, const light_set& lights,
+                   light_sampling mode, int depth, const photon_map& photons, first_hit* aov = nullptr) {
+    if (depth <= 0)
+        return color(0, 0, 0);
+    thread_ray_counters().traced++;
+    hit_record rec;
+    if (!world.hit(r, 0.001, infinity, rec)) {
+        PT_STAT(thread_path_counters().ended_miss++);
+        return background;
+    }
+    if (aov) {
+        aov->albedo = rec.mat->surface_albedo();
+        aov->normal = rec.normal;
+        aov->distance = rec.t * r.direction().length();
+    }
+
+    color result = rec.mat->emitted();
+    if (rec.mat->pdf(rec, rec.normal) <= 0) {
+        PT_STAT(thread_path_counters().ended_light++);
+        return result;
+    }
+    if (!photons.includes_direct() && depth > 1) {
+        // Direct light by both of next-event estimation's strategies: a light sample, and a
+        // bounce that may run into an emitter, weighted as ray_color_nee weighs them
+        result += sample_direct(rec, world, lights, mode);
+        ray scattered;
+        color attenuation;
+        hit_record light_rec;
+        if (rec.mat->scatter(r, rec, attenuation, scattered)) {
+            thread_ray_counters().traced++;
+            if (world.hit(scattered, 0.001, infinity, light_rec)) {
+                color emitted = light_rec.mat->emitted();
+                if (light_rec.light >= 0) {
+                    const emitter& light = lights.emitters[light_rec.light];
+                    const double dist = light_rec.t * scattered.direction().length();
+                    const double cos_light = std::fabs(dot(light.normal, unit_vector(scattered.direction())));
+                    const double light_pdf = lights.pmf(mode, rec.p, rec.normal, light_rec.light) * dist * dist
+                                           / (light.area * std::max(cos_light, 1e-12));
+                    emitted = emitted * mis_weight(rec.mat->pdf(rec, scattered.direction()), light_pdf);
+                }
+                result += attenuation * emitted;
+            }
+        }
+    }
+    PT_STAT(thread_path_counters().ended_max_depth++);
+    return result + photons.estimate(rec);
+}
+
+#endif
@@ -0,0 +1,387 @@
+#ifndef RADIANCE_CACHE_H
+#define RADIANCE_CACHE_H
+
+#include "rtweekend.h"
+#include "color.h"
+#include "hittable.h"
+#include "integrator.h"
+#include "lights.h"
+#include "material.h"
+#include "scene.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Radiance Cache
+//
+// Diffuse interreflection changes slowly across a surface, yet every path works it out again
+// bounce by bounce. The cache holds it per cell of a world-space grid, split by which way the
+// surface faces, and a path that reaches a diffuse hit at the cache's bounce takes the cell's
+// value for everything beyond instead of tracing on. Paths whose cell holds too few records
+// carry on as usual.
+//
+// The cache learns from training paths: full paths from the camera through pixels spread
+// over the whole image, each with a seed of its own. Every diffuse hit up to the lookup
+// bounce records the light leaving it over its albedo, summed over exactly the bounces a
+// path would still trace from the lookup bounce, so the cache adds no cut-off of its own;
+// what it adds is blur across a cell. Stored over the albedo, a record serves any diffuse
+// surface in its cell, and a lookup multiplies by the surface it stands on.
+//
+// A cache trains either once, before the first sample, or progressively, with batch n
+// traced before sample n of every pixel renders, so later samples see a better cache. The
+// batches are traced in fixed chunks and added to the grid in chunk order, so every cache,
+// and with it the image, is the same for any thread count, and a resumed render replays
+// the batches it already used. Lookups jitter the point across the cell, within the
+// surface, which hides the cells' edges.
+
+namespace cache_detail {
+
+// One training vertex: its cell and face, and the light leaving it over its albedo
+struct record {
+    uint64_t key;
+    float value[3];
+};
+
+// 40 bytes; an empty slot has the key ~0, which no cell packs to
+struct cell {
+    uint64_t key;
+    double sum[3];
+    uint32_t count;
+};
+
+const uint64_t empty_key = ~uint64_t(0);
+
+inline uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    return x ^ (x >> 33);
+}
+
+} // namespace cache_detail
+
+// Lookups by the calling thread, summed into render_stats after each tile
+struct cache_counters {
+    uint64_t hits = 0;          // paths the cache ended
+    uint64_t misses = 0;        // lookups that found too few records and traced on
+};
+
+inline cache_counters& thread_cache_counters() {
+    static thread_local cache_counters counters;
+    return counters;
+}
+
+class radiance_cache {
+public:
+    // Cells `cell_size` wide, looked up at hit `bounce` (0 is the camera ray's) of paths up
+    // to `max_depth` segments
+    radiance_cache(double cell_size, int bounce, int max_depth)
+        : cell(cell_size), inv_cell(1 / cell_size), query_bounce(bounce), depth(max_depth) {}
+
+    // Traces training batch `index` of `count` paths and adds their records
+    void train(const scene& scn, int index, int count, thread_pool& pool);
+
+    // Light leaving a diffuse hit, or false where its cell holds too few records
+    bool lookup(const hit_record& rec, color& out) const;
+
+    int bounce() const { return query_bounce; }
+    size_t cells() const { return used; }
+
+    // Bytes of the grid, which lookups read
+    size_t store_bytes() const { return table.capacity() * sizeof(cache_detail::cell); }
+
+    // All bytes held between batches, training buffers included
+    size_t memory_usage() const {
+        size_t bytes = store_bytes();
+        for (const auto& c : chunks)
+            bytes += c.capacity() * sizeof(cache_detail::record);
+        return bytes;
+    }
+
+public:
+    // Totals over every batch trained
+    int batches = 0;
+    uint64_t paths = 0;
+    uint64_t records = 0;
+    uint64_t rays = 0;
+    double seconds = 0;
+
+private:
+    static const int chunk_size = 4096;     // paths per task, fixed so batches match across pools
+    static const uint32_t min_records = 8;
+
+    uint64_t key(const point3& p, const vec3& n) const;
+    void trace(const scene& scn, uint64_t seed, int first, int last, std::vector<cache_detail::record>& out) const;
+    void add(const cache_detail::record& r);
+
+    double cell;
+    double inv_cell;
+    int query_bounce;
+    int depth;
+    std::vector<cache_detail::cell> table;  // open addressing, a power of two at most half full
+    size_t used = 0;
+    std::vector<std::vector<cache_detail::record>> chunks;
+};
+
+// 20 bits per cell coordinate and 3 for the axis and sign the normal is closest to
+uint64_t radiance_cache::key(const point3& p, const vec3& n) const {
+    uint64_t k = 0;
+    for (int a = 0; a < 3; a++)
+        k = (k << 20) | (static_cast<uint64_t>(static_cast<int64_t>(std::floor(p[a] * inv_cell))) & 0xFFFFF);
+    const double ax = std::fabs(n.x()), ay = std::fabs(n.y()), az = std::fabs(n.z());
+    const int axis = ax >= ay && ax >= az ? 0 : ay >= az ? 1 : 2;
+    return (k << 3) | static_cast<uint64_t>(axis * 2 + (n[axis] < 0 ? 1 : 0));
+}
+
+void radiance_cache::add(const cache_detail::record& r) {
+    using cache_detail::cell;
+    if (2 * (used + 1) > table.size()) {
+        std::vector<cell> old(std::max<size_t>(1024, table.size() * 2), cell{cache_detail::empty_key, {0, 0, 0}, 0});
+        old.swap(table);
+        used = 0;
+        for (const cell& c : old) {
+            if (c.key == cache_detail::empty_key)
+                continue;
+            size_t slot = cache_detail::mix(c.key) & (table.size() - 1);
+            while (table[slot].key != cache_detail::empty_key)
+                slot = (slot + 1) & (table.size() - 1);
+            table[slot] = c;
+            used++;
+        }
+    }
+    size_t slot = cache_detail::mix(r.key) & (table.size() - 1);
+    while (table[slot].key != r.key && table[slot].key != cache_detail::empty_key)
+        slot = (slot + 1) & (table.size() - 1);
+    cell& c = table[slot];
+    if (c.key == cache_detail::empty_key) {
+        c.key = r.key;
+        used++;
+    }
+    for (int i = 0; i < 3; i++)
+        c.sum[i] += r.value[i];
+    c.count++;
+}
+
+void radiance_cache::trace(const scene& scn, uint64_t seed, int first, int last,
+                           std::vector<cache_detail::record>& out) const {
+    const auto& settings = scn.settings;
+    const hittable& world = *scn.world;
+    const light_set& lights = scn.lights;
+    const camera cam = scn.make_camera();
+    const bool sample_lights = settings.lights != light_sampling::none && !lights.emitters.empty();
+    const int pixels = settings.image_width * settings.image_height;
+    pcg32& generator = random_generator();
+
+    // What each hit added, before the path's throughput: the (weighted) emission found there,
+    // the light sample taken there and the albedo the path went on with
+    struct vertex {
+        point3 p;
+        vec3 normal;
+        color albedo;
+        color emitted;
+        color direct;
+        color attenuation;
+        bool diffuse;
+    };
+    std::vector<vertex> path;
+    path.reserve(depth);
+
+    for (int i = first; i < last; i++) {
+        generator.seed(seed, static_cast<uint64_t>(i));
+        const int k = i % pixels;
+        const auto u = (k % settings.image_width + random_double()) / (settings.image_width - 1);
+        const auto v = (k / settings.image_width + random_double()) / (settings.image_height - 1);
+        ray current = cam.get_ray(u, v);
+
+        // The path as ray_color_nee traces it, one vertex per hit; a miss leaves one that only
+        // holds the background
+        path.clear();
+        double bsdf_pdf = 0;
+        for (int bounce = 0; bounce < depth; bounce++) {
+            vertex x{point3(), vec3(), color(0, 0, 0), color(0, 0, 0), color(0, 0, 0), color(0, 0, 0), false};
+            thread_ray_counters().traced++;
+            hit_record rec;
+            if (!world.hit(current, 0.001, infinity, rec)) {
+                x.emitted = settings.background;
+                path.push_back(x);
+                break;
+            }
+            x.p = rec.p;
+            x.normal = rec.normal;
+            x.albedo = rec.mat->surface_albedo();
+            x.emitted = rec.mat->emitted();
+            if (sample_lights && bsdf_pdf > 0 && rec.light >= 0) {
+                const vertex& last_vertex = path.back();
+                const emitter& light = lights.emitters[rec.light];
+                const double dist = rec.t * current.direction().length();
+                const double cos_light = std::fabs(dot(light.normal, unit_vector(current.direction())));
+                const double light_pdf = lights.pmf(settings.lights, last_vertex.p, last_vertex.normal, rec.light)
+                                       * dist * dist / (light.area * std::max(cos_light, 1e-12));
+                x.emitted = x.emitted * mis_weight(bsdf_pdf, light_pdf);
+            }
+            ray scattered;
+            if (!rec.mat->scatter(current, rec, x.attenuation, scattered)) {
+                path.push_back(x);
+                break;
+            }
+            x.diffuse = rec.mat->pdf(rec, rec.normal) > 0;
+            if (sample_lights && bounce + 1 < depth && x.diffuse)
+                x.direct = sample_direct(rec, world, lights, settings.lights);
+            path.push_back(x);
+            bsdf_pdf = rec.mat->pdf(rec, scattered.direction());
+            current = scattered;
+        }
+
+        // A lookup at hit q stands for hits q+1 .. depth-1 and the light samples at q ..
+        // depth-2; hit b < q records the same number of bounces after it
+        const int hits = static_cast<int>(path.size());
+        for (int b = 0; b <= query_bounce && b < hits; b++) {
+            const vertex& x = path[b];
+            if (!x.diffuse)
+                continue;
+            const int end = std::min(hits - 1, b + depth - 1 - query_bounce);
+            color leaving(0, 0, 0);
+            for (int j = end; j > b; j--) {
+                const color after = j < b + depth - 1 - query_bounce ? path[j].direct : color(0, 0, 0);
+                leaving = path[j - 1].attenuation * (path[j].emitted + after + leaving);
+            }
+            if (b + depth - 1 - query_bounce > b)
+                leaving += x.direct;
+            cache_detail::record r;
+            r.key = key(x.p, x.normal);
+            for (int c = 0; c < 3; c++)
+                r.value[c] = x.albedo[c] > 0 ? static_cast<float>(leaving[c] / x.albedo[c]) : 0.0f;
+            out.push_back(r);
+        }
+    }
+}
+
+void radiance_cache::train(const scene& scn, int index, int count, thread_pool& pool) {
+    using clock = std::chrono::steady_clock;
+    trace_scope trace_batch("cache batch", "render", index);
+    const auto start = clock::now();
+
+    // Each chunk fills its own list, added to the grid in chunk order
+    const uint64_t seed = static_cast<uint64_t>(scn.settings.seed) + 0xd1b54a32d192ed03ull * (index + 1);
+    const int chunk_count = (count + chunk_size - 1) / chunk_size;
+    chunks.resize(chunk_count);
+    std::vector<uint64_t> chunk_rays(chunk_count);
+    parallel_for(pool, 0, chunk_count, 1, [&](int lo, int hi) {
+        for (int c = lo; c < hi; c++) {
+            chunks[c].clear();
+            const uint64_t before = thread_ray_counters().traced;
+            trace(scn, seed, c * chunk_size, std::min(count, (c + 1) * chunk_size), chunks[c]);
+            chunk_rays[c] = thread_ray_counters().traced - before;
+        }
+    });
+    for (int c = 0; c < chunk_count; c++) {
+        for (const auto& r : chunks[c])
+            add(r);
+        records += chunks[c].size();
+        rays += chunk_rays[c];
+    }
+    batches++;
+    paths += static_cast<uint64_t>(count);
+    seconds += std::chrono::duration<double>(clock::now() - start).count();
+}
+
+bool radiance_cache::lookup(const hit_record& rec, color& out) const {
+    if (table.empty())
+        return false;
+
+    // Jitter within the surface's plane, by up to half a cell each way
+    const vec3& n = rec.normal;
+    const vec3 t = unit_vector(cross(n, std::fabs(n.x()) > 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0)));
+    const vec3 s = cross(n, t);
+    const point3 p = rec.p + (random_double() - 0.5) * cell * t + (random_double() - 0.5) * cell * s;
+
+    const uint64_t k = key(p, n);
+    size_t slot = cache_detail::mix(k) & (table.size() - 1);
+    while (table[slot].key != k) {
+        if (table[slot].key == cache_detail::empty_key)
+            return false;
+        slot = (slot + 1) & (table.size() - 1);
+    }
+    const cache_detail::cell& c = table[slot];
+    if (c.count < min_records)
+        return false;
+    out = color(c.sum[0], c.sum[1], c.sum[2]) / c.count;
+    return true;
+}
+
+// Path tracing, with or without next-event estimation as ray_color_nee and ray_color do it,
+// that hands the rest of the path to the cache at a diffuse hit on the cache's bounce
+color ray_color_cached(const ray& r, const color& background, const hittable& world, const light_set& lights,
+                       light_sampling mode, bool sample_lights, int depth, const radiance_cache& cache,
+                       first_hit* aov = nullptr) {
+    color result(0, 0, 0), throughput(1, 1, 1);
+    ray current = r;
+    double bsdf_pdf = 0;
+    point3 last_p;
+    vec3 last_normal;
+
+    for (int bounce = 0; ; bounce++) {
+        if (bounce >= depth) {
+            PT_STAT(thread_path_counters().ended_max_depth++);
+            return result;
+        }
+
+        thread_ray_counters().traced++;
+        hit_record rec;
+        if (!world.hit(current, 0.001, infinity, rec)) {
+            PT_STAT(thread_path_counters().ended_miss++);
+            return result + throughput * background;
+        }
+
+        if (aov && bounce == 0) {
+            aov->albedo = rec.mat->surface_albedo();
+            aov->normal = rec.normal;
+            aov->distance = rec.t * current.direction().length();
+        }
+
+        color emitted = rec.mat->emitted();
+        if (sample_lights && bsdf_pdf > 0 && rec.light >= 0) {
+            const emitter& light = lights.emitters[rec.light];
+            const double dist = rec.t * current.direction().length();
+            const double cos_light = std::fabs(dot(light.normal, unit_vector(current.direction())));
+            const double light_pdf = lights.pmf(mode, last_p, last_normal, rec.light) * dist * dist
+                                   / (light.area * std::max(cos_light, 1e-12));
+            emitted = emitted * mis_weight(bsdf_pdf, light_pdf);
+        }
+        result += throughput * emitted;
+
+        if (bounce == cache.bounce() && rec.mat->pdf(rec, rec.normal) > 0) {
+            color cached;
+            if (cache.lookup(rec, cached)) {
+                thread_cache_counters().hits++;
+                PT_STAT(thread_path_counters().ended_cache++);
+                return result + throughput * rec.mat->surface_albedo() * cached;
+            }
+            thread_cache_counters().misses++;
+        }
+
+        ray scattered;
+        color attenuation;
+        if (!rec.mat->scatter(current, rec, attenuation, scattered)) {
+            PT_STAT(thread_path_counters().ended_light++);
+            return result;
+        }
+
+        if (sample_lights && bounce + 1 < depth && rec.mat->pdf(rec, rec.normal) > 0)
+            result += throughput * sample_direct(rec, world, lights, mode);
+
+        throughput = throughput * attenuation;
+        bsdf_pdf = rec.mat->pdf(rec, scattered.direction());
+        last_p = rec.p;
+        last_normal = rec.normal;
+        current = scattered;
+    }
+}
+
+#endif
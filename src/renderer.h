@@ -0,0 +1,928 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include "rtweekend.h"
+#include "color.h"
+#include "bdpt.h"
+#include "camera.h"
+#include "guiding.h"
+#include "hittable.h"
+#include "integrator.h"
+#include "material.h"
+#include "mlt.h"
+#include "scene.h"
+#include "thread_pool.h"
+#include "pfm.h"
+#include "photon.h"
+#include "radiance_cache.h"
+#include "restir.h"
+#include "stats.h"
+#include "trace.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// Tiled Renderer
+//
+// The image is split into square tiles that run as tasks on the thread pool. Every pixel
+// keeps its own generator in the framebuffer, seeded from the scene seed with the pixel
+// index as the stream, and its samples are added to its sums one at a time. So an image is
+// the same for any thread count, and rendering the samples in several passes, or resuming
+// from a checkpoint, gives exactly the same sums as one uninterrupted pass.
+//
+// With `sampler counter` a sample draws counter-based numbers instead (see rtweekend.h),
+// keyed on the pixel, the sample's index and the number's place in it, so no generator
+// state carries from one sample to the next. Images are bit-identical the same way, and
+// each sample is reproducible on its own.
+
+struct render_stats {
+    double seconds = 0;
+    uint64_t samples = 0;
+    uint64_t primary_rays = 0;
+    uint64_t secondary_rays = 0;
+    uint64_t shadow_rays = 0;   // part of secondary_rays
+    path_counters paths;        // zero unless built with PT_STATS
+
+    // Photon passes, for the photon integrators; their rays are not counted above
+    int photon_passes = 0;
+    uint64_t photons = 0;           // shot
+    uint64_t photons_stored = 0;
+    uint64_t photon_rays = 0;
+    double photon_seconds = 0;      // shooting and building, part of seconds
+    size_t photon_store_bytes = 0;  // largest single pass
+    size_t photon_memory_bytes = 0; // with build buffers
+
+    // Radiance cache training and lookups; training rays are not counted above either
+    int cache_batches = 0;
+    uint64_t cache_paths = 0;
+    uint64_t cache_records = 0;
+    uint64_t cache_rays = 0;
+    double cache_seconds = 0;       // part of seconds
+    size_t cache_cells = 0;
+    size_t cache_store_bytes = 0;
+    size_t cache_memory_bytes = 0;  // with training buffers
+    uint64_t cache_hits = 0;
+    uint64_t cache_misses = 0;
+
+    // Path guiding: the guide after the render, and the samples per pixel rendered again to
+    // rebuild it when continuing a framebuffer it was not trained on
+    int guide_updates = 0;
+    size_t guide_leaves = 0;
+    size_t guide_nodes = 0;
+    size_t guide_memory_bytes = 0;
+    double guide_seconds = 0;       // updating, part of seconds
+    uint32_t guide_replayed = 0;
+
+    // Reservoir resampling of the first hits' direct light, with the same replay
+    int restir_candidates = 0;      // per pixel and sample; 0 when it did not run
+    size_t restir_memory_bytes = 0;
+    uint32_t restir_replayed = 0;
+
+    // Metropolis chains, with the same replay
+    int mlt_chains = 0;             // 0 when the mlt integrator did not run
+    double mlt_normalization = 0;   // b, the mean luminance of a path, as the image is scaled to
+    uint64_t mlt_steps = 0;         // over all renders of the framebuffer
+    uint64_t mlt_accepted = 0;
+    size_t mlt_memory_bytes = 0;
+    uint32_t mlt_replayed = 0;
+
+    uint64_t rays() const { return primary_rays + secondary_rays; }
+};
+
+// Half-open rectangle of pixels, in framebuffer coordinates (row 0 at the bottom)
+struct pixel_rect {
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+    bool empty() const { return x1 <= x0 || y1 <= y0; }
+    int width() const { return x1 - x0; }
+    int height() const { return y1 - y0; }
+};
+
+// Sample sums, sums of squares, sample counts and generator states per pixel; row 0 is the
+// bottom of the image
+struct framebuffer {
+    framebuffer(int w, int h)
+        : width(w), height(h), pixels(static_cast<size_t>(w) * h), squares(pixels.size()),
+          samples(pixels.size()), samplers(pixels.size()) {}
+
+    color& at(int i, int j) { return pixels[static_cast<size_t>(j) * width + i]; }
+    const color& at(int i, int j) const { return pixels[static_cast<size_t>(j) * width + i]; }
+
+    // Pixel estimates: the sample mean
+    float_image mean() const;
+
+    // Per-channel variance of each pixel estimate (sample variance / samples)
+    float_image variance() const;
+
+    // Starts recording what each pixel cost to render (see `cost`)
+    void track_cost() { cost.assign(pixels.size(), color(0, 0, 0)); }
+
+    // Cost per pixel as rays traced, BVH nodes visited and nanoseconds
+    float_image cost_image() const;
+
+    // Starts recording the first-hit features (see `albedo`)
+    void track_features() {
+        albedo.assign(pixels.size(), color(0, 0, 0));
+        normal.assign(pixels.size(), vec3(0, 0, 0));
+        distance.assign(pixels.size(), 0);
+    }
+
+    // Per-pixel means of the first-hit features
+    float_image albedo_image() const;
+    float_image normal_image() const;
+    float_image distance_image() const;
+
+    int width;
+    int height;
+    std::vector<color> pixels;
+    std::vector<color> squares;
+    std::vector<uint32_t> samples;      // samples taken so far
+    std::vector<pcg32> samplers;        // each pixel's generator, seeded before its first sample
+    // Rays, BVH nodes visited (zero unless built with PT_STATS) and nanoseconds per pixel,
+    // over all its samples; empty unless track_cost() was called
+    std::vector<color> cost;
+    // Sums of the first-hit albedo, normal and distance over the samples taken since
+    // track_features(); empty otherwise
+    std::vector<color> albedo;
+    std::vector<vec3> normal;
+    std::vector<double> distance;
+};
+
+float_image framebuffer::mean() const {
+    float_image img(width, height);
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            const size_t k = static_cast<size_t>(j) * width + i;
+            img.set(i, j, samples[k] > 0 ? pixels[k] / samples[k] : color(0, 0, 0));
+        }
+    }
+    return img;
+}
+
+float_image framebuffer::variance() const {
+    float_image img(width, height);
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            const size_t k = static_cast<size_t>(j) * width + i;
+            const double n = samples[k];
+            const color m = pixels[k] / n;
+            color v = n > 1 ? (squares[k] / n - m * m) * (n / (n - 1)) / n : color(0, 0, 0);
+            for (int c = 0; c < 3; c++)
+                v[c] = v[c] > 0 ? v[c] : 0;
+            img.set(i, j, v);
+        }
+    }
+    return img;
+}
+
+float_image framebuffer::cost_image() const {
+    float_image img(width, height);
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++)
+            img.set(i, j, cost.empty() ? color(0, 0, 0) : cost[static_cast<size_t>(j) * width + i]);
+    }
+    return img;
+}
+
+float_image framebuffer::albedo_image() const {
+    float_image img(width, height);
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            const size_t k = static_cast<size_t>(j) * width + i;
+            img.set(i, j, samples[k] > 0 && !albedo.empty() ? albedo[k] / samples[k] : color(0, 0, 0));
+        }
+    }
+    return img;
+}
+
+float_image framebuffer::normal_image() const {
+    float_image img(width, height);
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            const size_t k = static_cast<size_t>(j) * width + i;
+            const vec3 n = normal.empty() ? vec3(0, 0, 0) : normal[k];
+            img.set(i, j, n.length_squared() > 0 ? unit_vector(n) : n);
+        }
+    }
+    return img;
+}
+
+float_image framebuffer::distance_image() const {
+    float_image img(width, height);
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            const size_t k = static_cast<size_t>(j) * width + i;
+            const double d = samples[k] > 0 && !distance.empty() ? distance[k] / samples[k] : 0;
+            img.set(i, j, color(d, d, d));
+        }
+    }
+    return img;
+}
+
+class renderer {
+public:
+    static const int tile_size = 32;
+
+    renderer(const scene& s, thread_pool& p) : scn(s), pool(p) {}
+
+    // Takes every pixel of `fb` to the scene's samples_per_pixel, continuing from the
+    // samples it already holds
+    render_stats render(framebuffer& fb) const;
+
+public:
+    bool show_progress = true;      // tile countdown on stderr
+    int pass_samples = 0;           // samples per pixel in each pass over the image; 0 for one pass
+    // Called on the rendering thread after every pass but the last, while no tile runs
+    std::function<void(const framebuffer&)> on_pass;
+    // Pixels to render, empty for the whole image. A pixel samples the same way whatever
+    // the region, so renders of separate regions fit together exactly.
+    pixel_rect region;
+
+private:
+    void render_tile(framebuffer& fb, int x0, int y0, int x1, int y1, uint32_t target,
+                     const photon_map* photons, const radiance_cache* cache, path_guide* guide) const;
+    // One of the two rounds of a ReSTIR sample (see restir.h) over a tile
+    void restir_tile(framebuffer& fb, int x0, int y0, int x1, int y1, uint32_t target, restir_di& restir,
+                     bool resolve) const;
+
+    const scene& scn;
+    thread_pool& pool;
+    // The guided integrator's guide, the ReSTIR reservoirs or the Metropolis chains, kept for
+    // the next render() of the framebuffer they were built on, with the samples per pixel
+    // they have seen
+    mutable std::shared_ptr<path_guide> guide_state;
+    mutable std::shared_ptr<restir_di> restir_state;
+    mutable std::shared_ptr<metropolis> mlt_state;
+    mutable const framebuffer* state_fb = nullptr;
+    mutable uint32_t state_samples = 0;
+};
+
+render_stats renderer::render(framebuffer& fb) const {
+    using clock = std::chrono::steady_clock;
+    const auto start = clock::now();
+    trace_scope trace("render", "render");
+
+    pixel_rect area = region;
+    if (area.empty()) {
+        area.x1 = fb.width;
+        area.y1 = fb.height;
+    }
+    const int tiles_x = (area.width() + tile_size - 1) / tile_size;
+    const int tiles_y = (area.height() + tile_size - 1) / tile_size;
+    const int tile_count = tiles_x * tiles_y;
+
+    // Passes up to the target, starting from the fewest samples any pixel holds
+    const uint32_t target = static_cast<uint32_t>(std::max(0, scn.settings.samples_per_pixel));
+    uint32_t done = target;
+    for (int j = area.y0; j < area.y1; j++) {
+        for (int i = area.x0; i < area.x1; i++)
+            done = std::min(done, fb.samples[static_cast<size_t>(j) * fb.width + i]);
+    }
+    const uint32_t step = pass_samples > 0 ? static_cast<uint32_t>(pass_samples) : std::max(1u, target - done);
+    const int passes = done >= target ? 0 : static_cast<int>((target - done + step - 1) / step);
+
+    // The photon integrators render one sample per pixel at a time, sample n reading photon
+    // pass n, so the passes over the image do not change which map a sample sees
+    const bool photon_mode = scn.settings.integrator == integrator_type::photon
+                          || scn.settings.integrator == integrator_type::ppm;
+    photon_map photons;
+    photon_pass photon_settings;
+    if (photon_mode) {
+        photon_settings.count = scn.settings.photons;
+        photon_settings.max_depth = scn.settings.max_depth;
+        photon_settings.seed = scn.settings.seed;
+        photon_settings.direct = scn.settings.lights == light_sampling::none || scn.lights.emitters.empty();
+        photon_settings.radius = scn.settings.photon_radius;
+        aabb box;
+        if (photon_settings.radius <= 0 && scn.world->bounding_box(box))
+            photon_settings.radius = (box.max() - box.min()).length() / 100;
+    }
+    const double alpha = scn.settings.integrator == integrator_type::ppm ? scn.settings.photon_alpha : 1;
+
+    // A progressive cache trains batch n before sample n renders, so it goes one sample at a
+    // time as well; training covers the whole image whatever the region
+    const bool cache_mode = scn.settings.radiance_cache && scn.settings.integrator == integrator_type::path;
+    const bool progressive_cache = cache_mode && scn.settings.cache_policy == cache_update::progressive;
+    double cell = scn.settings.cache_cell;
+    aabb bounds;
+    if (cache_mode && cell <= 0)
+        cell = scn.world->bounding_box(bounds) ? (bounds.max() - bounds.min()).length() / 64 : 1;
+    radiance_cache cache(cell, scn.settings.cache_bounce, scn.settings.max_depth);
+    const int cache_paths = static_cast<int>(std::max(1.0, std::round(scn.settings.cache_training
+                                                                      * scn.settings.image_width
+                                                                      * scn.settings.image_height)));
+    if (cache_mode && !progressive_cache && passes > 0)
+        cache.train(scn, 0, cache_paths, pool);
+    const radiance_cache* lookup_cache = cache_mode ? &cache : nullptr;
+
+    // ReSTIR runs each sample in two rounds over the image. With temporal reuse it also reads
+    // the previous sample's reservoirs, which like the guide below are rebuilt for a
+    // framebuffer they have not seen.
+    const bool restir_mode = scn.settings.restir && scn.settings.integrator == integrator_type::path && !cache_mode;
+    restir_di* restir = nullptr;
+    uint32_t restir_replay = 0;
+    if (restir_mode && passes > 0) {
+        if (!restir_state || done == 0 || state_fb != &fb || state_samples != done) {
+            restir_settings rs;
+            rs.candidates = scn.settings.restir_candidates;
+            rs.neighbours = scn.settings.restir_neighbours;
+            rs.radius = scn.settings.restir_radius;
+            rs.history = scn.settings.restir_history;
+            restir_state = std::make_shared<restir_di>(fb.width, fb.height, rs);
+            restir_replay = rs.history > 0 ? done : 0;
+        }
+        restir = restir_state.get();
+    }
+    const bool per_sample = photon_mode || progressive_cache || restir;
+
+    // The guided integrator stops at the end of every guiding pass as well, to update the
+    // guide. A framebuffer the guide has not seen is continued by rendering its samples
+    // again into a scratch one, so the guide learns what it would have from the start.
+    const bool guided_mode = scn.settings.integrator == integrator_type::guided;
+    path_guide* guide = nullptr;
+    uint32_t replay = 0;
+    if (guided_mode && passes > 0) {
+        if (!guide_state || done == 0 || state_fb != &fb || state_samples != done) {
+            aabb box(point3(-1, -1, -1), point3(1, 1, 1));
+            scn.world->bounding_box(box);
+            guide_state = std::make_shared<path_guide>(box, scn.settings.guide_bsdf_fraction,
+                                                       scn.settings.guide_split_samples);
+            replay = done;
+        }
+        guide = guide_state.get();
+    }
+    // Metropolis chains run over the whole image, one task each, and go on where the last
+    // render of the framebuffer left them; for one they have not seen, they first run again
+    // to the samples it holds, adding nothing to it
+    const bool mlt_mode = scn.settings.integrator == integrator_type::mlt;
+    metropolis* chains = nullptr;
+    uint32_t mlt_replay = 0;
+    bool mlt_bootstrap = false;
+    if (mlt_mode && passes > 0) {
+        if (!mlt_state || done == 0 || state_fb != &fb || state_samples != done) {
+            mlt_settings ms;
+            ms.bootstrap = scn.settings.mlt_bootstrap;
+            ms.chains = scn.settings.mlt_chains;
+            ms.large_step = scn.settings.mlt_large_step;
+            ms.seed = static_cast<uint64_t>(scn.settings.seed);
+            mlt_state = std::make_shared<metropolis>(fb.width, fb.height, ms);
+            mlt_replay = done;
+            mlt_bootstrap = true;
+        }
+        chains = mlt_state.get();
+    }
+    // Rounds of tiles that samples [from, to) take, split at the guiding passes
+    auto guided_rounds = [](uint32_t from, uint32_t to) {
+        int rounds = 0;
+        for (; from < to; rounds++)
+            from = std::min(to, path_guide::pass_end(path_guide::pass_of(from)));
+        return rounds;
+    };
+    int rounds = per_sample ? static_cast<int>(target - std::min(done, target)) : passes;
+    if (restir)
+        rounds = 2 * static_cast<int>(restir_replay + target - std::min(done, target));
+    if (guide) {
+        rounds = guided_rounds(0, replay);
+        for (int pass = 0; pass < passes; pass++)
+            rounds += guided_rounds(done + pass * step, std::min(target, done + (pass + 1) * step));
+    }
+    if (chains)
+        rounds = passes + (mlt_replay > 0 ? 1 : 0);
+    const int units = chains ? chains->settings.chains : tile_count;
+
+    std::atomic<int> remaining{units * rounds};
+    std::mutex progress_lock;
+    render_stats stats;
+
+    // Top rows first, matching the order the image is written in
+    // A ReSTIR round of 1 or 2 runs that round of restir_tile instead of render_tile
+    auto render_tiles = [&](framebuffer& image, uint32_t tile_target, const photon_map* map, int restir_round = 0) {
+        task_group group(pool);
+        for (int t = 0; t < tile_count; t++) {
+            group.run([&, t] {
+                const int tx = t % tiles_x;
+                const int ty = tiles_y - 1 - t / tiles_x;
+                trace_scope trace("tile", "render", t);
+                auto& counters = thread_ray_counters();
+                counters = ray_counters();
+                auto& lookups = thread_cache_counters();
+                lookups = cache_counters();
+                PT_STAT(thread_path_counters() = path_counters());
+                const int x0 = area.x0 + tx * tile_size, y0 = area.y0 + ty * tile_size;
+                const int x1 = std::min(x0 + tile_size, area.x1), y1 = std::min(y0 + tile_size, area.y1);
+                if (restir_round > 0)
+                    restir_tile(image, x0, y0, x1, y1, tile_target, *restir, restir_round == 2);
+                else
+                    render_tile(image, x0, y0, x1, y1, tile_target, map, lookup_cache, guide);
+
+                int left = --remaining;
+                std::lock_guard<std::mutex> guard(progress_lock);
+                stats.primary_rays += counters.primary;
+                stats.secondary_rays += counters.traced - counters.primary;
+                stats.shadow_rays += counters.shadow;
+                stats.cache_hits += lookups.hits;
+                stats.cache_misses += lookups.misses;
+                PT_STAT(stats.paths.merge(thread_path_counters()));
+                if (show_progress)
+                    std::clog << "\rTiles remaining: " << left << ' ' << std::flush;
+            });
+        }
+        group.wait();
+    };
+
+    // Samples [from, to) of the guided integrator, updating the guide after each guiding pass
+    auto render_guided = [&](framebuffer& image, uint32_t from, uint32_t to) {
+        while (from < to) {
+            const int k = path_guide::pass_of(from);
+            const uint32_t end = std::min(to, path_guide::pass_end(k));
+            render_tiles(image, end, nullptr);
+            if (end == path_guide::pass_end(k))
+                guide->update(k);
+            from = end;
+        }
+    };
+    if (replay > 0) {
+        framebuffer scratch(fb.width, fb.height);
+        render_guided(scratch, 0, replay);
+        stats.guide_replayed = replay;
+    }
+
+    // Samples [from, to) with ReSTIR, one at a time
+    auto render_restir = [&](framebuffer& image, uint32_t from, uint32_t to) {
+        for (uint32_t n = from; n < to; n++) {
+            render_tiles(image, n + 1, nullptr, 1);
+            render_tiles(image, n + 1, nullptr, 2);
+            restir->end_sample();
+        }
+    };
+    if (restir_replay > 0) {
+        framebuffer scratch(fb.width, fb.height);
+        render_restir(scratch, 0, restir_replay);
+        stats.restir_replayed = restir_replay;
+    }
+
+    // The mlt integrator's paths: the path tracer's, through image point (x, y) in pixels
+    const camera cam = scn.make_camera();
+    const bool sample_lights = scn.settings.lights != light_sampling::none && !scn.lights.emitters.empty();
+    auto radiance = [&](double x, double y) {
+        ray r = cam.get_ray(x / (fb.width - 1), y / (fb.height - 1));
+        thread_ray_counters().primary++;
+        return scn.settings.spectral
+            ? spectral_color(r, scn.settings.background, *scn.world, scn.lights, scn.settings.lights,
+                             scn.settings.max_depth)
+            : sample_lights
+            ? ray_color_nee(r, scn.settings.background, *scn.world, scn.lights, scn.settings.lights,
+                            scn.settings.max_depth)
+            : ray_color(r, scn.settings.background, *scn.world, scn.settings.max_depth);
+    };
+    auto add_counters = [&] {
+        const auto& counters = thread_ray_counters();
+        std::lock_guard<std::mutex> guard(progress_lock);
+        stats.primary_rays += counters.primary;
+        stats.secondary_rays += counters.traced - counters.primary;
+        stats.shadow_rays += counters.shadow;
+        PT_STAT(stats.paths.merge(thread_path_counters()));
+    };
+    auto reset_counters = [] {
+        thread_ray_counters() = ray_counters();
+        PT_STAT(thread_path_counters() = path_counters());
+    };
+    // Takes every chain to `spp` samples per pixel, then sets the framebuffer to their sums
+    auto render_chains = [&](uint32_t spp, bool write) {
+        task_group group(pool);
+        for (int c = 0; c < chains->settings.chains; c++) {
+            group.run([&, c] {
+                trace_scope trace("chain", "render", c);
+                reset_counters();
+                chains->run(c, spp, radiance);
+                add_counters();
+                int left = --remaining;
+                std::lock_guard<std::mutex> guard(progress_lock);
+                if (show_progress)
+                    std::clog << "\rChains remaining: " << left << ' ' << std::flush;
+            });
+        }
+        group.wait();
+        if (!write)
+            return;
+        if (chains->overflowed())
+            std::clog << "\nWarning: mlt pixel sums overflowed; the image is wrong\n";
+        const double scale = chains->normalization > 0 ? chains->estimate() / chains->normalization : 0;
+        for (size_t k = 0; k < fb.pixels.size(); k++) {
+            fb.pixels[k] = chains->pixel(k, scale);
+            fb.samples[k] = spp;
+        }
+    };
+    if (mlt_bootstrap) {
+        trace_scope bootstrap_trace("bootstrap", "render");
+        const int count = chains->settings.bootstrap, chunk = 4096;
+        task_group group(pool);
+        for (int begin = 0; begin < count; begin += chunk) {
+            group.run([&, begin] {
+                reset_counters();
+                chains->bootstrap(begin, std::min(count, begin + chunk), radiance);
+                add_counters();
+            });
+        }
+        group.wait();
+        chains->normalize();
+    }
+    if (mlt_replay > 0) {
+        render_chains(mlt_replay, false);
+        stats.mlt_replayed = mlt_replay;
+    }
+
+    for (int pass = 0; pass < passes; pass++) {
+        const uint32_t pass_target = std::min(target, done + (pass + 1) * step);
+        if (progressive_cache) {
+            for (uint32_t n = done + pass * step; n < pass_target; n++) {
+                // A resumed render first replays the batches its earlier samples saw
+                while (cache.batches <= static_cast<int>(n))
+                    cache.train(scn, cache.batches, cache_paths, pool);
+                render_tiles(fb, n + 1, nullptr);
+            }
+        } else if (guide) {
+            render_guided(fb, done + pass * step, pass_target);
+        } else if (restir) {
+            render_restir(fb, done + pass * step, pass_target);
+        } else if (chains) {
+            render_chains(pass_target, true);
+        } else if (!photon_mode) {
+            render_tiles(fb, pass_target, nullptr);
+        } else {
+            for (uint32_t n = done + pass * step; n < pass_target; n++) {
+                photon_pass current = photon_settings;
+                current.index = static_cast<int>(n);
+                current.radius = photon_radius(photon_settings.radius, alpha, static_cast<int>(n));
+                photons.build(*scn.world, scn.lights, current, pool);
+                stats.photon_passes++;
+                stats.photons += static_cast<uint64_t>(current.count);
+                stats.photons_stored += photons.stored;
+                stats.photon_rays += photons.rays;
+                stats.photon_seconds += photons.trace_seconds + photons.build_seconds;
+                stats.photon_store_bytes = std::max(stats.photon_store_bytes, photons.store_bytes());
+                stats.photon_memory_bytes = std::max(stats.photon_memory_bytes, photons.memory_usage());
+                render_tiles(fb, n + 1, &photons);
+            }
+        }
+
+        if (on_pass && pass + 1 < passes)
+            on_pass(fb);
+    }
+
+    stats.cache_batches = cache.batches;
+    stats.cache_paths = cache.paths;
+    stats.cache_records = cache.records;
+    stats.cache_rays = cache.rays;
+    stats.cache_seconds = cache.seconds;
+    stats.cache_cells = cache.cells();
+    stats.cache_store_bytes = cache.store_bytes();
+    stats.cache_memory_bytes = cache.memory_usage();
+    if (guide || restir || chains) {
+        state_fb = &fb;
+        state_samples = target;
+    }
+    if (chains) {
+        stats.mlt_chains = chains->settings.chains;
+        stats.mlt_normalization = chains->estimate();
+        stats.mlt_steps = chains->steps();
+        stats.mlt_accepted = chains->accepted();
+        stats.mlt_memory_bytes = chains->memory_usage();
+    }
+    if (restir) {
+        stats.restir_candidates = restir->settings.candidates;
+        stats.restir_memory_bytes = restir->memory_usage();
+    }
+    if (guide) {
+        stats.guide_updates = guide->updates;
+        stats.guide_leaves = guide->leaf_count();
+        stats.guide_nodes = guide->node_count();
+        stats.guide_memory_bytes = guide->memory_usage();
+        stats.guide_seconds = guide->update_seconds;
+    }
+    stats.seconds = std::chrono::duration<double>(clock::now() - start).count();
+    stats.samples = stats.primary_rays;
+    return stats;
+}
+
+void renderer::render_tile(framebuffer& fb, int x0, int y0, int x1, int y1, uint32_t target,
+                           const photon_map* photons, const radiance_cache* cache, path_guide* guide) const {
+    const auto& settings = scn.settings;
+    const hittable& world = *scn.world;
+    const camera cam = scn.make_camera();
+    const bool track_cost = !fb.cost.empty();
+    const bool track_features = !fb.albedo.empty();
+    const bool sample_lights = settings.lights != light_sampling::none && !scn.lights.emitters.empty();
+    const bool bidirectional = settings.integrator == integrator_type::bdpt;
+    pcg32& generator = random_generator();
+    counter_sampler counter;
+    const bool counter_based = settings.sampler == sampler_type::counter;
+    if (counter_based)
+        thread_sample_source() = &counter;
+
+    for (int j = y0; j < y1; ++j) {
+        for (int i = x0; i < x1; ++i) {
+            const size_t k = static_cast<size_t>(j) * fb.width + i;
+            color& pixel_color = fb.pixels[k];
+            color& pixel_squares = fb.squares[k];
+            uint32_t& samples = fb.samples[k];
+
+            // Counters and clock before the pixel, for the cost channel
+            using clock = std::chrono::steady_clock;
+            const uint64_t rays_before = thread_ray_counters().traced;
+            const uint64_t nodes_before = thread_path_counters().nodes_visited;
+            const auto time_before = track_cost ? clock::now() : clock::time_point();
+
+            // The pixel's own generator picks up where its last sample left off
+            if (samples == 0)
+                fb.samplers[k].seed(static_cast<uint64_t>(settings.seed), k);
+            generator = fb.samplers[k];
+
+            // Multiple samples per pixel for antialiasing and noise reduction
+            for (; samples < target; ++samples) {
+                if (counter_based)
+                    counter.start(static_cast<uint64_t>(settings.seed), k, samples);
+                auto u = (i + random_double()) / (fb.width-1);
+                auto v = (j + random_double()) / (fb.height-1);
+                ray r = cam.get_ray(u, v);
+                thread_ray_counters().primary++;
+#ifdef PT_STATS
+                const uint64_t traced_before = thread_ray_counters().traced - thread_ray_counters().shadow;
+#endif
+                first_hit aov;
+                color sample = photons
+                    ? photon_color(r, settings.background, world, scn.lights, settings.lights, settings.max_depth,
+                                   *photons, track_features ? &aov : nullptr)
+                    : cache
+                    ? ray_color_cached(r, settings.background, world, scn.lights, settings.lights, sample_lights,
+                                       settings.max_depth, *cache, track_features ? &aov : nullptr)
+                    : guide
+                    ? guided_color(r, settings.background, world, scn.lights, settings.lights, sample_lights,
+                                   settings.max_depth, *guide, track_features ? &aov : nullptr)
+                    : bidirectional
+                    ? bdpt_color(r, settings.background, world, scn.lights, settings.max_depth,
+                                 track_features ? &aov : nullptr)
+                    : settings.spectral
+                    ? spectral_color(r, settings.background, world, scn.lights, settings.lights, settings.max_depth,
+                                     track_features ? &aov : nullptr)
+                    : sample_lights
+                    ? ray_color_nee(r, settings.background, world, scn.lights, settings.lights, settings.max_depth,
+                                    track_features ? &aov : nullptr)
+                    : ray_color(r, settings.background, world, settings.max_depth, track_features ? &aov : nullptr);
+                if (track_features) {
+                    fb.albedo[k] += aov.albedo;
+                    fb.normal[k] += aov.normal;
+                    fb.distance[k] += aov.distance;
+                }
+                PT_STAT(thread_path_counters().record_path(thread_ray_counters().traced - thread_ray_counters().shadow
+                                                           - traced_before));
+                pixel_color += sample;
+                pixel_squares += sample * sample;
+            }
+            fb.samplers[k] = generator;
+
+            if (track_cost) {
+                const double ns = std::chrono::duration<double, std::nano>(clock::now() - time_before).count();
+                fb.cost[k] +=
+                    color(static_cast<double>(thread_ray_counters().traced - rays_before),
+                          static_cast<double>(thread_path_counters().nodes_visited - nodes_before), ns);
+            }
+        }
+    }
+    thread_sample_source() = nullptr;
+}
+
+void renderer::restir_tile(framebuffer& fb, int x0, int y0, int x1, int y1, uint32_t target, restir_di& restir,
+                           bool resolve) const {
+    const auto& settings = scn.settings;
+    const hittable& world = *scn.world;
+    const camera cam = scn.make_camera();
+    const bool track_cost = !fb.cost.empty();
+    const bool track_features = !fb.albedo.empty();
+    pcg32& generator = random_generator();
+    counter_sampler counter;
+    const bool counter_based = settings.sampler == sampler_type::counter;
+    if (counter_based)
+        thread_sample_source() = &counter;
+
+    for (int j = y0; j < y1; ++j) {
+        for (int i = x0; i < x1; ++i) {
+            const size_t k = static_cast<size_t>(j) * fb.width + i;
+            if (fb.samples[k] >= target)
+                continue;
+            // The second round's numbers follow the first's, far enough on not to meet them
+            if (counter_based)
+                counter.start(static_cast<uint64_t>(settings.seed), k, fb.samples[k], resolve ? 1ull << 32 : 0);
+
+            using clock = std::chrono::steady_clock;
+            const uint64_t rays_before = thread_ray_counters().traced;
+            const uint64_t nodes_before = thread_path_counters().nodes_visited;
+            const auto time_before = track_cost ? clock::now() : clock::time_point();
+
+            // Both rounds draw from the pixel's generator, in turn
+            if (fb.samples[k] == 0 && !resolve)
+                fb.samplers[k].seed(static_cast<uint64_t>(settings.seed), k);
+            generator = fb.samplers[k];
+
+            if (!resolve) {
+                auto u = (i + random_double()) / (fb.width-1);
+                auto v = (j + random_double()) / (fb.height-1);
+                thread_ray_counters().primary++;
+                first_hit aov;
+                restir.generate(k, cam.get_ray(u, v), world, scn.lights, track_features ? &aov : nullptr);
+                if (track_features) {
+                    fb.albedo[k] += aov.albedo;
+                    fb.normal[k] += aov.normal;
+                    fb.distance[k] += aov.distance;
+                }
+            } else {
+#ifdef PT_STATS
+                const uint64_t traced_before = thread_ray_counters().traced - thread_ray_counters().shadow;
+#endif
+                const color sample = restir.resolve(i, j, settings.background, world, scn.lights, settings.lights,
+                                                    settings.max_depth);
+                // The camera ray was traced in the first round
+                PT_STAT(thread_path_counters().record_path(thread_ray_counters().traced - thread_ray_counters().shadow
+                                                           - traced_before + 1));
+                fb.pixels[k] += sample;
+                fb.squares[k] += sample * sample;
+                fb.samples[k]++;
+            }
+            fb.samplers[k] = generator;
+
+            if (track_cost) {
+                const double ns = std::chrono::duration<double, std::nano>(clock::now() - time_before).count();
+                fb.cost[k] +=
+                    color(static_cast<double>(thread_ray_counters().traced - rays_before),
+                          static_cast<double>(thread_path_counters().nodes_visited - nodes_before), ns);
+            }
+        }
+    }
+    thread_sample_source() = nullptr;
+}
+
+// Reservoir resampling, when it ran
+void print_restir_stats(std::ostream& out, const render_stats& stats) {
+    if (stats.restir_candidates == 0)
+        return;
+    out << "ReSTIR: " << stats.restir_candidates << " candidates per pixel and sample, reservoirs and hits "
+        << stats.restir_memory_bytes / 1024 << " KiB";
+    if (stats.restir_replayed > 0)
+        out << "; " << stats.restir_replayed << " spp replayed to rebuild them";
+    out << '\n';
+}
+
+// Metropolis chains, when the mlt integrator ran
+void print_mlt_stats(std::ostream& out, const render_stats& stats) {
+    if (stats.mlt_chains == 0)
+        return;
+    const double steps = stats.mlt_steps > 0 ? static_cast<double>(stats.mlt_steps) : 1;
+    out << "Metropolis: " << stats.mlt_chains << " chains, " << stats.mlt_steps << " steps, "
+        << 100 * stats.mlt_accepted / steps << "% accepted; mean path luminance " << stats.mlt_normalization
+        << ", chains and sums " << stats.mlt_memory_bytes / 1024 << " KiB";
+    if (stats.mlt_replayed > 0)
+        out << "; " << stats.mlt_replayed << " spp replayed to rebuild them";
+    out << '\n';
+}
+
+// Photon throughput and store size, when photon passes ran
+void print_photon_stats(std::ostream& out, const render_stats& stats) {
+    if (stats.photon_passes == 0)
+        return;
+    out << "Photons: " << stats.photons << " shot in " << stats.photon_passes << " passes, "
+        << stats.photons_stored << " stored, " << stats.photon_rays << " rays; "
+        << (stats.photon_seconds > 0 ? stats.photons / stats.photon_seconds / 1e6 : 0) << " Mphotons/s, store "
+        << stats.photon_store_bytes / 1024 << " KiB per pass (" << stats.photon_memory_bytes / 1024
+        << " KiB with build buffers)\n";
+}
+
+// Training and lookups of the radiance cache, when it ran
+void print_cache_stats(std::ostream& out, const render_stats& stats) {
+    if (stats.cache_batches == 0)
+        return;
+    const double lookups = stats.cache_hits + stats.cache_misses > 0 ? stats.cache_hits + stats.cache_misses : 1;
+    out << "Radiance cache: " << stats.cache_paths << " training paths in " << stats.cache_batches << " batches, "
+        << stats.cache_rays << " rays, " << stats.cache_seconds << " s; " << stats.cache_records << " records in "
+        << stats.cache_cells << " cells, " << stats.cache_store_bytes / 1024 << " KiB ("
+        << stats.cache_memory_bytes / 1024 << " KiB with training buffers); "
+        << 100 * stats.cache_hits / lookups << "% of lookups ended the path\n";
+}
+
+// Size and upkeep of the path guide, when the guided integrator ran
+void print_guiding_stats(std::ostream& out, const render_stats& stats) {
+    if (stats.guide_leaves == 0)
+        return;
+    out << "Path guide: " << stats.guide_updates << " updates in " << stats.guide_seconds << " s; "
+        << stats.guide_leaves << " regions, " << stats.guide_nodes << " quadtree nodes, "
+        << stats.guide_memory_bytes / 1024 << " KiB";
+    if (stats.guide_replayed > 0)
+        out << "; " << stats.guide_replayed << " spp replayed to rebuild it";
+    out << '\n';
+}
+
+// Human-readable counter summary; the path counters only appear when compiled in
+void print_stats(std::ostream& out, const render_stats& stats, const phase_times& phases) {
+    out << "Time: parse " << phases.parse_ms << " ms, build " << phases.build_ms << " ms, render "
+        << phases.render_ms << " ms, output " << phases.output_ms << " ms (denoise " << phases.denoise_ms << " ms)\n";
+    out << "Rays: " << stats.primary_rays << " primary, " << stats.secondary_rays << " secondary ("
+        << stats.shadow_rays << " shadow)\n";
+    print_photon_stats(out, stats);
+    print_cache_stats(out, stats);
+    print_guiding_stats(out, stats);
+    print_restir_stats(out, stats);
+    print_mlt_stats(out, stats);
+    if (!path_counters_enabled())
+        return;
+
+    const auto& p = stats.paths;
+    const double rays = stats.rays() > 0 ? static_cast<double>(stats.rays()) : 1;
+    const double paths = p.paths() > 0 ? static_cast<double>(p.paths()) : 1;
+    out << "BVH: " << p.nodes_visited << " nodes visited (" << p.nodes_visited / rays << " per ray), "
+        << p.prim_tests << " primitive tests (" << p.prim_tests / rays << " per ray)\n";
+    out << "Paths: " << p.paths() << " ended: " << 100 * p.ended_light / paths << "% on a light, "
+        << 100 * p.ended_miss / paths << "% escaped, " << 100 * p.ended_max_depth / paths << "% at max_depth, "
+        << 100 * p.ended_cache / paths << "% in the radiance cache\n";
+    out << "Path length (rays): ";
+    for (int i = 0; i < path_counters::length_bins; i++) {
+        if (p.path_length[i] > 0)
+            out << ' ' << i << (i == path_counters::length_bins - 1 ? "+" : "") << ": "
+                << 100 * p.path_length[i] / paths << '%';
+    }
+    out << '\n';
+}
+
+// The same figures as one JSON object
+void write_stats_json(std::ostream& out, const render_stats& stats, const phase_times& phases) {
+    const auto& p = stats.paths;
+    out << "{\n  \"phases_ms\": {\"parse\": " << phases.parse_ms << ", \"build\": " << phases.build_ms
+        << ", \"render\": " << phases.render_ms << ", \"output\": " << phases.output_ms
+        << ", \"denoise\": " << phases.denoise_ms << "},\n"
+        << "  \"samples\": " << stats.samples << ",\n"
+        << "  \"primary_rays\": " << stats.primary_rays << ",\n"
+        << "  \"secondary_rays\": " << stats.secondary_rays << ",\n"
+        << "  \"shadow_rays\": " << stats.shadow_rays << ",\n"
+        << "  \"photons\": {\"passes\": " << stats.photon_passes << ", \"shot\": " << stats.photons
+        << ", \"stored\": " << stats.photons_stored << ", \"rays\": " << stats.photon_rays
+        << ", \"seconds\": " << stats.photon_seconds << ", \"store_bytes\": " << stats.photon_store_bytes
+        << ", \"memory_bytes\": " << stats.photon_memory_bytes << "},\n"
+        << "  \"radiance_cache\": {\"batches\": " << stats.cache_batches << ", \"paths\": " << stats.cache_paths
+        << ", \"records\": " << stats.cache_records << ", \"rays\": " << stats.cache_rays
+        << ", \"seconds\": " << stats.cache_seconds << ", \"cells\": " << stats.cache_cells
+        << ", \"store_bytes\": " << stats.cache_store_bytes << ", \"memory_bytes\": " << stats.cache_memory_bytes
+        << ", \"hits\": " << stats.cache_hits
+        << ", \"misses\": " << stats.cache_misses << "},\n"
+        << "  \"path_guide\": {\"updates\": " << stats.guide_updates << ", \"seconds\": " << stats.guide_seconds
+        << ", \"regions\": " << stats.guide_leaves << ", \"nodes\": " << stats.guide_nodes
+        << ", \"memory_bytes\": " << stats.guide_memory_bytes << ", \"replayed_spp\": " << stats.guide_replayed
+        << "},\n"
+        << "  \"restir\": {\"candidates\": " << stats.restir_candidates << ", \"memory_bytes\": "
+        << stats.restir_memory_bytes << ", \"replayed_spp\": " << stats.restir_replayed << "},\n"
+        << "  \"mlt\": {\"chains\": " << stats.mlt_chains << ", \"normalization\": " << stats.mlt_normalization
+        << ", \"steps\": " << stats.mlt_steps << ", \"accepted\": " << stats.mlt_accepted
+        << ", \"memory_bytes\": " << stats.mlt_memory_bytes << ", \"replayed_spp\": " << stats.mlt_replayed << "},\n"
+        << "  \"counters_enabled\": " << (path_counters_enabled() ? "true" : "false");
+    if (path_counters_enabled()) {
+        out << ",\n  \"nodes_visited\": " << p.nodes_visited << ",\n"
+            << "  \"primitive_tests\": " << p.prim_tests << ",\n"
+            << "  \"paths_ended\": {\"light\": " << p.ended_light << ", \"miss\": " << p.ended_miss
+            << ", \"max_depth\": " << p.ended_max_depth << ", \"cache\": " << p.ended_cache << "},\n"
+            << "  \"path_length\": [";
+        // Trailing empty bins are left out
+        int last = path_counters::length_bins - 1;
+        while (last > 0 && p.path_length[last] == 0)
+            last--;
+        for (int i = 0; i <= last; i++)
+            out << (i ? ", " : "") << p.path_length[i];
+        out << "]";
+    }
+    out << "\n}\n";
+}
+
+// Plain PPM, top row first
+void write_ppm(std::ostream& out, const framebuffer& fb) {
+    out << "P3\n" << fb.width << ' ' << fb.height << "\n255\n";
+    for (int j = fb.height-1; j >= 0; --j) {
+        for (int i = 0; i < fb.width; ++i) {
+            const size_t k = static_cast<size_t>(j) * fb.width + i;
+            write_color(out, fb.pixels[k], std::max(1, static_cast<int>(fb.samples[k])));
+        }
+    }
+}
+
+// The same for an image of means, such as a denoised one
+void write_ppm(std::ostream& out, const float_image& img) {
+    out << "P3\n" << img.width << ' ' << img.height << "\n255\n";
+    for (int j = img.height-1; j >= 0; --j) {
+        for (int i = 0; i < img.width; ++i)
+            write_color(out, img.at(i, j), 1);
+    }
+}
+
+#endif
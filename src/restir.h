@@ -0,0 +1,397 @@
+#ifndef RESTIR_H
+#define RESTIR_H
+
+#include "rtweekend.h"
+#include "color.h"
+#include "hittable.h"
+#include "integrator.h"
+#include "lights.h"
+#include "material.h"
+#include "stats.h"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+// Reservoir-Based Direct Lighting
+//
+// ReSTIR DI (Bitterli et al. 2020) for the light reaching the camera's first hits. Each
+// pixel draws a few candidate points on emitters in proportion to their power, plus the one
+// its material's bounce runs into, keeps one of them in proportion to its unshadowed
+// contribution, and remembers it in a reservoir: the sample, the sum of the candidates'
+// weights and their number. Reservoirs then merge, with the pixel's own from the previous
+// sample when temporal reuse is on and with a few random neighbours' (spatial reuse), each
+// merge keeping one sample out of all the candidates behind both. A pixel so chooses from
+// several times the candidates it drew, and shades the chosen one with a single shadow ray.
+//
+// Every sample index runs in two rounds over the image: the first traces the camera rays
+// and their first bounce, draws candidates, drops a candidate its shadow ray finds blocked
+// and merges with the previous sample; the second, once every pixel has done so, merges
+// neighbours, shades and continues the path along the bounce. Each round only reads what
+// the last one wrote, so images are the same for any thread count.
+//
+// Merges weigh each reservoir's sample by the balance heuristic over the surfaces merged,
+// which keeps the estimate unbiased for unshadowed light. Neighbours facing more than 25
+// degrees away or lying at a depth 10% off are not merged. Visibility is only tested on the
+// final sample, so light can leak from a neighbour's sample across a shadow edge: a small
+// bias, the price of a preview that converges fast. Only the first hit's direct light is
+// resampled; the rest of the path is traced as next-event estimation would.
+//
+// Temporal reuse is off by default. It makes each sample better, but the framebuffer
+// averages a pixel's samples, and those it ties together share their light sample: on
+// scenes/cornell_many_lights.scene the average at 16 spp has a third to a half more error
+// with a history of 20 than without.
+
+struct restir_settings {
+    int candidates = 8;         // drawn per pixel and sample
+    int neighbours = 3;         // spatial merges per pixel
+    double radius = 16;         // pixels the neighbours lie within
+    double history = 0;         // the previous sample counts for at most this many times the new candidates
+};
+
+namespace restir_detail {
+
+// One chosen light sample and what it was chosen from
+struct reservoir {
+    int light = -1;         // emitter index, or -1 for none
+    point3 y;               // the point on it
+    double w_sum = 0;       // resampling weights seen
+    double M = 0;           // candidates seen
+    double W = 0;           // weight the sample's contribution is multiplied by
+    bool tested = false;    // y is known to be visible from the surface the reservoir is for
+
+    // Streams in a candidate of resampling weight w standing for m candidates; u in [0, 1).
+    // Returns whether it replaced the sample.
+    bool add(int l, const point3& q, double w, double m, double u) {
+        w_sum += w;
+        M += m;
+        if (w > 0 && u * w_sum < w) {
+            light = l;
+            y = q;
+            return true;
+        }
+        return false;
+    }
+};
+
+// What a pixel's camera ray hit, which neighbours' merges read
+struct surface {
+    hit_record rec;
+    double depth = 0;       // along the camera ray
+    bool hit = false;
+    bool diffuse = false;   // light samples can shade it
+};
+
+// The rest of the pixel's path as the first round leaves it: the camera ray, and the bounce
+// the material drew at the hit with what it runs into, a candidate when that is an emitter
+struct path_start {
+    ray r;
+    ray bounce;
+    color attenuation;
+    hit_record next;
+    bool scattered = false;
+    bool next_hit = false;
+};
+
+// Unshadowed luminance emitter `light`'s point y sends through surface s to the camera,
+// per unit area of the emitter: the target the reservoirs resample towards
+inline double target(const surface& s, const light_set& lights, int light, const point3& y) {
+    if (light < 0 || !s.diffuse)
+        return 0;
+    const emitter& e = lights.emitters[light];
+    const vec3 to_light = y - s.rec.p;
+    const double dist2 = to_light.length_squared();
+    const vec3 wi = to_light / std::sqrt(dist2);
+    return light_detail::luminance(s.rec.mat->eval(s.rec, wi) * e.radiance) * std::fabs(dot(e.normal, wi)) / dist2;
+}
+
+// Whether a neighbour's reservoir is worth merging into a pixel's
+inline bool similar(const surface& a, const surface& b) {
+    return b.diffuse && dot(a.rec.normal, b.rec.normal) > 0.906 && std::fabs(a.depth - b.depth) < 0.1 * a.depth;
+}
+
+// Merges `count` reservoirs, reservoir i found at surface at[i], into one for surface s.
+// Each sample is weighted by the balance heuristic over the surfaces, counted by their
+// candidates, so one that a neighbour's target rarely chose but s's target rates highly
+// cannot outweigh the rest.
+inline reservoir combine(const surface& s, const light_set& lights, const reservoir* const* in,
+                         const surface* const* at, int count) {
+    reservoir out;
+    double p = 0;           // target of the kept sample at s
+    for (int i = 0; i < count; i++) {
+        const reservoir& r = *in[i];
+        const double u = random_double();
+        double mine = 0, all = 0, own = -1;
+        if (r.W > 0) {
+            for (int j = 0; j < count; j++) {
+                const double t = target(*at[j], lights, r.light, r.y);
+                if (at[j] == &s)
+                    own = t;
+                all += in[j]->M * t;
+                if (j == i)
+                    mine = in[j]->M * t;
+            }
+            if (own < 0)
+                own = target(s, lights, r.light, r.y);
+        }
+        const double w = all > 0 ? mine / all * own * r.W : 0;
+        if (out.add(r.light, r.y, w, r.M, u)) {
+            out.tested = r.tested && at[i] == &s;
+            p = own;
+        }
+    }
+    out.W = p > 0 ? out.w_sum / p : 0;
+    return out;
+}
+
+// Whether nothing blocks the segment from p to y
+inline bool visible(const hittable& world, const point3& p, const point3& y) {
+    const vec3 to_light = y - p;
+    const double dist = to_light.length();
+    thread_ray_counters().traced++;
+    thread_ray_counters().shadow++;
+    hit_record blocker;
+    return !world.hit(ray(p, to_light / dist), 0.001, dist * (1 - 1e-6), blocker);
+}
+
+} // namespace restir_detail
+
+class restir_di {
+public:
+    restir_di(int w, int h, const restir_settings& s)
+        : settings(s), width(w), height(h), current(static_cast<size_t>(w) * h), previous(current.size()),
+          paths(current.size()), temporal(current.size()), resolved(current.size()) {}
+
+    // First round for pixel k: traces camera ray r, draws candidates and merges them with the
+    // pixel's reservoir from the previous sample
+    void generate(size_t k, const ray& r, const hittable& world, const light_set& lights, first_hit* aov);
+
+    // Second round for pixel (i, j): merges neighbours, then returns the path's light with
+    // the first hit's direct light from the merged reservoir
+    color resolve(int i, int j, const color& background, const hittable& world, const light_set& lights,
+                  light_sampling mode, int depth);
+
+    // After both rounds of a sample over the image
+    void end_sample() { std::swap(current, previous); }
+
+    size_t memory_usage() const {
+        return (current.capacity() + previous.capacity()) * sizeof(restir_detail::surface)
+             + paths.capacity() * sizeof(restir_detail::path_start)
+             + (temporal.capacity() + resolved.capacity()) * sizeof(restir_detail::reservoir);
+    }
+
+public:
+    restir_settings settings;
+
+private:
+    int width, height;
+    std::vector<restir_detail::surface> current, previous;
+    std::vector<restir_detail::path_start> paths;
+    std::vector<restir_detail::reservoir> temporal;     // after the first round
+    std::vector<restir_detail::reservoir> resolved;     // after the second, kept for the next sample
+};
+
+void restir_di::generate(size_t k, const ray& r, const hittable& world, const light_set& lights,
+                         first_hit* aov) {
+    using namespace restir_detail;
+    surface& s = current[k];
+    path_start& path = paths[k];
+    path.r = r;
+    thread_ray_counters().traced++;
+    s.hit = world.hit(r, 0.001, infinity, s.rec);
+    s.diffuse = s.hit && s.rec.mat->pdf(s.rec, s.rec.normal) > 0 && !lights.emitters.empty();
+    s.depth = s.hit ? s.rec.t * r.direction().length() : 0;
+    if (aov && s.hit) {
+        aov->albedo = s.rec.mat->surface_albedo();
+        aov->normal = s.rec.normal;
+        aov->distance = s.depth;
+    }
+    reservoir& out = temporal[k];
+    out = reservoir();
+    if (!s.diffuse)
+        return;
+
+    // Candidates drawn in proportion to the emitters' power, which the resampling then sharpens
+    // to what reaches this point far more cheaply than the light BVH would, and one more where
+    // the material's bounce finds an emitter. Each is weighted by the balance heuristic over
+    // both ways of drawing it, so points beside an emitter, which the light samples reach
+    // with huge weights, come mostly from the bounce as they do for next-event estimation.
+    const double count = settings.candidates;
+    reservoir fresh;
+    for (int c = 0; c < settings.candidates; c++) {
+        double pmf;
+        const int light = lights.sample_power(random_double(), pmf);
+        const double a = random_double(), b = random_double(), u = random_double();
+        if (light < 0 || pmf <= 0) {
+            fresh.add(-1, point3(), 0, 1, u);
+            continue;
+        }
+        // target / (count * light density + bounce density), both per unit area, times dist2
+        const emitter& e = lights.emitters[light];
+        const point3 y = e.point(a, b);
+        const vec3 to_y = y - s.rec.p;
+        const double dist2 = to_y.length_squared();
+        const vec3 wi = to_y / std::sqrt(dist2);
+        const double bsdf_pdf = s.rec.mat->pdf(s.rec, wi);
+        double w = 0;
+        if (bsdf_pdf > 0) {
+            const double cos_light = std::fabs(dot(e.normal, wi));
+            w = light_detail::luminance(s.rec.mat->eval(s.rec, wi) * e.radiance) * cos_light
+              / (count * pmf * dist2 / e.area + bsdf_pdf * cos_light);
+        }
+        fresh.add(light, y, w, 1, u);
+    }
+    path.scattered = s.rec.mat->scatter(r, s.rec, path.attenuation, path.bounce);
+    path.next_hit = false;
+    if (path.scattered) {
+        thread_ray_counters().traced++;
+        path.next_hit = world.hit(path.bounce, 0.001, infinity, path.next);
+    }
+    const double u = random_double();
+    bool from_bounce = false;       // the bounce found the sample, so nothing blocks it
+    if (path.next_hit && path.next.light >= 0) {
+        const int light = path.next.light;
+        const emitter& e = lights.emitters[light];
+        const vec3 wi = unit_vector(path.bounce.direction());
+        const double dist = path.next.t * path.bounce.direction().length();
+        const double cos_light = std::max(std::fabs(dot(e.normal, wi)), 1e-12);
+        const double bsdf_area = s.rec.mat->pdf(s.rec, wi) * cos_light / (dist * dist);
+        const double light_area = lights.power_pmf(light) / e.area;
+        from_bounce = fresh.add(light, path.next.p,
+                                target(s, lights, light, path.next.p) / (count * light_area + bsdf_area), 0, u);
+    }
+    // The balance heuristic already divides by the candidates
+    const double p = target(s, lights, fresh.light, fresh.y);
+    fresh.W = p > 0 ? fresh.w_sum / p : 0;
+    // A blocked sample is no use to this pixel or any that merges it
+    if (fresh.W > 0 && !from_bounce && !visible(world, s.rec.p, fresh.y))
+        fresh.W = 0;
+    fresh.tested = fresh.W > 0;
+
+    const surface& before = previous[k];
+    if (settings.history <= 0 || !similar(s, before)) {
+        out = fresh;
+        return;
+    }
+    reservoir history = resolved[k];
+    history.M = std::min(history.M, settings.history * fresh.M);
+    const reservoir* in[2] = {&fresh, &history};
+    const surface* at[2] = {&s, &before};
+    out = combine(s, lights, in, at, 2);
+}
+
+color restir_di::resolve(int i, int j, const color& background, const hittable& world, const light_set& lights,
+                         light_sampling mode, int depth) {
+    using namespace restir_detail;
+    const size_t k = static_cast<size_t>(j) * width + i;
+    const surface& s = current[k];
+    const path_start& path = paths[k];
+    const bool sample_lights = mode != light_sampling::none && !lights.emitters.empty();
+    if (!s.hit) {
+        PT_STAT(thread_path_counters().ended_miss++);
+        return background;
+    }
+    // Emitters end the path there; other surfaces are path traced from the camera as usual
+    if (!s.diffuse) {
+        ray scattered;
+        color attenuation;
+        if (!s.rec.mat->scatter(path.r, s.rec, attenuation, scattered)) {
+            PT_STAT(thread_path_counters().ended_light++);
+            return s.rec.mat->emitted();
+        }
+        return sample_lights ? ray_color_nee(path.r, background, world, lights, mode, depth)
+                             : ray_color(path.r, background, world, depth);
+    }
+
+    // Neighbours within the radius, by the pixel's own generator
+    const reservoir* in[16];
+    const surface* at[16];
+    int count = 0;
+    in[count] = &temporal[k];
+    at[count++] = &s;
+    for (int n = 0; n < std::min(settings.neighbours, 15); n++) {
+        const double angle = 2 * pi * random_double();
+        const double radius = settings.radius * std::sqrt(random_double());
+        const int x = i + static_cast<int>(std::lround(radius * std::cos(angle)));
+        const int y = j + static_cast<int>(std::lround(radius * std::sin(angle)));
+        if (x < 0 || y < 0 || x >= width || y >= height || (x == i && y == j))
+            continue;
+        const size_t q = static_cast<size_t>(y) * width + x;
+        if (!similar(s, current[q]))
+            continue;
+        in[count] = &temporal[q];
+        at[count++] = &current[q];
+    }
+    const reservoir chosen = count > 1 ? combine(s, lights, in, at, count) : temporal[k];
+    resolved[k] = chosen;
+
+    color result = s.rec.mat->emitted();
+    if (depth < 2)
+        return result;
+    if (chosen.W > 0 && (chosen.tested || visible(world, s.rec.p, chosen.y))) {
+        const emitter& e = lights.emitters[chosen.light];
+        const vec3 to_light = chosen.y - s.rec.p;
+        const double dist2 = to_light.length_squared();
+        const vec3 wi = to_light / std::sqrt(dist2);
+        result += s.rec.mat->eval(s.rec, wi) * e.radiance * (std::fabs(dot(e.normal, wi)) / dist2 * chosen.W);
+    }
+
+    // The rest of the path, as ray_color_nee traces it from the bounce the first round drew,
+    // except that emitters in the light set add nothing there: the reservoir has counted them
+    if (!path.scattered)
+        return result;
+    ray current_ray = path.bounce;
+    color throughput = path.attenuation;
+    double bsdf_pdf = s.rec.mat->pdf(s.rec, current_ray.direction());
+    point3 last_p = s.rec.p;
+    vec3 last_normal = s.rec.normal;
+    for (int bounce = 1; ; bounce++) {
+        if (bounce >= depth) {
+            PT_STAT(thread_path_counters().ended_max_depth++);
+            return result;
+        }
+
+        hit_record rec;
+        bool hit = path.next_hit;
+        if (bounce == 1) {
+            rec = path.next;
+        } else {
+            thread_ray_counters().traced++;
+            hit = world.hit(current_ray, 0.001, infinity, rec);
+        }
+        if (!hit) {
+            PT_STAT(thread_path_counters().ended_miss++);
+            return result + throughput * background;
+        }
+
+        color emitted = rec.mat->emitted();
+        if (rec.light >= 0 && bounce == 1) {
+            emitted = color(0, 0, 0);
+        } else if (rec.light >= 0 && sample_lights && bsdf_pdf > 0) {
+            const emitter& light = lights.emitters[rec.light];
+            const double dist = rec.t * current_ray.direction().length();
+            const double cos_light = std::fabs(dot(light.normal, unit_vector(current_ray.direction())));
+            const double light_pdf = lights.pmf(mode, last_p, last_normal, rec.light) * dist * dist
+                                   / (light.area * std::max(cos_light, 1e-12));
+            emitted = emitted * mis_weight(bsdf_pdf, light_pdf);
+        }
+        result += throughput * emitted;
+
+        ray scattered;
+        color attenuation;
+        if (!rec.mat->scatter(current_ray, rec, attenuation, scattered)) {
+            PT_STAT(thread_path_counters().ended_light++);
+            return result;
+        }
+        if (sample_lights && bounce + 1 < depth && rec.mat->pdf(rec, rec.normal) > 0)
+            result += throughput * sample_direct(rec, world, lights, mode);
+
+        throughput = throughput * attenuation;
+        bsdf_pdf = sample_lights ? rec.mat->pdf(rec, scattered.direction()) : 0;
+        last_p = rec.p;
+        last_normal = rec.normal;
+        current_ray = scattered;
+    }
+}
+
+#endif
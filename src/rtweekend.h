@@ -1,7 +1,9 @@
 #ifndef RTWEEKEND_H
 #define RTWEEKEND_H
 
+#include <atomic>
 #include <cmath>
+#include <cstdint>
 #include <limits>
 #include <memory>
 #include <cstdlib>
@@ -20,9 +22,97 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
+// PCG32 generator (O'Neill): 64-bit state, 32-bit output, independent streams
+class pcg32 {
+public:
+    pcg32(uint64_t seed_value = 0x853c49e6748fea9bULL, uint64_t stream = 0) { seed(seed_value, stream); }
+
+    void seed(uint64_t seed_value, uint64_t stream = 0) {
+        inc = (stream << 1u) | 1u;
+        state = 0;
+        next();
+        state += seed_value;
+        next();
+    }
+
+    uint32_t next() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        uint32_t xorshifted = static_cast<uint32_t>(((old >> 18u) ^ old) >> 27u);
+        uint32_t rot = static_cast<uint32_t>(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((0u - rot) & 31));
+    }
+
+    // Uniform in [0,1)
+    double next_double() {
+        return next() * (1.0 / 4294967296.0);
+    }
+
+public:
+    uint64_t state;
+    uint64_t inc;
+};
+
+// Each thread draws from its own stream, so render threads neither share state nor
+// serialize on a lock the way rand() does. Streams are handed out in thread start order.
+inline pcg32& random_generator() {
+    static std::atomic<uint64_t> next_stream{0};
+    static thread_local pcg32 generator(0x853c49e6748fea9bULL, next_stream++);
+    return generator;
+}
+
+inline void seed_random(uint64_t seed_value, uint64_t stream = 0) {
+    random_generator().seed(seed_value, stream);
+}
+
+// Numbers for integrators that choose what a path is built from rather than drawing it,
+// such as Metropolis sampling in primary sample space (see mlt.h). While one is set on a
+// thread, random_double() reads from it instead of the thread's generator.
+class sample_source {
+public:
+    virtual ~sample_source() = default;
+    virtual double next() = 0;      // in [0,1)
+};
+
+inline sample_source*& thread_sample_source() {
+    static thread_local sample_source* source = nullptr;
+    return source;
+}
+
+// SplitMix64's finalizer (Steele et al. 2014): every bit of the input moves about half of
+// the output's
+inline uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Counter-based numbers: the n-th number of a sample is a hash of (seed, pixel, sample, n),
+// so it depends on nothing drawn before it, on this pixel or any other. Sampling then needs
+// no generator state carried between samples, and a render's numbers are fixed by where
+// they are used, whichever thread uses them and in whatever order.
+class counter_sampler : public sample_source {
+public:
+    // Numbers of one sample, from dimension `first` on
+    void start(uint64_t seed, uint64_t pixel, uint64_t sample, uint64_t first = 0) {
+        key = mix64(mix64(mix64(seed) + pixel) + sample);
+        dimension = first;
+    }
+
+    double next() override {
+        return (mix64(key + 0x9e3779b97f4a7c15ULL * ++dimension) >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+private:
+    uint64_t key = 0;
+    uint64_t dimension = 0;
+};
+
 inline double random_double() {
     // Returns a random real in [0,1).
-    return rand() / (RAND_MAX + 1.0);
+    if (sample_source* source = thread_sample_source())
+        return source->next();
+    return random_generator().next_double();
 }
 
 inline double random_double(double min, double max) {
@@ -0,0 +1,607 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "aarect.h"
+#include "box.h"
+#include "triangle.h"
+#include "mesh.h"
+#include "transform.h"
+#include "instance.h"
+#include "bvh.h"
+#include "material.h"
+#include "lights.h"
+#include "trace.h"
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Scene Description
+//
+// A scene file is plain text, one statement per line, '#' starts a comment:
+//
+//   image      <width> <height>
+//   samples    <samples per pixel>
+//   max_depth  <bounces>
+//   seed       <n>                      (random sequence; images differ per seed)
+//   sampler    pcg|counter              (each pixel's generator, or numbers hashed from the
+//                                        pixel, sample and dimension; see rtweekend.h)
+//   background <r> <g> <b>
+//   accel      binary|wide|quantized
+//   bvh_builder sah|lbvh
+//   light_sampling none|uniform|bvh     (next-event estimation; see lights.h)
+//   spectral                            (path and mlt integrators: four wavelengths per path
+//                                        instead of RGB, see spectrum.h)
+//   integrator path|bdpt|photon|ppm|guided|mlt (bidirectional path tracing, see bdpt.h;
+//                                        photon mapping with a fixed or shrinking radius,
+//                                        photon.h; path tracing with learned bounces, guiding.h;
+//                                        primary sample space Metropolis, mlt.h)
+//   photons    <photons per pass>
+//   photon_radius <radius> [alpha]      (0 for 1/100 of the scene's diagonal; alpha for ppm)
+//   radiance_cache <cell size> [bounce] (path integrator; 0 for 1/64 of the scene's diagonal;
+//                                        looked up at hit 1 by default, see radiance_cache.h)
+//   cache_update once|progressive [paths] (training paths per pixel: once before the render,
+//                                        default 4, or before every sample, default 0.25)
+//   restir     <candidates> [neighbours] [radius] [history] (path integrator; direct light at
+//                                        the first hit from per-pixel reservoirs reused across
+//                                        pixels, and across samples given a history, see restir.h)
+//   guiding    <bsdf fraction> [split samples] (guided integrator; share of bounces that
+//                                        follow the BSDF, default 0.5, and deposits that split
+//                                        a region, default 12000)
+//   mlt        <bootstrap paths> [chains] [large step] (mlt integrator; paths b is estimated
+//                                        from, default 100000, Markov chains, default 64, and
+//                                        share of fresh proposals, default 0.3)
+//   camera     lookfrom <x y z> lookat <x y z> vup <x y z> vfov <degrees>
+//   material   <name> lambertian|diffuse_light <r> <g> <b>
+//   material   <name> dielectric <index> [cauchy b] (glass; index at 587.6 nm, dispersion
+//                                        in square micrometres, default 0)
+//   xy_rect    <x0> <x1> <y0> <y1> <z>  <material> [transforms]
+//   xz_rect    <x0> <x1> <z0> <z1> <y>  <material> [transforms]
+//   yz_rect    <y0> <y1> <z0> <z1> <x>  <material> [transforms]
+//   box        <x0 y0 z0> <x1 y1 z1>    <material> [transforms]
+//   triangle   <x y z> <x y z> <x y z>  <material> [transforms]
+//   mesh       <file.obj>               <material> [transforms]
+//   sphere_mesh <x y z> <radius> <segments> <material> [transforms]
+//
+//   object     <name>                   (primitives up to 'end' form one shared object)
+//   end
+//   instance   <name> [transforms]
+//   instance_grid <name> <nx> <ny> <nz> <dx dy dz> [transforms]
+//
+// Transforms are applied in the order written: translate <x y z>, scale <x y z>,
+// rotate_x|rotate_y|rotate_z <degrees>. Mesh paths are relative to the scene file.
+//
+// An object block becomes a bottom-level BVH that every instance of it shares; the
+// top-level BVH is built over the instances and the remaining primitives. instance_grid
+// places nx*ny*nz instances at (i*dx, j*dy, k*dz) before applying its transforms.
+
+struct camera_settings {
+    point3 lookfrom = point3(278, 278, -800);
+    point3 lookat = point3(278, 278, 0);
+    vec3 vup = vec3(0, 1, 0);
+    double vfov = 40.0;
+};
+
+enum class integrator_type { path, bdpt, photon, ppm, guided, mlt };
+
+enum class cache_update { once, progressive };
+
+enum class sampler_type { pcg, counter };
+
+// The integrator a scene or command line names, or false for an unknown name
+inline bool integrator_from_name(const std::string& name, integrator_type& out) {
+    if (name == "path")
+        out = integrator_type::path;
+    else if (name == "bdpt")
+        out = integrator_type::bdpt;
+    else if (name == "photon")
+        out = integrator_type::photon;
+    else if (name == "ppm")
+        out = integrator_type::ppm;
+    else if (name == "guided")
+        out = integrator_type::guided;
+    else if (name == "mlt")
+        out = integrator_type::mlt;
+    else
+        return false;
+    return true;
+}
+
+struct render_settings {
+    int image_width = 600;
+    int image_height = 600;
+    int samples_per_pixel = 200;
+    int max_depth = 10;
+    int seed = 0;
+    sampler_type sampler = sampler_type::pcg;
+    color background = color(0, 0, 0);
+    bvh_layout accel = bvh_layout::binary;    // node layout of every BVH in the scene
+    bvh_builder builder = bvh_builder::sah;
+    light_sampling lights = light_sampling::none;
+    integrator_type integrator = integrator_type::path;
+    int photons = 200000;           // per pass, for the photon integrators
+    double photon_radius = 0;       // of the first pass; 0 picks one from the scene's size
+    double photon_alpha = 0.7;      // share of the photons each ppm pass keeps
+    bool radiance_cache = false;    // for the path integrator
+    double cache_cell = 0;          // 0 picks one from the scene's size
+    int cache_bounce = 1;           // hit the cache is looked up at; the camera ray's is 0
+    cache_update cache_policy = cache_update::once;
+    double cache_training = 4;      // training paths per pixel, per batch
+    bool restir = false;            // for the path integrator without a radiance cache
+    int restir_candidates = 8;      // light samples drawn per pixel and sample
+    int restir_neighbours = 3;      // reservoirs merged from nearby pixels
+    double restir_radius = 16;      // in pixels
+    double restir_history = 0;      // cap on the previous sample's reservoir, in new candidates; 0 is off
+    double guide_bsdf_fraction = 0.5;   // bounces the guided integrator takes from the BSDF
+    double guide_split_samples = 12000; // deposits that split a guiding region
+    int mlt_bootstrap = 100000;     // paths the mlt integrator's normalization comes from
+    int mlt_chains = 64;
+    double mlt_large_step = 0.3;    // share of proposals that are fresh paths
+    bool spectral = false;          // hero wavelengths instead of RGB, for path and mlt
+};
+
+struct scene {
+    render_settings settings;
+    camera_settings view;
+    hittable_list objects;          // Top-level objects as declared
+    std::vector<shared_ptr<triangle_mesh>> meshes;
+    std::vector<shared_ptr<bvh_accel>> prototypes;  // Bottom-level BVHs of object blocks
+    shared_ptr<hittable> world;     // Top-level acceleration structure built over objects
+    light_set lights;               // Emitting rectangles outside object blocks
+
+    int primitive_count = 0;
+    int instance_count = 0;
+    double parse_ms = 0;
+    double build_ms = 0;
+
+    // Geometry and BVH bytes, counting each shared object once
+    size_t memory_usage() const {
+        size_t bytes = (world ? world->memory_usage() : 0) + lights.memory_usage();
+        for (const auto& proto : prototypes)
+            bytes += proto->memory_usage();
+        return bytes;
+    }
+
+    camera make_camera() const {
+        auto aspect_ratio = static_cast<double>(settings.image_width) / settings.image_height;
+        return camera(view.lookfrom, view.lookat, view.vup, view.vfov, aspect_ratio);
+    }
+};
+
+class scene_parser {
+public:
+    scene_parser(const std::string& scene_path) : path(scene_path) {
+        auto slash = path.find_last_of("/\\");
+        directory = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+    }
+
+    void parse(scene& scn);
+
+private:
+    std::string path;
+    std::string directory;
+    int line_number = 0;
+    std::map<std::string, shared_ptr<material>> materials;
+    std::map<std::string, shared_ptr<bvh_accel>> prototypes;
+    shared_ptr<bvh_accel> open_object;
+
+    [[noreturn]] void fail(const std::string& message) const {
+        throw std::runtime_error(path + ":" + std::to_string(line_number) + ": " + message);
+    }
+
+    std::string word(std::istringstream& ss, const char* what) const {
+        std::string w;
+        if (!(ss >> w))
+            fail(std::string("expected ") + what);
+        return w;
+    }
+
+    double number(std::istringstream& ss) const {
+        double x;
+        if (!(ss >> x))
+            fail("expected a number");
+        return x;
+    }
+
+    int integer(std::istringstream& ss) const {
+        auto x = number(ss);
+        if (x != static_cast<int>(x) || x < 1)
+            fail("expected a positive integer");
+        return static_cast<int>(x);
+    }
+
+    vec3 triple(std::istringstream& ss) const {
+        auto x = number(ss);
+        auto y = number(ss);
+        auto z = number(ss);
+        return vec3(x, y, z);
+    }
+
+    shared_ptr<material> find_material(std::istringstream& ss) const {
+        auto name = word(ss, "material name");
+        auto it = materials.find(name);
+        if (it == materials.end())
+            fail("unknown material '" + name + "'");
+        return it->second;
+    }
+
+    shared_ptr<bvh_accel> find_object(std::istringstream& ss) const {
+        auto name = word(ss, "object name");
+        auto it = prototypes.find(name);
+        if (it == prototypes.end())
+            fail("unknown object '" + name + "'");
+        return it->second;
+    }
+
+    void parse_camera(std::istringstream& ss, camera_settings& view) const;
+    void parse_material(std::istringstream& ss);
+    bool parse_transforms(std::istringstream& ss, transform& xform) const;
+};
+
+void scene_parser::parse(scene& scn) {
+    std::ifstream in(path);
+    if (!in)
+        throw std::runtime_error("cannot open scene file '" + path + "'");
+
+    std::string line;
+    while (std::getline(in, line)) {
+        line_number++;
+        auto comment = line.find('#');
+        if (comment != std::string::npos)
+            line.erase(comment);
+
+        std::istringstream ss(line);
+        std::string cmd;
+        if (!(ss >> cmd))
+            continue;
+
+        // Primitives inside an object block go to its bottom-level BVH
+        auto& target = open_object ? open_object->objects : scn.objects.objects;
+
+        shared_ptr<hittable> object;
+        std::unique_ptr<emitter> light;     // for a rectangle that emits, in its own space
+        if (cmd == "image") {
+            scn.settings.image_width = integer(ss);
+            scn.settings.image_height = integer(ss);
+        } else if (cmd == "samples") {
+            scn.settings.samples_per_pixel = integer(ss);
+        } else if (cmd == "max_depth") {
+            scn.settings.max_depth = integer(ss);
+        } else if (cmd == "seed") {
+            auto x = number(ss);
+            if (x != static_cast<int>(x) || x < 0)
+                fail("expected a non-negative integer");
+            scn.settings.seed = static_cast<int>(x);
+        } else if (cmd == "sampler") {
+            auto name = word(ss, "sampler");
+            if (name == "pcg")
+                scn.settings.sampler = sampler_type::pcg;
+            else if (name == "counter")
+                scn.settings.sampler = sampler_type::counter;
+            else
+                fail("unknown sampler '" + name + "'");
+        } else if (cmd == "background") {
+            scn.settings.background = triple(ss);
+        } else if (cmd == "accel") {
+            auto layout = word(ss, "BVH layout");
+            if (layout == "binary")
+                scn.settings.accel = bvh_layout::binary;
+            else if (layout == "wide")
+                scn.settings.accel = bvh_layout::wide;
+            else if (layout == "quantized")
+                scn.settings.accel = bvh_layout::quantized;
+            else
+                fail("unknown BVH layout '" + layout + "'");
+        } else if (cmd == "bvh_builder") {
+            auto name = word(ss, "BVH builder");
+            if (name == "sah")
+                scn.settings.builder = bvh_builder::sah;
+            else if (name == "lbvh")
+                scn.settings.builder = bvh_builder::lbvh;
+            else
+                fail("unknown BVH builder '" + name + "'");
+        } else if (cmd == "light_sampling") {
+            auto name = word(ss, "light sampling");
+            if (name == "none")
+                scn.settings.lights = light_sampling::none;
+            else if (name == "uniform")
+                scn.settings.lights = light_sampling::uniform;
+            else if (name == "bvh")
+                scn.settings.lights = light_sampling::bvh;
+            else
+                fail("unknown light sampling '" + name + "'");
+        } else if (cmd == "spectral") {
+            scn.settings.spectral = true;
+        } else if (cmd == "integrator") {
+            auto name = word(ss, "integrator");
+            if (!integrator_from_name(name, scn.settings.integrator))
+                fail("unknown integrator '" + name + "'");
+        } else if (cmd == "photons") {
+            scn.settings.photons = integer(ss);
+        } else if (cmd == "photon_radius") {
+            scn.settings.photon_radius = number(ss);
+            if (!(ss >> std::ws).eof())
+                scn.settings.photon_alpha = number(ss);
+            if (scn.settings.photon_radius < 0 || scn.settings.photon_alpha <= 0 || scn.settings.photon_alpha > 1)
+                fail("photon_radius needs radius >= 0 and 0 < alpha <= 1");
+        } else if (cmd == "radiance_cache") {
+            scn.settings.radiance_cache = true;
+            scn.settings.cache_cell = number(ss);
+            if (!(ss >> std::ws).eof())
+                scn.settings.cache_bounce = integer(ss);
+            if (scn.settings.cache_cell < 0 || scn.settings.cache_bounce < 1)
+                fail("radiance_cache needs cell size >= 0 and bounce >= 1");
+        } else if (cmd == "cache_update") {
+            auto name = word(ss, "cache update");
+            if (name == "once") {
+                scn.settings.cache_policy = cache_update::once;
+                scn.settings.cache_training = 4;
+            } else if (name == "progressive") {
+                scn.settings.cache_policy = cache_update::progressive;
+                scn.settings.cache_training = 0.25;
+            } else {
+                fail("unknown cache update '" + name + "'");
+            }
+            if (!(ss >> std::ws).eof())
+                scn.settings.cache_training = number(ss);
+            if (scn.settings.cache_training <= 0)
+                fail("cache_update needs training paths > 0");
+        } else if (cmd == "restir") {
+            scn.settings.restir = true;
+            scn.settings.restir_candidates = integer(ss);
+            if (!(ss >> std::ws).eof()) {
+                auto x = number(ss);
+                if (x != static_cast<int>(x))
+                    fail("expected an integer");
+                scn.settings.restir_neighbours = static_cast<int>(x);
+            }
+            if (!(ss >> std::ws).eof())
+                scn.settings.restir_radius = number(ss);
+            if (!(ss >> std::ws).eof())
+                scn.settings.restir_history = number(ss);
+            if (scn.settings.restir_candidates < 1 || scn.settings.restir_neighbours < 0
+                || scn.settings.restir_neighbours > 15 || scn.settings.restir_radius <= 0
+                || scn.settings.restir_history < 0)
+                fail("restir needs candidates >= 1, 0 to 15 neighbours, radius > 0 and history >= 0");
+        } else if (cmd == "guiding") {
+            scn.settings.guide_bsdf_fraction = number(ss);
+            if (!(ss >> std::ws).eof())
+                scn.settings.guide_split_samples = number(ss);
+            if (scn.settings.guide_bsdf_fraction <= 0 || scn.settings.guide_bsdf_fraction > 1
+                || scn.settings.guide_split_samples <= 0)
+                fail("guiding needs 0 < bsdf fraction <= 1 and split samples > 0");
+        } else if (cmd == "mlt") {
+            scn.settings.mlt_bootstrap = integer(ss);
+            if (!(ss >> std::ws).eof())
+                scn.settings.mlt_chains = integer(ss);
+            if (!(ss >> std::ws).eof())
+                scn.settings.mlt_large_step = number(ss);
+            if (scn.settings.mlt_bootstrap < 1 || scn.settings.mlt_chains < 1 || scn.settings.mlt_large_step <= 0
+                || scn.settings.mlt_large_step > 1)
+                fail("mlt needs bootstrap paths >= 1, chains >= 1 and 0 < large step <= 1");
+        } else if (cmd == "camera") {
+            parse_camera(ss, scn.view);
+        } else if (cmd == "material") {
+            parse_material(ss);
+        } else if (cmd == "xy_rect" || cmd == "xz_rect" || cmd == "yz_rect") {
+            auto a0 = number(ss), a1 = number(ss), b0 = number(ss), b1 = number(ss), k = number(ss);
+            auto mat = find_material(ss);
+            // Emitters outside object blocks are sampled; the rectangle reports its index on hits
+            auto glow = dynamic_cast<diffuse_light*>(mat.get());
+            const bool sampled = glow && !open_object;
+            const int index = sampled ? static_cast<int>(scn.lights.emitters.size()) : -1;
+            if (cmd == "xy_rect") {
+                auto rect = make_shared<xy_rect>(a0, a1, b0, b1, k, mat);
+                rect->light = index;
+                object = rect;
+                if (sampled)
+                    light = std::make_unique<emitter>(point3(a0, b0, k), vec3(a1 - a0, 0, 0), vec3(0, b1 - b0, 0), glow->emit_color);
+            } else if (cmd == "xz_rect") {
+                auto rect = make_shared<xz_rect>(a0, a1, b0, b1, k, mat);
+                rect->light = index;
+                object = rect;
+                if (sampled)
+                    light = std::make_unique<emitter>(point3(a0, k, b0), vec3(a1 - a0, 0, 0), vec3(0, 0, b1 - b0), glow->emit_color);
+            } else {
+                auto rect = make_shared<yz_rect>(a0, a1, b0, b1, k, mat);
+                rect->light = index;
+                object = rect;
+                if (sampled)
+                    light = std::make_unique<emitter>(point3(k, a0, b0), vec3(0, a1 - a0, 0), vec3(0, 0, b1 - b0), glow->emit_color);
+            }
+        } else if (cmd == "box") {
+            auto p0 = triple(ss);
+            auto p1 = triple(ss);
+            object = make_shared<box>(p0, p1, find_material(ss));
+        } else if (cmd == "triangle") {
+            auto a = triple(ss), b = triple(ss), c = triple(ss);
+            object = make_shared<triangle>(a, b, c, find_material(ss));
+        } else if (cmd == "mesh" || cmd == "sphere_mesh") {
+            auto mesh = make_shared<triangle_mesh>();
+            if (cmd == "mesh") {
+                auto file = word(ss, "mesh file");
+                load_obj(file.front() == '/' ? file : directory + file, mesh->vertices, mesh->indices);
+                if (mesh->indices.empty())
+                    fail("mesh '" + file + "' has no faces");
+            } else {
+                auto center = triple(ss);
+                auto radius = number(ss);
+                make_uv_sphere(center, radius, integer(ss), mesh->vertices, mesh->indices);
+            }
+            mesh->mp = find_material(ss);
+            // The mesh BVH is built with the rest of the scene in load_scene()
+            scn.meshes.push_back(mesh);
+            scn.primitive_count += mesh->triangle_count() - 1;
+            object = mesh;
+        } else if (cmd == "object") {
+            auto name = word(ss, "object name");
+            if (open_object)
+                fail("object blocks cannot be nested");
+            if (prototypes.count(name))
+                fail("object '" + name + "' is already defined");
+            open_object = make_shared<bvh_accel>();
+            prototypes[name] = open_object;
+        } else if (cmd == "end") {
+            if (!open_object)
+                fail("'end' without 'object'");
+            if (open_object->objects.empty())
+                fail("empty object");
+            scn.prototypes.push_back(open_object);
+            open_object = nullptr;
+        } else if (cmd == "instance") {
+            auto proto = find_object(ss);
+            transform xform;
+            parse_transforms(ss, xform);
+            target.push_back(make_shared<instance>(proto, xform));
+            scn.instance_count++;
+        } else if (cmd == "instance_grid") {
+            auto proto = find_object(ss);
+            int nx = integer(ss), ny = integer(ss), nz = integer(ss);
+            auto spacing = triple(ss);
+            transform xform;
+            parse_transforms(ss, xform);
+            for (int i = 0; i < nx; i++) {
+                for (int j = 0; j < ny; j++) {
+                    for (int k = 0; k < nz; k++) {
+                        auto offset = vec3(i*spacing.x(), j*spacing.y(), k*spacing.z());
+                        target.push_back(make_shared<instance>(proto, xform * transform::translate(offset)));
+                    }
+                }
+            }
+            scn.instance_count += nx * ny * nz;
+        } else {
+            fail("unknown statement '" + cmd + "'");
+        }
+
+        if (object) {
+            transform xform;
+            if (parse_transforms(ss, xform))
+                object = make_shared<instance>(object, xform);
+            target.push_back(object);
+            scn.primitive_count++;
+            if (light)
+                scn.lights.emitters.emplace_back(xform.point(light->corner), xform.vector(light->u),
+                                                 xform.vector(light->v), light->radiance);
+        }
+
+        std::string extra;
+        if (ss >> extra)
+            fail("unexpected '" + extra + "'");
+    }
+
+    if (open_object)
+        fail("missing 'end' for object block");
+}
+
+void scene_parser::parse_camera(std::istringstream& ss, camera_settings& view) const {
+    std::string key;
+    while (ss >> key) {
+        if (key == "lookfrom")
+            view.lookfrom = triple(ss);
+        else if (key == "lookat")
+            view.lookat = triple(ss);
+        else if (key == "vup")
+            view.vup = triple(ss);
+        else if (key == "vfov")
+            view.vfov = number(ss);
+        else
+            fail("unknown camera parameter '" + key + "'");
+    }
+}
+
+void scene_parser::parse_material(std::istringstream& ss) {
+    auto name = word(ss, "material name");
+    auto type = word(ss, "material type");
+
+    if (type == "dielectric") {
+        const double index = number(ss);
+        const double b = (ss >> std::ws).eof() ? 0 : number(ss);
+        if (index < 1 || b < 0)
+            fail("dielectric needs index >= 1 and cauchy b >= 0");
+        materials[name] = make_shared<dielectric>(index, b);
+        return;
+    }
+    auto c = triple(ss);
+    if (type == "lambertian")
+        materials[name] = make_shared<lambertian>(c);
+    else if (type == "diffuse_light")
+        materials[name] = make_shared<diffuse_light>(c);
+    else
+        fail("unknown material type '" + type + "'");
+}
+
+bool scene_parser::parse_transforms(std::istringstream& ss, transform& xform) const {
+    bool any = false;
+    std::string op;
+    while (ss >> op) {
+        if (op == "translate")
+            xform = transform::translate(triple(ss)) * xform;
+        else if (op == "scale")
+            xform = transform::scale(triple(ss)) * xform;
+        else if (op == "rotate_x")
+            xform = transform::rotate(0, number(ss)) * xform;
+        else if (op == "rotate_y")
+            xform = transform::rotate(1, number(ss)) * xform;
+        else if (op == "rotate_z")
+            xform = transform::rotate(2, number(ss)) * xform;
+        else
+            fail("unknown transform '" + op + "'");
+        any = true;
+    }
+    return any;
+}
+
+// Parses a scene file and builds its acceleration structure, on `pool` when given. Throws
+// std::runtime_error with a "file:line: message" description on malformed input.
+inline scene load_scene(const std::string& path, thread_pool* pool = nullptr) {
+    using clock = std::chrono::steady_clock;
+    scene scn;
+
+    auto start = clock::now();
+    {
+        trace_scope trace("parse", "scene");
+        scene_parser(path).parse(scn);
+    }
+    auto parsed = clock::now();
+    // Bottom-up: meshes, then object blocks in declaration order, then the top level
+    auto configure = [&](bvh_tree& tree) {
+        tree.layout = scn.settings.accel;
+        tree.builder = scn.settings.builder;
+        tree.pool = pool;
+    };
+    for (size_t i = 0; i < scn.meshes.size(); i++) {
+        trace_scope trace("build mesh", "scene", static_cast<int64_t>(i));
+        configure(scn.meshes[i]->tree);
+        scn.meshes[i]->build();
+    }
+    for (size_t i = 0; i < scn.prototypes.size(); i++) {
+        trace_scope trace("build object", "scene", static_cast<int64_t>(i));
+        configure(scn.prototypes[i]->tree);
+        scn.prototypes[i]->build();
+    }
+    auto top = make_shared<bvh_accel>();
+    {
+        trace_scope trace("build top level", "scene");
+        top->objects = scn.objects.objects;
+        configure(top->tree);
+        top->build();
+    }
+    scn.world = top;
+    {
+        trace_scope trace("build lights", "scene");
+        scn.lights.build();
+    }
+    auto built = clock::now();
+
+    scn.parse_ms = std::chrono::duration<double, std::milli>(parsed - start).count();
+    scn.build_ms = std::chrono::duration<double, std::milli>(built - parsed).count();
+    return scn;
+}
+
+#endif
@@ -0,0 +1,282 @@
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include "rtweekend.h"
+#include "color.h"
+#include <algorithm>
+#include <cmath>
+
+// PT_SCALAR_SPECTRUM keeps the lanes in a plain array, to measure what SSE saves
+#if (defined(__SSE2__) || defined(_M_X64)) && !defined(PT_SCALAR_SPECTRUM)
+#include <emmintrin.h>
+#define SPECTRUM_SSE 1
+#endif
+
+// Spectral Rendering
+//
+// Hero wavelength sampling (Wilkie et al. 2014): a path carries light at four wavelengths,
+// one drawn for it and three more spaced evenly from it around the visible range, and each
+// of them is a sample of the pixel's colour. The four values sit in the lanes of one SSE
+// register, so the path costs little more than an RGB one, whose three channels already
+// take a vec3. A surface that bends the wavelengths apart (see dielectric in material.h)
+// keeps only the first, the hero, from there on.
+//
+// Wavelengths are drawn from 360 to 830 nm in proportion to the eye's sensitivity, with
+// pbrt-v4's fit to it. Scenes stay RGB: albedos and emissions become spectra by Smits'
+// method (1999), a sum of a white spectrum and two of six primary ones, and a path's light
+// turns back into linear sRGB through the CIE 1931 matching functions (Wyman et al.'s
+// multi-lobe fit). Those are tabulated every nanometre on first use, with the matching
+// functions scaled so that a flat spectrum of 1 gives RGB (1, 1, 1); the Smits spectrum of
+// a grey then renders as the same grey. Saturated colours come back slightly changed.
+
+// Four floats, one per wavelength
+struct spectrum4 {
+    spectrum4() : spectrum4(0.0f) {}
+    explicit spectrum4(float x) {
+#ifdef SPECTRUM_SSE
+        v = _mm_set1_ps(x);
+#else
+        for (float& e : v) e = x;
+#endif
+    }
+    spectrum4(float a, float b, float c, float d) {
+#ifdef SPECTRUM_SSE
+        v = _mm_setr_ps(a, b, c, d);
+#else
+        v[0] = a; v[1] = b; v[2] = c; v[3] = d;
+#endif
+    }
+
+    // From and to 16-byte aligned memory
+    static spectrum4 load(const float* p) {
+        spectrum4 s;
+#ifdef SPECTRUM_SSE
+        s.v = _mm_load_ps(p);
+#else
+        for (int i = 0; i < 4; i++) s.v[i] = p[i];
+#endif
+        return s;
+    }
+    void store(float* p) const {
+#ifdef SPECTRUM_SSE
+        _mm_store_ps(p, v);
+#else
+        for (int i = 0; i < 4; i++) p[i] = v[i];
+#endif
+    }
+
+    float operator[](int i) const {
+        alignas(16) float lanes[4];
+        store(lanes);
+        return lanes[i];
+    }
+
+    spectrum4& operator+=(const spectrum4& o) { return *this = *this + o; }
+    spectrum4& operator*=(const spectrum4& o) { return *this = *this * o; }
+
+    friend spectrum4 operator+(const spectrum4& a, const spectrum4& b) {
+        spectrum4 s;
+#ifdef SPECTRUM_SSE
+        s.v = _mm_add_ps(a.v, b.v);
+#else
+        for (int i = 0; i < 4; i++) s.v[i] = a.v[i] + b.v[i];
+#endif
+        return s;
+    }
+    friend spectrum4 operator*(const spectrum4& a, const spectrum4& b) {
+        spectrum4 s;
+#ifdef SPECTRUM_SSE
+        s.v = _mm_mul_ps(a.v, b.v);
+#else
+        for (int i = 0; i < 4; i++) s.v[i] = a.v[i] * b.v[i];
+#endif
+        return s;
+    }
+    friend spectrum4 operator*(const spectrum4& a, float t) { return a * spectrum4(t); }
+
+    // Sum of the lanes of a * b
+    friend float dot(const spectrum4& a, const spectrum4& b) {
+        alignas(16) float lanes[4];
+        (a * b).store(lanes);
+        return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+
+    bool is_black() const {
+#ifdef SPECTRUM_SSE
+        return _mm_movemask_ps(_mm_cmpgt_ps(v, _mm_setzero_ps())) == 0;
+#else
+        return v[0] <= 0 && v[1] <= 0 && v[2] <= 0 && v[3] <= 0;
+#endif
+    }
+
+#ifdef SPECTRUM_SSE
+    __m128 v;
+#else
+    float v[4];
+#endif
+};
+
+namespace spectrum_detail {
+
+const int lambda_min = 360, lambda_max = 830;
+const int table_size = lambda_max - lambda_min + 1;
+
+// Smits' spectra at the centres of 10 bins from 380 to 720 nm: white, then cyan, magenta,
+// yellow, red, green and blue
+const int basis_count = 7;
+enum basis { white, cyan, magenta, yellow, red, green, blue };
+const double smits[basis_count][10] = {
+    {1.0000, 1.0000, 0.9999, 0.9993, 0.9992, 0.9998, 1.0000, 1.0000, 1.0000, 1.0000},
+    {0.9710, 0.9426, 1.0007, 1.0007, 1.0007, 1.0007, 0.1564, 0.0000, 0.0000, 0.0000},
+    {1.0000, 1.0000, 0.9685, 0.2229, 0.0000, 0.0458, 0.8369, 1.0000, 1.0000, 0.9959},
+    {0.0001, 0.0000, 0.1088, 0.6651, 1.0000, 1.0000, 0.9996, 0.9586, 0.9685, 0.9840},
+    {0.1012, 0.0515, 0.0000, 0.0000, 0.0000, 0.0000, 0.8325, 1.0149, 1.0149, 1.0149},
+    {0.0000, 0.0000, 0.0273, 0.7937, 1.0000, 0.9418, 0.1719, 0.0000, 0.0000, 0.0025},
+    {1.0000, 1.0000, 0.8916, 0.3323, 0.0000, 0.0000, 0.0003, 0.0369, 0.0483, 0.0496},
+};
+
+// Piecewise Gaussian with different spreads either side of the mean
+inline double lobe(double lambda, double mean, double below, double above) {
+    const double t = (lambda - mean) / (lambda < mean ? below : above);
+    return std::exp(-0.5 * t * t);
+}
+
+// Per nanometre: the seven spectra, then the matching functions as linear sRGB, so a row
+// is all a path needs from a wavelength
+struct tables {
+    static const int row = 12;      // 7 spectra, 3 channels, padding
+    alignas(16) float rows[table_size][row];
+
+    tables() {
+        double cmf[table_size][3];
+        double total[3] = {0, 0, 0};
+        for (int k = 0; k < table_size; k++) {
+            const double l = lambda_min + k;
+            const double x = 1.056 * lobe(l, 599.8, 37.9, 31.0) + 0.362 * lobe(l, 442.0, 16.0, 26.7)
+                           - 0.065 * lobe(l, 501.1, 20.4, 26.2);
+            const double y = 0.821 * lobe(l, 568.8, 46.9, 40.5) + 0.286 * lobe(l, 530.9, 16.3, 31.1);
+            const double z = 1.217 * lobe(l, 437.0, 11.8, 36.0) + 0.681 * lobe(l, 459.0, 26.0, 13.8);
+            cmf[k][0] = 3.2404542 * x - 1.5371385 * y - 0.4985314 * z;
+            cmf[k][1] = -0.9692660 * x + 1.8760108 * y + 0.0415560 * z;
+            cmf[k][2] = 0.0556434 * x - 0.2040259 * y + 1.0572252 * z;
+            for (int c = 0; c < 3; c++)
+                total[c] += cmf[k][c];
+        }
+        for (int k = 0; k < table_size; k++) {
+            const double l = lambda_min + k;
+            // Between bin centres, held flat beyond the first and last
+            const double bin = std::clamp((l - 380) / 34 - 0.5, 0.0, 9.0);
+            const int b0 = std::min(8, static_cast<int>(bin));
+            const double t = bin - b0;
+            for (int s = 0; s < basis_count; s++)
+                rows[k][s] = static_cast<float>(smits[s][b0] * (1 - t) + smits[s][b0 + 1] * t);
+            for (int c = 0; c < 3; c++)
+                rows[k][basis_count + c] = static_cast<float>(cmf[k][c] / total[c]);
+            rows[k][10] = rows[k][11] = 0;
+        }
+    }
+};
+
+inline const tables& table() {
+    static const tables t;
+    return t;
+}
+
+// pbrt-v4's density of visible wavelengths, 0.0039398042 / cosh^2(0.0072 (lambda - 538))
+// per nanometre, sampled at u; `pdf` gets the density there. With z = tanh(0.0072 (538 -
+// lambda)) the density is 0.0039398042 (1 - z^2), so only the atanh costs anything.
+inline double sample_visible(double u, double& pdf) {
+    const double z = 0.85691062 - 1.82750197 * u;
+    pdf = 0.0039398042 * (1 - z * z);
+    return 538 - 138.888889 * 0.5 * std::log((1 + z) / (1 - z));
+}
+
+} // namespace spectrum_detail
+
+// The four wavelengths of a path, with what every spectrum and the conversion to RGB need
+// from them
+struct wavelengths {
+    float lambda[4];                                    // nm; lambda[0] is the hero
+    spectrum4 basis[spectrum_detail::basis_count];      // Smits' spectra at the four
+    spectrum4 rgb[3];                                   // matching functions over 4 * density
+    bool hero_only = false;
+
+    // Hero at u in [0, 1), the others at u + 1/4, u + 1/2 and u + 3/4
+    static wavelengths sample(double u) {
+        using namespace spectrum_detail;
+        const tables& t = table();
+        wavelengths wl;
+        alignas(16) float lanes[tables::row][4];
+        for (int i = 0; i < 4; i++) {
+            double ui = u + 0.25 * i;
+            ui -= std::floor(ui);
+            double pdf;
+            const double l = std::clamp(sample_visible(ui, pdf), static_cast<double>(lambda_min),
+                                        static_cast<double>(lambda_max));
+            wl.lambda[i] = static_cast<float>(l);
+            const int k = std::min(table_size - 1, static_cast<int>(l - lambda_min + 0.5));
+            const float weight = static_cast<float>(1 / (4 * pdf));
+            for (int s = 0; s < basis_count; s++)
+                lanes[s][i] = t.rows[k][s];
+            for (int c = 0; c < 3; c++)
+                lanes[basis_count + c][i] = t.rows[k][basis_count + c] * weight;
+        }
+        for (int s = 0; s < basis_count; s++)
+            wl.basis[s] = spectrum4::load(lanes[s]);
+        for (int c = 0; c < 3; c++)
+            wl.rgb[c] = spectrum4::load(lanes[basis_count + c]);
+        return wl;
+    }
+
+    double hero() const { return lambda[0]; }
+
+    // After a surface that sent each wavelength its own way: only the hero goes on, and it
+    // now stands for all four
+    void terminate_secondary() {
+        if (hero_only)
+            return;
+        const spectrum4 keep(4, 0, 0, 0);
+        for (auto& c : rgb)
+            c *= keep;
+        hero_only = true;
+    }
+
+    color to_rgb(const spectrum4& s) const {
+        return color(dot(s, rgb[0]), dot(s, rgb[1]), dot(s, rgb[2]));
+    }
+};
+
+// An RGB triple as a spectrum: white scaled by the smallest channel, plus two of Smits'
+// primaries for what the others have over it
+struct rgb_spectrum {
+    float scale[3] = {0, 0, 0};
+    unsigned char basis[3] = {spectrum_detail::white, spectrum_detail::white, spectrum_detail::white};
+
+    rgb_spectrum() {}
+    explicit rgb_spectrum(const color& c) {
+        using namespace spectrum_detail;
+        const double r = c.x(), g = c.y(), b = c.z();
+        if (r <= g && r <= b) {
+            set(r, cyan, g <= b ? g - r : b - r, g <= b ? blue : green, g <= b ? b - g : g - b);
+        } else if (g <= r && g <= b) {
+            set(g, magenta, r <= b ? r - g : b - g, r <= b ? blue : red, r <= b ? b - r : r - b);
+        } else {
+            set(b, yellow, r <= g ? r - b : g - b, r <= g ? green : red, r <= g ? g - r : r - g);
+        }
+    }
+
+    spectrum4 at(const wavelengths& wl) const {
+        return wl.basis[basis[0]] * scale[0] + wl.basis[basis[1]] * scale[1] + wl.basis[basis[2]] * scale[2];
+    }
+
+private:
+    void set(double w, int first, double a, int second, double b) {
+        scale[0] = static_cast<float>(w);
+        basis[1] = static_cast<unsigned char>(first);
+        scale[1] = static_cast<float>(a);
+        basis[2] = static_cast<unsigned char>(second);
+        scale[2] = static_cast<float>(b);
+    }
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <algorithm>
+#include <cstdint>
+
+// Hot-Path Counters
+//
+// BVH nodes visited, primitive tests, path lengths and how paths end. They are compiled in
+// only with PT_STATS defined (cmake -DPT_STATS=ON); otherwise PT_STAT(...) discards its
+// statement and the release build carries no counting at all. Each thread counts into its
+// own block, which the renderer adds into its render_stats as every tile finishes.
+
+#ifdef PT_STATS
+#define PT_STAT(statement) do { statement; } while (0)
+#else
+#define PT_STAT(statement) do {} while (0)
+#endif
+
+struct path_counters {
+    static const int length_bins = 64;     // the last bin also holds longer paths
+
+    uint64_t nodes_visited = 0;     // BVH nodes tested, every level; a 4-wide node counts once
+    uint64_t prim_tests = 0;        // BVH leaf entries tested: objects, instances, triangles
+    uint64_t ended_max_depth = 0;   // paths cut off by max_depth
+    uint64_t ended_light = 0;       // paths absorbed by a surface that does not scatter (diffuse_light)
+    uint64_t ended_miss = 0;        // paths that left the scene
+    uint64_t ended_cache = 0;       // paths the radiance cache finished
+    uint64_t path_length[length_bins] = {};     // paths by rays traced, camera ray included
+
+    void record_path(uint64_t rays) {
+        path_length[std::min<uint64_t>(rays, length_bins - 1)]++;
+    }
+
+    void merge(const path_counters& other) {
+        nodes_visited += other.nodes_visited;
+        prim_tests += other.prim_tests;
+        ended_max_depth += other.ended_max_depth;
+        ended_light += other.ended_light;
+        ended_miss += other.ended_miss;
+        ended_cache += other.ended_cache;
+        for (int i = 0; i < length_bins; i++)
+            path_length[i] += other.path_length[i];
+    }
+
+    uint64_t paths() const { return ended_max_depth + ended_light + ended_miss + ended_cache; }
+};
+
+inline path_counters& thread_path_counters() {
+    static thread_local path_counters counters;
+    return counters;
+}
+
+inline bool path_counters_enabled() {
+#ifdef PT_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Wall time of each phase of a frame
+struct phase_times {
+    double parse_ms = 0;
+    double build_ms = 0;
+    double render_ms = 0;
+    double output_ms = 0;
+    double denoise_ms = 0;      // part of output_ms
+};
+
+#endif
@@ -0,0 +1,259 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "trace.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-Stealing Thread Pool
+//
+// thread_pool(n) runs work on n threads: n-1 workers plus whichever thread waits on a
+// task_group, which executes queued tasks instead of blocking. Each worker pushes and pops
+// its own deque at the back (newest first, good locality for recursive splits) and steals
+// from the front of the others when it runs dry. Tasks submitted from outside the pool go
+// to a shared injection queue.
+
+class thread_pool {
+public:
+    using task = std::function<void()>;
+
+    explicit thread_pool(int threads = 0);
+    ~thread_pool();
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    // Threads that execute tasks, counting the waiting thread
+    int size() const { return static_cast<int>(workers.size()) + 1; }
+
+    void submit(task t);
+
+    // Runs one queued task on the calling thread; false if none was available
+    bool run_pending_task();
+
+    size_t steal_count() const { return steals.load(std::memory_order_relaxed); }
+
+    static int hardware_threads() {
+        auto n = std::thread::hardware_concurrency();
+        return n > 0 ? static_cast<int>(n) : 1;
+    }
+
+private:
+    struct task_queue {
+        std::mutex lock;
+        std::deque<task> tasks;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<task_queue>> queues;   // one per worker, then the injection queue
+    std::mutex sleep_lock;
+    std::condition_variable wake;
+    std::atomic<int> pending{0};
+    std::atomic<size_t> steals{0};
+    bool stopping = false;
+
+    // Index of the calling thread's queue in this pool, or the injection queue
+    int queue_index() const;
+    bool pop(int self, task& t);
+    void worker_loop(int index);
+
+    static thread_local const thread_pool* current_pool;
+    static thread_local int current_index;
+};
+
+thread_local const thread_pool* thread_pool::current_pool = nullptr;
+thread_local int thread_pool::current_index = -1;
+
+thread_pool::thread_pool(int threads) {
+    if (threads <= 0)
+        threads = hardware_threads();
+
+    for (int i = 0; i < threads; i++)
+        queues.push_back(std::make_unique<task_queue>());
+    for (int i = 0; i < threads - 1; i++)
+        workers.emplace_back([this, i] { worker_loop(i); });
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> guard(sleep_lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& w : workers)
+        w.join();
+}
+
+int thread_pool::queue_index() const {
+    return current_pool == this ? current_index : static_cast<int>(queues.size()) - 1;
+}
+
+void thread_pool::submit(task t) {
+    auto& q = *queues[queue_index()];
+    {
+        std::lock_guard<std::mutex> guard(q.lock);
+        q.tasks.push_back(std::move(t));
+    }
+    pending.fetch_add(1);
+
+    // Taking the sleep lock orders this against a worker checking `pending` before it waits
+    { std::lock_guard<std::mutex> guard(sleep_lock); }
+    wake.notify_one();
+}
+
+bool thread_pool::pop(int self, task& t) {
+    const int n = static_cast<int>(queues.size());
+
+    // Own queue, newest first
+    {
+        auto& q = *queues[self];
+        std::lock_guard<std::mutex> guard(q.lock);
+        if (!q.tasks.empty()) {
+            t = std::move(q.tasks.back());
+            q.tasks.pop_back();
+            return true;
+        }
+    }
+
+    // Otherwise take the oldest task of another queue. Only tasks taken from another
+    // worker's deque count as steals; the injection queue is where outside work arrives.
+    const int injection = n - 1;
+    for (int k = 1; k < n; k++) {
+        const int victim = (self + k) % n;
+        auto& q = *queues[victim];
+        std::lock_guard<std::mutex> guard(q.lock);
+        if (!q.tasks.empty()) {
+            t = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            if (victim != injection) {
+                steals.fetch_add(1, std::memory_order_relaxed);
+                trace_instant("steal", "pool", victim);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool thread_pool::run_pending_task() {
+    if (pending.load() == 0)
+        return false;
+
+    task t;
+    if (!pop(queue_index(), t))
+        return false;
+    pending.fetch_sub(1);
+    t();
+    return true;
+}
+
+void thread_pool::worker_loop(int index) {
+    current_pool = this;
+    current_index = index;
+    trace_thread_name() = "worker " + std::to_string(index + 1);
+
+    while (true) {
+        if (run_pending_task())
+            continue;
+
+        std::unique_lock<std::mutex> guard(sleep_lock);
+        wake.wait(guard, [this] { return stopping || pending.load() > 0; });
+        if (stopping && pending.load() == 0)
+            return;
+    }
+}
+
+// Fork-Join Group
+//
+// wait() keeps the calling thread busy with queued tasks until every task started through
+// this group has finished, so groups may be nested freely (recursive builds). When nothing
+// is left to run it sleeps until the last task finishes, rechecking the queues now and then
+// since a running task may still fork more work. The first exception thrown by a task is
+// rethrown from wait() once the rest of the group has finished.
+class task_group {
+public:
+    explicit task_group(thread_pool& p) : pool(p) {}
+
+    // Never throws: an error nobody waited for is dropped rather than raised while unwinding
+    ~task_group() { drain(); }
+
+    task_group(const task_group&) = delete;
+    task_group& operator=(const task_group&) = delete;
+
+    template <typename F>
+    void run(F&& f) {
+        outstanding.fetch_add(1);
+        pool.submit([this, f = std::forward<F>(f)]() mutable {
+            try {
+                f();
+            } catch (...) {
+                std::lock_guard<std::mutex> guard(lock);
+                if (!error)
+                    error = std::current_exception();
+            }
+            finish();
+        });
+    }
+
+    void wait() {
+        drain();
+        std::exception_ptr e;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            std::swap(e, error);
+        }
+        if (e)
+            std::rethrow_exception(e);
+    }
+
+private:
+    thread_pool& pool;
+    std::atomic<int> outstanding{0};
+    std::mutex lock;
+    std::condition_variable done;
+    std::exception_ptr error;
+
+    void finish() {
+        // Notify under the lock: once outstanding reaches zero the waiter may destroy us
+        std::lock_guard<std::mutex> guard(lock);
+        if (outstanding.fetch_sub(1) == 1)
+            done.notify_all();
+    }
+
+    void drain() {
+        while (outstanding.load() > 0) {
+            if (pool.run_pending_task())
+                continue;
+            std::unique_lock<std::mutex> guard(lock);
+            done.wait_for(guard, std::chrono::microseconds(200),
+                          [this] { return outstanding.load() == 0; });
+        }
+        // The last finish() may still hold the lock; let it release before we can be destroyed
+        std::lock_guard<std::mutex> guard(lock);
+    }
+};
+
+// Calls body(lo, hi) over [begin, end) in chunks of about `grain` items
+template <typename F>
+void parallel_for(thread_pool& pool, int begin, int end, int grain, F&& body) {
+    if (end - begin <= grain || pool.size() == 1) {
+        body(begin, end);
+        return;
+    }
+    task_group group(pool);
+    for (int lo = begin; lo < end; lo += grain) {
+        int hi = lo + grain < end ? lo + grain : end;
+        group.run([&body, lo, hi] { body(lo, hi); });
+    }
+    group.wait();
+}
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Event Tracing
+//
+// An optional timeline of what every thread was doing, written as Chrome trace-event JSON
+// for chrome://tracing or ui.perfetto.dev. Nothing is recorded until trace_start(); before
+// that a trace point costs one relaxed load. Each thread records into its own fixed-size
+// ring buffer without locks, overwriting its oldest events once the buffer is full. The
+// buffer is registered under a lock the first time its thread records, and belongs to the
+// registry so it outlives the thread. trace_write() reads every buffer, so it must run
+// after the traced work has finished.
+
+struct trace_event {
+    const char* name;       // string literals only, the buffer keeps the pointer
+    const char* category;
+    int64_t start_ns;
+    int64_t duration_ns;    // negative for instant events
+    int64_t id;             // written as args.id when non-negative
+};
+
+struct trace_buffer {
+    static const size_t capacity = size_t(1) << 16;
+
+    void record(const trace_event& e) {
+        const size_t n = head.load(std::memory_order_relaxed);
+        events[n % capacity] = e;
+        head.store(n + 1, std::memory_order_release);
+    }
+
+    int tid = 0;
+    std::string thread_name;
+    std::vector<trace_event> events = std::vector<trace_event>(capacity);
+    std::atomic<size_t> head{0};    // events recorded so far, including overwritten ones
+};
+
+struct trace_registry {
+    std::atomic<bool> enabled{false};
+    std::chrono::steady_clock::time_point start;
+    std::mutex lock;
+    std::vector<std::unique_ptr<trace_buffer>> buffers;
+};
+
+inline trace_registry& trace_global() {
+    static trace_registry registry;
+    return registry;
+}
+
+inline bool trace_enabled() {
+    return trace_global().enabled.load(std::memory_order_relaxed);
+}
+
+inline int64_t trace_now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - trace_global().start).count();
+}
+
+// Name the calling thread shows under in the viewer
+inline std::string& trace_thread_name() {
+    static thread_local std::string name;
+    return name;
+}
+
+inline trace_buffer& trace_thread_buffer() {
+    static thread_local trace_buffer* buffer = nullptr;
+    if (!buffer) {
+        auto& registry = trace_global();
+        std::lock_guard<std::mutex> guard(registry.lock);
+        registry.buffers.push_back(std::make_unique<trace_buffer>());
+        buffer = registry.buffers.back().get();
+        buffer->tid = static_cast<int>(registry.buffers.size());
+        buffer->thread_name = trace_thread_name().empty() ? "thread " + std::to_string(buffer->tid)
+                                                          : trace_thread_name();
+    }
+    return *buffer;
+}
+
+// Starts recording; the timeline begins at this call
+inline void trace_start() {
+    auto& registry = trace_global();
+    registry.start = std::chrono::steady_clock::now();
+    registry.enabled.store(true, std::memory_order_relaxed);
+}
+
+inline void trace_instant(const char* name, const char* category, int64_t id = -1) {
+    if (trace_enabled())
+        trace_thread_buffer().record({name, category, trace_now(), -1, id});
+}
+
+// Records the lifetime of the scope as one event
+class trace_scope {
+public:
+    trace_scope(const char* name, const char* category, int64_t id = -1)
+        : event{name, category, trace_enabled() ? trace_now() : -1, 0, id} {}
+
+    ~trace_scope() {
+        if (event.start_ns < 0)
+            return;
+        event.duration_ns = trace_now() - event.start_ns;
+        trace_thread_buffer().record(event);
+    }
+
+    trace_scope(const trace_scope&) = delete;
+    trace_scope& operator=(const trace_scope&) = delete;
+
+private:
+    trace_event event;
+};
+
+// Writes every recorded event as a Chrome trace-event JSON object; times in microseconds
+inline void trace_write(std::ostream& out) {
+    auto& registry = trace_global();
+    std::lock_guard<std::mutex> guard(registry.lock);
+
+    size_t dropped = 0;
+    bool first = true;
+    auto separator = [&]() -> std::ostream& {
+        out << (first ? "\n" : ",\n");
+        first = false;
+        return out;
+    };
+
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    for (const auto& buffer : registry.buffers) {
+        std::string name;
+        for (char c : buffer->thread_name)
+            name += (c == '"' || c == '\\') ? '_' : c;
+        separator() << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->tid
+                    << ", \"args\": {\"name\": \"" << name << "\"}}";
+
+        const size_t head = buffer->head.load(std::memory_order_acquire);
+        const size_t first_kept = head > trace_buffer::capacity ? head - trace_buffer::capacity : 0;
+        dropped += first_kept;
+        for (size_t n = first_kept; n < head; n++) {
+            const auto& e = buffer->events[n % trace_buffer::capacity];
+            auto& line = separator() << "{\"name\": \"" << e.name << "\", \"cat\": \"" << e.category
+                                     << "\", \"pid\": 1, \"tid\": " << buffer->tid << ", \"ts\": " << e.start_ns / 1e3;
+            if (e.duration_ns >= 0)
+                line << ", \"ph\": \"X\", \"dur\": " << e.duration_ns / 1e3;
+            else
+                line << ", \"ph\": \"i\", \"s\": \"t\"";
+            if (e.id >= 0)
+                line << ", \"args\": {\"id\": " << e.id << "}";
+            line << "}";
+        }
+    }
+    out << "\n], \"otherData\": {\"dropped_events\": " << dropped << "}}\n";
+}
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "rtweekend.h"
+#include "aabb.h"
+
+// Affine Transform (3x3 linear part plus translation)
+class transform {
+public:
+    transform() : m{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}} {}
+
+    static transform translate(const vec3& offset) {
+        transform t;
+        for (int i = 0; i < 3; i++)
+            t.m[i][3] = offset[i];
+        return t;
+    }
+
+    static transform scale(const vec3& s) {
+        transform t;
+        for (int i = 0; i < 3; i++)
+            t.m[i][i] = s[i];
+        return t;
+    }
+
+    // Rotation about a coordinate axis (0 = x, 1 = y, 2 = z), right-handed
+    static transform rotate(int axis, double degrees) {
+        transform t;
+        auto radians = degrees_to_radians(degrees);
+        auto c = cos(radians);
+        auto s = sin(radians);
+        int a = (axis + 1) % 3;
+        int b = (axis + 2) % 3;
+        t.m[a][a] = c;  t.m[a][b] = -s;
+        t.m[b][a] = s;  t.m[b][b] = c;
+        return t;
+    }
+
+    // Composition: (A * B) applies B first, then A
+    transform operator*(const transform& o) const {
+        transform t;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 4; j++) {
+                t.m[i][j] = m[i][0]*o.m[0][j] + m[i][1]*o.m[1][j] + m[i][2]*o.m[2][j];
+            }
+            t.m[i][3] += m[i][3];
+        }
+        return t;
+    }
+
+    point3 point(const point3& p) const {
+        return vector(p) + vec3(m[0][3], m[1][3], m[2][3]);
+    }
+
+    vec3 vector(const vec3& v) const {
+        return vec3(m[0][0]*v[0] + m[0][1]*v[1] + m[0][2]*v[2],
+                    m[1][0]*v[0] + m[1][1]*v[1] + m[1][2]*v[2],
+                    m[2][0]*v[0] + m[2][1]*v[1] + m[2][2]*v[2]);
+    }
+
+    // Multiplies by the transposed linear part. Called on the inverse transform this maps
+    // normals from object space to world space.
+    vec3 transposed_vector(const vec3& v) const {
+        return vec3(m[0][0]*v[0] + m[1][0]*v[1] + m[2][0]*v[2],
+                    m[0][1]*v[0] + m[1][1]*v[1] + m[2][1]*v[2],
+                    m[0][2]*v[0] + m[1][2]*v[1] + m[2][2]*v[2]);
+    }
+
+    aabb box(const aabb& b) const {
+        aabb out;
+        for (int i = 0; i < 8; i++) {
+            out.expand(point(point3(i & 1 ? b.maximum.x() : b.minimum.x(),
+                                    i & 2 ? b.maximum.y() : b.minimum.y(),
+                                    i & 4 ? b.maximum.z() : b.minimum.z())));
+        }
+        return out;
+    }
+
+    transform inverse() const {
+        // Inverse of the 3x3 part via the adjugate, then invert the translation
+        transform t;
+        auto det = m[0][0]*(m[1][1]*m[2][2] - m[1][2]*m[2][1])
+                 - m[0][1]*(m[1][0]*m[2][2] - m[1][2]*m[2][0])
+                 + m[0][2]*(m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+        auto inv_det = 1.0 / det;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                int i1 = (j + 1) % 3, i2 = (j + 2) % 3;
+                int j1 = (i + 1) % 3, j2 = (i + 2) % 3;
+                t.m[i][j] = (m[i1][j1]*m[i2][j2] - m[i1][j2]*m[i2][j1]) * inv_det;
+            }
+        }
+        auto offset = t.vector(vec3(m[0][3], m[1][3], m[2][3]));
+        for (int i = 0; i < 3; i++)
+            t.m[i][3] = -offset[i];
+        return t;
+    }
+
+public:
+    double m[3][4];
+};
+
+#endif
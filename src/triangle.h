@@ -0,0 +1,77 @@
+#ifndef TRIANGLE_H
+#define TRIANGLE_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+
+// Möller-Trumbore ray/triangle test, shared by single triangles and meshes.
+// Returns the ray parameter in t when the hit lies inside (t_min, t_max).
+inline bool intersect_triangle(
+    const ray& r, const point3& v0, const point3& v1, const point3& v2,
+    double t_min, double t_max, double& t
+) {
+    const auto e1 = v1 - v0;
+    const auto e2 = v2 - v0;
+    const auto pvec = cross(r.direction(), e2);
+    const auto det = dot(e1, pvec);
+    if (fabs(det) < 1e-12)
+        return false;
+
+    const auto inv_det = 1.0 / det;
+    const auto tvec = r.origin() - v0;
+    const auto u = dot(tvec, pvec) * inv_det;
+    if (u < 0.0 || u > 1.0)
+        return false;
+
+    const auto qvec = cross(tvec, e1);
+    const auto v = dot(r.direction(), qvec) * inv_det;
+    if (v < 0.0 || u + v > 1.0)
+        return false;
+
+    t = dot(e2, qvec) * inv_det;
+    return t >= t_min && t <= t_max;
+}
+
+inline aabb triangle_box(const point3& v0, const point3& v1, const point3& v2) {
+    aabb box;
+    box.expand(v0);
+    box.expand(v1);
+    box.expand(v2);
+    return box;
+}
+
+// Single Triangle
+class triangle : public hittable {
+public:
+    triangle() {}
+    triangle(const point3& a, const point3& b, const point3& c, shared_ptr<material> mat)
+        : v0(a), v1(b), v2(c), mp(mat) {}
+
+    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+        double t;
+        if (!intersect_triangle(r, v0, v1, v2, t_min, t_max, t))
+            return false;
+
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.set_face_normal(r, unit_vector(cross(v1 - v0, v2 - v0)));
+        rec.mat = mp.get();
+        rec.light = -1;
+        return true;
+    }
+
+    virtual bool bounding_box(aabb& output_box) const override {
+        output_box = triangle_box(v0, v1, v2);
+        return true;
+    }
+
+    virtual size_t memory_usage() const override {
+        return sizeof(*this);
+    }
+
+public:
+    point3 v0, v1, v2;
+    shared_ptr<material> mp;
+};
+
+#endif
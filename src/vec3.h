@@ -95,4 +95,18 @@ inline vec3 unit_vector(const vec3 &v) {
     return v / v.length();
 }
 
+// Mirror direction of v about unit normal n
+inline vec3 reflect(const vec3 &v, const vec3 &n) {
+    return v - 2 * dot(v, n) * n;
+}
+
+// Snell's law for unit uv entering through unit normal n, with etai_over_etat the ratio of
+// the indices either side
+inline vec3 refract(const vec3 &uv, const vec3 &n, double etai_over_etat) {
+    auto cos_theta = fmin(dot(-uv, n), 1.0);
+    vec3 r_out_perp = etai_over_etat * (uv + cos_theta * n);
+    vec3 r_out_parallel = -sqrt(fabs(1.0 - r_out_perp.length_squared())) * n;
+    return r_out_perp + r_out_parallel;
+}
+
 #endif
\ No newline at end of file
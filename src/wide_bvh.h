@@ -0,0 +1,208 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "stats.h"
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define WIDE_BVH_SSE 1
+#endif
+
+// 4-Wide BVH
+//
+// Built by collapsing the binary BVH (see bvh_tree::collapse_node), so it inherits the SAH
+// splits. Each node keeps the bounds of its four children SoA in single precision, which
+// lets one SSE slab test check all four boxes at once. Bounds are rounded outward when
+// narrowed from double, and the far distances are padded, so a ray never misses a box the
+// double-precision test would hit.
+//
+// The traversal loop is shared by every 4-wide node format; a node type only has to
+// encode its children (set_children) and slab-test them against a wide_ray (intersect).
+
+// Float conversions that never shrink a box
+inline float float_round_down(double x) {
+    float f = static_cast<float>(x);
+    return f > x ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+
+inline float float_round_up(double x) {
+    float f = static_cast<float>(x);
+    return f < x ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
+// Ray data precomputed once per traversal
+struct wide_ray {
+    wide_ray(const ray& r) {
+        for (int a = 0; a < 3; a++) {
+            org[a] = static_cast<float>(r.origin()[a]);
+            inv[a] = static_cast<float>(1.0 / r.direction()[a]);
+            // Planes are indexed min x, y, z then max x, y, z
+            near_plane[a] = inv[a] < 0 ? a + 3 : a;
+            far_plane[a] = inv[a] < 0 ? a : a + 3;
+        }
+#ifdef WIDE_BVH_SSE
+        for (int a = 0; a < 3; a++) {
+            org4[a] = _mm_set1_ps(org[a]);
+            inv4[a] = _mm_set1_ps(inv[a]);
+        }
+#endif
+    }
+
+    // Padding on the far distance covers float rounding in the slab arithmetic
+    static constexpr float far_scale = 1.0f + 4.0f * std::numeric_limits<float>::epsilon();
+
+    float org[3];
+    float inv[3];
+    int near_plane[3];
+    int far_plane[3];
+#ifdef WIDE_BVH_SSE
+    __m128 org4[3];
+    __m128 inv4[3];
+#endif
+};
+
+struct alignas(64) bvh4_node {
+    float bounds[6][4];     // min x, y, z then max x, y, z; one lane per child
+    int child[4];           // interior: node index; leaf: first entry in prim_indices
+    int count[4];           // leaf primitive count, 0 for interior and empty slots
+
+    // Empty slots get inverted bounds, which the sign-selected slab test always rejects
+    bvh4_node() {
+        for (int lane = 0; lane < 4; lane++) {
+            for (int a = 0; a < 3; a++) {
+                bounds[a][lane] = std::numeric_limits<float>::infinity();
+                bounds[a+3][lane] = -std::numeric_limits<float>::infinity();
+            }
+            child[lane] = -1;
+            count[lane] = 0;
+        }
+    }
+
+    void set_children(int n, const aabb* boxes, const int* indices, const int* counts) {
+        for (int lane = 0; lane < n; lane++) {
+            for (int a = 0; a < 3; a++) {
+                bounds[a][lane] = float_round_down(boxes[lane].minimum[a]);
+                bounds[a+3][lane] = float_round_up(boxes[lane].maximum[a]);
+            }
+            child[lane] = indices[lane];
+            count[lane] = counts[lane];
+        }
+    }
+
+    // Returns a bit mask of the children hit within [t_min, t_max] and their entry distances
+    int intersect(const wide_ray& r, float t_min, float t_max, float t_near[4]) const;
+};
+
+template <typename Node>
+class wide_bvh {
+public:
+    static const int stack_size = 256;
+
+    // hit_leaf(first, count, t_min, t_max) tests a leaf's primitives and shrinks t_max
+    template <typename F>
+    bool intersect(const ray& r, double t_min, double t_max, F&& hit_leaf) const;
+
+    size_t memory_usage() const {
+        return nodes.capacity() * sizeof(Node);
+    }
+
+public:
+    std::vector<Node> nodes;
+};
+
+inline int bvh4_node::intersect(const wide_ray& r, float t_min, float t_max, float t_near[4]) const {
+#ifdef WIDE_BVH_SSE
+    __m128 tn = _mm_set1_ps(t_min);
+    __m128 tf = _mm_set1_ps(t_max);
+    const __m128 scale = _mm_set1_ps(wide_ray::far_scale);
+    for (int a = 0; a < 3; a++) {
+        __m128 n = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds[r.near_plane[a]]), r.org4[a]), r.inv4[a]);
+        __m128 f = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds[r.far_plane[a]]), r.org4[a]), r.inv4[a]);
+        // Operand order makes a NaN slab (0 * inf) leave the interval unchanged
+        tn = _mm_max_ps(n, tn);
+        tf = _mm_min_ps(_mm_mul_ps(f, scale), tf);
+    }
+    _mm_storeu_ps(t_near, tn);
+    return _mm_movemask_ps(_mm_cmple_ps(tn, tf));
+#else
+    int mask = 0;
+    for (int lane = 0; lane < 4; lane++) {
+        float tn = t_min, tf = t_max;
+        for (int a = 0; a < 3; a++) {
+            float n = (bounds[r.near_plane[a]][lane] - r.org[a]) * r.inv[a];
+            float f = (bounds[r.far_plane[a]][lane] - r.org[a]) * r.inv[a] * wide_ray::far_scale;
+            tn = n > tn ? n : tn;
+            tf = f < tf ? f : tf;
+        }
+        t_near[lane] = tn;
+        if (tn <= tf)
+            mask |= 1 << lane;
+    }
+    return mask;
+#endif
+}
+
+template <typename Node>
+template <typename F>
+bool wide_bvh<Node>::intersect(const ray& r, double t_min, double t_max, F&& hit_leaf) const {
+    if (nodes.empty())
+        return false;
+
+    const wide_ray wr(r);
+    const float t_min_f = float_round_down(t_min);
+    float t_max_f = float_round_up(t_max);
+
+    struct entry {
+        float t;        // entry distance, lets popped entries behind a closer hit be skipped
+        int child;
+        int count;
+    } stack[stack_size];
+    int sp = 0;
+    stack[sp++] = {t_min_f, 0, 0};
+    bool hit_anything = false;
+
+    while (sp > 0) {
+        const entry e = stack[--sp];
+        if (e.t > t_max_f)
+            continue;
+
+        if (e.count > 0) {
+            if (hit_leaf(e.child, e.count, t_min, t_max)) {
+                hit_anything = true;
+                t_max_f = float_round_up(t_max);
+            }
+            continue;
+        }
+
+        const Node& node = nodes[e.child];
+        PT_STAT(thread_path_counters().nodes_visited++);
+        float t_near[4];
+        const int mask = node.intersect(wr, t_min_f, t_max_f, t_near);
+
+        // Push hit children far-to-near so the nearest one is popped first
+        int order[4];
+        int hits = 0;
+        for (int lane = 0; lane < 4; lane++) {
+            if (!(mask & (1 << lane)))
+                continue;
+            int k = hits++;
+            while (k > 0 && t_near[order[k-1]] < t_near[lane]) {
+                order[k] = order[k-1];
+                k--;
+            }
+            order[k] = lane;
+        }
+        for (int k = 0; k < hits; k++) {
+            int lane = order[k];
+            stack[sp++] = {t_near[lane], node.child[lane], node.count[lane]};
+        }
+    }
+
+    return hit_anything;
+}
+
+#endif
@@ -0,0 +1,33 @@
+# Renders SCENE with RENDERER and checks it against the reference in REFERENCE_DIR with
+# COMPARE (image_compare), judging the difference against the noise of both images.
+# Run by ctest; fails when the render fails or any check of the comparison does.
+#
+#   cmake -DRENDERER=... -DCOMPARE=... -DSCENE=... -DREFERENCE_DIR=... -DNAME=...
+#         -DOUTPUT_DIR=... -P image_regression.cmake
+
+foreach(var RENDERER COMPARE SCENE REFERENCE_DIR NAME OUTPUT_DIR)
+    if(NOT DEFINED ${var})
+        message(FATAL_ERROR "image_regression.cmake needs -D${var}=...")
+    endif()
+endforeach()
+
+set(test_pfm ${OUTPUT_DIR}/${NAME}.pfm)
+set(test_variance ${OUTPUT_DIR}/${NAME}_variance.pfm)
+
+execute_process(
+    COMMAND ${RENDERER} --threads 1 --pfm ${test_pfm} --variance ${test_variance} ${SCENE}
+    OUTPUT_QUIET
+    ERROR_VARIABLE render_log
+    RESULT_VARIABLE render_status)
+if(NOT render_status EQUAL 0)
+    message(FATAL_ERROR "render of ${SCENE} failed (${render_status}):\n${render_log}")
+endif()
+
+execute_process(
+    COMMAND ${COMPARE} ${test_pfm} ${REFERENCE_DIR}/${NAME}.pfm
+            --variance ${test_variance}
+            --reference-variance ${REFERENCE_DIR}/${NAME}_variance.pfm
+    RESULT_VARIABLE compare_status)
+if(NOT compare_status EQUAL 0)
+    message(FATAL_ERROR "${NAME} does not match its reference (image_compare exit ${compare_status})")
+endif()
@@ -0,0 +1,171 @@
+// Checks that renders do not depend on the thread count or on how the samples are split
+// into passes: renders a scene with each integrator and sampler at several thread counts,
+// and once more in two passes, and compares every framebuffer with the first bytewise.
+//
+// Usage: determinism_check [--threads 1,2,4,8] [--spp N] [--image W H]
+//                          [--integrators path,nee,spectral,...] [--samplers pcg,counter] [scene file]
+//
+// The integrators are the scene's names (path, bdpt, photon, ppm, guided, mlt) and these
+// variants of path: nee (light_sampling bvh), spectral (with light_sampling uniform),
+// restir and cache (radiance_cache). All of them are checked by default, at 8 spp (default)
+// on a 64x64 image (default) of scenes/cornell_box.scene. Sums, sums of squares and sample
+// counts must match to the bit; the time per sample on the first thread count is printed
+// alongside, and the image's mean, which the two samplers should agree on within noise.
+//
+// Exit status: 0 when every render matches, 1 when one differs, 2 on bad input.
+
+#include "rtweekend.h"
+#include "scene.h"
+#include "renderer.h"
+#include "thread_pool.h"
+#include "compare.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct check_options {
+    std::vector<int> threads = {1, 2, 4, 8};
+    int spp = 8;
+    int width = 64, height = 64;
+};
+
+// The scene with integrator `name` and sampler `sampler`, or false for an unknown name
+static bool configure(scene& scn, const std::string& name, const std::string& sampler, const check_options& options) {
+    auto& settings = scn.settings;
+    settings.samples_per_pixel = options.spp;
+    settings.image_width = options.width;
+    settings.image_height = options.height;
+    if (sampler == "pcg")
+        settings.sampler = sampler_type::pcg;
+    else if (sampler == "counter")
+        settings.sampler = sampler_type::counter;
+    else
+        return false;
+
+    settings.integrator = integrator_type::path;
+    if (name == "nee") {
+        settings.lights = light_sampling::bvh;
+    } else if (name == "spectral") {
+        settings.lights = light_sampling::uniform;
+        settings.spectral = true;
+    } else if (name == "restir") {
+        settings.restir = true;
+    } else if (name == "cache") {
+        settings.radiance_cache = true;
+    } else if (name != "path") {
+        return integrator_from_name(name, settings.integrator);
+    }
+    return true;
+}
+
+static bool same(const framebuffer& a, const framebuffer& b) {
+    const size_t n = a.pixels.size();
+    return std::memcmp(a.pixels.data(), b.pixels.data(), n * sizeof(color)) == 0
+        && std::memcmp(a.squares.data(), b.squares.data(), n * sizeof(color)) == 0
+        && std::memcmp(a.samples.data(), b.samples.data(), n * sizeof(uint32_t)) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    check_options options;
+    std::vector<std::string> integrators = {"path", "nee", "spectral", "restir", "cache",
+                                            "bdpt", "photon", "ppm", "guided", "mlt"};
+    std::vector<std::string> samplers = {"pcg", "counter"};
+    std::string path = PT_SCENE_DIR "/cornell_box.scene";
+    bool usage_error = false;
+
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--threads" && a + 1 < argc) {
+            options.threads.clear();
+            for (const auto& t : split_list(argv[++a]))
+                options.threads.push_back(std::atoi(t.c_str()));
+        } else if (arg == "--spp" && a + 1 < argc)
+            options.spp = std::atoi(argv[++a]);
+        else if (arg == "--image" && a + 2 < argc) {
+            options.width = std::atoi(argv[++a]);
+            options.height = std::atoi(argv[++a]);
+        } else if (arg == "--integrators" && a + 1 < argc)
+            integrators = split_list(argv[++a]);
+        else if (arg == "--samplers" && a + 1 < argc)
+            samplers = split_list(argv[++a]);
+        else if (arg[0] != '-')
+            path = arg;
+        else
+            usage_error = true;
+    }
+    for (int t : options.threads)
+        usage_error = usage_error || t < 1;
+    // Two passes need two samples
+    if (usage_error || options.threads.empty() || options.spp < 2 || options.width < 2 || options.height < 2) {
+        std::fprintf(stderr, "Usage: %s [--threads 1,2,4,8] [--spp N] [--image W H] "
+                             "[--integrators path,nee,spectral,...] [--samplers pcg,counter] [scene file]\n",
+                     argv[0]);
+        return 2;
+    }
+
+    bool all_same = true;
+    try {
+        std::printf("%dx%d, %d spp, threads", options.width, options.height, options.spp);
+        for (int t : options.threads)
+            std::printf(" %d", t);
+        std::printf(", then two passes on %d\n", options.threads.back());
+        std::printf("  %-10s %-8s %-14s %-8s %10s %10s\n", "integrator", "sampler", "thread counts", "passes",
+                    "ms/spp", "mean");
+        for (const auto& name : integrators) {
+            for (const auto& sampler : samplers) {
+                framebuffer first(options.width, options.height);
+                bool threads_same = true;
+                double seconds = 0;
+                for (size_t t = 0; t < options.threads.size(); t++) {
+                    thread_pool pool(options.threads[t]);
+                    scene scn = load_scene(path, &pool);
+                    if (!configure(scn, name, sampler, options)) {
+                        std::fprintf(stderr, "Error: unknown integrator '%s' or sampler '%s'\n", name.c_str(),
+                                     sampler.c_str());
+                        return 2;
+                    }
+                    renderer render(scn, pool);
+                    render.show_progress = false;
+                    framebuffer fb(options.width, options.height);
+                    const double s = render.render(fb).seconds;
+                    if (t == 0) {
+                        first = fb;
+                        seconds = s;
+                    } else if (!same(fb, first)) {
+                        threads_same = false;
+                    }
+                }
+
+                // Half the samples, then the rest, continuing the same framebuffer
+                thread_pool pool(options.threads.back());
+                scene scn = load_scene(path, &pool);
+                configure(scn, name, sampler, options);
+                renderer render(scn, pool);
+                render.show_progress = false;
+                framebuffer fb(options.width, options.height);
+                scn.settings.samples_per_pixel = options.spp / 2;
+                render.render(fb);
+                scn.settings.samples_per_pixel = options.spp;
+                render.render(fb);
+                const bool passes_same = same(fb, first);
+
+                double mean = 0;
+                for (float x : first.mean().pixels)
+                    mean += x;
+                mean /= 3.0 * options.width * options.height;
+                std::printf("  %-10s %-8s %-14s %-8s %10.2f %10.5f\n", name.c_str(), sampler.c_str(),
+                            threads_same ? "identical" : "DIFFER", passes_same ? "identical" : "DIFFER",
+                            1000 * seconds / options.spp, mean);
+                std::fflush(stdout);
+                all_same = all_same && threads_same && passes_same;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 2;
+    }
+    std::printf(all_same ? "All renders match\n" : "Renders differ\n");
+    return all_same ? 0 : 1;
+}
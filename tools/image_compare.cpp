@@ -0,0 +1,214 @@
+// Compares a render against a reference, both as PFM files from `ImageRenderer --pfm`.
+//
+// Usage: image_compare <test.pfm> <reference.pfm> [--variance test_variance.pfm]
+//            [--reference-variance reference_variance.pfm] [--tolerance ratio]
+//            [--max-rmse x] [--max-relmse x] [--max-flip x]
+//
+// Reports:
+//   RMSE        root mean squared error over all channels
+//   relMSE      mean of (test - ref)^2 / (ref^2 + 0.01), which weights dark regions up
+//   FLIP-like   mean perceptual difference in [0, 1]: both images are clamped to display
+//               range, converted to CIELAB, blurred by a small Gaussian (a crude contrast
+//               sensitivity filter) and compared with the HyAB distance / 100. This follows
+//               the structure of NVIDIA's FLIP without its exact filters.
+//
+// With --variance (from `ImageRenderer --variance`), differences are judged against the
+// noise of the pixel estimates (plus the reference's noise when its variance is given), so
+// a correct render passes at any spp and a biased one (from a sampling or precision change)
+// fails:
+//   MSE ratio   MSE over the mean variance; about 1 for an unbiased render
+//   block chi2  differences summed over 8x8 blocks, squared and divided by the summed
+//               variance; the median over blocks and channels, scaled so it is about 1
+//               when unbiased. Noise averages out within a block while bias adds up, so
+//               this catches small biases that the per-pixel MSE still hides. The median
+//               ignores the blocks whose variance 64 spp underestimates (rare light paths).
+//   mean z      whole-image mean difference in standard errors; fails beyond 4
+// The ratio checks fail above --tolerance (default 1.5).
+//
+// Exit status: 0 when every check passes, 1 when one fails, 2 on bad input.
+
+#include "vec3.h"
+#include "pfm.h"
+#include "compare.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+static double channel_mean(const float_image& img) {
+    double sum = 0;
+    for (float f : img.pixels)
+        sum += f;
+    return img.pixels.empty() ? 0 : sum / img.pixels.size();
+}
+
+// Linear sRGB in display range to CIELAB (D65)
+static vec3 to_lab(const vec3& rgb) {
+    double r = std::clamp(rgb.x(), 0.0, 1.0), g = std::clamp(rgb.y(), 0.0, 1.0), b = std::clamp(rgb.z(), 0.0, 1.0);
+    double x = (0.4124 * r + 0.3576 * g + 0.1805 * b) / 0.9505;
+    double y = (0.2126 * r + 0.7152 * g + 0.0722 * b);
+    double z = (0.0193 * r + 0.1192 * g + 0.9505 * b) / 1.0890;
+    auto f = [](double t) { return t > 0.008856 ? std::cbrt(t) : 7.787 * t + 16.0 / 116.0; };
+    return vec3(116 * f(y) - 16, 500 * (f(x) - f(y)), 200 * (f(y) - f(z)));
+}
+
+// Separable Gaussian, sigma of one pixel, clamped at the borders
+static std::vector<vec3> blur(const std::vector<vec3>& src, int width, int height) {
+    const double w[5] = {0.0545, 0.2442, 0.4026, 0.2442, 0.0545};
+    std::vector<vec3> tmp(src.size()), dst(src.size());
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            vec3 sum(0, 0, 0);
+            for (int k = -2; k <= 2; k++)
+                sum += w[k+2] * src[j * width + std::clamp(i + k, 0, width - 1)];
+            tmp[j * width + i] = sum;
+        }
+    }
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            vec3 sum(0, 0, 0);
+            for (int k = -2; k <= 2; k++)
+                sum += w[k+2] * tmp[std::clamp(j + k, 0, height - 1) * width + i];
+            dst[j * width + i] = sum;
+        }
+    }
+    return dst;
+}
+
+static double flip_like(const float_image& test, const float_image& ref) {
+    const int width = test.width, height = test.height;
+    std::vector<vec3> a(static_cast<size_t>(width) * height), b(a.size());
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            a[j * width + i] = to_lab(test.at(i, j));
+            b[j * width + i] = to_lab(ref.at(i, j));
+        }
+    }
+    a = blur(a, width, height);
+    b = blur(b, width, height);
+
+    double sum = 0;
+    for (size_t k = 0; k < a.size(); k++) {
+        vec3 d = a[k] - b[k];
+        double hyab = std::fabs(d.x()) + std::sqrt(d.y()*d.y() + d.z()*d.z());
+        sum += std::min(1.0, hyab / 100.0);
+    }
+    return sum / a.size();
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> paths;
+    std::string variance_path, reference_variance_path;
+    double tolerance = 1.5;
+    double max_rmse = -1, max_relmse = -1, max_flip = -1;
+    bool usage_error = false;
+
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--variance" && a + 1 < argc)
+            variance_path = argv[++a];
+        else if (arg == "--reference-variance" && a + 1 < argc)
+            reference_variance_path = argv[++a];
+        else if (arg == "--tolerance" && a + 1 < argc)
+            tolerance = std::atof(argv[++a]);
+        else if (arg == "--max-rmse" && a + 1 < argc)
+            max_rmse = std::atof(argv[++a]);
+        else if (arg == "--max-relmse" && a + 1 < argc)
+            max_relmse = std::atof(argv[++a]);
+        else if (arg == "--max-flip" && a + 1 < argc)
+            max_flip = std::atof(argv[++a]);
+        else if (arg.size() > 1 && arg[0] == '-')
+            usage_error = true;
+        else
+            paths.push_back(arg);
+    }
+    if (usage_error || paths.size() != 2) {
+        std::fprintf(stderr, "Usage: %s <test.pfm> <reference.pfm> [--variance test_variance.pfm]\n"
+                             "           [--reference-variance reference_variance.pfm] [--tolerance ratio]\n"
+                             "           [--max-rmse x] [--max-relmse x] [--max-flip x]\n", argv[0]);
+        return 2;
+    }
+
+    try {
+        const auto test = read_pfm(paths[0]);
+        const auto ref = read_pfm(paths[1]);
+        if (test.width != ref.width || test.height != ref.height)
+            throw std::runtime_error("image sizes differ");
+
+        const image_error error = compare_images(test, ref);
+        const double mse = error.rmse * error.rmse;
+        const double flip = flip_like(test, ref);
+
+        bool pass = true;
+        auto check = [&](const char* name, double value, double limit) {
+            const bool ok = limit < 0 || value <= limit;
+            if (limit < 0)
+                std::printf("%-10s %12.6g\n", name, value);
+            else
+                std::printf("%-10s %12.6g   limit %-10.6g %s\n", name, value, limit, ok ? "ok" : "FAIL");
+            pass = pass && ok;
+        };
+        check("RMSE", error.rmse, max_rmse);
+        check("relMSE", error.relmse, max_relmse);
+        check("FLIP-like", flip, max_flip);
+
+        if (!variance_path.empty()) {
+            const auto var = read_pfm(variance_path);
+            if (var.width != test.width || var.height != test.height)
+                throw std::runtime_error("variance image size differs");
+            double expected = channel_mean(var);
+            if (!reference_variance_path.empty())
+                expected += channel_mean(read_pfm(reference_variance_path));
+
+            const double ratio = expected > 0 ? mse / expected : (mse > 0 ? INFINITY : 1.0);
+            std::printf("%-10s %12.6g   (noise-only MSE %.6g)\n", "MSE", mse, expected);
+            check("MSE ratio", ratio, tolerance);
+
+            float_image ref_var;
+            if (!reference_variance_path.empty())
+                ref_var = read_pfm(reference_variance_path);
+            auto noise = [&](size_t k) {
+                return var.pixels[k] + (ref_var.pixels.empty() ? 0.0 : ref_var.pixels[k]);
+            };
+
+            const int block = 8;
+            std::vector<double> chi2;
+            double diff_sum = 0, var_sum = 0;
+            for (int bj = 0; bj < test.height; bj += block) {
+                for (int bi = 0; bi < test.width; bi += block) {
+                    for (int c = 0; c < 3; c++) {
+                        double d = 0, v = 0;
+                        for (int j = bj; j < std::min(bj + block, test.height); j++) {
+                            for (int i = bi; i < std::min(bi + block, test.width); i++) {
+                                const size_t k = (static_cast<size_t>(j) * test.width + i) * 3 + c;
+                                d += test.pixels[k] - ref.pixels[k];
+                                v += noise(k);
+                            }
+                        }
+                        diff_sum += d;
+                        var_sum += v;
+                        if (v > 0)
+                            chi2.push_back(d * d / v);
+                    }
+                }
+            }
+            // Median of a one-degree chi-squared variable
+            const double chi2_median = 0.4549;
+            double block_ratio = 0;
+            if (!chi2.empty()) {
+                std::nth_element(chi2.begin(), chi2.begin() + chi2.size() / 2, chi2.end());
+                block_ratio = chi2[chi2.size() / 2] / chi2_median;
+            }
+            check("block chi2", block_ratio, tolerance);
+            check("mean z", var_sum > 0 ? std::fabs(diff_sum) / std::sqrt(var_sum) : 0.0, 4.0);
+        }
+
+        std::printf("%s\n", pass ? "PASS" : "FAIL");
+        return pass ? 0 : 1;
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 2;
+    }
+}
@@ -0,0 +1,77 @@
+// Merges partial renders (`ImageRenderer --crop ... --partial file`) into the final image.
+//
+// Usage: merge_partials [--pfm image.pfm] [--variance variance.pfm] <partial>... > image.ppm
+//
+// Partials of one frame are added pixel by pixel: sample sums, sums of squares and sample
+// counts. Regions that do not overlap are stitched together unchanged, and overlapping
+// ones are averaged by their sample counts. Overlaps only add information when the renders
+// used different `seed`s; with the same seed they repeat the same samples. Pixels no
+// partial covers stay black and are reported.
+//
+// Exit status: 0 on success, 1 when pixels are missing, 2 on bad input.
+
+#include "rtweekend.h"
+#include "renderer.h"
+#include "checkpoint.h"
+#include "pfm.h"
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> paths;
+    std::string pfm_path, variance_path;
+    bool usage_error = false;
+
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--pfm" && a + 1 < argc)
+            pfm_path = argv[++a];
+        else if (arg == "--variance" && a + 1 < argc)
+            variance_path = argv[++a];
+        else if (arg.size() > 1 && arg[0] == '-')
+            usage_error = true;
+        else
+            paths.push_back(arg);
+    }
+    if (usage_error || paths.empty()) {
+        std::fprintf(stderr, "Usage: %s [--pfm image.pfm] [--variance variance.pfm] <partial>... > image.ppm\n", argv[0]);
+        return 2;
+    }
+
+    try {
+        std::vector<partial_render> parts;
+        for (const auto& path : paths)
+            parts.push_back(read_partial(path));
+
+        framebuffer fb(parts[0].full_width, parts[0].full_height);
+        for (size_t p = 0; p < parts.size(); p++) {
+            try {
+                merge_partial(fb, parts[p]);
+            } catch (const std::exception& e) {
+                throw std::runtime_error("'" + paths[p] + "': " + e.what());
+            }
+        }
+
+        size_t missing = 0;
+        for (auto n : fb.samples)
+            missing += n == 0;
+
+        write_ppm(std::cout, fb);
+        if (!pfm_path.empty())
+            write_pfm(pfm_path, fb.mean());
+        if (!variance_path.empty())
+            write_pfm(variance_path, fb.variance());
+
+        std::fprintf(stderr, "Merged %zu partials into a %dx%d image\n", parts.size(), fb.width, fb.height);
+        if (missing > 0) {
+            std::fprintf(stderr, "Warning: %zu pixels have no samples\n", missing);
+            return 1;
+        }
+        return 0;
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 2;
+    }
+}